@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can
+# be found in the LICENSE.txt file.
+#
+
+"""Compare two sets of hdrview-bench results.
+
+Benchmarks are matched by name and image size, and the ratio of their median
+times is printed. A ratio above 1 means the new version is faster. The script
+exits with a non-zero status if any benchmark got slower by more than the
+--threshold fraction.
+
+Examples:
+    hdrview-bench --out=before.json
+    (rebuild)
+    hdrview-bench --out=after.json
+    compare-bench.py before.json after.json --threshold 0.05
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(filename):
+    with open(filename) as f:
+        results = json.load(f)
+    return {(b["name"], b["params"]["width"], b["params"]["height"]): b for b in results["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("old", help="results of the baseline version")
+    parser.add_argument("new", help="results of the version to compare")
+    parser.add_argument("--threshold", type=float, default=0.1,
+                        help="report benchmarks that are slower by more than this fraction (default: 0.1)")
+    args = parser.parse_args()
+
+    old, new = load(args.old), load(args.new)
+    regressions = 0
+    print("{:<60} {:>10} {:>10} {:>8}".format("benchmark", "old [s]", "new [s]", "speedup"))
+    for key in sorted(set(old) & set(new)):
+        before = old[key]["seconds"]["median"]
+        after = new[key]["seconds"]["median"]
+        speedup = before / after if after > 0 else float("inf")
+        slower = speedup < 1.0 / (1.0 + args.threshold)
+        regressions += slower
+        name = "{} @ {}x{}".format(*key)
+        print("{:<60} {:>10.5f} {:>10.5f} {:>7.2f}x{}".format(name, before, after, speedup, "  <--" if slower else ""))
+
+    for key in sorted(set(old) ^ set(new)):
+        print("{} @ {}x{} is only in {}".format(key[0], key[1], key[2], args.old if key in old else args.new))
+
+    if regressions:
+        print("{} benchmark(s) slower by more than {:.0%}".format(regressions, args.threshold), file=sys.stderr)
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can
+# be found in the LICENSE.txt file.
+#
+
+"""Send newline-delimited JSON jobs to an hdrbatch server and print its replies.
+
+Jobs are read from the given files (or standard input), one JSON object per
+line, for example:
+
+    {"id": "frame-001", "inputs": ["frame-001.exr"], "filter": "gaussian,2,2", "format": "png", "save": true}
+
+The server is either an already running `hdrbatch --socket=PATH`, or an
+`hdrbatch --server` process started by this script with --exec. The script
+waits for each job to finish before sending the next one, and exits with a
+non-zero status if any job failed.
+
+Examples:
+    hdrbatch --socket=/tmp/hdrbatch.sock &
+    hdrbatch-client.py --socket /tmp/hdrbatch.sock jobs.jsonl
+    hdrbatch-client.py --socket /tmp/hdrbatch.sock --shutdown
+
+    hdrbatch-client.py --exec ./hdrbatch jobs.jsonl
+"""
+
+import argparse
+import json
+import socket
+import subprocess
+import sys
+
+FINAL_STATES = {"done", "error", "pong", "shutdown"}
+
+
+def read_jobs(filenames):
+    for filename in filenames or ["-"]:
+        stream = sys.stdin if filename == "-" else open(filename)
+        for line in stream:
+            line = line.strip()
+            if line:
+                yield line
+        if stream is not sys.stdin:
+            stream.close()
+
+
+def run_job(send, receive, job):
+    """Send a job and print status messages until it finishes. Returns the final status."""
+    send(job)
+    while True:
+        line = receive()
+        if not line:
+            raise RuntimeError("hdrbatch server closed the connection")
+        print(line.rstrip("\n"), flush=True)
+        status = json.loads(line)
+        if status.get("status") in FINAL_STATES:
+            return status
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    server = parser.add_mutually_exclusive_group(required=True)
+    server.add_argument("--socket", metavar="PATH", help="connect to an hdrbatch server listening on PATH")
+    server.add_argument("--exec", metavar="HDRBATCH", help="start HDRBATCH --server and send the jobs to it")
+    parser.add_argument("--shutdown", action="store_true", help="ask the server to shut down after the jobs")
+    parser.add_argument("jobs", nargs="*", metavar="JOBFILE",
+                        help="files with one JSON job per line ('-' for standard input)")
+    args = parser.parse_args()
+
+    process = None
+    if args.socket:
+        connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        connection.connect(args.socket)
+        stream = connection.makefile("rw", encoding="utf-8")
+        jobs = read_jobs(args.jobs) if args.jobs or not args.shutdown else []
+    else:
+        process = subprocess.Popen([args.exec, "--server"], stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                                   universal_newlines=True)
+        stream = None
+        jobs = read_jobs(args.jobs)
+
+    def send(line):
+        out = stream if stream else process.stdin
+        out.write(line + "\n")
+        out.flush()
+
+    def receive():
+        return stream.readline() if stream else process.stdout.readline()
+
+    failed = 0
+    for job in jobs:
+        if run_job(send, receive, job).get("status") == "error":
+            failed += 1
+
+    if args.shutdown or process:
+        run_job(send, receive, json.dumps({"command": "shutdown"}))
+    if process:
+        process.stdin.close()
+        process.wait()
+
+    if failed:
+        print("{} job(s) failed".format(failed), file=sys.stderr)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
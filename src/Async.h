@@ -9,6 +9,7 @@
 #include <future>
 #include <chrono>
 #include "Progress.h"
+#include "Trace.h"
 
 
 template <typename T>
@@ -29,7 +30,8 @@ public:
 	 * @param compute The function to execute asyncrhonously
 	 */
 	AsyncTask(TaskFunc compute)
-		: m_compute([compute](AtomicProgress & prog){T ret = compute(prog); prog.setDone(); return ret;}), m_progress(true)
+		: m_compute([compute](AtomicProgress & prog){TraceZone zone("AsyncTask"); T ret = compute(prog); prog.setDone(); return ret;}),
+		  m_progress(true)
 	{
 
 	}
@@ -39,7 +41,7 @@ public:
 	 * @param compute The function to execute asyncrhonously
 	 */
 	AsyncTask(NoProgressTaskFunc compute)
-		: m_compute([compute](AtomicProgress &){return compute();}), m_progress(false)
+		: m_compute([compute](AtomicProgress &){TraceZone zone("AsyncTask"); return compute();}), m_progress(false)
 	{
 
 	}
@@ -65,6 +67,7 @@ public:
 		if (m_ready)
 			return m_value;
 
+		TraceZone zone("AsyncTask::get");
 		m_value = m_future.valid() ? m_future.get() : m_compute(m_progress);
 
 		m_ready = true;
@@ -0,0 +1,231 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "Benchmark.h"
+#include <sys/stat.h>            // for stat
+#include <algorithm>             // for sort, find_if, max
+#include <cmath>                 // for sqrt
+#include <spdlog/fmt/fmt.h>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>             // for GetProcessTimes, GetCurrentProcess
+#include <psapi.h>               // for GetProcessMemoryInfo
+#else
+#include <sys/resource.h>        // for getrusage
+#endif
+
+using namespace std;
+
+namespace
+{
+
+double throughput(double megapixels, double seconds)
+{
+	return seconds > 0.0 ? megapixels / seconds : 0.0;
+}
+
+} // namespace
+
+
+double processCPUSeconds()
+{
+#if defined(_WIN32)
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0.0;
+	auto seconds = [](const FILETIME & t)
+	{
+		return ((uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime) * 1e-7;
+	};
+	return seconds(kernel) + seconds(user);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.0;
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+	       1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+uint64_t peakResidentBytes()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#if defined(__APPLE__)
+	return uint64_t(usage.ru_maxrss);           // bytes on macOS
+#else
+	return uint64_t(usage.ru_maxrss) * 1024;    // kilobytes on Linux
+#endif
+#endif
+}
+
+uint64_t fileBytes(const string & filename)
+{
+	struct stat info;
+	return stat(filename.c_str(), &info) == 0 ? uint64_t(info.st_size) : 0;
+}
+
+Json summaryStatistics(vector<double> values)
+{
+	Json result = Json::object();
+	if (values.empty())
+		return result;
+
+	sort(values.begin(), values.end());
+	size_t n = values.size();
+	double mean = 0.0, m2 = 0.0;
+	for (double v : values)
+		mean += v / n;
+	for (double v : values)
+		m2 += (v - mean) * (v - mean);
+
+	result["median"] = n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+	result["mean"] = mean;
+	result["stddev"] = n > 1 ? sqrt(m2 / (n - 1)) : 0.0;
+	result["min"] = values.front();
+	result["max"] = values.back();
+	return result;
+}
+
+
+StageTiming & StageTiming::operator+=(const StageTiming & other)
+{
+	calls += other.calls;
+	wallSeconds += other.wallSeconds;
+	cpuSeconds += other.cpuSeconds;
+	megapixels += other.megapixels;
+	bytesRead += other.bytesRead;
+	bytesWritten += other.bytesWritten;
+	return *this;
+}
+
+
+StageTimings::Scope::Scope(StageTimings * timings, const string & stage, double megapixels) :
+	m_timings(timings), m_stage(stage), m_cpuStart(timings ? processCPUSeconds() : 0.0), m_zone(stage)
+{
+	m_timing.calls = 1;
+	m_timing.megapixels = megapixels;
+}
+
+StageTimings::Scope::~Scope()
+{
+	if (!m_timings)
+		return;
+
+	m_timing.wallSeconds = m_timer.elapsed() / 1000.0;
+	m_timing.cpuSeconds = processCPUSeconds() - m_cpuStart;
+	m_timings->add(m_stage, m_timing);
+}
+
+void StageTimings::add(const string & stage, const StageTiming & timing)
+{
+	lock_guard<mutex> lock(m_mutex);
+	auto it = find_if(m_stages.begin(), m_stages.end(),
+	                  [&stage](const pair<string, StageTiming> & s) {return s.first == stage;});
+	if (it == m_stages.end())
+		m_stages.emplace_back(stage, timing);
+	else
+		it->second += timing;
+}
+
+StageTimingList StageTimings::stages() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_stages;
+}
+
+
+Json benchmarkReport(const vector<BenchmarkRun> & runs, int warmup)
+{
+	Json report = Json::object();
+	report["repeats"] = runs.size();
+	report["warmup"] = warmup;
+
+	vector<double> wall, cpu, mps;
+	for (auto & run : runs)
+	{
+		wall.push_back(run.wallSeconds);
+		cpu.push_back(run.cpuSeconds);
+		mps.push_back(throughput(run.megapixels, run.wallSeconds));
+	}
+
+	Json total = Json::object();
+	total["files"] = runs.empty() ? 0 : runs.front().numFiles;
+	total["megapixels"] = runs.empty() ? 0.0 : runs.front().megapixels;
+	total["wall_seconds"] = summaryStatistics(wall);
+	total["cpu_seconds"] = summaryStatistics(cpu);
+	total["megapixels_per_second"] = summaryStatistics(mps);
+	report["total"] = total;
+
+	// the stages in order of first appearance over all runs
+	vector<string> names;
+	for (auto & run : runs)
+		for (auto & stage : run.stages)
+			if (find(names.begin(), names.end(), stage.first) == names.end())
+				names.push_back(stage.first);
+
+	report["stages"] = Json::array();
+	for (auto & name : names)
+	{
+		vector<double> stageWall, stageCPU, stageMPS;
+		StageTiming first;
+		for (auto & run : runs)
+		{
+			StageTiming timing;
+			for (auto & stage : run.stages)
+				if (stage.first == name)
+					timing = stage.second;
+			if (&run == &runs.front())
+				first = timing;
+			stageWall.push_back(timing.wallSeconds);
+			stageCPU.push_back(timing.cpuSeconds);
+			stageMPS.push_back(throughput(timing.megapixels, timing.wallSeconds));
+		}
+
+		Json stage = Json::object();
+		stage["name"] = name;
+		stage["calls"] = first.calls;
+		stage["megapixels"] = first.megapixels;
+		stage["bytes_read"] = first.bytesRead;
+		stage["bytes_written"] = first.bytesWritten;
+		stage["wall_seconds"] = summaryStatistics(stageWall);
+		stage["cpu_seconds"] = summaryStatistics(stageCPU);
+		if (first.megapixels > 0.0)
+			stage["megapixels_per_second"] = summaryStatistics(stageMPS);
+		report["stages"].push_back(stage);
+	}
+
+	report["peak_rss_bytes"] = peakResidentBytes();
+	return report;
+}
+
+string benchmarkTable(const Json & report)
+{
+	auto row = [](const string & name, const Json & entry, const Json & mps)
+	{
+		return fmt::format("{:<36} {:>10.4f} {:>9.4f} {:>10.4f} {:>10}\n", name,
+		                   entry["wall_seconds"]["median"].asNumber(), entry["wall_seconds"]["stddev"].asNumber(),
+		                   entry["cpu_seconds"]["median"].asNumber(),
+		                   mps.isObject() ? fmt::format("{:.2f}", mps["median"].asNumber()) : string("-"));
+	};
+
+	string table = fmt::format("{:g} timed run(s) after {:g} warm-up run(s), peak RSS {:.1f} MB\n",
+	                           report["repeats"].asNumber(), report["warmup"].asNumber(),
+	                           report["peak_rss_bytes"].asNumber() / 1048576.0);
+	table += fmt::format("{:<36} {:>10} {:>9} {:>10} {:>10}\n", "stage", "wall [s]", "stddev", "cpu [s]", "MP/s");
+	for (auto & stage : report["stages"].items())
+		table += row(stage["name"].asString(), stage, stage["megapixels_per_second"]);
+	table += row("total", report["total"], report["total"]["megapixels_per_second"]);
+	return table;
+}
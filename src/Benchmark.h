@@ -0,0 +1,113 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <cstdint>               // for uint64_t
+#include <mutex>                 // for mutex
+#include <string>                // for string
+#include <utility>               // for pair
+#include <vector>                // for vector
+#include "Json.h"                // for Json
+#include "Timer.h"               // for Timer
+#include "Trace.h"               // for TraceZone
+
+
+//! The user plus system CPU time consumed by all threads of this process, in seconds
+double processCPUSeconds();
+
+//! The peak resident set size of this process, in bytes, or 0 if unknown
+uint64_t peakResidentBytes();
+
+//! The size of the file \a filename in bytes, or 0 if it does not exist
+uint64_t fileBytes(const std::string & filename);
+
+//! The median, mean, sample standard deviation, minimum and maximum of \a values, as a JSON object
+Json summaryStatistics(std::vector<double> values);
+
+
+//! The accumulated cost of one stage of a batch run, over all files
+struct StageTiming
+{
+	size_t calls = 0;
+	double wallSeconds = 0.0;
+	double cpuSeconds = 0.0;    ///< Process CPU time, which includes work running concurrently with the stage
+	double megapixels = 0.0;
+	uint64_t bytesRead = 0;
+	uint64_t bytesWritten = 0;
+
+	StageTiming & operator+=(const StageTiming & other);
+};
+
+using StageTimingList = std::vector<std::pair<std::string, StageTiming>>;
+
+
+/*!
+ * @brief Thread-safe collection of the per-stage timings of a batch run.
+ *
+ * The stages are kept in the order in which they are first recorded.
+ */
+class StageTimings
+{
+public:
+	/*!
+	 * Records the wall and CPU time from its construction to its destruction as one call of a stage.
+	 * The stage is also recorded as a trace zone while tracing is enabled.
+	 */
+	class Scope
+	{
+	public:
+		//! Only records the trace zone if \a timings is null
+		Scope(StageTimings * timings, const std::string & stage, double megapixels = 0.0);
+		~Scope();
+
+		void setMegapixels(double megapixels)   {m_timing.megapixels = megapixels;}
+		void addBytesRead(uint64_t bytes)       {m_timing.bytesRead += bytes; m_zone.addBytes(bytes);}
+		void addBytesWritten(uint64_t bytes)    {m_timing.bytesWritten += bytes; m_zone.addBytes(bytes);}
+
+	private:
+		StageTimings * m_timings;
+		std::string m_stage;
+		StageTiming m_timing;
+		Timer m_timer;
+		double m_cpuStart;
+		TraceZone m_zone;
+	};
+
+	void add(const std::string & stage, const StageTiming & timing);
+	StageTimingList stages() const;
+
+private:
+	mutable std::mutex m_mutex;
+	StageTimingList m_stages;
+};
+
+
+//! The measurements of one complete, timed run
+struct BenchmarkRun
+{
+	StageTimingList stages;
+	double wallSeconds = 0.0;
+	double cpuSeconds = 0.0;
+	size_t numFiles = 0;
+	double megapixels = 0.0;
+};
+
+
+/*!
+ * @brief Summarize repeated runs as JSON.
+ *
+ * For the whole run and each stage, the wall time, CPU time and throughput in megapixels
+ * per second are reported as the median, mean, standard deviation, minimum and maximum
+ * over the \a runs, along with the bytes read and written per run and the peak resident
+ * set size of the process.
+ *
+ * @param warmup	The number of untimed runs that preceded \a runs, for the record
+ */
+Json benchmarkReport(const std::vector<BenchmarkRun> & runs, int warmup);
+
+//! Format a report created by benchmarkReport() as a human-readable table
+std::string benchmarkTable(const Json & report);
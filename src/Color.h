@@ -21,7 +21,7 @@ public:
     //@{ \name Constructors and assignment
     //-----------------------------------------------------------------------
     Color3() = default;
-    Color3(const Color3 & c) : r(c.r), g(c.g), b(c.b) {}
+    Color3(const Color3 & c) = default;
     Color3(float x, float y, float z) : r(x), g(y), b(z) {}
     explicit Color3(float c) : r(c), g(c), b(c) {}
     explicit Color3(const float* c) : r(c[0]), g(c[1]), b(c[2]) {}
@@ -0,0 +1,559 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "ColorLUT.h"
+#include <algorithm>             // for min, max, max_element, upper_bound
+#include <cctype>                // for isalpha
+#include <cmath>                 // for log2, exp2, ceil, fabs
+#include <cstdlib>               // for strtof
+#include <fstream>               // for ifstream, ofstream
+#include <sstream>               // for istringstream
+#include <stdexcept>             // for runtime_error, invalid_argument
+#include "Common.h"              // for getExtension, toLower
+#include "FastMath.h"            // for FASTMATH_DISPATCH
+#include "ParallelFor.h"         // for parallel_for
+#include "Timer.h"               // for Timer
+#include "Trace.h"               // for TraceZone, traceImageId
+#include <spdlog/spdlog.h>
+
+using namespace std;
+
+// local functions
+namespace
+{
+
+// the linear map from a LUT's domain to its grid coordinates
+struct GridAxis
+{
+	float scale, offset;
+
+	GridAxis(float mn, float mx, int size) :
+		scale((size - 1) / (mx - mn)), offset(-mn * (size - 1) / (mx - mn)) {}
+};
+
+// the grid coordinate of v, clamped to [0, maxCoord], with NaN mapping to 0
+inline float gridCoord(float v, const GridAxis & axis, float maxCoord)
+{
+	float x = v * axis.scale + axis.offset;
+	return x > 0.f ? (x < maxCoord ? x : maxCoord) : 0.f;
+}
+
+//
+// The kernels below only use selects and gathers, so that they can be vectorized. Like the span
+// functions of FastMath.h, they are compiled for several instruction sets.
+//
+
+FASTMATH_DISPATCH void lookup1D(float * __restrict v, size_t n, const float * __restrict table, int size,
+                                GridAxis axis)
+{
+	float maxCoord = float(size - 1);
+	for (size_t i = 0; i < n; ++i)
+	{
+		float x = gridCoord(v[i], axis, maxCoord);
+		int i0 = min(int(x), size - 2);
+		float f = x - float(i0);
+		v[i] = table[i0] + f * (table[i0 + 1] - table[i0]);
+	}
+}
+
+// The unit cube between grid points is split into six tetrahedra along its diagonal, and the color
+// is interpolated between the four corners of the tetrahedron containing it. This only needs four
+// lookups instead of the eight of trilinear interpolation, and it keeps the neutral axis exact.
+FASTMATH_DISPATCH void lookupTetrahedral(float * __restrict r, float * __restrict g, float * __restrict b, size_t n,
+                                         const float * __restrict tr, const float * __restrict tg,
+                                         const float * __restrict tb, int size,
+                                         GridAxis ar, GridAxis ag, GridAxis ab)
+{
+	float maxCoord = float(size - 1);
+	int dx = 1, dy = size, dz = size * size;
+	for (size_t i = 0; i < n; ++i)
+	{
+		float x = gridCoord(r[i], ar, maxCoord);
+		float y = gridCoord(g[i], ag, maxCoord);
+		float z = gridCoord(b[i], ab, maxCoord);
+		int ix = min(int(x), size - 2), iy = min(int(y), size - 2), iz = min(int(z), size - 2);
+		float fx = x - float(ix), fy = y - float(iy), fz = z - float(iz);
+
+		// the corners of the tetrahedron are found by stepping along the axes in the order of
+		// decreasing fractions: o1 steps along the largest one, o2 along all but the smallest one
+		bool xy = fx >= fy, yz = fy >= fz, xz = fx >= fz;
+		int o1 = xy ? (xz ? dx : dz) : (yz ? dy : dz);
+		int o2 = dx + dy + dz - (xy ? (yz ? dz : dy) : (xz ? dz : dx));
+
+		float fMax = max(fx, max(fy, fz)), fMin = min(fx, min(fy, fz));
+		float fMid = fx + fy + fz - fMax - fMin;
+		float w0 = 1.f - fMax, w1 = fMax - fMid, w2 = fMid - fMin, w3 = fMin;
+
+		int i0 = ix * dx + iy * dy + iz * dz;
+		int i1 = i0 + o1, i2 = i0 + o2, i3 = i0 + dx + dy + dz;
+		r[i] = w0 * tr[i0] + w1 * tr[i1] + w2 * tr[i2] + w3 * tr[i3];
+		g[i] = w0 * tg[i0] + w1 * tg[i1] + w2 * tg[i2] + w3 * tg[i3];
+		b[i] = w0 * tb[i0] + w1 * tb[i1] + w2 * tb[i2] + w3 * tb[i3];
+	}
+}
+
+FASTMATH_DISPATCH void lookupTrilinear(float * __restrict r, float * __restrict g, float * __restrict b, size_t n,
+                                       const float * __restrict tr, const float * __restrict tg,
+                                       const float * __restrict tb, int size,
+                                       GridAxis ar, GridAxis ag, GridAxis ab)
+{
+	float maxCoord = float(size - 1);
+	int dx = 1, dy = size, dz = size * size;
+	for (size_t i = 0; i < n; ++i)
+	{
+		float x = gridCoord(r[i], ar, maxCoord);
+		float y = gridCoord(g[i], ag, maxCoord);
+		float z = gridCoord(b[i], ab, maxCoord);
+		int ix = min(int(x), size - 2), iy = min(int(y), size - 2), iz = min(int(z), size - 2);
+		float fx = x - float(ix), fy = y - float(iy), fz = z - float(iz);
+
+		int i0 = ix * dx + iy * dy + iz * dz;
+		float w000 = (1.f - fx) * (1.f - fy) * (1.f - fz), w100 = fx * (1.f - fy) * (1.f - fz),
+		      w010 = (1.f - fx) * fy * (1.f - fz),         w110 = fx * fy * (1.f - fz),
+		      w001 = (1.f - fx) * (1.f - fy) * fz,         w101 = fx * (1.f - fy) * fz,
+		      w011 = (1.f - fx) * fy * fz,                 w111 = fx * fy * fz;
+
+#define TRILINEAR(t) \
+		(w000 * t[i0] + w100 * t[i0 + dx] + w010 * t[i0 + dy] + w110 * t[i0 + dx + dy] + \
+		 w001 * t[i0 + dz] + w101 * t[i0 + dx + dz] + w011 * t[i0 + dy + dz] + w111 * t[i0 + dx + dy + dz])
+		r[i] = TRILINEAR(tr);
+		g[i] = TRILINEAR(tg);
+		b[i] = TRILINEAR(tb);
+#undef TRILINEAR
+	}
+}
+
+// the fields of a line, with comments removed
+vector<string> lineFields(const string & line)
+{
+	istringstream in(line.substr(0, line.find('#')));
+	vector<string> fields;
+	string field;
+	while (in >> field)
+		fields.push_back(field);
+	return fields;
+}
+
+// keywords start with a letter, except for the "3DMESH" of .3dl files
+bool isKeyword(const string & field)
+{
+	return isalpha(field[0]) || field == "3DMESH";
+}
+
+float parseLUTFloat(const string & s, const string & filename, int lineNumber)
+{
+	char * end = nullptr;
+	float value = strtof(s.c_str(), &end);
+	if (s.empty() || *end != '\0')
+		throw runtime_error(fmt::format("Cannot parse \"{}\" as a number on line {} of \"{}\".",
+		                                s, lineNumber, filename));
+	return value;
+}
+
+// The piecewise-linear table with \a size entries over [0,1] that maps each of the increasing values in
+// \a mesh to its index divided by mesh.size()-1, so that a non-uniform mesh can be looked up as a
+// uniform one
+vector<float> inverseMesh(const vector<float> & mesh, int size)
+{
+	vector<float> table(size);
+	for (int i = 0; i < size; ++i)
+	{
+		float x = i / float(size - 1);
+		size_t j = upper_bound(mesh.begin(), mesh.end(), x) - mesh.begin();
+		j = ::clamp(j, size_t(1), mesh.size() - 1);
+		float f = ::clamp((x - mesh[j - 1]) / (mesh[j] - mesh[j - 1]), 0.f, 1.f);
+		table[i] = (j - 1 + f) / (mesh.size() - 1);
+	}
+	return table;
+}
+
+ColorLUT loadCube(const string & filename)
+{
+	ifstream in(filename);
+	if (!in)
+		throw runtime_error(fmt::format("Cannot open LUT \"{}\".", filename));
+
+	string title;
+	int size1D = 0, size3D = 0;
+	bool hasDomain = false, hasRange1D = false, hasRange3D = false;
+	Color3 domainMin(0.f), domainMax(1.f);
+	float range1D[2] = {0.f, 1.f}, range3D[2] = {0.f, 1.f};
+	vector<Color3> values;
+
+	string line;
+	int lineNumber = 0;
+	while (getline(in, line))
+	{
+		++lineNumber;
+		auto fields = lineFields(line);
+		if (fields.empty())
+			continue;
+
+		const string & keyword = fields[0];
+		if (keyword == "TITLE")
+		{
+			size_t first = line.find('"'), last = line.rfind('"');
+			title = first != last ? line.substr(first + 1, last - first - 1) : "";
+		}
+		else if ((keyword == "LUT_1D_SIZE" || keyword == "LUT_3D_SIZE") && fields.size() == 2)
+			(keyword == "LUT_1D_SIZE" ? size1D : size3D) = int(parseLUTFloat(fields[1], filename, lineNumber));
+		else if ((keyword == "DOMAIN_MIN" || keyword == "DOMAIN_MAX") && fields.size() == 4)
+		{
+			Color3 & c = keyword == "DOMAIN_MIN" ? domainMin : domainMax;
+			for (int i = 0; i < 3; ++i)
+				c[i] = parseLUTFloat(fields[i + 1], filename, lineNumber);
+			hasDomain = true;
+		}
+		else if ((keyword == "LUT_1D_INPUT_RANGE" || keyword == "LUT_3D_INPUT_RANGE") && fields.size() == 3)
+		{
+			bool is1D = keyword == "LUT_1D_INPUT_RANGE";
+			float * range = is1D ? range1D : range3D;
+			range[0] = parseLUTFloat(fields[1], filename, lineNumber);
+			range[1] = parseLUTFloat(fields[2], filename, lineNumber);
+			(is1D ? hasRange1D : hasRange3D) = true;
+		}
+		else if (isKeyword(keyword))
+			spdlog::get("console")->debug("Ignoring \"{}\" on line {} of LUT \"{}\".", keyword, lineNumber, filename);
+		else if (fields.size() == 3)
+			values.emplace_back(parseLUTFloat(fields[0], filename, lineNumber),
+			                    parseLUTFloat(fields[1], filename, lineNumber),
+			                    parseLUTFloat(fields[2], filename, lineNumber));
+		else
+			throw runtime_error(fmt::format("Cannot parse line {} of LUT \"{}\".", lineNumber, filename));
+	}
+
+	if (size1D == 0 && size3D == 0)
+		throw runtime_error(fmt::format("LUT \"{}\" has neither a LUT_1D_SIZE nor a LUT_3D_SIZE.", filename));
+	if (size1D != 0 && (size1D < 2 || size1D > 65536))
+		throw runtime_error(fmt::format("Invalid 1D LUT size {} in \"{}\".", size1D, filename));
+	if (size3D != 0 && (size3D < 2 || size3D > 256))
+		throw runtime_error(fmt::format("Invalid 3D LUT size {} in \"{}\".", size3D, filename));
+
+	size_t expected = size_t(size1D) + size_t(size3D) * size3D * size3D;
+	if (values.size() != expected)
+		throw runtime_error(fmt::format("LUT \"{}\" should have {} entries, but has {}.",
+		                                filename, expected, values.size()));
+
+	// DOMAIN_MIN/MAX apply to the first LUT; Resolve files give the range of each LUT instead
+	Color3 min1D = hasRange1D ? Color3(range1D[0]) : domainMin, max1D = hasRange1D ? Color3(range1D[1]) : domainMax;
+	Color3 min3D = hasRange3D ? Color3(range3D[0]) : (size1D || !hasDomain ? Color3(0.f) : domainMin);
+	Color3 max3D = hasRange3D ? Color3(range3D[1]) : (size1D || !hasDomain ? Color3(1.f) : domainMax);
+
+	vector<float> tables1D[3], tables3D[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		tables1D[c].resize(size1D);
+		for (int i = 0; i < size1D; ++i)
+			tables1D[c][i] = values[i][c];
+
+		// .cube files store the entries with red varying fastest, like the tables
+		tables3D[c].resize(values.size() - size1D);
+		for (size_t i = size1D; i < values.size(); ++i)
+			tables3D[c][i - size1D] = values[i][c];
+	}
+
+	return ColorLUT::fromTables(size1D, min1D, max1D, tables1D, size3D, min3D, max3D, tables3D, title);
+}
+
+ColorLUT load3dl(const string & filename)
+{
+	ifstream in(filename);
+	if (!in)
+		throw runtime_error(fmt::format("Cannot open LUT \"{}\".", filename));
+
+	vector<float> mesh;
+	vector<float> values;
+	string line;
+	int lineNumber = 0;
+	while (getline(in, line))
+	{
+		++lineNumber;
+		auto fields = lineFields(line);
+		// skip blank lines and keywords such as "3DMESH" or "Mesh 4 12"
+		if (fields.empty() || isKeyword(fields[0]))
+			continue;
+
+		// the first line of numbers holds the input values of the grid points
+		if (mesh.empty())
+		{
+			for (auto & f : fields)
+				mesh.push_back(parseLUTFloat(f, filename, lineNumber));
+			if (mesh.size() < 2)
+				throw runtime_error(fmt::format("Invalid input mesh on line {} of LUT \"{}\".", lineNumber, filename));
+		}
+		else if (fields.size() == 3)
+		{
+			for (auto & f : fields)
+				values.push_back(parseLUTFloat(f, filename, lineNumber));
+		}
+		else
+			throw runtime_error(fmt::format("Cannot parse line {} of LUT \"{}\".", lineNumber, filename));
+	}
+
+	int size = int(mesh.size());
+	if (size > 256 || values.size() != 3 * size_t(size) * size * size)
+		throw runtime_error(fmt::format("LUT \"{}\" should have {} entries, but has {}.",
+		                                filename, size_t(size) * size * size, values.size() / 3));
+
+	// the integer inputs and outputs are normalized by the bit depths that fit their largest values
+	auto maxForBitDepth = [](float largest) {return exp2(ceil(log2(max(largest, 1.f) + 1.f))) - 1.f;};
+	float inMax = maxForBitDepth(mesh.back());
+	float outMax = maxForBitDepth(*max_element(values.begin(), values.end()));
+	for (auto & m : mesh)
+		m /= inMax;
+
+	// a uniform mesh maps to the domain of the 3D LUT, other meshes need a shaper
+	bool uniform = mesh.front() == 0.f;
+	for (int i = 0; i < size; ++i)
+		uniform &= fabs(mesh[i] - i * mesh.back() / (size - 1)) <= 0.5f / inMax;
+
+	int size1D = 0;
+	vector<float> tables1D[3], tables3D[3];
+	if (!uniform)
+	{
+		for (int i = 1; i < size; ++i)
+			if (mesh[i] <= mesh[i - 1])
+				throw runtime_error(fmt::format("The input mesh of LUT \"{}\" is not increasing.", filename));
+		size1D = 4096;
+		tables1D[0] = tables1D[1] = tables1D[2] = inverseMesh(mesh, size1D);
+	}
+
+	// .3dl files store the entries with blue varying fastest
+	for (int c = 0; c < 3; ++c)
+		tables3D[c].resize(size_t(size) * size * size);
+	for (int ri = 0; ri < size; ++ri)
+		for (int gi = 0; gi < size; ++gi)
+			for (int bi = 0; bi < size; ++bi)
+			{
+				size_t src = 3 * (bi + size * (gi + size_t(size) * ri));
+				size_t dst = ri + size * (gi + size_t(size) * bi);
+				for (int c = 0; c < 3; ++c)
+					tables3D[c][dst] = values[src + c] / outMax;
+			}
+
+	return ColorLUT::fromTables(size1D, Color3(0.f), Color3(1.f), tables1D,
+	                            size, Color3(0.f), Color3(uniform ? mesh.back() : 1.f), tables3D,
+	                            getBasename(filename));
+}
+
+} // namespace
+
+
+const vector<string> & ColorLUT::interpolationNames()
+{
+	static const vector<string> names = {"Trilinear", "Tetrahedral"};
+	return names;
+}
+
+
+ColorLUT ColorLUT::fromTables(int size1D, const Color3 & min1D, const Color3 & max1D, const vector<float> tables1D[3],
+                              int size3D, const Color3 & min3D, const Color3 & max3D, const vector<float> tables3D[3],
+                              const string & title)
+{
+	ColorLUT lut;
+	lut.title = title;
+	lut.m_size1D = size1D;
+	lut.m_min1D = min1D;
+	lut.m_max1D = max1D;
+	lut.m_size3D = size3D;
+	lut.m_min3D = min3D;
+	lut.m_max3D = max3D;
+	for (int c = 0; c < 3; ++c)
+	{
+		lut.m_table1D[c] = tables1D[c];
+		lut.m_table3D[c] = tables3D[c];
+		if (lut.m_min1D[c] >= lut.m_max1D[c] || lut.m_min3D[c] >= lut.m_max3D[c])
+			throw runtime_error(fmt::format("LUT \"{}\" has an empty domain.", title));
+	}
+	return lut;
+}
+
+
+ColorLUT ColorLUT::load(const string & filename)
+{
+	Timer timer;
+	string ext = toLower(getExtension(filename));
+	ColorLUT lut;
+	if (ext == "cube")
+		lut = loadCube(filename);
+	else if (ext == "3dl")
+		lut = load3dl(filename);
+	else
+		throw runtime_error(fmt::format("Unrecognized LUT format \"{}\", expected .cube or .3dl.", filename));
+
+	spdlog::get("console")->debug("Loaded {} from \"{}\" in {} seconds.", lut.description(), filename,
+	                              timer.elapsed() / 1000.f);
+	return lut;
+}
+
+
+void ColorLUT::save(const string & filename) const
+{
+	if (isNull())
+		throw runtime_error("Cannot save an empty LUT.");
+
+	ofstream out(filename);
+	if (!out)
+		throw runtime_error(fmt::format("Cannot open \"{}\" for writing.", filename));
+
+	auto uniformDomain = [](const Color3 & mn, const Color3 & mx)
+	{
+		return mn.r == mn.g && mn.r == mn.b && mx.r == mx.g && mx.r == mx.b;
+	};
+	auto writeDomain = [&out](const Color3 & mn, const Color3 & mx)
+	{
+		if (mn.r != 0.f || mn.g != 0.f || mn.b != 0.f || mx.r != 1.f || mx.g != 1.f || mx.b != 1.f)
+			out << fmt::format("DOMAIN_MIN {:.7g} {:.7g} {:.7g}\nDOMAIN_MAX {:.7g} {:.7g} {:.7g}\n",
+			                   mn.r, mn.g, mn.b, mx.r, mx.g, mx.b);
+	};
+
+	if (!title.empty())
+		out << fmt::format("TITLE \"{}\"\n", title);
+
+	if (m_size1D && m_size3D)
+	{
+		if (!uniformDomain(m_min1D, m_max1D) || !uniformDomain(m_min3D, m_max3D))
+			throw runtime_error("A .cube file cannot store a shaper and a 3D LUT with per-channel domains.");
+		out << fmt::format("LUT_1D_SIZE {}\nLUT_1D_INPUT_RANGE {:.7g} {:.7g}\n", m_size1D, m_min1D.r, m_max1D.r);
+		out << fmt::format("LUT_3D_SIZE {}\nLUT_3D_INPUT_RANGE {:.7g} {:.7g}\n", m_size3D, m_min3D.r, m_max3D.r);
+	}
+	else if (m_size1D)
+	{
+		out << fmt::format("LUT_1D_SIZE {}\n", m_size1D);
+		writeDomain(m_min1D, m_max1D);
+	}
+	else
+	{
+		out << fmt::format("LUT_3D_SIZE {}\n", m_size3D);
+		writeDomain(m_min3D, m_max3D);
+	}
+
+	out << "\n";
+	for (int i = 0; i < m_size1D; ++i)
+		out << fmt::format("{:.7g} {:.7g} {:.7g}\n", m_table1D[0][i], m_table1D[1][i], m_table1D[2][i]);
+	for (size_t i = 0; i < m_table3D[0].size(); ++i)
+		out << fmt::format("{:.7g} {:.7g} {:.7g}\n", m_table3D[0][i], m_table3D[1][i], m_table3D[2][i]);
+
+	if (!out)
+		throw runtime_error(fmt::format("Error writing LUT \"{}\".", filename));
+}
+
+
+ColorLUT ColorLUT::bake(const function<Color3(const Color3 &)> & f, int size, float maxValue)
+{
+	if (size < 2 || size > 256)
+		throw invalid_argument(fmt::format("Invalid 3D LUT size {}, expected a size between 2 and 256.", size));
+
+	Timer timer;
+	vector<float> tables1D[3], tables3D[3];
+	int size1D = 0;
+
+	// the input value of each grid point along an axis
+	vector<float> inputs(size);
+	for (int i = 0; i < size; ++i)
+		inputs[i] = i / float(size - 1);
+
+	if (maxValue > 1.f)
+	{
+		// log2(1 + K x), normalized to [0,1], which is roughly linear below 1/K
+		const float K = 64.f;
+		size1D = 4096;
+		vector<float> shaper(size1D);
+		for (int i = 0; i < size1D; ++i)
+			shaper[i] = float(log2(1.0 + K * maxValue * i / (size1D - 1.0)) / log2(1.0 + K * maxValue));
+		tables1D[0] = tables1D[1] = tables1D[2] = shaper;
+
+		// Invert the tabulated shaper rather than the exact curve, so that each grid point is looked
+		// up exactly at its input value, and only the 3D interpolation adds error
+		for (int i = 0; i < size; ++i)
+		{
+			size_t j = upper_bound(shaper.begin(), shaper.end(), inputs[i]) - shaper.begin();
+			j = ::clamp(j, size_t(1), shaper.size() - 1);
+			float t = ::clamp((inputs[i] - shaper[j - 1]) / (shaper[j] - shaper[j - 1]), 0.f, 1.f);
+			inputs[i] = (j - 1 + t) / (size1D - 1) * maxValue;
+		}
+	}
+
+	for (int c = 0; c < 3; ++c)
+		tables3D[c].resize(size_t(size) * size * size);
+	parallel_for(0, size, [&](int bi)
+	{
+		for (int gi = 0; gi < size; ++gi)
+			for (int ri = 0; ri < size; ++ri)
+			{
+				Color3 v = f(Color3(inputs[ri], inputs[gi], inputs[bi]));
+				size_t i = ri + size * (gi + size_t(size) * bi);
+				for (int c = 0; c < 3; ++c)
+					tables3D[c][i] = v[c];
+			}
+	});
+
+	ColorLUT lut = fromTables(size1D, Color3(0.f), Color3(max(maxValue, 1.f)), tables1D,
+	                          size, Color3(0.f), Color3(1.f), tables3D, "");
+	spdlog::get("console")->debug("Baking a {} took {} seconds.", lut.description(), timer.elapsed() / 1000.f);
+	return lut;
+}
+
+
+size_t ColorLUT::bytes() const
+{
+	return 3 * (m_table1D[0].size() + m_table3D[0].size()) * sizeof(float);
+}
+
+
+string ColorLUT::description() const
+{
+	if (m_size3D && m_size1D)
+		return fmt::format("{}^3 LUT with a {} entry shaper", m_size3D, m_size1D);
+	else if (m_size3D)
+		return fmt::format("{}^3 LUT", m_size3D);
+	else if (m_size1D)
+		return fmt::format("{} entry 1D LUT", m_size1D);
+	return "empty LUT";
+}
+
+
+Color3 ColorLUT::lookup(const Color3 & c, Interpolation interp) const
+{
+	float r = c.r, g = c.g, b = c.b;
+	lookup(&r, &g, &b, 1, interp);
+	return Color3(r, g, b);
+}
+
+
+void ColorLUT::lookup(float * r, float * g, float * b, size_t n, Interpolation interp) const
+{
+	if (m_size1D)
+	{
+		float * channels[3] = {r, g, b};
+		for (int c = 0; c < 3; ++c)
+			lookup1D(channels[c], n, m_table1D[c].data(), m_size1D, GridAxis(m_min1D[c], m_max1D[c], m_size1D));
+	}
+
+	if (m_size3D)
+	{
+		GridAxis ar(m_min3D.r, m_max3D.r, m_size3D), ag(m_min3D.g, m_max3D.g, m_size3D),
+		         ab(m_min3D.b, m_max3D.b, m_size3D);
+		if (interp == TETRAHEDRAL)
+			lookupTetrahedral(r, g, b, n, m_table3D[0].data(), m_table3D[1].data(), m_table3D[2].data(),
+			                  m_size3D, ar, ag, ab);
+		else
+			lookupTrilinear(r, g, b, n, m_table3D[0].data(), m_table3D[1].data(), m_table3D[2].data(),
+			                m_size3D, ar, ag, ab);
+	}
+}
+
+
+void ColorLUT::apply(HDRImage & image, Interpolation interp, AtomicProgress progress) const
+{
+	Timer timer;
+	TraceZone zone("ColorLUT::apply", traceImageId(&image), image.size() * sizeof(Color4));
+	image.transformColors([this,interp](float * r, float * g, float * b, size_t n)
+	{
+		lookup(r, g, b, n, interp);
+	}, progress);
+	spdlog::get("console")->trace("Applying a {} took: {} seconds.", description(), (timer.elapsed()/1000.f));
+}
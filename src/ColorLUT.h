@@ -0,0 +1,108 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <functional>            // for function
+#include <string>                // for string
+#include <vector>                // for vector
+#include "Color.h"               // for Color3
+#include "HDRImage.h"            // for HDRImage
+#include "Progress.h"            // for AtomicProgress
+
+
+/*!
+ * @brief A color lookup table: an optional per-channel 1D LUT (the shaper) followed by an
+ * optional 3D LUT.
+ *
+ * Inputs outside of a LUT's domain are clamped to it, and NaNs map to the domain minimum.
+ * Alpha is never changed.
+ */
+class ColorLUT
+{
+public:
+	enum Interpolation : int
+	{
+		TRILINEAR = 0,
+		TETRAHEDRAL
+	};
+	static const std::vector<std::string> & interpolationNames();
+
+	/*!
+	 * @brief Load a LUT from an Adobe/Resolve .cube file or an Autodesk/Lustre .3dl file.
+	 *
+	 * A .cube file may hold a 1D LUT, a 3D LUT, or, as written by Resolve, a 1D shaper followed
+	 * by a 3D LUT. Integer .3dl tables are normalized by the bit depth inferred from their largest
+	 * value, and a non-uniform input mesh becomes a 1D shaper.
+	 * Throws std::runtime_error if the file cannot be read or parsed.
+	 */
+	static ColorLUT load(const std::string & filename);
+
+	/*!
+	 * @brief Save the LUT as a .cube file.
+	 *
+	 * A LUT with both a shaper and a 3D LUT is written in the Resolve format, which only allows
+	 * the same domain for all channels. Throws std::runtime_error on failure.
+	 */
+	void save(const std::string & filename) const;
+
+	/*!
+	 * @brief Bake the color function \a f into a \a size^3 3D LUT.
+	 *
+	 * If \a maxValue is above 1, the LUT covers [0, maxValue] using a logarithmic shaper, which
+	 * spends the grid points evenly across stops instead of on the highlights.
+	 */
+	static ColorLUT bake(const std::function<Color3(const Color3 &)> & f, int size, float maxValue = 1.f);
+
+	/*!
+	 * @brief Create a LUT from its tables, with the red input varying fastest in the 3D tables.
+	 *
+	 * Either LUT can be left out by giving it a size of 0.
+	 * Throws std::runtime_error if a domain is empty.
+	 */
+	static ColorLUT fromTables(int size1D, const Color3 & min1D, const Color3 & max1D,
+	                           const std::vector<float> tables1D[3],
+	                           int size3D, const Color3 & min3D, const Color3 & max3D,
+	                           const std::vector<float> tables3D[3],
+	                           const std::string & title = "");
+
+	bool isNull() const                 {return !m_size1D && !m_size3D;}
+	int size1D() const                  {return m_size1D;}
+	int size3D() const                  {return m_size3D;}
+	//! The number of bytes used by the tables
+	size_t bytes() const;
+	//! Describes the LUT, for instance "33^3 LUT with a 4096 entry shaper"
+	std::string description() const;
+
+	//! The domain and table of channel \a c of the shaper, and of output channel \a c of the 3D LUT
+	const Color3 & min1D() const                    {return m_min1D;}
+	const Color3 & max1D() const                    {return m_max1D;}
+	const std::vector<float> & table1D(int c) const {return m_table1D[c];}
+	const Color3 & min3D() const                    {return m_min3D;}
+	const Color3 & max3D() const                    {return m_max3D;}
+	const std::vector<float> & table3D(int c) const {return m_table3D[c];}
+
+	//! Look up a single color
+	Color3 lookup(const Color3 & c, Interpolation interp = TETRAHEDRAL) const;
+
+	//! Look up the \a n colors in \a r, \a g and \a b in place, using the vectorized kernels
+	void lookup(float * r, float * g, float * b, size_t n, Interpolation interp = TETRAHEDRAL) const;
+
+	//! Apply the LUT to the color channels of \a image in place, using HDRImage::transformColors()
+	void apply(HDRImage & image, Interpolation interp = TETRAHEDRAL,
+	           AtomicProgress progress = AtomicProgress()) const;
+
+	std::string title;
+
+private:
+	int m_size1D = 0;
+	Color3 m_min1D = Color3(0.f), m_max1D = Color3(1.f);
+	std::vector<float> m_table1D[3];    ///< The shaper of each channel
+
+	int m_size3D = 0;
+	Color3 m_min3D = Color3(0.f), m_max3D = Color3(1.f);
+	std::vector<float> m_table3D[3];    ///< Each output channel, with the red input varying fastest
+};
@@ -0,0 +1,305 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "ColorPipeline.h"
+#include <algorithm>             // for min, max
+#include <cmath>                 // for fabs, isfinite
+#include "FastMath.h"            // for FASTMATH_DISPATCH
+#include "ParallelFor.h"         // for parallel_for
+#include "Timer.h"               // for Timer
+#include "Trace.h"               // for TraceZone, traceImageId
+#include <spdlog/spdlog.h>
+
+using namespace std;
+using namespace Eigen;
+
+// local functions
+namespace
+{
+
+// the number of colors whose inputs are kept for tables made from curves at a time
+const int TILE_SIZE = 256;
+
+// the number of entries of the tables that curves are composed into
+const int CURVE_TABLE_SIZE = 4096;
+
+FASTMATH_DISPATCH void applyAffine(float * __restrict r, float * __restrict g, float * __restrict b, size_t n,
+                                   const Matrix3f & m, const Vector3f & o)
+{
+	float m00 = m(0,0), m01 = m(0,1), m02 = m(0,2),
+	      m10 = m(1,0), m11 = m(1,1), m12 = m(1,2),
+	      m20 = m(2,0), m21 = m(2,1), m22 = m(2,2);
+	float o0 = o[0], o1 = o[1], o2 = o[2];
+	for (size_t i = 0; i < n; ++i)
+	{
+		float x = r[i], y = g[i], z = b[i];
+		r[i] = m00 * x + m01 * y + m02 * z + o0;
+		g[i] = m10 * x + m11 * y + m12 * z + o1;
+		b[i] = m20 * x + m21 * y + m22 * z + o2;
+	}
+}
+
+// a diagonal matrix only scales each channel, which also keeps infinities out of the other channels
+FASTMATH_DISPATCH void applyScaleOffset(float * __restrict v, size_t n, float scale, float offset)
+{
+	for (size_t i = 0; i < n; ++i)
+		v[i] = scale * v[i] + offset;
+}
+
+// apply a curve to one channel, using its vectorized version if there is one
+void applyCurve(const ColorPipeline::CurveFunc & f, const ColorPipeline::SpanFunc & span, float * v, size_t n)
+{
+	if (span)
+		span(v, v, n);
+	else
+		for (size_t i = 0; i < n; ++i)
+			v[i] = f(v[i]);
+}
+
+bool isIdentity(const Matrix3f & m, const Vector3f & offset)
+{
+	return m.isIdentity(0.f) && offset.isZero(0.f);
+}
+
+} // namespace
+
+
+void ColorPipeline::addMatrix(const Matrix3f & m, const Vector3f & offset, const string & name)
+{
+	Transform t;
+	t.type = Transform::AFFINE;
+	t.name = name;
+	t.matrix = m;
+	t.offset = offset;
+	m_transforms.push_back(t);
+}
+
+void ColorPipeline::addGain(const Color3 & gain, const string & name)
+{
+	addMatrix(Vector3f(gain.r, gain.g, gain.b).asDiagonal(), Vector3f::Zero(), name);
+}
+
+void ColorPipeline::addCurve(const CurveFunc & f, const string & name, const SpanFunc & span, float lo, float hi)
+{
+	Transform t;
+	t.type = Transform::CURVE;
+	t.name = name;
+	t.curve = f;
+	t.span = span;
+	t.lo = lo;
+	t.hi = hi;
+	m_transforms.push_back(t);
+}
+
+void ColorPipeline::addFunction(const ColorFunc & f, const string & name)
+{
+	Transform t;
+	t.type = Transform::FUNCTION;
+	t.name = name;
+	t.function = f;
+	m_transforms.push_back(t);
+}
+
+void ColorPipeline::addLUT(const shared_ptr<const ColorLUT> & lut, ColorLUT::Interpolation interp, const string & name)
+{
+	Transform t;
+	t.type = Transform::LUT;
+	t.name = name;
+	t.lut = lut;
+	t.interp = interp;
+	m_transforms.push_back(t);
+}
+
+void ColorPipeline::append(const ColorPipeline & other)
+{
+	m_transforms.insert(m_transforms.end(), other.m_transforms.begin(), other.m_transforms.end());
+}
+
+string ColorPipeline::description() const
+{
+	string out;
+	for (size_t i = 0; i < m_transforms.size(); ++i)
+		out += (i ? " -> " : "") + m_transforms[i].name;
+	return out;
+}
+
+
+bool ColorPipeline::composeCurves(const vector<Transform> & curves, float tolerance, Transform & t)
+{
+	t = Transform();
+	t.type = Transform::CURVE;
+	t.lo = curves.front().lo;
+	t.hi = curves.front().hi;
+	for (size_t i = 0; i < curves.size(); ++i)
+		t.name += (i ? " + " : "") + curves[i].name;
+	if (curves.size() > 1)
+		t.name = "[" + t.name + "]";
+
+	t.curve = [curves](float v)
+	{
+		for (auto & c : curves)
+			v = c.curve(v);
+		return v;
+	};
+
+	// a single vectorized curve is faster and more accurate than a table
+	if (curves.size() == 1 && curves.front().span)
+	{
+		t.span = curves.front().span;
+		return true;
+	}
+
+	// tabulate the composed curve, and keep the table if it is close enough to the curve
+	// everywhere in between the entries
+	vector<float> table(CURVE_TABLE_SIZE);
+	float step = (t.hi - t.lo) / (CURVE_TABLE_SIZE - 1);
+	for (int i = 0; i < CURVE_TABLE_SIZE; ++i)
+		table[i] = t.curve(t.lo + i * step);
+
+	for (int i = 0; i + 1 < CURVE_TABLE_SIZE; ++i)
+		for (float f : {0.f, 0.25f, 0.5f, 0.75f})
+		{
+			float exact = t.curve(t.lo + (i + f) * step);
+			float approx = table[i] + f * (table[i + 1] - table[i]);
+			if (!isfinite(exact) || fabs(approx - exact) > tolerance * max(1.f, fabs(exact)))
+				return curves.size() == 1;
+		}
+
+	vector<float> tables[3] = {table, table, table}, none[3];
+	t.type = Transform::LUT;
+	t.lut = make_shared<ColorLUT>(ColorLUT::fromTables(CURVE_TABLE_SIZE, Color3(t.lo), Color3(t.hi), tables,
+	                                                   0, Color3(0.f), Color3(1.f), none));
+	t.name += " table";
+	return true;
+}
+
+
+ColorPipeline ColorPipeline::compiled(float tolerance) const
+{
+	ColorPipeline result;
+	for (size_t i = 0; i < m_transforms.size();)
+	{
+		const Transform & t = m_transforms[i];
+		if (t.type == Transform::AFFINE)
+		{
+			// fold all adjacent matrices into one
+			Transform folded = t;
+			for (++i; i < m_transforms.size() && m_transforms[i].type == Transform::AFFINE; ++i)
+			{
+				const Transform & next = m_transforms[i];
+				folded.offset = next.matrix * folded.offset + next.offset;
+				folded.matrix = next.matrix * folded.matrix;
+				folded.name += " * " + next.name;
+			}
+			if (!isIdentity(folded.matrix, folded.offset))
+				result.m_transforms.push_back(folded);
+		}
+		else if (t.type == Transform::CURVE)
+		{
+			size_t end = i;
+			while (end < m_transforms.size() && m_transforms[end].type == Transform::CURVE)
+				++end;
+
+			// compose the longest runs of curves that can be tabulated
+			while (i < end)
+			{
+				Transform composed;
+				size_t last = end;
+				while (!composeCurves(vector<Transform>(m_transforms.begin() + i, m_transforms.begin() + last),
+				                      tolerance, composed))
+					--last;
+				result.m_transforms.push_back(composed);
+				i = last;
+			}
+		}
+		else
+		{
+			result.m_transforms.push_back(t);
+			++i;
+		}
+	}
+
+	spdlog::get("console")->trace("Compiled the color transforms \"{}\" into \"{}\".", description(),
+	                              result.description());
+	return result;
+}
+
+
+Color3 ColorPipeline::operator()(const Color3 & c) const
+{
+	float r = c.r, g = c.g, b = c.b;
+	apply(&r, &g, &b, 1);
+	return Color3(r, g, b);
+}
+
+
+void ColorPipeline::apply(float * r, float * g, float * b, size_t n) const
+{
+	float * channels[3] = {r, g, b};
+	for (auto & t : m_transforms)
+	{
+		switch (t.type)
+		{
+			case Transform::AFFINE:
+				if (t.matrix.isDiagonal(0.f))
+				{
+					for (int c = 0; c < 3; ++c)
+						applyScaleOffset(channels[c], n, t.matrix(c,c), t.offset[c]);
+				}
+				else
+					applyAffine(r, g, b, n, t.matrix, t.offset);
+				break;
+
+			case Transform::CURVE:
+				for (auto v : channels)
+					applyCurve(t.curve, t.span, v, n);
+				break;
+
+			case Transform::FUNCTION:
+				for (size_t i = 0; i < n; ++i)
+				{
+					Color3 c = t.function(Color3(r[i], g[i], b[i]));
+					r[i] = c.r;
+					g[i] = c.g;
+					b[i] = c.b;
+				}
+				break;
+
+			case Transform::LUT:
+				for (size_t i0 = 0; i0 < n; i0 += TILE_SIZE)
+				{
+					size_t m = min(size_t(TILE_SIZE), n - i0);
+					float in[3][TILE_SIZE];
+					if (t.curve)
+						for (int c = 0; c < 3; ++c)
+							copy(channels[c] + i0, channels[c] + i0 + m, in[c]);
+
+					t.lut->lookup(r + i0, g + i0, b + i0, m, t.interp);
+
+					// tables made from curves only cover [lo,hi], outside of which the curves are evaluated
+					if (t.curve)
+						for (int c = 0; c < 3; ++c)
+							for (size_t i = 0; i < m; ++i)
+								if (!(in[c][i] >= t.lo && in[c][i] <= t.hi))
+									channels[c][i0 + i] = t.curve(in[c][i]);
+				}
+				break;
+		}
+	}
+}
+
+
+void ColorPipeline::apply(HDRImage & image, AtomicProgress progress) const
+{
+	Timer timer;
+	TraceZone zone("ColorPipeline::apply", traceImageId(&image), image.size() * sizeof(Color4));
+	image.transformColors([this](float * r, float * g, float * b, size_t n)
+	{
+		apply(r, g, b, n);
+	}, progress);
+	spdlog::get("console")->trace("Applying the color transforms \"{}\" took: {} seconds.", description(),
+	                              (timer.elapsed()/1000.f));
+}
@@ -0,0 +1,111 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <Eigen/Core>            // for Matrix3f, Vector3f
+#include <functional>            // for function
+#include <memory>                // for shared_ptr
+#include <string>                // for string
+#include <vector>                // for vector
+#include "Color.h"               // for Color3
+#include "ColorLUT.h"            // for ColorLUT
+#include "HDRImage.h"            // for HDRImage
+#include "Progress.h"            // for AtomicProgress
+
+
+/*!
+ * @brief A sequence of color transforms, which is compiled into a single per-pixel kernel.
+ *
+ * The transforms are 3x3 matrices with an offset, 1D curves applied to each color channel,
+ * 3D LUTs, and arbitrary color functions. compiled() folds adjacent matrices into one, and
+ * composes adjacent curves into one, which is replaced by a table when that is accurate enough.
+ * apply() then runs all transforms on each tile of pixels in turn, in a single pass over the image.
+ */
+class ColorPipeline
+{
+public:
+	using CurveFunc = std::function<float(float)>;
+	using SpanFunc = std::function<void(const float *, float *, size_t)>;
+	using ColorFunc = std::function<Color3(const Color3 &)>;
+
+	//! Add the affine transform m * c + offset
+	void addMatrix(const Eigen::Matrix3f & m, const Eigen::Vector3f & offset = Eigen::Vector3f::Zero(),
+	                const std::string & name = "matrix");
+	//! Add a per-channel gain, which is folded like a diagonal matrix
+	void addGain(const Color3 & gain, const std::string & name = "gain");
+	/*!
+	 * @brief Add the curve \a f, applied to each color channel.
+	 *
+	 * \a span is an optional vectorized version of \a f, such as those of FastMath.h. When curves
+	 * are composed into a table, the table covers [\a lo, \a hi], and values outside of it are
+	 * computed exactly.
+	 */
+	void addCurve(const CurveFunc & f, const std::string & name, const SpanFunc & span = nullptr,
+	              float lo = 0.f, float hi = 1.f);
+	//! Add a function of the whole color, such as a hue rotation, which cannot be folded
+	void addFunction(const ColorFunc & f, const std::string & name);
+	//! Add a 3D LUT
+	void addLUT(const std::shared_ptr<const ColorLUT> & lut, ColorLUT::Interpolation interp,
+	            const std::string & name = "LUT");
+	//! Add all transforms of \a other
+	void append(const ColorPipeline & other);
+
+	bool empty() const              {return m_transforms.empty();}
+	size_t size() const             {return m_transforms.size();}
+	//! Describes the transforms, for instance "exposure * matrix -> [srgb + gamma] table"
+	std::string description() const;
+
+	/*!
+	 * @brief The pipeline with adjacent transforms folded.
+	 *
+	 * The longest runs of curves whose composition is within \a tolerance of a table, relative to
+	 * values above 1, are replaced by that table, except for single vectorized curves.
+	 */
+	ColorPipeline compiled(float tolerance = 2e-5f) const;
+
+	//! Transform a single color
+	Color3 operator()(const Color3 & c) const;
+
+	//! Transform the \a n colors in \a r, \a g and \a b in place
+	void apply(float * r, float * g, float * b, size_t n) const;
+
+	//! Transform the color channels of \a image in place, applying all transforms to each tile in turn
+	void apply(HDRImage & image, AtomicProgress progress = AtomicProgress()) const;
+
+private:
+	struct Transform
+	{
+		enum Type
+		{
+			AFFINE = 0,
+			CURVE,
+			FUNCTION,
+			LUT
+		};
+
+		Type type;
+		std::string name;
+		Eigen::Matrix3f matrix;                     ///< For AFFINE transforms
+		Eigen::Vector3f offset;
+		CurveFunc curve;                            ///< For CURVEs, and LUTs made from curves outside [lo,hi]
+		SpanFunc span;
+		float lo = 0.f, hi = 1.f;
+		ColorFunc function;                         ///< For FUNCTIONs
+		std::shared_ptr<const ColorLUT> lut;        ///< For LUTs
+		ColorLUT::Interpolation interp = ColorLUT::TETRAHEDRAL;
+	};
+
+	/*!
+	 * @brief Compose \a curves into \a t, which is a table if it is accurate enough.
+	 *
+	 * Returns false if there are several curves and they cannot be tabulated, otherwise a single
+	 * curve that cannot be tabulated is kept as it is.
+	 */
+	static bool composeCurves(const std::vector<Transform> & curves, float tolerance, Transform & t);
+
+	std::vector<Transform> m_transforms;
+};
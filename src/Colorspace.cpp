@@ -8,6 +8,11 @@
 #include "Common.h"
 #include "Color.h"
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <Eigen/LU>
 
 namespace
 {
@@ -572,6 +577,284 @@ void convertColorSpace(EColorSpace dst, float *a, float *b, float *c,
 	}
 }
 
+namespace
+{
+
+// Branch-free versions of the per-color conversions above, used by the planar convertColorSpace.
+// Both sides of each condition are computed and then selected, which lets the compiler vectorize
+// the loops; any infinities or NaNs in the discarded side do not matter.
+
+// cube root of a finite x, with a relative error below 2e-6
+inline float fastCbrt(float x)
+{
+	float ax = std::abs(x);
+	uint32_t i;
+	memcpy(&i, &ax, sizeof(i));
+	// dividing the exponent by three gives an estimate within about 5%
+	i = i / 3 + 0x2a5137a0u;
+	float y;
+	memcpy(&y, &i, sizeof(y));
+
+	// each Halley iteration triples the number of correct digits
+	for (int k = 0; k < 2; ++k)
+	{
+		float y3 = y * y * y;
+		y *= (y3 + 2.f * ax) / (2.f * y3 + ax);
+	}
+	y = ax == 0.f || ax == std::numeric_limits<float>::infinity() ? ax : y;
+	return x < 0.f ? -y : y;
+}
+
+inline float cube(float x)
+{
+	return x * x * x;
+}
+
+inline void fastXYZToLab(float & L, float & a, float & b, float X, float Y, float Z)
+{
+	X *= 1.0f / 0.95047f;
+	Z *= 1.0f / 1.08883f;
+
+	X = (X > eps) ? fastCbrt(X) : (kappa * X + 16.0f) / 116.0f;
+	Y = (Y > eps) ? fastCbrt(Y) : (kappa * Y + 16.0f) / 116.0f;
+	Z = (Z > eps) ? fastCbrt(Z) : (kappa * Z + 16.0f) / 116.0f;
+
+	L = (116.0f * Y) - 16.f;
+	a = 500.0f * (X - Y);
+	b = 200.0f * (Y - Z);
+}
+
+inline void fastLabToXYZ(float & X, float & Y, float & Z, float L, float a, float b)
+{
+	float yr = (L > kappa*eps) ? cube((L + 16.0f) / 116.0f) : L / kappa;
+	float fy = (yr > eps) ? (L + 16.0f) / 116.0f : (kappa*yr + 16.0f) / 116.0f;
+	float fx = a / 500.0f + fy;
+	float fz = fy - b / 200.0f;
+
+	float fx3 = cube(fx);
+	float fz3 = cube(fz);
+
+	X = ((fx3 > eps) ? fx3 : (116.0f * fx - 16.0f) / kappa) * 0.95047f;
+	Y = yr;
+	Z = ((fz3 > eps) ? fz3 : (116.0f * fz - 16.0f) / kappa) * 1.08883f;
+}
+
+inline void fastXYZToLuv(float & L, float & u, float & v, float X, float Y, float Z)
+{
+	float denom = 1.0f / (X + 15.0f * Y + 3.0f * Z);
+	L = (Y > eps) ? (116.0f * fastCbrt(Y)) - 16.0f : kappa * Y;
+	u = 13.0f * L * ((4.0f * X) * denom - refU);
+	v = 13.0f * L * ((9.0f * Y) * denom - refV);
+}
+
+inline void fastLuvToXYZ(float & X, float & Y, float & Z, float L, float u, float v)
+{
+	Y = (L > kappa * eps) ? cube((L + 16.0f) / 116.0f) : L / kappa;
+
+	float a = (1.0f/3.0f) * ((52.0f * L) / (u + 13.0f * L * refU) - 1.0f);
+	float b = -5.0f * Y;
+	float d = Y * ((39.0f * L) / (v + 13.0f * L * refV) - 5.0f);
+
+	X = (d - b) / (a + (1.0f/3.0f));
+	Z = X * a + b;
+}
+
+inline void fastXYZToxy(float & x, float & y, float X, float Y, float Z)
+{
+	float denom = X + Y + Z;
+	x = denom == 0.0f ? 0.31271f : X / denom;
+	y = denom == 0.0f ? 0.32902f : Y / denom;
+}
+
+inline void fastxyYToXZ(float & X, float & Z, float x, float y, float Y)
+{
+	X = Y == 0.0f ? 0.0f : x*Y;
+	Z = Y == 0.0f ? 0.0f : (1.0f - x - y) * Y / y;
+}
+
+inline void fastRGBToHSV(float & H, float & S, float & V, float R, float G, float B)
+{
+	float mx = std::max(std::max(R, G), B);
+	float mn = std::min(std::min(R, G), B);
+	float delta = mx - mn;
+
+	S = (mx != 0) ? delta / mx : 0;
+	V = mx;
+
+	float h = (R == mx) ? (G - B) / delta : (G == mx) ? 2 + (B - R) / delta : 4 + (R - G) / delta;
+	h *= 1.0f / 6.0f;
+	h = h < 0.0f ? h + 1.0f : h;
+	H = S == 0.0f ? 0.0f : h;
+}
+
+inline void fastHSVToRGB(float & R, float & G, float & B, float H, float S, float V)
+{
+	H = H == 1.0f ? 0.0f : H * 6.0f;
+
+	float i = std::floor(H);
+	float f = H - i;
+	float p = V * (1-S);
+	float q = V * (1-(S*f));
+	float t = V * (1-(S*(1-f)));
+
+	// select the sextant; the achromatic case gives V for all three
+	float r = (i == 1) ? q : (i == 2 || i == 3) ? p : (i == 4) ? t : V;
+	float g = (i == 0) ? t : (i == 1 || i == 2) ? V : (i == 3) ? q : p;
+	float b = (i == 0 || i == 1) ? p : (i == 2) ? t : (i == 5) ? q : V;
+	R = S == 0.0f ? V : r;
+	G = S == 0.0f ? V : g;
+	B = S == 0.0f ? V : b;
+}
+
+inline void fastRGBToHSL(float & H, float & S, float & L, float R, float G, float B)
+{
+	float mn = std::min(std::min(R, G), B);
+	float mx = std::max(std::max(R, G), B);
+
+	float sum = mn + mx;
+	float diff = mx - mn;
+	L = sum / 2;
+
+	float s = (L <= .5f) ? ((mn < 0) ? 1 - mn : diff / sum) : ((mx > 1) ? mx : diff / (2 - sum));
+
+	float h = (R == mx) ? (G - B) / diff : (G == mx) ? (B - R) / diff + 2 : (R - G) / diff + 4;
+	h *= 1.0f / 6.0f;
+	h = (h < 0 || h > 1) ? h - std::floor(h) : h;
+
+	bool achromatic = diff < 1e-6f;
+	H = achromatic ? 0.0f : h;
+	S = achromatic ? 0.0f : s;
+}
+
+inline float fastHueToRGB(float x, float y, float hue)
+{
+	hue = (hue < 0 || hue > 1) ? hue - std::floor(hue) : hue;
+
+	return (6 * hue < 1.f) ? x + 6 * (y - x) * hue :
+	       (2 * hue < 1.f) ? y :
+	       (3 * hue < 2.f) ? x + 6 * (y - x) * (2.0f/3.0f - hue) : x;
+}
+
+inline void fastHSLToRGB(float & R, float & G, float & B, float H, float S, float L)
+{
+	float y = (L < 0.5f) ? ((S > 1) ? 2 * L + S - 1 : L + L * S) : ((S > 1) ? S : L + S - L * S);
+	float x = 2 * L - y;
+
+	R = S <= 0 ? L : fastHueToRGB(x, y, H + (1 / 3.f));
+	G = S <= 0 ? L : fastHueToRGB(x, y, H);
+	B = S <= 0 ? L : fastHueToRGB(x, y, H - (1 / 3.f));
+}
+
+} // namespace
+
+
+void convertColorSpace(EColorSpace dst, float *a, float *b, float *c,
+                       EColorSpace src, const float *A, const float *B, const float *C, size_t n)
+{
+	// always convert between the color spaces by way of XYZ, stored in the outputs in between
+	switch (src)
+	{
+		case LinearSRGB_CS:
+			for (size_t i = 0; i < n; ++i)
+				LinearSRGBToXYZ(&a[i], &b[i], &c[i], A[i], B[i], C[i]);
+			break;
+		case LinearAdobeRGB_CS:
+			for (size_t i = 0; i < n; ++i)
+				LinearAdobeRGBToXYZ(&a[i], &b[i], &c[i], A[i], B[i], C[i]);
+			break;
+		case CIELab_CS:
+			for (size_t i = 0; i < n; ++i)
+			{
+				float L = A[i], la = B[i], lb = C[i];
+				unnormalizeLab(&L, &la, &lb);
+				fastLabToXYZ(a[i], b[i], c[i], L, la, lb);
+			}
+			break;
+		case CIELuv_CS:
+			for (size_t i = 0; i < n; ++i)
+				fastLuvToXYZ(a[i], b[i], c[i], A[i], B[i], C[i]);
+			break;
+		case CIExyY_CS:
+			for (size_t i = 0; i < n; ++i)
+			{
+				float Y = C[i];
+				fastxyYToXZ(a[i], c[i], A[i], B[i], Y);
+				b[i] = Y;
+			}
+			break;
+		case HLS_CS:
+			for (size_t i = 0; i < n; ++i)
+			{
+				float R, G, Bl;
+				fastHSLToRGB(R, G, Bl, A[i], B[i], C[i]);
+				LinearSRGBToXYZ(&a[i], &b[i], &c[i], R, G, Bl);
+			}
+			break;
+		case HSV_CS:
+			for (size_t i = 0; i < n; ++i)
+			{
+				float R, G, Bl;
+				fastHSVToRGB(R, G, Bl, A[i], B[i], C[i]);
+				LinearSRGBToXYZ(&a[i], &b[i], &c[i], R, G, Bl);
+			}
+			break;
+		default:                                    // XYZ
+			if (a != A) memcpy(a, A, n * sizeof(float));
+			if (b != B) memcpy(b, B, n * sizeof(float));
+			if (c != C) memcpy(c, C, n * sizeof(float));
+	}
+
+	// now convert from XYZ to the destination color space in place
+	switch (dst)
+	{
+		case LinearSRGB_CS:
+			for (size_t i = 0; i < n; ++i)
+				XYZToLinearSRGB(&a[i], &b[i], &c[i], a[i], b[i], c[i]);
+			break;
+		case LinearAdobeRGB_CS:
+			for (size_t i = 0; i < n; ++i)
+				XYZToLinearAdobeRGB(&a[i], &b[i], &c[i], a[i], b[i], c[i]);
+			break;
+		case CIELab_CS:
+			for (size_t i = 0; i < n; ++i)
+			{
+				fastXYZToLab(a[i], b[i], c[i], a[i], b[i], c[i]);
+				normalizeLab(&a[i], &b[i], &c[i]);
+			}
+			break;
+		case CIELuv_CS:
+			for (size_t i = 0; i < n; ++i)
+				fastXYZToLuv(a[i], b[i], c[i], a[i], b[i], c[i]);
+			break;
+		case CIExyY_CS:
+			for (size_t i = 0; i < n; ++i)
+			{
+				float Y = b[i];
+				fastXYZToxy(a[i], b[i], a[i], Y, c[i]);
+				c[i] = Y;
+			}
+			break;
+		case HLS_CS:
+			for (size_t i = 0; i < n; ++i)
+			{
+				float R, G, Bl;
+				XYZToLinearSRGB(&R, &G, &Bl, a[i], b[i], c[i]);
+				fastRGBToHSL(a[i], b[i], c[i], R, G, Bl);
+			}
+			break;
+		case HSV_CS:
+			for (size_t i = 0; i < n; ++i)
+			{
+				float R, G, Bl;
+				XYZToLinearSRGB(&R, &G, &Bl, a[i], b[i], c[i]);
+				fastRGBToHSV(a[i], b[i], c[i], R, G, Bl);
+			}
+			break;
+		default: break;                             // XYZ
+	}
+}
+
+
 const vector<string> & colorSpaceNames()
 {
 	static const vector<string> names =
@@ -586,4 +869,151 @@ const vector<string> & colorSpaceNames()
 			"HSV"
 		};
 	return names;
-}
\ No newline at end of file
+}
+
+
+const vector<string> & chromaticAdaptationNames()
+{
+	static const vector<string> names =
+		{
+			"XYZ scaling",
+			"von Kries",
+			"Bradford",
+			"CAT02"
+		};
+	return names;
+}
+
+
+namespace
+{
+
+// the linear sRGB to XYZ matrix, which matches LinearSRGBToXYZ
+Eigen::Matrix3f sRGBToXYZMatrix()
+{
+	return (Eigen::Matrix3f() << 0.412453f, 0.357580f, 0.180423f,
+	                             0.212671f, 0.715160f, 0.072169f,
+	                             0.019334f, 0.119193f, 0.950227f).finished();
+}
+
+// the XYZ to cone response matrix of each chromatic adaptation transform
+Eigen::Matrix3f coneResponseMatrix(EChromaticAdaptation method)
+{
+	switch (method)
+	{
+		case VON_KRIES_CA:
+			return (Eigen::Matrix3f() <<  0.40024f, 0.70760f, -0.08081f,
+			                             -0.22630f, 1.16532f,  0.04570f,
+			                              0.00000f, 0.00000f,  0.91822f).finished();
+		case BRADFORD_CA:
+			return (Eigen::Matrix3f() <<  0.8951f,  0.2664f, -0.1614f,
+			                             -0.7502f,  1.7135f,  0.0367f,
+			                              0.0389f, -0.0685f,  1.0296f).finished();
+		case CAT02_CA:
+			return (Eigen::Matrix3f() <<  0.7328f, 0.4296f, -0.1624f,
+			                             -0.7036f, 1.6975f,  0.0061f,
+			                              0.0030f, 0.0136f,  0.9834f).finished();
+		default:
+			return Eigen::Matrix3f::Identity();
+	}
+}
+
+// the temperatures the Planckian locus approximation below is accurate for
+const float minTemperature = 1000.f;
+const float maxTemperature = 15000.f;
+// the distance from the locus, in CIE 1960 uv, of a tint of 1
+const float tintScale = 1.f / 3000.f;
+
+// the CIE 1960 uv chromaticity of a black body at temperature T, using Krystek's approximation
+Eigen::Vector2f planckianLocus(float T)
+{
+	T = clamp(T, minTemperature, maxTemperature);
+	return Eigen::Vector2f((0.860117757f + 1.54118254e-4f * T + 1.28641212e-7f * T * T) /
+	                       (1.f + 8.42420235e-4f * T + 7.08145163e-7f * T * T),
+	                       (0.317398726f + 4.22806245e-5f * T + 4.20481691e-8f * T * T) /
+	                       (1.f - 2.89741816e-5f * T + 1.61456053e-7f * T * T));
+}
+
+// the unit vector perpendicular to the locus at T, pointing towards green
+Eigen::Vector2f planckianNormal(float T)
+{
+	Eigen::Vector2f d = planckianLocus(T * 1.01f) - planckianLocus(T * 0.99f);
+	return Eigen::Vector2f(d.y(), -d.x()).normalized();
+}
+
+Eigen::Vector2f xyToUV(float x, float y)
+{
+	float denom = -2.f * x + 12.f * y + 3.f;
+	return Eigen::Vector2f(4.f * x / denom, 6.f * y / denom);
+}
+
+// the shift of the locus that makes 6504K the D65 white of sRGB
+Eigen::Vector2f locusShift()
+{
+	Eigen::Vector3f white = sRGBToXYZMatrix() * Eigen::Vector3f::Ones();
+	return xyToUV(white.x() / white.sum(), white.y() / white.sum()) - planckianLocus(6504.f);
+}
+
+} // namespace
+
+
+Eigen::Matrix3f chromaticAdaptation(const Color3 & srcWhite, const Color3 & dstWhite, EChromaticAdaptation method)
+{
+	Eigen::Matrix3f toXYZ = sRGBToXYZMatrix();
+	Eigen::Matrix3f toCone = coneResponseMatrix(method) * toXYZ;
+
+	Eigen::Vector3f src = toXYZ * Eigen::Vector3f(srcWhite.r, srcWhite.g, srcWhite.b);
+	Eigen::Vector3f dst = toXYZ * Eigen::Vector3f(dstWhite.r, dstWhite.g, dstWhite.b);
+	Eigen::Vector3f srcCone = coneResponseMatrix(method) * (src / src.y());
+	Eigen::Vector3f dstCone = coneResponseMatrix(method) * (dst / dst.y());
+	if (!(srcCone.minCoeff() > 0.f) || !(dstCone.minCoeff() > 0.f))
+		throw invalid_argument("Cannot adapt to a white that is not a positive color.");
+
+	return toCone.inverse() * dstCone.cwiseQuotient(srcCone).asDiagonal() * toCone;
+}
+
+
+Color3 temperatureTintToLinearSRGB(float temperature, float tint)
+{
+	Eigen::Vector2f uv = planckianLocus(temperature) + locusShift() -
+	                     tint * tintScale * planckianNormal(temperature);
+
+	float denom = 2.f * uv.x() - 8.f * uv.y() + 4.f;
+	float x = 3.f * uv.x() / denom, y = 2.f * uv.y() / denom;
+	Color3 rgb;
+	XYZToLinearSRGB(&rgb.r, &rgb.g, &rgb.b, x / y, 1.f, (1.f - x - y) / y);
+	return rgb;
+}
+
+
+void linearSRGBToTemperatureTint(float *temperature, float *tint, const Color3 & white)
+{
+	float X, Y, Z, x, y;
+	LinearSRGBToXYZ(&X, &Y, &Z, white.r, white.g, white.b);
+	XYZToxy(&x, &y, X, Y, Z);
+	Eigen::Vector2f uv = xyToUV(x, y) - locusShift();
+
+	// find the closest point on the locus, first coarsely and then with a golden section search,
+	// in mireds, which are more evenly spaced along the locus than Kelvins
+	auto distance = [&uv](float mired) {return (planckianLocus(1e6f / mired) - uv).squaredNorm();};
+	const int numSteps = 64;
+	float lo = 1e6f / maxTemperature, hi = 1e6f / minTemperature, step = (hi - lo) / numSteps;
+	int best = 0;
+	for (int i = 1; i <= numSteps; ++i)
+		if (distance(lo + i * step) < distance(lo + best * step))
+			best = i;
+
+	float a = max(lo, lo + (best - 1) * step), b = min(hi, lo + (best + 1) * step);
+	const float invPhi = 0.618034f;
+	for (int i = 0; i < 32; ++i)
+	{
+		float c = b - invPhi * (b - a), d = a + invPhi * (b - a);
+		if (distance(c) < distance(d))
+			b = d;
+		else
+			a = c;
+	}
+
+	*temperature = 1e6f / (0.5f * (a + b));
+	*tint = -(uv - planckianLocus(*temperature)).dot(planckianNormal(*temperature)) / tintScale;
+}
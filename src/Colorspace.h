@@ -7,6 +7,8 @@
 #pragma once
 
 #include "Fwd.h"
+#include <Eigen/Core>
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -27,6 +29,33 @@
  */
 void convertColorSpace(EColorSpace dst, float *a, float *b, float *c, EColorSpace src, float A, float B, float C);
 
+/*!
+ * @brief		Color space conversion of many colors at once
+ *
+ * Converts \a n colors stored as three planar arrays, like calling the per-color
+ * convertColorSpace() on each of them. Each color space is converted with branch-free loops
+ * that the compiler vectorizes, and the cube roots needed by CIE L*a*b* and L*u*v* are computed
+ * with a bit-level initial estimate refined by Halley iterations instead of std::cbrt.
+ * The results agree with the per-color version to within 2e-6 of the largest component,
+ * or 4e-6 for conversions to or from L*a*b* and L*u*v*. The hue and saturation of nearly
+ * gray colors are ill-conditioned, so HSL and HSV results only agree once converted back to
+ * RGB. hdrview-bench --accuracy checks these bounds for every pair of color spaces.
+ *
+ * The output arrays may be the same as the input arrays, but must not otherwise overlap them.
+ *
+ * @param[in] dst 	Destination color space
+ * @param[out] a 	First components of the destination colors
+ * @param[out] b	Second components of the destination colors
+ * @param[out] c	Third components of the destination colors
+ * @param[in] src	Source color space
+ * @param[in] A  	First components of the source colors
+ * @param[in] B  	Second components of the source colors
+ * @param[in] C  	Third components of the source colors
+ * @param[in] n		The number of colors
+ */
+void convertColorSpace(EColorSpace dst, float *a, float *b, float *c,
+                       EColorSpace src, const float *A, const float *B, const float *C, size_t n);
+
 // to/from linear to sRGB and AdobeRGB
 float SRGBToLinear(float a);
 void SRGBToLinear(float * r, float * g, float * b);
@@ -78,4 +107,41 @@ void SatAdjust(float *R, float *G, float *B, float s);
 
 
 
-const std::vector<std::string> & colorSpaceNames();
\ No newline at end of file
+const std::vector<std::string> & colorSpaceNames();
+
+
+//! The chromatic adaptation transforms, which differ in the cone responses that are scaled
+enum EChromaticAdaptation : int
+{
+	XYZ_SCALING_CA = 0,
+	VON_KRIES_CA,
+	BRADFORD_CA,
+	CAT02_CA
+};
+
+const std::vector<std::string> & chromaticAdaptationNames();
+
+/*!
+ * @brief		The matrix that adapts linear sRGB colors seen under one white to another
+ *
+ * Both whites are given as linear sRGB colors, and are normalized to the same luminance, so
+ * the matrix maps \a srcWhite to a color with the chromaticity of \a dstWhite and the luminance
+ * of \a srcWhite. Throws std::invalid_argument if a white has a cone response that is not positive.
+ *
+ * @param[in] srcWhite	The white of the colors to adapt, for instance a neutral picked in an image
+ * @param[in] dstWhite	The white to adapt to, Color3(1.f) for the D65 white of sRGB
+ * @param[in] method	The chromatic adaptation transform
+ */
+Eigen::Matrix3f chromaticAdaptation(const Color3 & srcWhite, const Color3 & dstWhite,
+                                    EChromaticAdaptation method = BRADFORD_CA);
+
+/*!
+ * @brief		The linear sRGB white, with a luminance of 1, of an illuminant's temperature and tint
+ *
+ * The temperature, in Kelvin in [1000,15000], follows the Planckian locus, which is shifted
+ * so that a temperature of 6504K and a tint of 0 give the D65 white. The tint in [-100,100]
+ * moves perpendicularly to the locus, towards magenta when positive and green when negative.
+ */
+Color3 temperatureTintToLinearSRGB(float temperature, float tint);
+//! The temperature and tint that are closest to the chromaticity of the linear sRGB \a white
+void linearSRGBToTemperatureTint(float *temperature, float *tint, const Color3 & white);
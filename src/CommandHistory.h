@@ -12,7 +12,11 @@
 #include "HDRImage.h"          // for HDRImage
 #include "Fwd.h"               // for HDRImage
 
-//! Generic image manipulation undo class
+/*!
+    Generic image manipulation undo class.
+    Undo and redo must replace \a img rather than modify the pixels it points to, since they may be
+    shared with other owners, and caches such as ExposureFusion recognize images by their address.
+*/
 class ImageCommandUndo
 {
 public:
@@ -20,6 +24,9 @@ public:
 
     virtual void undo(std::shared_ptr<HDRImage> & img) = 0;
     virtual void redo(std::shared_ptr<HDRImage> & img) = 0;
+
+    //! The memory held by this command for undoing, if known
+    virtual size_t bytes() const {return 0;}
 };
 
 using UndoPtr = std::shared_ptr<ImageCommandUndo>;
@@ -38,6 +45,7 @@ public:
 
     void undo(std::shared_ptr<HDRImage> & img) override {img.swap(m_undoImage);}
     void redo(std::shared_ptr<HDRImage> & img) override {undo(img);}
+    size_t bytes() const override {return m_undoImage ? m_undoImage->size() * sizeof(Color4) : 0;}
 
 	const std::shared_ptr<HDRImage> image() const {return m_undoImage;}
 
@@ -45,7 +53,7 @@ private:
     std::shared_ptr<HDRImage> m_undoImage;
 };
 
-//! Specify the undo and redo commands using lambda expressions
+//! Specify the undo and redo commands using lambda expressions, which must replace their argument, see ImageCommandUndo
 class LambdaUndo : public ImageCommandUndo
 {
 public:
@@ -85,6 +93,15 @@ public:
     bool hasUndo() const        {return m_currentState > 0;}
     bool hasRedo() const        {return m_currentState < size();}
 
+    //! The memory held by all undo and redo snapshots, as far as the commands report it
+    size_t bytes() const
+    {
+        size_t sum = 0;
+        for (auto & cmd : m_history)
+            sum += cmd->bytes();
+        return sum;
+    }
+
     void addCommand(UndoPtr cmd)
     {
         // deletes all history newer than the current state
@@ -5,7 +5,23 @@
 //
 
 #include "Common.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <regex>
+#include <stdexcept>
+#include <spdlog/fmt/fmt.h>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -28,6 +44,38 @@ string getBasename(const string& filename)
     return filename.substr(start, length);
 }
 
+string createTemporaryFile(const string& prefix, const string& ext)
+{
+    string suffix = ext.empty() ? "" : "." + ext;
+#if defined(_WIN32)
+    const char * dir = getenv("TEMP");
+    if (!dir)
+        dir = getenv("TMP");
+    static atomic<unsigned> counter(0);
+    for (int attempt = 0; attempt < 100; ++attempt)
+    {
+        string filename = fmt::format("{}\\{}.{}.{}{}", dir ? dir : ".", prefix, _getpid(), counter++, suffix);
+        int fd;
+        if (_sopen_s(&fd, filename.c_str(), _O_CREAT | _O_EXCL | _O_WRONLY, _SH_DENYRW, _S_IREAD | _S_IWRITE) == 0)
+        {
+            _close(fd);
+            return filename;
+        }
+    }
+    throw runtime_error(fmt::format("Cannot create a temporary file in \"{}\".", dir ? dir : "."));
+#else
+    const char * dir = getenv("TMPDIR");
+    string pattern = fmt::format("{}/{}.XXXXXX{}", dir && *dir ? dir : "/tmp", prefix, suffix);
+    vector<char> filename(pattern.begin(), pattern.end());
+    filename.push_back('\0');
+    int fd = mkstemps(filename.data(), int(suffix.size()));
+    if (fd < 0)
+        throw runtime_error(fmt::format("Cannot create the temporary file \"{}\": {}.", pattern, strerror(errno)));
+    close(fd);
+    return filename.data();
+#endif
+}
+
 
 const vector<string> & channelNames()
 {
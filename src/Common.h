@@ -343,6 +343,15 @@ inline T square(T value)
 std::string getExtension(const std::string& filename);
 std::string getBasename(const std::string& filename);
 
+/*!
+ * @brief Create an empty file with a unique name in the temporary directory, and return its name.
+ *
+ * The name is \a prefix, a random part, and the extension \a ext. The file is created
+ * exclusively and only readable by the user, so that other users cannot substitute their own
+ * file for it. Throws std::runtime_error on failure.
+ */
+std::string createTemporaryFile(const std::string& prefix, const std::string& ext);
+
 
 const std::vector<std::string> & channelNames();
 const std::vector<std::string> & blendModeNames();
@@ -9,12 +9,20 @@
 #include "GLImage.h"
 #include "HDRViewer.h"
 #include "HDRImage.h"
+#include "HDRImageViewer.h"
 #include "ImageListPanel.h"
 #include "EnvMap.h"
 #include "Colorspace.h"
+#include "ColorLUT.h"
+#include "ColorPipeline.h"
+#include "FastMath.h"
 #include "HSLGradient.h"
 #include "MultiGraph.h"
+#include "ExposureFusion.h"
 #include "FilmicToneCurve.h"
+#include "ImageStack.h"
+#include "LocalTonemap.h"
+#include "Noise.h"
 #include <spdlog/spdlog.h>
 #include <Eigen/Geometry>
 
@@ -84,6 +92,34 @@ void addOKCancelButtons(FormHelper * gui, Window * window,
 	gui->addWidget("", w);
 }
 
+// the size of the LUTs that color edits are baked into for their previews, and the largest value they cover
+const int PREVIEW_LUT_SIZE = 33;
+const float PREVIEW_LUT_MAX = 64.f;
+
+// preview the color edit f by baking it into a 3D LUT, which the viewer's shader applies when drawing
+void previewColorEdit(HDRImageViewer * viewer, const function<Color3(const Color3 &)> & f)
+{
+	viewer->setPreviewLUT(make_shared<ColorLUT>(ColorLUT::bake(f, PREVIEW_LUT_SIZE, PREVIEW_LUT_MAX)));
+}
+
+// the average of the finite colors in the size by size square centered at pixel
+Color3 averageColor(const HDRImage & image, const Vector2i & pixel, int size)
+{
+	Color3 sum(0.f);
+	int count = 0;
+	for (int y = max(0, pixel.y() - size/2); y <= min(image.height() - 1, pixel.y() + size/2); ++y)
+		for (int x = max(0, pixel.x() - size/2); x <= min(image.width() - 1, pixel.x() + size/2); ++x)
+		{
+			const Color4 & c = image(x,y);
+			if (isfinite(c.r + c.g + c.b))
+			{
+				sum += Color3(c.r, c.g, c.b);
+				++count;
+			}
+		}
+	return count ? sum / float(count) : Color3(1.f);
+}
+
 Button * createColorSpaceButton(Widget *parent, HDRViewScreen * screen, ImageListPanel * imagesPanel)
 {
 	static string name = "Convert color space...";
@@ -107,10 +143,71 @@ Button * createColorSpaceButton(Widget *parent, HDRViewScreen * screen, ImageLis
 				[&]()
 				{
 					imagesPanel->modifyImage(
-						[&](const shared_ptr<const HDRImage> & img) -> ImageCommandResult
+						[&](const shared_ptr<const HDRImage> & img, AtomicProgress & progress) -> ImageCommandResult
 						{
-							return {make_shared<HDRImage>(img->unaryExpr([](const Color4 & c){return c.convert(dst, src);}).eval()),
-							        nullptr};
+							return {make_shared<HDRImage>(img->convertedColorSpace(dst, src, progress)), nullptr};
+						});
+				});
+
+			window->center();
+			window->requestFocus();
+		});
+	return b;
+}
+
+Button * createColorLUTButton(Widget *parent, HDRViewScreen * screen, ImageListPanel * imagesPanel)
+{
+	static string name = "Apply 3D LUT...";
+	static string filename;
+	static ColorLUT::Interpolation interp = ColorLUT::TETRAHEDRAL;
+	auto b = new Button(parent, name, ENTYPO_ICON_PALETTE);
+	b->setFixedHeight(21);
+	b->setCallback(
+		[&, screen, imagesPanel]()
+		{
+			FormHelper *gui = new FormHelper(screen);
+			gui->setFixedSize(Vector2i(125, 20));
+
+			auto window = gui->addWindow(Eigen::Vector2i(10, 10), name);
+
+			auto fileBtn = new Button(window, filename.empty() ? "Choose..." : getBasename(filename), ENTYPO_ICON_FOLDER);
+			fileBtn->setFixedHeight(20);
+			fileBtn->setCallback(
+				[fileBtn]()
+				{
+					string f = file_dialog({{"cube", "Adobe/Resolve cube LUT"}, {"3dl", "Autodesk/Lustre 3D LUT"}}, false);
+					if (!f.empty())
+					{
+						filename = f;
+						fileBtn->setCaption(getBasename(filename));
+					}
+				});
+			gui->addWidget("LUT file:", fileBtn);
+
+			gui->addVariable("Interpolation:", interp, true)
+			   ->setItems(ColorLUT::interpolationNames());
+
+			addOKCancelButtons(gui, window,
+				[&, screen]()
+				{
+					shared_ptr<const ColorLUT> lut;
+					try
+					{
+						lut = make_shared<ColorLUT>(ColorLUT::load(filename));
+					}
+					catch (const exception & e)
+					{
+						new MessageDialog(screen, MessageDialog::Type::Warning, "Error",
+						                  string("Could not load LUT:\n ") + e.what());
+						return;
+					}
+
+					imagesPanel->modifyImage(
+						[lut](const shared_ptr<const HDRImage> & img, AtomicProgress & progress) -> ImageCommandResult
+						{
+							auto result = make_shared<HDRImage>(*img);
+							lut->apply(*result, interp, progress);
+							return {result, nullptr};
 						});
 				});
 
@@ -158,7 +255,23 @@ Button * createExposureGammaButton(Widget *parent, HDRViewScreen * screen, Image
 			graph->setYTicks(xTicks);
 			gui->addWidget("", graph);
 
-			auto graphCb = [graph]()
+			// apply the exposure, offset and gamma in a single pass
+			auto exposureGamma = []()
+			{
+				ColorPipeline color;
+				color.addMatrix(pow(2.0f, exposure) * Eigen::Matrix3f::Identity(), Eigen::Vector3f::Constant(offset),
+				                "exposure/offset");
+				float invGamma = 1.0f / gamma;
+				if (invGamma != 1.0f)
+					color.addCurve([invGamma](float v) {return fastPow(v, invGamma);}, "gamma",
+					               [invGamma](const float * in, float * out, size_t n)
+					               {fastPow(in, out, n, invGamma);});
+				return color.compiled();
+			};
+
+			// preview the edit with a baked LUT, and only modify the image on OK
+			HDRImageViewer * viewer = imagesPanel->imageViewer();
+			auto graphCb = [graph,viewer,exposureGamma]()
 			{
 				VectorXf lCurve = VectorXf::LinSpaced(257, 0.0f, 1.0f).unaryExpr(
 					[](float v)
@@ -166,6 +279,9 @@ Button * createExposureGammaButton(Widget *parent, HDRViewScreen * screen, Image
 						return pow(pow(2.0f, exposure) * v + offset, 1.0f/gamma);
 					});
 				graph->setValues(lCurve, 1);
+
+				ColorPipeline color = exposureGamma();
+				previewColorEdit(viewer, [color](const Color3 & c) {return color(c);});
 			};
 
 			graphCb();
@@ -183,18 +299,149 @@ Button * createExposureGammaButton(Widget *parent, HDRViewScreen * screen, Image
 			                        "Gamma:", gamma,
 			                        0.0001f, 10.f, 0.1f, graphCb);
 
+			auto stopPreview = [viewer]() {viewer->setPreviewLUT(nullptr);};
+
 			addOKCancelButtons(gui, window,
-				[&]()
+				[&, stopPreview, exposureGamma]()
 				{
+					stopPreview();
+
+					spdlog::get("console")->debug("{}; {}; {}", exposure, offset, gamma);
+					ColorPipeline color = exposureGamma();
 					imagesPanel->modifyImage(
-						[&](const shared_ptr<const HDRImage> & img) -> ImageCommandResult
+						[color](const shared_ptr<const HDRImage> & img, AtomicProgress & progress) -> ImageCommandResult
 						{
-							spdlog::get("console")->debug("{}; {}; {}", exposure, offset, gamma);
-							return {make_shared<HDRImage>((Color4(pow(2.0f, exposure), 1.f) * (*img) + Color4(offset, 0.f)).pow(Color4(1.0f/gamma))),
-							        nullptr};
+							auto result = make_shared<HDRImage>(*img);
+							color.apply(*result, progress);
+							return {result, nullptr};
+						});
+				},
+				stopPreview);
+
+			window->center();
+			window->requestFocus();
+		});
+	return b;
+}
+
+Button * createWhiteBalanceButton(Widget *parent, HDRViewScreen * screen, ImageListPanel * imagesPanel)
+{
+	static string name = "White balance...";
+	static float temperature = 6504.f;
+	static float tint = 0.f;
+	static EChromaticAdaptation method = BRADFORD_CA;
+	static int sampleSize = 1;
+	static const vector<string> sampleSizeNames = {"Point sample", "3 by 3 average", "5 by 5 average",
+	                                               "11 by 11 average", "31 by 31 average"};
+	static const int sampleSizes[] = {1, 3, 5, 11, 31};
+	auto b = new Button(parent, name, ENTYPO_ICON_PALETTE);
+	b->setFixedHeight(21);
+	b->setCallback(
+		[&, screen, imagesPanel]()
+		{
+			FormHelper *gui = new FormHelper(screen);
+			gui->setFixedSize(Vector2i(100, 20));
+
+			auto window = gui->addWindow(Eigen::Vector2i(10, 10), name);
+			HDRImageViewer * viewer = imagesPanel->imageViewer();
+
+			// adapts the white of the illuminant to the D65 white of sRGB
+			auto whiteBalance = []() -> Eigen::Matrix3f
+			{
+				try
+				{
+					return chromaticAdaptation(temperatureTintToLinearSRGB(temperature, tint), Color3(1.f), method);
+				}
+				catch (const invalid_argument &)
+				{
+					return Eigen::Matrix3f::Identity();
+				}
+			};
+
+			// preview the white balance in the shader, and only modify the image on OK
+			auto previewCb = [viewer,whiteBalance]()
+			{
+				viewer->setColorMatrix(whiteBalance());
+			};
+
+			auto setTemperature = createFloatBoxAndSlider(gui, window,
+			                                              "Temperature:", temperature,
+			                                              1000.f, 15000.f, 50.f, previewCb,
+			                                              "The color temperature of the illuminant, in Kelvin.");
+
+			auto setTint = createFloatBoxAndSlider(gui, window,
+			                                       "Tint:", tint,
+			                                       -100.f, 100.f, 1.f, previewCb,
+			                                       "The tint of the illuminant, towards magenta when positive and green when negative.");
+
+			gui->addVariable<EChromaticAdaptation>("Adaptation:",
+			                                       [previewCb](const EChromaticAdaptation & m) {method = m; previewCb();},
+			                                       []() {return method;}, true)
+			   ->setItems(chromaticAdaptationNames());
+
+			auto spacer = new Widget(window);
+			spacer->setFixedHeight(5);
+			gui->addWidget("", spacer);
+
+			auto sampleCombo = new ComboBox(window, sampleSizeNames);
+			sampleCombo->setSelectedIndex(sampleSize);
+			sampleCombo->setCallback([](int i) {sampleSize = i;});
+			gui->addWidget("Sample size:", sampleCombo);
+
+			auto pickBtn = new Button(window, "Pick neutral", ENTYPO_ICON_DROP);
+			pickBtn->setFlags(Button::ToggleButton);
+			pickBtn->setTooltip("Click on a pixel that should be neutral to set the temperature and tint.");
+			pickBtn->setChangeCallback(
+				[viewer,imagesPanel,pickBtn,setTemperature,setTint](bool pushed)
+				{
+					if (!pushed)
+					{
+						viewer->setPickCallback(nullptr);
+						return;
+					}
+
+					viewer->setPickCallback(
+						[viewer,imagesPanel,pickBtn,setTemperature,setTint](const Vector2i & pixel)
+						{
+							auto img = imagesPanel->currentImage();
+							if (!img)
+								return;
+
+							float t, ti;
+							linearSRGBToTemperatureTint(&t, &ti, averageColor(img->image(), pixel, sampleSizes[sampleSize]));
+							setTemperature(clamp(t, 1000.f, 15000.f));
+							setTint(clamp(ti, -100.f, 100.f));
+
+							pickBtn->setPushed(false);
+							viewer->setPickCallback(nullptr);
 						});
 				});
+			gui->addWidget("", pickBtn);
+
+			auto stopPreview = [viewer]()
+			{
+				viewer->setColorMatrix(Eigen::Matrix3f::Identity());
+				viewer->setPickCallback(nullptr);
+			};
+
+			addOKCancelButtons(gui, window,
+				[&, stopPreview, whiteBalance]()
+				{
+					stopPreview();
 
+					ColorPipeline color;
+					color.addMatrix(whiteBalance(), Eigen::Vector3f::Zero(), "white balance");
+					imagesPanel->modifyImage(
+						[color](const shared_ptr<const HDRImage> & img, AtomicProgress & progress) -> ImageCommandResult
+						{
+							auto result = make_shared<HDRImage>(*img);
+							color.apply(*result, progress);
+							return {result, nullptr};
+						});
+				},
+				stopPreview);
+
+			previewCb();
 			window->center();
 			window->requestFocus();
 		});
@@ -329,6 +576,7 @@ Button * createFilmicTonemappingButton(Widget *parent, HDRViewScreen * screen, I
 	static FilmicToneCurve::FullCurve fCurve;
 	static FilmicToneCurve::CurveParamsUser params;
 	static float vizFstops = 1.f;
+	static bool inverse = false;
 	static const auto activeColor = Color(255, 255, 255, 200);
 	auto b = new Button(parent, name, ENTYPO_ICON_CONTROLLER_VOLUME);
 	b->setFixedHeight(21);
@@ -349,7 +597,20 @@ Button * createFilmicTonemappingButton(Widget *parent, HDRViewScreen * screen, I
 			graph->setWell(false);
 			gui->addWidget("", graph);
 
-			auto graphCb = [graph]()
+			// bake the curve into a table that is evaluated by a vectorized kernel
+			auto filmic = []()
+			{
+				auto baked = make_shared<FilmicToneCurve::BakedCurve>(FilmicToneCurve::bake(fCurve, inverse));
+				ColorPipeline pipeline;
+				pipeline.addCurve([baked](float v) {return baked->eval(v);},
+				                  inverse ? "filmic-inverse" : "filmic",
+				                  [baked](const float * in, float * out, size_t n) {baked->eval(in, out, n);});
+				return pipeline;
+			};
+
+			// preview the curve with a baked LUT, and only modify the image on OK
+			HDRImageViewer * viewer = imagesPanel->imageViewer();
+			auto graphCb = [graph,viewer,filmic]()
 			{
 				float range = pow(2.f, vizFstops);
 				FilmicToneCurve::CurveParamsDirect directParams;
@@ -375,11 +636,13 @@ Button * createFilmicTonemappingButton(Widget *parent, HDRViewScreen * screen, I
 //				    directParams.overshootX,
 //				    directParams.overshootY);
 
-				graph->setValues(VectorXf::LinSpaced(257, 0.0f, range), 0);
-				VectorXf lCurve = VectorXf::LinSpaced(257, 0.0f, range).unaryExpr(
-					[](float v)
+				// the inverse maps [0,1] back to [0,range], so it is plotted scaled down by the range
+				float xRange = inverse ? 1.f : range;
+				graph->setValues(VectorXf::LinSpaced(257, 0.0f, xRange), 0);
+				VectorXf lCurve = VectorXf::LinSpaced(257, 0.0f, xRange).unaryExpr(
+					[range](float v)
 					{
-						return fCurve.eval(v);
+						return inverse ? fCurve.evalInv(v) / range : fCurve.eval(v);
 					});
 				graph->setValues(lCurve, 1);
 
@@ -389,9 +652,12 @@ Button * createFilmicTonemappingButton(Widget *parent, HDRViewScreen * screen, I
 				// create the x tick labels
 				vector<string> xTickLabels(numTicks);
 				for (int i = 0; i < numTicks; ++i)
-					xTickLabels[i] = fmt::format("{:.2f}", range*xTicks[i]);
+					xTickLabels[i] = fmt::format("{:.2f}", xRange*xTicks[i]);
 				graph->setXTicks(xTicks, xTickLabels);
 				graph->setYTicks(VectorXf::LinSpaced(3, 0.0f, 1.0f));
+
+				ColorPipeline pipeline = filmic();
+				previewColorEdit(viewer, [pipeline](const Color3 & c) {return pipeline(c);});
 			};
 
 			graphCb();
@@ -424,28 +690,139 @@ Button * createFilmicTonemappingButton(Widget *parent, HDRViewScreen * screen, I
 			                        "Gamma:", params.gamma,
 			                        0.f, 5.f, 0.01f, graphCb);
 
+			auto iCheck = gui->addVariable("Inverse:", inverse, true);
+			iCheck->setTooltip("Undo the tone curve, for instance to recover linear values from a tonemapped image.");
+			iCheck->setCallback(
+				[graphCb](bool b)
+				{
+					inverse = b;
+					graphCb();
+				});
+
+			auto stopPreview = [viewer]() {viewer->setPreviewLUT(nullptr);};
+
+			addOKCancelButtons(gui, window,
+				[&, stopPreview, filmic]()
+				{
+					stopPreview();
+
+					ColorPipeline pipeline = filmic();
+					imagesPanel->modifyImage(
+						[pipeline](const shared_ptr<const HDRImage> & img, AtomicProgress & progress) -> ImageCommandResult
+						{
+							auto result = make_shared<HDRImage>(*img);
+							pipeline.apply(*result, progress);
+							return {result, nullptr};
+						});
+				},
+				stopPreview);
+
+			window->center();
+			window->requestFocus();
+		});
+	return b;
+}
+
+Button * createLocalTonemappingButton(Widget *parent, HDRViewScreen * screen, ImageListPanel * imagesPanel)
+{
+	static string name = "Local tonemapping...";
+	static LocalTonemapSpec tonemap;
+	static bool preview = false;
+	static int previewSize = 1024;
+	auto b = new Button(parent, name, ENTYPO_ICON_CONTROLLER_VOLUME);
+	b->setFixedHeight(21);
+	b->setCallback(
+		[&, screen, imagesPanel]()
+		{
+			FormHelper *gui = new FormHelper(screen);
+			gui->setFixedSize(Vector2i(75, 20));
+
+			auto window = gui->addWindow(Eigen::Vector2i(10, 10), name);
+//           window->setModal(true);    // BUG: this should be set to modal, but doesn't work with comboboxes
+
+			auto opBox = gui->addVariable("Operator:", tonemap.op, true);
+			opBox->setItems(LocalTonemapSpec::operatorNames());
+
+			// the parameters of each operator, which are only enabled for it
+			vector<pair<FloatBox<float>*, vector<LocalTonemapSpec::Operator>>> boxes;
+			auto addBox = [gui,&boxes](const string & label, float & value, float increment, const string & help,
+			                           const vector<LocalTonemapSpec::Operator> & ops)
+			{
+				auto w = gui->addVariable(label, value);
+				w->setSpinnable(true);
+				w->setValueIncrement(increment);
+				w->setMinValue(0.0f);
+				w->setTooltip(help);
+				boxes.push_back({w, ops});
+			};
+			addBox("Key:", tonemap.key, 0.01f, "The value that the log-average luminance is mapped to.",
+			       {LocalTonemapSpec::REINHARD});
+			addBox("Sharpening:", tonemap.sharpening, 0.5f,
+			       "Larger values select larger neighborhoods, which increases local contrast.",
+			       {LocalTonemapSpec::REINHARD});
+			addBox("Threshold:", tonemap.threshold, 0.01f,
+			       "The largest contrast that is allowed within the neighborhood of a pixel.",
+			       {LocalTonemapSpec::REINHARD});
+			addBox("Contrast:", tonemap.contrast, 0.5f, "The contrast of the base layer after compression, in stops.",
+			       {LocalTonemapSpec::DURAND});
+			addBox("Spatial sigma:", tonemap.sigmaSpatial, 0.005f,
+			       "The size of the base layer's features, as a fraction of the image size.",
+			       {LocalTonemapSpec::DURAND});
+			addBox("Detail:", tonemap.detail, 0.05f, "Values below 1 enhance details, values above 1 smooth them.",
+			       {LocalTonemapSpec::LOCAL_LAPLACIAN});
+			addBox("Compression:", tonemap.compression, 0.05f, "Values below 1 compress the contrast of large edges.",
+			       {LocalTonemapSpec::LOCAL_LAPLACIAN});
+			addBox("Range sigma:", tonemap.sigmaRange, 0.1f,
+			       "The contrast, in stops, that separates details from edges.",
+			       {LocalTonemapSpec::DURAND, LocalTonemapSpec::LOCAL_LAPLACIAN});
+			auto sat = gui->addVariable("Saturation:", tonemap.saturation);
+			sat->setSpinnable(true);
+			sat->setValueIncrement(0.05f);
+			sat->setMinValue(0.0f);
+			sat->setTooltip("The exponent applied to the ratio between the colors and the luminance.");
+
+			auto enableBoxes = [boxes](LocalTonemapSpec::Operator op)
+			{
+				for (auto & box : boxes)
+					box.first->setEnabled(find(box.second.begin(), box.second.end(), op) != box.second.end());
+			};
+			enableBoxes(tonemap.op);
+			opBox->setCallback(
+				[enableBoxes](const LocalTonemapSpec::Operator & op)
+				{
+					tonemap.op = op;
+					enableBoxes(op);
+				});
+
+			auto sizeBox = gui->addVariable("Preview size:", previewSize);
+			sizeBox->setSpinnable(true);
+			sizeBox->setMinValue(64);
+			sizeBox->setValueIncrement(128);
+			sizeBox->setEnabled(preview);
+			sizeBox->setTooltip("The local adaptation is computed on the image downsampled to at most this many pixels across.");
+			auto previewCheck = gui->addVariable("Preview resolution:", preview, true);
+			previewCheck->setTooltip("Compute the local adaptation at a lower resolution, which is much faster on large images.");
+			previewCheck->setCallback(
+				[sizeBox](bool b)
+				{
+					preview = b;
+					sizeBox->setEnabled(b);
+				});
+
 			addOKCancelButtons(gui, window,
 				[&]()
 				{
-				   imagesPanel->modifyImage(
-				       [&](const shared_ptr<const HDRImage> &img) -> ImageCommandResult
-				       {
-				           return {make_shared<HDRImage>(img->unaryExpr(
-				               [](const Color4 & c)
-				               {
-//					               float srcLum = c.average();
-//					               float dstLum = fCurve.eval(srcLum);
-////					               return c * (dstLum/srcLum);
-//					               return Color4(c.r * (dstLum/srcLum),
-//					                             c.g * (dstLum/srcLum),
-//					                             c.b * (dstLum/srcLum),
-//					                             c.a);
-				                   return Color4(fCurve.eval(c.r),
-				                                 fCurve.eval(c.g),
-				                                 fCurve.eval(c.b),
-				                                 c.a);
-				               }).eval()), nullptr};
-				       });
+					imagesPanel->modifyImage(
+						[&](const shared_ptr<const HDRImage> & img, AtomicProgress & progress) -> ImageCommandResult
+						{
+							LocalTonemapSpec spec = tonemap;
+							spec.previewSize = preview ? previewSize : 0;
+							spec.sigmaSpatial = max(spec.sigmaSpatial, 1e-4f);
+							spec.sigmaRange = max(spec.sigmaRange, 1e-2f);
+							spec.key = max(spec.key, 1e-4f);
+							spec.threshold = max(spec.threshold, 1e-4f);
+							return {make_shared<HDRImage>(locallyTonemapped(*img, spec, progress)), nullptr};
+						});
 				});
 
 			window->center();
@@ -480,11 +857,16 @@ Button * createHueSaturationButton(Widget *parent, HDRViewScreen * screen, Image
 			fixedRainbow->setFixedWidth(256);
 			dynamicRainbow->setFixedWidth(256);
 
-			auto cb = [dynamicRainbow]()
+			// preview the adjustment with a baked LUT, and only modify the image on OK
+			HDRImageViewer * viewer = imagesPanel->imageViewer();
+			auto cb = [dynamicRainbow,viewer]()
 			{
 				dynamicRainbow->setHueOffset(hue);
 				dynamicRainbow->setSaturation((saturation + 100.f)/200.f);
 				dynamicRainbow->setLightness((lightness + 100.f)/200.f);
+
+				float h = hue, s = (saturation+100.f)/100.f, l = lightness/100.f;
+				previewColorEdit(viewer, [h,s,l](const Color3 & c) {return c.HSLAdjust(h, s, l);});
 			};
 
 			createFloatBoxAndSlider(gui, window,
@@ -511,9 +893,12 @@ Button * createHueSaturationButton(Widget *parent, HDRViewScreen * screen, Image
 
 			gui->addWidget("", dynamicRainbow);
 
+			auto stopPreview = [viewer]() {viewer->setPreviewLUT(nullptr);};
+
 			addOKCancelButtons(gui, window,
-			                   [&]()
+			                   [&, stopPreview]()
 			                   {
+				                   stopPreview();
 				                   imagesPanel->modifyImage(
 					                   [&](const shared_ptr<const HDRImage> &img) -> ImageCommandResult
 					                   {
@@ -524,7 +909,10 @@ Button * createHueSaturationButton(Widget *parent, HDRViewScreen * screen, Image
 									                   return c.HSLAdjust(hue, (saturation+100.f)/100.f, (lightness)/100.f);
 								                   }).eval()), nullptr};
 					                   });
-			                   });
+			                   },
+			                   stopPreview);
+
+			cb();
 
 			window->center();
 			window->requestFocus();
@@ -767,6 +1155,222 @@ Button * createMedianFilterButton(Widget *parent, HDRViewScreen * screen, ImageL
 	return b;
 }
 
+Button * createAddNoiseButton(Widget *parent, HDRViewScreen * screen, ImageListPanel * imagesPanel)
+{
+	static NoiseSpec noise;
+	static int seed = 0;
+	static string name = "Add noise...";
+	auto b = new Button(parent, name, ENTYPO_ICON_DROP);
+	b->setFixedHeight(21);
+	b->setCallback(
+		[&, screen, imagesPanel]()
+		{
+			FormHelper *gui = new FormHelper(screen);
+			gui->setFixedSize(Vector2i(75, 20));
+
+			auto window = gui->addWindow(Eigen::Vector2i(10, 10), name);
+//           window->setModal(true);    // BUG: this should be set to modal, but doesn't work with comboboxes
+
+			gui->addVariable("Distribution:", noise.distribution, true)
+			   ->setItems(NoiseSpec::distributionNames());
+
+			auto w = gui->addVariable("A:", noise.a);
+			w->setSpinnable(true);
+			w->setValueIncrement(0.1f);
+			w->setTooltip("Uniform: the minimum value. Gaussian: the mean. Poisson: the number of photons per unit intensity.");
+			w = gui->addVariable("B:", noise.b);
+			w->setSpinnable(true);
+			w->setValueIncrement(0.1f);
+			w->setTooltip("Uniform: the maximum value. Gaussian: the standard deviation. Unused for Poisson noise.");
+
+			gui->addVariable("Monochrome:", noise.monochrome, true);
+
+			auto s = gui->addVariable("Seed:", seed);
+			s->setSpinnable(true);
+			s->setMinValue(0);
+			s->setTooltip("The same seed always produces the same noise.");
+
+			addOKCancelButtons(gui, window,
+				[&]()
+				{
+					imagesPanel->modifyImage(
+						[&](const shared_ptr<const HDRImage> & img, AtomicProgress & progress) -> ImageCommandResult
+						{
+							NoiseSpec spec = noise;
+							spec.seed = uint64_t(seed);
+							spec.a = spec.distribution == NoiseSpec::POISSON ? max(spec.a, 1e-3f) : spec.a;
+							return {make_shared<HDRImage>(noisy(*img, spec, 0, progress)),
+							        nullptr};
+						});
+				});
+
+			window->center();
+			window->requestFocus();
+		});
+	return b;
+}
+
+// The images that pass the file filter, which stand in for a selection of images. Shows an error and
+// returns false unless there are at least two of them, and all are loaded.
+bool filteredImages(HDRViewScreen * screen, ImageListPanel * imagesPanel,
+                    vector<shared_ptr<const HDRImage>> & images, vector<string> & names)
+{
+	for (int i = 0; i < imagesPanel->numImages(); ++i)
+	{
+		if (!imagesPanel->nthImageIsVisible(i))
+			continue;
+		auto img = imagesPanel->image(i);
+		if (!img->canModify())
+		{
+			new MessageDialog(screen, MessageDialog::Type::Warning, "Error",
+			                  "Please wait for \"" + img->filename() + "\" to finish loading.");
+			return false;
+		}
+		images.push_back(img->sharedImage());
+		names.push_back(img->filename());
+	}
+	if (images.size() < 2)
+	{
+		new MessageDialog(screen, MessageDialog::Type::Warning, "Error",
+		                  "This requires at least 2 images. Use the file filter to select the images.");
+		return false;
+	}
+	return true;
+}
+
+Button * createMergeExposuresButton(Widget *parent, HDRViewScreen * screen, ImageListPanel * imagesPanel)
+{
+	static string name = "Merge exposures...";
+	static float step = 0.f;
+	static ExposureMergeOptions merge;
+	auto b = new Button(parent, name, ENTYPO_ICON_LAYERS);
+	b->setFixedHeight(21);
+	b->setCallback(
+		[&, screen, imagesPanel]()
+		{
+			FormHelper *gui = new FormHelper(screen);
+			gui->setFixedSize(Vector2i(75, 20));
+
+			auto window = gui->addWindow(Eigen::Vector2i(10, 10), name);
+//           window->setModal(true);    // BUG: this should be set to modal, but doesn't work with comboboxes
+
+			auto w = gui->addVariable("Exposure step:", step);
+			w->setSpinnable(true);
+			w->setValueIncrement(0.5f);
+			w->setMinValue(0.0f);
+			w->setTooltip("The exposure difference in stops between consecutive images, which must be listed from "
+			              "darkest to brightest. If 0, the exposures are estimated from the images.");
+			w = gui->addVariable("Deghosting:", merge.ghostThreshold);
+			w->setSpinnable(true);
+			w->setValueIncrement(0.25f);
+			w->setMinValue(0.0f);
+			w->setTooltip("Down-weight pixels whose radiance differs from that of the middle exposure by more than "
+			              "about this many stops, to remove the ghosts of moving objects. 0 disables deghosting.");
+			gui->addVariable("Recover response:", merge.recoverResponse, true)
+			   ->setTooltip("Recover the camera response from the images instead of treating their values as linear.");
+
+			addOKCancelButtons(gui, window,
+				[&, screen]()
+				{
+					vector<shared_ptr<const HDRImage>> images;
+					vector<string> names;
+					if (!filteredImages(screen, imagesPanel, images, names))
+						return;
+
+					ExposureMergeOptions options = merge;
+					if (step > 0.f)
+						for (size_t i = 0; i < images.size(); ++i)
+							options.exposures.push_back(step * i);
+
+					imagesPanel->newImage("merged exposures",
+						[images,names,options](const shared_ptr<const HDRImage> &, AtomicProgress & progress) -> ImageCommandResult
+						{
+							try
+							{
+								return {make_shared<HDRImage>(mergeExposures(images, names, options, progress)), nullptr};
+							}
+							catch (const exception & e)
+							{
+								spdlog::get("console")->error("Could not merge exposures: {}", e.what());
+								return {nullptr, nullptr};
+							}
+						});
+				});
+
+			window->center();
+			window->requestFocus();
+		});
+	return b;
+}
+
+Button * createFuseExposuresButton(Widget *parent, HDRViewScreen * screen, ImageListPanel * imagesPanel)
+{
+	static string name = "Fuse exposures...";
+	static ExposureFusionSpec spec;
+	// keeps the weights and pyramids of the last fusion, so fusing again after changing the filter is faster
+	static ExposureFusion fusion;
+	auto b = new Button(parent, name, ENTYPO_ICON_DOCUMENTS);
+	b->setFixedHeight(21);
+	b->setCallback(
+		[&, screen, imagesPanel]()
+		{
+			// forget the inputs of the last fusion that no longer exist, e.g. because they were closed
+			fusion.pruneExpired();
+
+			FormHelper *gui = new FormHelper(screen);
+			gui->setFixedSize(Vector2i(75, 20));
+
+			auto window = gui->addWindow(Eigen::Vector2i(10, 10), name);
+//           window->setModal(true);    // BUG: this should be set to modal, but doesn't work with comboboxes
+
+			auto addExponent = [gui](const string & label, float & value, const string & help)
+			{
+				auto w = gui->addVariable(label, value);
+				w->setSpinnable(true);
+				w->setValueIncrement(0.25f);
+				w->setMinValue(0.0f);
+				w->setTooltip(help);
+			};
+			addExponent("Contrast:", spec.contrast, "The exponent of the local contrast in each pixel's weight.");
+			addExponent("Saturation:", spec.saturation, "The exponent of the color saturation in each pixel's weight.");
+			addExponent("Exposedness:", spec.exposedness, "The exponent of the closeness to mid-gray in each pixel's weight.");
+			auto w = gui->addVariable("Sigma:", spec.sigma);
+			w->setSpinnable(true);
+			w->setValueIncrement(0.05f);
+			w->setMinValue(0.01f);
+			w->setTooltip("The tolerance of the closeness to mid-gray, in sRGB-encoded values.");
+
+			addOKCancelButtons(gui, window,
+				[&, screen]()
+				{
+					vector<shared_ptr<const HDRImage>> images;
+					vector<string> names;
+					if (!filteredImages(screen, imagesPanel, images, names))
+						return;
+
+					ExposureFusionSpec options = spec;
+					options.sigma = max(options.sigma, 0.01f);
+					imagesPanel->newImage("fused exposures",
+						[images,options](const shared_ptr<const HDRImage> &, AtomicProgress & progress) -> ImageCommandResult
+						{
+							try
+							{
+								return {make_shared<HDRImage>(fusion.fuse(images, options, progress)), nullptr};
+							}
+							catch (const exception & e)
+							{
+								spdlog::get("console")->error("Could not fuse exposures: {}", e.what());
+								return {nullptr, nullptr};
+							}
+						});
+				});
+
+			window->center();
+			window->requestFocus();
+		});
+	return b;
+}
+
 Button * createResizeButton(Widget *parent, HDRViewScreen * screen, ImageListPanel * imagesPanel)
 {
 	static int width = 128, height = 128;
@@ -878,6 +1482,7 @@ Button * createRemapButton(Widget *parent, HDRViewScreen *screen, ImageListPanel
 	static bool autoAspect = true;
 	static HDRImage::BorderMode borderModeX = HDRImage::EDGE, borderModeY = HDRImage::EDGE;
 	static int samples = 1;
+	static bool filtered = false;
 
 	static float autoAspects[] =
 		{
@@ -885,7 +1490,9 @@ Button * createRemapButton(Widget *parent, HDRViewScreen *screen, ImageListPanel
 			1.f,
 			2.f,
 			2.f,
-			0.75f
+			0.75f,
+			4.f / 3.f,
+			6.f
 		};
 
 	static string name = "Remap...";
@@ -991,6 +1598,17 @@ Button * createRemapButton(Widget *parent, HDRViewScreen *screen, ImageListPanel
 			w = gui->addVariable("Super-samples:", samples);
 			w->setSpinnable(true);
 			w->setMinValue(1);
+			w->setEnabled(!filtered);
+
+			auto filteredCheckbox = gui->addVariable("Anti-aliased:", filtered, true);
+			filteredCheckbox->setTooltip("Adapt the sampling of each pixel to its footprint in the source map, "
+			                             "computed from the derivatives of the mappings, instead of super-sampling.");
+			filteredCheckbox->setCallback(
+				[w](bool f)
+				{
+					filtered = f;
+					w->setEnabled(!filtered);
+				});
 
 			addOKCancelButtons(gui, window,
 				[&]()
@@ -999,11 +1617,17 @@ Button * createRemapButton(Widget *parent, HDRViewScreen *screen, ImageListPanel
 //					auto xyz2src = XYZToEnvMapUV(from);
 //					auto warp = [dst2xyz,xyz2src](const Vector2f &uv) { return xyz2src(dst2xyz(uv)); };
 					auto warp = [](const Vector2f &uv) { return convertEnvMappingUV(from, to, uv); };
+					auto jacobian = [](const Vector2f &uv) { return convertEnvMappingUVJacobian(from, to, uv); };
+					auto batchWarp = [](const UVArray &dstUV, UVArray &srcUV) { batchConvertEnvMappingUV(from, to, dstUV, srcUV); };
 
 					imagesPanel->modifyImage(
-						[&](const shared_ptr<const HDRImage> & img, AtomicProgress & progress) -> ImageCommandResult
+						[warp,jacobian,batchWarp](const shared_ptr<const HDRImage> & img, AtomicProgress & progress) -> ImageCommandResult
 						{
-							return {make_shared<HDRImage>(img->resampled(width, height, progress, warp, samples, sampler,
+							if (filtered)
+								return {make_shared<HDRImage>(img->filteredResampled(width, height, progress, warp, jacobian,
+								                                                    sampler, borderModeX, borderModeY)),
+								        nullptr};
+							return {make_shared<HDRImage>(img->resampled(width, height, progress, batchWarp, samples, sampler,
 							                                            borderModeX, borderModeY)),
 							        nullptr};
 						});
@@ -1649,8 +2273,8 @@ EditImagePanel::EditImagePanel(Widget *parent, HDRViewScreen * screen, ImageList
 				[](const shared_ptr<const HDRImage> & img) -> ImageCommandResult
 				{
 					return {make_shared<HDRImage>(img->rotated90CW()),
-					        make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { *img2 = img2->rotated90CCW(); },
-					                                [](shared_ptr<HDRImage> & img2) { *img2 = img2->rotated90CW(); })};
+					        make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { img2 = make_shared<HDRImage>(img2->rotated90CCW()); },
+					                                [](shared_ptr<HDRImage> & img2) { img2 = make_shared<HDRImage>(img2->rotated90CW()); })};
 				});
 		});
 
@@ -1669,8 +2293,8 @@ EditImagePanel::EditImagePanel(Widget *parent, HDRViewScreen * screen, ImageList
 				[](const shared_ptr<const HDRImage> & img) -> ImageCommandResult
 				{
 					return {make_shared<HDRImage>(img->rotated90CCW()),
-					        make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { *img2 = img2->rotated90CW(); },
-					                                [](shared_ptr<HDRImage> & img2) { *img2 = img2->rotated90CCW(); })};
+					        make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { img2 = make_shared<HDRImage>(img2->rotated90CW()); },
+					                                [](shared_ptr<HDRImage> & img2) { img2 = make_shared<HDRImage>(img2->rotated90CCW()); })};
 				});
 		});
 
@@ -1707,7 +2331,7 @@ EditImagePanel::EditImagePanel(Widget *parent, HDRViewScreen * screen, ImageList
 				[](const shared_ptr<const HDRImage> & img) -> ImageCommandResult
 				{
 					return {make_shared<HDRImage>(img->inverted()),
-					        make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { *img2 = img2->inverted(); })};
+					        make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { img2 = make_shared<HDRImage>(img2->inverted()); })};
 				});
 		});
 	agrid->setAnchor(m_filterButtons.back(), AdvancedGridLayout::Anchor(0, agrid->rowCount()-1));
@@ -1739,6 +2363,11 @@ EditImagePanel::EditImagePanel(Widget *parent, HDRViewScreen * screen, ImageList
 	agrid->appendRow(0);
 	agrid->setAnchor(m_filterButtons.back(), AdvancedGridLayout::Anchor(0, agrid->rowCount()-1, 3, 1));
 
+	agrid->appendRow(spacing);  // spacing
+	m_filterButtons.push_back(createWhiteBalanceButton(buttonRow, m_screen, m_imagesPanel));
+	agrid->appendRow(0);
+	agrid->setAnchor(m_filterButtons.back(), AdvancedGridLayout::Anchor(0, agrid->rowCount()-1, 3, 1));
+
 	agrid->appendRow(spacing);  // spacing
 	m_filterButtons.push_back(createBrightnessContrastButton(buttonRow, m_screen, m_imagesPanel));
 	agrid->appendRow(0);
@@ -1749,6 +2378,11 @@ EditImagePanel::EditImagePanel(Widget *parent, HDRViewScreen * screen, ImageList
 	agrid->appendRow(0);
 	agrid->setAnchor(m_filterButtons.back(), AdvancedGridLayout::Anchor(0, agrid->rowCount()-1, 3, 1));
 
+	agrid->appendRow(spacing);  // spacing
+	m_filterButtons.push_back(createLocalTonemappingButton(buttonRow, m_screen, m_imagesPanel));
+	agrid->appendRow(0);
+	agrid->setAnchor(m_filterButtons.back(), AdvancedGridLayout::Anchor(0, agrid->rowCount()-1, 3, 1));
+
 	agrid->appendRow(spacing);  // spacing
 	m_filterButtons.push_back(createHueSaturationButton(buttonRow, m_screen, m_imagesPanel));
 	agrid->appendRow(0);
@@ -1759,6 +2393,11 @@ EditImagePanel::EditImagePanel(Widget *parent, HDRViewScreen * screen, ImageList
 	agrid->appendRow(0);
 	agrid->setAnchor(m_filterButtons.back(), AdvancedGridLayout::Anchor(0, agrid->rowCount()-1, 3, 1));
 
+	agrid->appendRow(spacing);  // spacing
+	m_filterButtons.push_back(createColorLUTButton(buttonRow, m_screen, m_imagesPanel));
+	agrid->appendRow(0);
+	agrid->setAnchor(m_filterButtons.back(), AdvancedGridLayout::Anchor(0, agrid->rowCount()-1, 3, 1));
+
 	new Label(this, "Filters", "sans-bold");
 	buttonRow = new Widget(this);
 	buttonRow->setLayout(new GridLayout(Orientation::Horizontal, 1, Alignment::Fill, 0, spacing));
@@ -1767,6 +2406,13 @@ EditImagePanel::EditImagePanel(Widget *parent, HDRViewScreen * screen, ImageList
 	m_filterButtons.push_back(createBilateralFilterButton(buttonRow, m_screen, m_imagesPanel));
 	m_filterButtons.push_back(createUnsharpMaskFilterButton(buttonRow, m_screen, m_imagesPanel));
 	m_filterButtons.push_back(createMedianFilterButton(buttonRow, m_screen, m_imagesPanel));
+	m_filterButtons.push_back(createAddNoiseButton(buttonRow, m_screen, m_imagesPanel));
+
+	new Label(this, "Multiple images", "sans-bold");
+	buttonRow = new Widget(this);
+	buttonRow->setLayout(new GridLayout(Orientation::Horizontal, 1, Alignment::Fill, 0, spacing));
+	m_filterButtons.push_back(createMergeExposuresButton(buttonRow, m_screen, m_imagesPanel));
+	m_filterButtons.push_back(createFuseExposuresButton(buttonRow, m_screen, m_imagesPanel));
 }
 
 
@@ -6,11 +6,198 @@
 
 #include "Common.h"
 #include "EnvMap.h"
+#include "FastMath.h"            // for fastSinCos, fastAtan2, fastAcos, FASTMATH_DISPATCH
+#include <stdexcept>             // for invalid_argument
 
 using namespace Eigen;
 using std::vector;
 using std::string;
 
+namespace
+{
+
+// Jacobian of a radially symmetric mapping xyz = (s(r) X, -s(r) Y, c(r)), where XY = 2 UV - 1
+// and r = |XY|, given s(r), t = s'(r)/r and q = c'(r)/r
+Matrix<float,3,2> radialToXYZJacobian(const Vector2f & XY, float s, float t, float q)
+{
+    Matrix<float,3,2> J;
+    J <<  s + t*XY(0)*XY(0),   t*XY(0)*XY(1),
+         -t*XY(0)*XY(1),     -(s + t*XY(1)*XY(1)),
+          q*XY(0),             q*XY(1);
+    return 2*J;
+}
+
+// Jacobian of the inverse radial mapping U = (1 + h x)/2, V = (1 - h y)/2, where h = g(z)/rho
+// and rho = |(x,y)|, given h and dhdz = g'(z)/rho
+Matrix<float,2,3> radialFromXYZJacobian(const Vector3f & xyz, float h, float dhdz)
+{
+    float rho2 = xyz(0)*xyz(0) + xyz(1)*xyz(1);
+    float dhdx = -h*xyz(0)/rho2, dhdy = -h*xyz(1)/rho2;
+
+    Matrix<float,2,3> J;
+    J <<   h + xyz(0)*dhdx,     xyz(0)*dhdy,       xyz(0)*dhdz,
+         -(xyz(1)*dhdx),      -(h + xyz(1)*dhdy), -(xyz(1)*dhdz);
+    return 0.5f*J;
+}
+
+// Jacobian of the longitude, U = (1.5 pi - atan2(z,x))/(2 pi), shared by the lat-long and cylindrical maps
+Matrix<float,1,3> longitudeFromXYZJacobian(const Vector3f & xyz)
+{
+    float rho2 = xyz(0)*xyz(0) + xyz(2)*xyz(2);
+    return Matrix<float,1,3>(xyz(2), 0.f, -xyz(0)) / float(2*M_PI*rho2);
+}
+
+// A cube map layout: the cell of each face in a grid of cols x rows faces, and the directions that
+// right and down in the image point to on it. The faces are in the order +x, -x, +y, -y, +z, -z,
+// and the direction at face coordinates (s,t) in [-1,1]^2 is normal + s right + t down.
+struct CubeLayout
+{
+    int cols, rows;
+    int col[6], row[6];
+    float right[6][3], down[6][3];
+
+    // the face drawn in a cell of the grid. Cells without a face, to the sides of a vertical cross,
+    // are treated as part of the face in the same column and the row of +z, clamped to its edge
+    int faceAt(int c, int r) const
+    {
+        int equatorFace = 4;
+        for (int f = 0; f < 6; ++f)
+            if (col[f] == c && row[f] == r)
+                return f;
+            else if (col[f] == c && row[f] == row[4])
+                equatorFace = f;
+        return equatorFace;
+    }
+};
+
+const CubeLayout VERTICAL_CROSS =
+{
+    3, 4,
+    {2, 0, 1, 1, 1, 1},
+    {1, 1, 0, 2, 1, 3},
+    {{0,0,-1}, {0,0,1}, {1,0,0}, {1,0,0}, {1,0,0}, {1,0,0}},
+    {{0,-1,0}, {0,-1,0}, {0,0,1}, {0,0,-1}, {0,-1,0}, {0,1,0}}
+};
+
+const CubeLayout HORIZONTAL_CROSS =
+{
+    4, 3,
+    {2, 0, 1, 1, 1, 3},
+    {1, 1, 0, 2, 1, 1},
+    {{0,0,-1}, {0,0,1}, {1,0,0}, {1,0,0}, {1,0,0}, {-1,0,0}},
+    {{0,-1,0}, {0,-1,0}, {0,0,1}, {0,0,-1}, {0,-1,0}, {0,-1,0}}
+};
+
+// the faces of the horizontal cross, side by side
+const CubeLayout STRIP =
+{
+    6, 1,
+    {0, 1, 2, 3, 4, 5},
+    {0, 0, 0, 0, 0, 0},
+    {{0,0,-1}, {0,0,1}, {1,0,0}, {1,0,0}, {1,0,0}, {-1,0,0}},
+    {{0,-1,0}, {0,-1,0}, {0,0,1}, {0,0,-1}, {0,-1,0}, {0,-1,0}}
+};
+
+const CubeLayout & cubeLayout(EEnvMappingUVMode mode)
+{
+    return mode == CUBE_MAP_STRIP ? STRIP : mode == CUBE_MAP_HORIZONTAL_CROSS ? HORIZONTAL_CROSS : VERTICAL_CROSS;
+}
+
+Vector3f faceNormal(int f)
+{
+    Vector3f n = Vector3f::Zero();
+    n(f / 2) = (f & 1) ? -1.f : 1.f;
+    return n;
+}
+
+// the face of the cube that xyz points to, and its coordinate along that face's axis
+int cubeFace(const Vector3f & xyz, float & l)
+{
+    // ties go to x, then y
+    int axis = 0;
+    l = std::fabs(xyz(0));
+    if (std::fabs(xyz(1)) > l)
+    {
+        axis = 1;
+        l = std::fabs(xyz(1));
+    }
+    if (std::fabs(xyz(2)) > l)
+    {
+        axis = 2;
+        l = std::fabs(xyz(2));
+    }
+    return 2 * axis + (xyz(axis) > 0 ? 0 : 1);
+}
+
+// the face, and its coordinates s and t, at UV. t is clamped in cells without a face.
+int cubeFaceAt(const CubeLayout & layout, const Vector2f & UV, float & s, float & t, bool & clamped)
+{
+    float fu = UV(0) * layout.cols, fv = UV(1) * layout.rows;
+    int r = clamp(int(std::floor(fv)), 0, layout.rows - 1);
+    int f = layout.faceAt(clamp(int(std::floor(fu)), 0, layout.cols - 1), r);
+
+    s = 2 * (fu - layout.col[f]) - 1;
+    t = 2 * (fv - layout.row[f]) - 1;
+    clamped = r != layout.row[f];
+    if (clamped)
+        t = clamp(t, -1.f, 1.f);
+    return f;
+}
+
+Vector3f cubeLayoutToXYZ(const CubeLayout & layout, const Vector2f & UV)
+{
+    float s, t;
+    bool clamped;
+    int f = cubeFaceAt(layout, UV, s, t, clamped);
+    return (faceNormal(f) + s * Map<const Vector3f>(layout.right[f]) + t * Map<const Vector3f>(layout.down[f])).normalized();
+}
+
+Matrix<float,3,2> cubeLayoutToXYZJacobian(const CubeLayout & layout, const Vector2f & UV)
+{
+    float s, t;
+    bool clamped;
+    int f = cubeFaceAt(layout, UV, s, t, clamped);
+
+    // the derivatives of the unnormalized direction p, whose length is 1/|n|_inf since p has unit
+    // infinity norm. The derivative of n = p/|p| is then (I - n n^T) dp / |p|
+    Matrix<float,3,2> dP;
+    dP.col(0) = 2.f * layout.cols * Map<const Vector3f>(layout.right[f]);
+    dP.col(1) = clamped ? Vector3f::Zero() : Vector3f(2.f * layout.rows * Map<const Vector3f>(layout.down[f]));
+
+    Vector3f n = cubeLayoutToXYZ(layout, UV);
+    float invLength = n.cwiseAbs().maxCoeff();
+    return (Matrix3f::Identity() - n * n.transpose()) * dP * invLength;
+}
+
+Vector2f XYZToCubeLayout(const CubeLayout & layout, const Vector3f & xyz)
+{
+    float l;
+    int f = cubeFace(xyz, l);
+    Vector3f temp = xyz / l;
+    float s = temp.dot(Map<const Vector3f>(layout.right[f]));
+    float t = temp.dot(Map<const Vector3f>(layout.down[f]));
+    return Vector2f((layout.col[f] + 0.5f * (s + 1)) / layout.cols,
+                    (layout.row[f] + 0.5f * (t + 1)) / layout.rows);
+}
+
+Matrix<float,2,3> XYZToCubeLayoutJacobian(const CubeLayout & layout, const Vector3f & xyz)
+{
+    float l;
+    int f = cubeFace(xyz, l);
+    int axis = f / 2;
+
+    // U and V are linear in temp = xyz/l, where l = |xyz(axis)|
+    Matrix<float,2,3> A;
+    A.row(0) = Map<const Vector3f>(layout.right[f]).transpose() / (2.f * layout.cols);
+    A.row(1) = Map<const Vector3f>(layout.down[f]).transpose() / (2.f * layout.rows);
+
+    Matrix3f dTemp = Matrix3f::Identity() / l;
+    dTemp.col(axis) -= xyz * (sign(xyz(axis)) / (l*l));
+    return A * dTemp;
+}
+
+} // namespace
+
 Vector2f convertEnvMappingUV(EEnvMappingUVMode dst, EEnvMappingUVMode src, const Vector2f & srcUV)
 {
     Vector2f uv;
@@ -27,12 +214,18 @@ Vector2f convertEnvMappingUV(EEnvMappingUVMode dst, EEnvMappingUVMode src, const
         case LAT_LONG:
             xyz = latLongToXYZ(srcUV);
             break;
-	    case CYLINDRICAL:
-		    xyz = cylindricalToXYZ(srcUV);
-		    break;
+        case CYLINDRICAL:
+            xyz = cylindricalToXYZ(srcUV);
+            break;
         case CUBE_MAP:
             xyz = cubeMapToXYZ(srcUV);
             break;
+        case CUBE_MAP_HORIZONTAL_CROSS:
+            xyz = horizontalCrossToXYZ(srcUV);
+            break;
+        case CUBE_MAP_STRIP:
+            xyz = cubeStripToXYZ(srcUV);
+            break;
     }
 
     switch (dst)
@@ -46,18 +239,31 @@ Vector2f convertEnvMappingUV(EEnvMappingUVMode dst, EEnvMappingUVMode src, const
         case LAT_LONG:
             uv = XYZToLatLong(xyz);
             break;
-	    case CYLINDRICAL:
-		    uv = XYZToCylindrical(xyz);
-		    break;
+        case CYLINDRICAL:
+            uv = XYZToCylindrical(xyz);
+            break;
         case CUBE_MAP:
             uv = XYZToCubeMap(xyz);
             break;
+        case CUBE_MAP_HORIZONTAL_CROSS:
+            uv = XYZToHorizontalCross(xyz);
+            break;
+        case CUBE_MAP_STRIP:
+            uv = XYZToCubeStrip(xyz);
+            break;
     }
 
     return uv;
 }
 
 
+Matrix2f convertEnvMappingUVJacobian(EEnvMappingUVMode dst, EEnvMappingUVMode src, const Vector2f & srcUV)
+{
+    Vector3f xyz = envMapUVToXYZ(src)(srcUV);
+    return XYZToEnvMapUVJacobian(dst)(xyz) * envMapUVToXYZJacobian(src)(srcUV);
+}
+
+
 const vector<string> & envMappingNames()
 {
     static const vector<string> names =
@@ -66,7 +272,9 @@ const vector<string> & envMappingNames()
             "Mirror ball",
             "Longitude-latitude",
             "Cylindrical",
-            "Cube map"
+            "Cube map (vertical cross)",
+            "Cube map (horizontal cross)",
+            "Cube map (6-face strip)"
         };
     return names;
 }
@@ -81,10 +289,39 @@ UV2XYZFn * envMapUVToXYZ(EEnvMappingUVMode mode)
             return mirrorBallToXYZ;
         case LAT_LONG:
             return latLongToXYZ;
-	    case CYLINDRICAL:
-		    return cylindricalToXYZ;
+        case CYLINDRICAL:
+            return cylindricalToXYZ;
         case CUBE_MAP:
             return cubeMapToXYZ;
+        case CUBE_MAP_HORIZONTAL_CROSS:
+            return horizontalCrossToXYZ;
+        case CUBE_MAP_STRIP:
+            return cubeStripToXYZ;
+        default:
+            throw std::invalid_argument("Unknown environment map mapping.");
+    }
+}
+
+UV2XYZJacobianFn * envMapUVToXYZJacobian(EEnvMappingUVMode mode)
+{
+    switch (mode)
+    {
+        case ANGULAR_MAP:
+            return angularMapToXYZJacobian;
+        case MIRROR_BALL:
+            return mirrorBallToXYZJacobian;
+        case LAT_LONG:
+            return latLongToXYZJacobian;
+        case CYLINDRICAL:
+            return cylindricalToXYZJacobian;
+        case CUBE_MAP:
+            return cubeMapToXYZJacobian;
+        case CUBE_MAP_HORIZONTAL_CROSS:
+            return horizontalCrossToXYZJacobian;
+        case CUBE_MAP_STRIP:
+            return cubeStripToXYZJacobian;
+        default:
+            throw std::invalid_argument("Unknown environment map mapping.");
     }
 }
 
@@ -98,10 +335,39 @@ XYZ2UVFn * XYZToEnvMapUV(EEnvMappingUVMode mode)
             return XYZToMirrorBall;
         case LAT_LONG:
             return XYZToLatLong;
-	    case CYLINDRICAL:
-		    return XYZToCylindrical;
+        case CYLINDRICAL:
+            return XYZToCylindrical;
         case CUBE_MAP:
             return XYZToCubeMap;
+        case CUBE_MAP_HORIZONTAL_CROSS:
+            return XYZToHorizontalCross;
+        case CUBE_MAP_STRIP:
+            return XYZToCubeStrip;
+        default:
+            throw std::invalid_argument("Unknown environment map mapping.");
+    }
+}
+
+XYZ2UVJacobianFn * XYZToEnvMapUVJacobian(EEnvMappingUVMode mode)
+{
+    switch (mode)
+    {
+        case ANGULAR_MAP:
+            return XYZToAngularMapJacobian;
+        case MIRROR_BALL:
+            return XYZToMirrorBallJacobian;
+        case LAT_LONG:
+            return XYZToLatLongJacobian;
+        case CYLINDRICAL:
+            return XYZToCylindricalJacobian;
+        case CUBE_MAP:
+            return XYZToCubeMapJacobian;
+        case CUBE_MAP_HORIZONTAL_CROSS:
+            return XYZToHorizontalCrossJacobian;
+        case CUBE_MAP_STRIP:
+            return XYZToCubeStripJacobian;
+        default:
+            throw std::invalid_argument("Unknown environment map mapping.");
     }
 }
 
@@ -166,52 +432,104 @@ Vector3f cylindricalToXYZ(const Vector2f& UV)
 
 Vector3f cubeMapToXYZ(const Vector2f& UV)
 {
-    // This is assuming that the Cubemap is a vertical cross
-    Vector3f xyz;
-    float k, j;
+    return cubeLayoutToXYZ(VERTICAL_CROSS, UV);
+}
 
-    if (clamp(UV(0), (1.0f/3.0f), (2.0f/3.0f)) == UV(0))
-    {
-        j = clamp(UV(0), (1.0f/3.0f), (2.0f/3.0f));
-        xyz(0) = (UV(0) - 0.5f) * 6.0f;
-        if (clamp(UV(1), 0.0f, 0.25f) == UV(1))
-        {
-            xyz(1) = 1;
-            xyz(2) = (UV(1) - 0.125f) * 8.0f;
-        }
-        else if (clamp(UV(1), 0.25f, 0.5f) == UV(1))
-        {
-            xyz(1) = (0.375f - UV(1)) * 8.0f;
-            xyz(2) = 1;
-        }
-        else if (clamp(UV(1), 0.5f, 0.75f) == UV(1))
-        {
-            xyz(1) = -1;
-            xyz(2) = (0.625f - UV(1)) * 8.0f;
-        }
-        else
-        {
-            xyz(1) = (UV(1) - 0.875f) * 8.0f;
-            xyz(2) = -1;
-        }
-    }
-    else if (clamp(UV(0), 0.0f, (1.0f/3.0f)) == UV(0))
+Vector3f horizontalCrossToXYZ(const Vector2f& UV)
+{
+    return cubeLayoutToXYZ(HORIZONTAL_CROSS, UV);
+}
+
+Vector3f cubeStripToXYZ(const Vector2f& UV)
+{
+    return cubeLayoutToXYZ(STRIP, UV);
+}
+
+
+Matrix<float,3,2> angularMapToXYZJacobian(const Vector2f& UV)
+{
+    Vector2f XY = 2*UV - Vector2f::Ones();
+    float r = XY.norm();
+
+    // everything beyond the unit circle is clamped to the -z pole
+    if (r >= 1.f)
+        return Matrix<float,3,2>::Zero();
+
+    // s = sin(pi r)/r, with Taylor expansions of s and s'(r)/r around the center
+    float s, t;
+    if (r < 1e-3f)
     {
-        xyz(0) = -1;
-        k = clamp(UV(1), 0.25f, 0.5f);
-        j = clamp(UV(0), 0.0f, (1.0f/3.0f));
-        xyz(1) = (0.375f - k) * 8.0f;
-        xyz(2) = (j - (1.0f/6.0f)) * 6.0f;
+        s = M_PI * (1.f - (M_PI*M_PI*r*r) / 6.f);
+        t = -M_PI*M_PI*M_PI / 3.f;
     }
     else
     {
-        xyz(0) = 1;
-        k = clamp(UV(1), 0.25f, 0.5f);
-        j = clamp(UV(0), (2.0f/3.0f), 1.0f);
-        xyz(1) = (0.375f - k) * 8.0f;
-        xyz(2) = ((5.0f/6.0f) - j) * 6.0f;
+        s = std::sin(M_PI*r) / r;
+        t = (M_PI*std::cos(M_PI*r) - s) / (r*r);
     }
-    return xyz.normalized();
+    return radialToXYZJacobian(XY, s, t, -M_PI*s);
+}
+
+Matrix<float,3,2> mirrorBallToXYZJacobian(const Vector2f& UV)
+{
+    Vector2f XY = 2*UV - Vector2f::Ones();
+    float r = XY.norm();
+
+    // everything beyond the unit circle is clamped to the -z pole
+    if (r >= 1.f)
+        return Matrix<float,3,2>::Zero();
+
+    // sin(phi) = 2 r sqrt(1-r^2) and cos(phi) = 1 - 2 r^2
+    float c = std::sqrt(1.f - r*r);
+    return radialToXYZJacobian(XY, 2*c, -2/c, -4.f);
+}
+
+Matrix<float,3,2> latLongToXYZJacobian(const Vector2f& UV)
+{
+    float theta = lerp<float>(1.5f*M_PI, -M_PI_2, UV(0));
+    float phi   = UV(1)*M_PI;
+
+    float sinPhi = std::sin(phi), cosPhi = std::cos(phi);
+    float sinTheta = std::sin(theta), cosTheta = std::cos(theta);
+
+    // dtheta/du = -2 pi and dphi/dv = pi
+    Matrix<float,3,2> J;
+    J << 2*M_PI*sinPhi*sinTheta,  M_PI*cosPhi*cosTheta,
+         0.f,                    -M_PI*sinPhi,
+        -2*M_PI*sinPhi*cosTheta,  M_PI*cosPhi*sinTheta;
+    return J;
+}
+
+Matrix<float,3,2> cylindricalToXYZJacobian(const Vector2f& UV)
+{
+    float theta  = lerp<float>(1.5f*M_PI, -M_PI_2, UV(0));
+    float cosPhi = lerp<float>(1.f, -1.f, UV(1));
+
+    float sinPhi = std::sqrt(1.f-cosPhi*cosPhi);
+    float sinTheta = std::sin(theta), cosTheta = std::cos(theta);
+
+    // dtheta/du = -2 pi, dcosPhi/dv = -2, and so dsinPhi/dv = 2 cosPhi/sinPhi
+    float dSinPhi = 2*cosPhi/sinPhi;
+    Matrix<float,3,2> J;
+    J << 2*M_PI*sinPhi*sinTheta, dSinPhi*cosTheta,
+         0.f,                    -2.f,
+        -2*M_PI*sinPhi*cosTheta, dSinPhi*sinTheta;
+    return J;
+}
+
+Matrix<float,3,2> cubeMapToXYZJacobian(const Vector2f& UV)
+{
+    return cubeLayoutToXYZJacobian(VERTICAL_CROSS, UV);
+}
+
+Matrix<float,3,2> horizontalCrossToXYZJacobian(const Vector2f& UV)
+{
+    return cubeLayoutToXYZJacobian(HORIZONTAL_CROSS, UV);
+}
+
+Matrix<float,3,2> cubeStripToXYZJacobian(const Vector2f& UV)
+{
+    return cubeLayoutToXYZJacobian(STRIP, UV);
 }
 
 ////////////////////////////////
@@ -262,59 +580,328 @@ Vector2f XYZToCylindrical(const Vector3f& xyz)
 
 Vector2f XYZToCubeMap(const Vector3f& xyz)
 {
-    // Again, the CubeMap is a vertical cross
-    float U, V;
-    float l;            // infinite-norm of xyz
-    int flg;            // Marker of which window we're in
-    Vector3f temp;
-
-    // Make sure that the infinite norm of xyz == 1;
-    // flg determines which side we're looking at.
-    l = fabs(xyz(0));
-    flg = (int)sign(xyz(0));
-    if (fabs(xyz(1)) > l)
+    return XYZToCubeLayout(VERTICAL_CROSS, xyz);
+}
+
+Vector2f XYZToHorizontalCross(const Vector3f& xyz)
+{
+    return XYZToCubeLayout(HORIZONTAL_CROSS, xyz);
+}
+
+Vector2f XYZToCubeStrip(const Vector3f& xyz)
+{
+    return XYZToCubeLayout(STRIP, xyz);
+}
+
+
+Matrix<float,2,3> XYZToAngularMapJacobian(const Vector3f& xyz)
+{
+    // around the +z pole, phi/pi ~ rho/pi, so h = (phi/pi)/rho is constant to first order
+    float rho = std::sqrt(xyz(0)*xyz(0) + xyz(1)*xyz(1));
+    if (rho < 1e-6f && xyz(2) > 0)
+        return radialFromXYZJacobian(xyz, float(M_1_PI), 0.f);
+
+    float z = clamp(xyz(2), -1.f, 1.f);
+    float h = float(std::acos(z) / M_PI) / rho;
+    float dhdz = -1.f / float(M_PI*std::sqrt(1.f - z*z)*rho);
+    return radialFromXYZJacobian(xyz, h, dhdz);
+}
+
+Matrix<float,2,3> XYZToMirrorBallJacobian(const Vector3f& xyz)
+{
+    // around the +z pole, sin(phi/2) ~ rho/2, so h = sin(phi/2)/rho is constant to first order
+    float rho = std::sqrt(xyz(0)*xyz(0) + xyz(1)*xyz(1));
+    if (rho < 1e-6f && xyz(2) > 0)
+        return radialFromXYZJacobian(xyz, 0.5f, 0.f);
+
+    // sin(phi/2) = sqrt((1-z)/2)
+    float g = std::sqrt(std::max(0.f, 0.5f*(1.f - xyz(2))));
+    return radialFromXYZJacobian(xyz, g/rho, -1.f / (4*g*rho));
+}
+
+Matrix<float,2,3> XYZToLatLongJacobian(const Vector3f& xyz)
+{
+    float y = clamp(xyz(1), -1.f, 1.f);
+    Matrix<float,2,3> J;
+    J.row(0) = longitudeFromXYZJacobian(xyz);
+    J.row(1) << 0.f, -1.f / float(M_PI*std::sqrt(1.f - y*y)), 0.f;
+    return J;
+}
+
+Matrix<float,2,3> XYZToCylindricalJacobian(const Vector3f& xyz)
+{
+    Matrix<float,2,3> J;
+    J.row(0) = longitudeFromXYZJacobian(xyz);
+    J.row(1) << 0.f, -0.5f, 0.f;
+    return J;
+}
+
+Matrix<float,2,3> XYZToCubeMapJacobian(const Vector3f& xyz)
+{
+    return XYZToCubeLayoutJacobian(VERTICAL_CROSS, xyz);
+}
+
+Matrix<float,2,3> XYZToHorizontalCrossJacobian(const Vector3f& xyz)
+{
+    return XYZToCubeLayoutJacobian(HORIZONTAL_CROSS, xyz);
+}
+
+Matrix<float,2,3> XYZToCubeStripJacobian(const Vector3f& xyz)
+{
+    return XYZToCubeLayoutJacobian(STRIP, xyz);
+}
+
+////////////////////////////////
+// Batch conversions. Each loop is free of branches, so that it can be vectorized.
+
+namespace
+{
+
+const float TWO_PI = 6.28318531f;
+
+FASTMATH_DISPATCH void batchAngularMapToXYZ(const float * u, const float * v, float * x, float * y, float * z, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        float X = 2 * u[i] - 1, Y = 2 * v[i] - 1;
+        float r = std::sqrt(X * X + Y * Y);
+        float sinPhi, cosPhi;
+        fastSinCos(float(M_PI) * (r < 1.f ? r : 1.f), sinPhi, cosPhi);
+        // sinPhi times cos(theta) and sin(theta), which are X/r and Y/r, or 1 and 0 at the center
+        float k = r > 0.f ? sinPhi / r : 0.f;
+        x[i] = k * X;
+        y[i] = -k * Y;
+        z[i] = cosPhi;
+    }
+}
+
+FASTMATH_DISPATCH void batchMirrorBallToXYZ(const float * u, const float * v, float * x, float * y, float * z, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        // 1 - r^2 cancels near the rim, so it is computed in double, where the squares are exact
+        double X = 2.0 * u[i] - 1, Y = 2.0 * v[i] - 1;
+        double r2 = X * X + Y * Y;
+        r2 = r2 < 1.0 ? r2 : 1.0;
+        // sin(phi) = 2 r sqrt(1 - r^2) divided by r as above, which is 0 beyond the unit circle
+        float k = 2 * std::sqrt(float(1 - r2));
+        x[i] = k * float(X);
+        y[i] = -k * float(Y);
+        z[i] = float(1 - 2 * r2);
+    }
+}
+
+FASTMATH_DISPATCH void batchLatLongToXYZ(const float * u, const float * v, float * x, float * y, float * z, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
     {
-        l = fabs(xyz(1));
-        flg = (int)sign(xyz(1)) * 2;
+        float sinTheta, cosTheta, sinPhi, cosPhi;
+        fastSinCos(float(1.5 * M_PI) - TWO_PI * u[i], sinTheta, cosTheta);
+        fastSinCos(float(M_PI) * v[i], sinPhi, cosPhi);
+        x[i] = sinPhi * cosTheta;
+        y[i] = cosPhi;
+        z[i] = sinPhi * sinTheta;
     }
-    if (fabs(xyz(2)) > l)
+}
+
+FASTMATH_DISPATCH void batchCylindricalToXYZ(const float * u, const float * v, float * x, float * y, float * z, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
     {
-        l = fabs(xyz(2));
-        flg = (int)sign(xyz(2)) * 3;
+        float sinTheta, cosTheta;
+        fastSinCos(float(1.5 * M_PI) - TWO_PI * u[i], sinTheta, cosTheta);
+        float cosPhi = 1 - 2 * v[i];
+        // 1 - cosPhi^2 factored so that it does not cancel near the poles
+        float sin2Phi = 4 * v[i] * (1 - v[i]);
+        float sinPhi = std::sqrt(sin2Phi > 0.f ? sin2Phi : 0.f);
+        x[i] = sinPhi * cosTheta;
+        y[i] = cosPhi;
+        z[i] = sinPhi * sinTheta;
     }
-    l = 1 / l;
-    temp = l * xyz;
+}
 
-    if (flg == 3)
+FASTMATH_DISPATCH void batchCubeLayoutToXYZ(const CubeLayout & faces, const float * u, const float * v,
+                                            float * x, float * y, float * z, size_t n)
+{
+    // a local copy, which the stores to x, y and z cannot alias, so the loop does not reload it
+    const CubeLayout layout = faces;
+
+    // the face of each cell, and whether t is clamped on it
+    int cellFace[24];
+    int cellClamped[24];
+    for (int r = 0; r < layout.rows; ++r)
+        for (int c = 0; c < layout.cols; ++c)
+        {
+            int f = layout.faceAt(c, r);
+            cellFace[r * layout.cols + c] = f;
+            cellClamped[r * layout.cols + c] = r != layout.row[f];
+        }
+
+    float normal[6][3] = {{1,0,0}, {-1,0,0}, {0,1,0}, {0,-1,0}, {0,0,1}, {0,0,-1}};
+    for (size_t i = 0; i < n; ++i)
     {
-        U = temp(0) / 6.0f + 0.5f;
-        V = -temp(1) / 8.0f + 0.375f;
+        float fu = u[i] * layout.cols, fv = v[i] * layout.rows;
+        // truncation, unlike floor, is vectorized without SSE4.1, and only differs for negative values,
+        // which are clamped to 0 anyway
+        int c = int(fu), r = int(fv);
+        c = c < 0 ? 0 : (c < layout.cols ? c : layout.cols - 1);
+        r = r < 0 ? 0 : (r < layout.rows ? r : layout.rows - 1);
+        int cell = r * layout.cols + c;
+        int f = cellFace[cell];
+
+        float s = 2 * (fu - layout.col[f]) - 1;
+        float t = 2 * (fv - layout.row[f]) - 1;
+        float tc = t < -1.f ? -1.f : (t < 1.f ? t : 1.f);
+        t = cellClamped[cell] ? tc : t;
+
+        float px = normal[f][0] + s * layout.right[f][0] + t * layout.down[f][0];
+        float py = normal[f][1] + s * layout.right[f][1] + t * layout.down[f][1];
+        float pz = normal[f][2] + s * layout.right[f][2] + t * layout.down[f][2];
+        float k = 1.f / std::sqrt(px * px + py * py + pz * pz);
+        x[i] = k * px;
+        y[i] = k * py;
+        z[i] = k * pz;
     }
-    else if (flg == -1)
+}
+
+// U = (1 + h x)/2, V = (1 - h y)/2 for the radial maps, where h is the radius in the map divided by |(x,y)|
+FASTMATH_DISPATCH void batchXYZToAngularMap(const float * x, const float * y, const float * z, float * u, float * v, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
     {
-        U = temp(2) / 6.0f + (1.0f/6.0f);   // stupid type promotion oddity
-        V = -temp(1) / 8.0f + 0.375f;       // with Viz Studio so this explicit
-    }                                       // float notation crap has to be done.
-    else if (flg == 1)
+        float rho = std::sqrt(x[i] * x[i] + y[i] * y[i]);
+        float radius = fastAcos(z[i]) * float(M_1_PI);
+        // at the poles, theta = atan2(0, 0) = 0 as in XYZToAngularMap
+        float cosTheta = rho > 0.f ? x[i] / rho : 1.f;
+        float sinTheta = rho > 0.f ? y[i] / rho : 0.f;
+        u[i] = 0.5f * (radius * cosTheta + 1);
+        v[i] = 0.5f * (1 - radius * sinTheta);
+    }
+}
+
+FASTMATH_DISPATCH void batchXYZToMirrorBall(const float * x, const float * y, const float * z, float * u, float * v, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
     {
-        U = -temp(2) / 6.0f + (5.0f/6.0f);  // I actually had a 180-degree out of
-        V = -temp(1) / 8.0f + 0.375f;       // phase thing going w/o the explicit
-    }                                       // float notation and parenthesis.
-    else if (flg == 2)
+        float rho = std::sqrt(x[i] * x[i] + y[i] * y[i]);
+        // sin(phi/2) = sqrt((1 - z)/2)
+        float radius2 = 0.5f * (1 - z[i]);
+        float radius = std::sqrt(radius2 > 0.f ? radius2 : 0.f);
+        float cosTheta = rho > 0.f ? x[i] / rho : 1.f;
+        float sinTheta = rho > 0.f ? y[i] / rho : 0.f;
+        u[i] = 0.5f * (radius * cosTheta + 1);
+        v[i] = 0.5f * (1 - radius * sinTheta);
+    }
+}
+
+// the longitude shared by the lat-long and cylindrical maps, wrapped to [0,1)
+inline float longitude(float x, float z)
+{
+    // U is in [1/4, 5/4], so a select wraps it without floor, which needs SSE4.1 to vectorize
+    float U = 0.75f - fastAtan2(z, x) * float(0.5 * M_1_PI);
+    return U < 1.f ? U : U - 1.f;
+}
+
+FASTMATH_DISPATCH void batchXYZToLatLong(const float * x, const float * y, const float * z, float * u, float * v, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
     {
-        U = temp(0) / 6.0f + 0.5f;
-        V = temp(2) / 8.0f + 0.125f;
+        u[i] = longitude(x[i], z[i]);
+        v[i] = fastAcos(y[i]) * float(M_1_PI);
     }
-    else if (flg == -2)
+}
+
+FASTMATH_DISPATCH void batchXYZToCylindrical(const float * x, const float * y, const float * z, float * u, float * v, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
     {
-        U = temp(0) / 6.0f + 0.5f;
-        V = -temp(2) / 8.0f + 0.625f;
+        u[i] = longitude(x[i], z[i]);
+        v[i] = 0.5f * (1 - y[i]);
     }
-    else
+}
+
+FASTMATH_DISPATCH void batchXYZToCubeLayout(const CubeLayout & faces, const float * x, const float * y, const float * z,
+                                            float * u, float * v, size_t n)
+{
+    // a local copy, as in batchCubeLayoutToXYZ
+    const CubeLayout layout = faces;
+
+    for (size_t i = 0; i < n; ++i)
     {
-        U = temp(0) / 6.0f + 0.5f;
-        V = temp(1) / 8.0f + 0.875f;
+        // pick the face like cubeFace
+        float ax = std::fabs(x[i]), ay = std::fabs(y[i]), az = std::fabs(z[i]);
+        bool yMajor = ay > ax;
+        float l = yMajor ? ay : ax;
+        bool zMajor = az > l;
+        l = zMajor ? az : l;
+        float a = zMajor ? z[i] : (yMajor ? y[i] : x[i]);
+        int f = 2 * (zMajor ? 2 : int(yMajor)) + (a > 0.f ? 0 : 1);
+
+        float k = 1.f / l;
+        float tx = k * x[i], ty = k * y[i], tz = k * z[i];
+        float s = tx * layout.right[f][0] + ty * layout.right[f][1] + tz * layout.right[f][2];
+        float t = tx * layout.down[f][0] + ty * layout.down[f][1] + tz * layout.down[f][2];
+        u[i] = (layout.col[f] + 0.5f * (s + 1)) / layout.cols;
+        v[i] = (layout.row[f] + 0.5f * (t + 1)) / layout.rows;
     }
+}
+
+} // namespace
+
+
+void batchEnvMapUVToXYZ(EEnvMappingUVMode mode, const UVArray & uv, XYZArray & xyz)
+{
+    size_t n = uv.rows();
+    xyz.resize(uv.rows(), 3);
+    const float * u = uv.col(0).data(), * v = uv.col(1).data();
+    float * x = xyz.col(0).data(), * y = xyz.col(1).data(), * z = xyz.col(2).data();
 
-    return Vector2f(U, V);
+    switch (mode)
+    {
+        case ANGULAR_MAP:
+            return batchAngularMapToXYZ(u, v, x, y, z, n);
+        case MIRROR_BALL:
+            return batchMirrorBallToXYZ(u, v, x, y, z, n);
+        case LAT_LONG:
+            return batchLatLongToXYZ(u, v, x, y, z, n);
+        case CYLINDRICAL:
+            return batchCylindricalToXYZ(u, v, x, y, z, n);
+        case CUBE_MAP:
+        case CUBE_MAP_HORIZONTAL_CROSS:
+        case CUBE_MAP_STRIP:
+            return batchCubeLayoutToXYZ(cubeLayout(mode), u, v, x, y, z, n);
+    }
+    throw std::invalid_argument("Unknown environment map mapping.");
+}
+
+void batchXYZToEnvMapUV(EEnvMappingUVMode mode, const XYZArray & xyz, UVArray & uv)
+{
+    size_t n = xyz.rows();
+    uv.resize(xyz.rows(), 2);
+    const float * x = xyz.col(0).data(), * y = xyz.col(1).data(), * z = xyz.col(2).data();
+    float * u = uv.col(0).data(), * v = uv.col(1).data();
+
+    switch (mode)
+    {
+        case ANGULAR_MAP:
+            return batchXYZToAngularMap(x, y, z, u, v, n);
+        case MIRROR_BALL:
+            return batchXYZToMirrorBall(x, y, z, u, v, n);
+        case LAT_LONG:
+            return batchXYZToLatLong(x, y, z, u, v, n);
+        case CYLINDRICAL:
+            return batchXYZToCylindrical(x, y, z, u, v, n);
+        case CUBE_MAP:
+        case CUBE_MAP_HORIZONTAL_CROSS:
+        case CUBE_MAP_STRIP:
+            return batchXYZToCubeLayout(cubeLayout(mode), x, y, z, u, v, n);
+    }
+    throw std::invalid_argument("Unknown environment map mapping.");
+}
+
+void batchConvertEnvMappingUV(EEnvMappingUVMode dst, EEnvMappingUVMode src, const UVArray & srcUV, UVArray & dstUV)
+{
+    XYZArray xyz;
+    batchEnvMapUVToXYZ(src, srcUV, xyz);
+    batchXYZToEnvMapUV(dst, xyz, dstUV);
 }
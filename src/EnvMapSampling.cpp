@@ -0,0 +1,383 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "EnvMapSampling.h"
+#include <algorithm>             // for min, max, upper_bound, fill
+#include <cmath>                 // for cos, isfinite, nextafter, round
+#include <cstring>               // for memcmp
+#include <fstream>               // for ifstream, ofstream
+#include <limits>                // for numeric_limits
+#include <stdexcept>             // for runtime_error
+#include "Common.h"              // for clamp
+#include "ParallelFor.h"         // for parallel_for
+#include "Timer.h"               // for Timer
+#include "Trace.h"               // for TraceZone, traceImageId
+#include <spdlog/spdlog.h>
+
+using namespace std;
+using namespace Eigen;
+
+// local functions
+namespace
+{
+
+// Sidecar files hold, in native byte order:
+//   char[8]      MAGIC
+//   uint32       VERSION
+//   int32        width, height
+//   float        integral
+//   float        marginal CDF[height + 1]
+//   AliasEntry   marginal alias table[height], each a float threshold, float probability and uint32 alias
+//   float        conditional CDFs[height][width + 1]
+//   AliasEntry   conditional alias tables[height][width]
+const char MAGIC[8] = {'H', 'D', 'R', 'E', 'N', 'V', 'I', 'S'};
+const uint32_t VERSION = 1;
+
+using AliasEntry = EnvMapDistribution::AliasEntry;
+
+// the largest float below 1, which keeps the relative positions in cells below 1
+const float ONE_MINUS_EPSILON = 1.f - numeric_limits<float>::epsilon() / 2;
+
+// the cell of coordinate u in [0,1] on a grid of n cells, computed in double precision so that it
+// agrees with cellCoordinate()
+int cellIndex(float u, int n)
+{
+	return clamp(int(double(u) * n), 0, n - 1);
+}
+
+// The coordinate at relative position offset in cell i of n. Dividing by n in float can round the
+// coordinate of a position near the edge of a cell into its neighbor, which may have zero
+// probability, so the result is moved to the nearest float that cellIndex() maps back to cell i.
+float cellCoordinate(int i, float offset, int n)
+{
+	float u = float((i + double(offset)) / n);
+	if (cellIndex(u, n) > i)
+		u = nextafter(u, 0.f);
+	else if (cellIndex(u, n) < i)
+		u = nextafter(u, 1.f);
+	return u;
+}
+
+// the size of the header, before the tables
+const size_t HEADER_BYTES = sizeof(MAGIC) + sizeof(uint32_t) + 2 * sizeof(int32_t) + sizeof(float);
+
+size_t tableBytes(int w, int h)
+{
+	return (size_t(h) + 1) * sizeof(float) + size_t(h) * sizeof(AliasEntry) +
+	       size_t(h) * (size_t(w) + 1) * sizeof(float) + size_t(h) * w * sizeof(AliasEntry);
+}
+
+template <typename T>
+void writeValue(ofstream & out, const T & value)
+{
+	out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+void readValue(ifstream & in, T & value)
+{
+	in.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+template <typename T>
+void writeArray(ofstream & out, const vector<T> & values)
+{
+	out.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+}
+
+template <typename T>
+void readArray(ifstream & in, vector<T> & values, size_t size)
+{
+	values.resize(size);
+	in.read(reinterpret_cast<char *>(values.data()), size * sizeof(T));
+}
+
+// the solid angle of row y of a lat-long map with h rows
+double rowSolidAngle(int y, int h)
+{
+	return 2 * M_PI * (cos(M_PI * y / h) - cos(M_PI * (y + 1) / h));
+}
+
+// The average luminance of the image over each of the w cells of row y of a w x h grid, which is
+// no finer than the image. Negative and non-finite values count as zero.
+void cellLuminances(const HDRImage & image, int w, int h, int y, double * cells)
+{
+	int iw = image.width(), ih = image.height();
+	int y0 = int(int64_t(y) * ih / h), y1 = int(int64_t(y + 1) * ih / h);
+	for (int x = 0; x < w; ++x)
+	{
+		int x0 = int(int64_t(x) * iw / w), x1 = int(int64_t(x + 1) * iw / w);
+		double sum = 0.0;
+		for (int sy = y0; sy < y1; ++sy)
+			for (int sx = x0; sx < x1; ++sx)
+			{
+				float l = image(sx, sy).luminance();
+				if (l > 0.f && isfinite(l))
+					sum += l;
+			}
+		cells[x] = sum / ((y1 - y0) * (x1 - x0));
+	}
+}
+
+// Fill the n+1 entries of cdf with the running sum of the n weights, divided by their sum total
+void buildCDF(const double * weights, int n, double total, float * cdf)
+{
+	double sum = 0.0;
+	cdf[0] = 0.f;
+	for (int i = 0; i < n; ++i)
+	{
+		sum += weights[i];
+		cdf[i + 1] = float(sum / total);
+	}
+	cdf[n] = 1.f;
+}
+
+// Build the alias table of the n weights, whose sum total is positive, with Vose's algorithm:
+// each cell whose probability is below average is topped up by a cell above average, which
+// then takes its place in the list of cells below or above average. The other arguments are
+// scratch space.
+void buildAliasTable(const double * weights, int n, double total, AliasEntry * table,
+                     vector<double> & scaled, vector<uint32_t> & small, vector<uint32_t> & large)
+{
+	scaled.resize(n);
+	small.clear();
+	large.clear();
+	for (int i = 0; i < n; ++i)
+	{
+		double p = weights[i] / total;
+		table[i].probability = float(p);
+		scaled[i] = p * n;
+		(scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+	}
+
+	while (!small.empty() && !large.empty())
+	{
+		uint32_t s = small.back(), l = large.back();
+		small.pop_back();
+		table[s].threshold = float(scaled[s]);
+		table[s].alias = l;
+
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+
+	// the cells left in either list are full, up to rounding errors
+	for (uint32_t i : small)
+	{
+		table[i].threshold = 1.f;
+		table[i].alias = i;
+	}
+	for (uint32_t i : large)
+	{
+		table[i].threshold = 1.f;
+		table[i].alias = i;
+	}
+}
+
+// Find the cell of the n-cell CDF that contains xi, and the relative position of xi in it
+int invertCDF(const float * cdf, int n, float xi, float & offset)
+{
+	xi = min(xi, ONE_MINUS_EPSILON);
+	int i = clamp(int(upper_bound(cdf, cdf + n + 1, xi) - cdf) - 1, 0, n - 1);
+	float width = cdf[i + 1] - cdf[i];
+	offset = width > 0.f ? clamp((xi - cdf[i]) / width, 0.f, ONE_MINUS_EPSILON) : 0.5f;
+	return i;
+}
+
+// Draw a cell of the n-cell alias table with xi, and reuse the rest of xi as the relative position in it
+int sampleAliasTable(const AliasEntry * table, int n, float xi, float & offset)
+{
+	float scaled = xi * n;
+	int i = clamp(int(scaled), 0, n - 1);
+	float u = clamp(scaled - i, 0.f, ONE_MINUS_EPSILON);
+	const AliasEntry & entry = table[i];
+	if (u < entry.threshold)
+	{
+		offset = u / entry.threshold;
+		return i;
+	}
+	offset = min((u - entry.threshold) / (1.f - entry.threshold), ONE_MINUS_EPSILON);
+	return int(entry.alias);
+}
+
+} // namespace
+
+
+EnvMapDistribution::EnvMapDistribution(const HDRImage & image, int maxWidth, AtomicProgress progress)
+{
+	Timer timer;
+	TraceZone zone("EnvMapDistribution", traceImageId(&image), image.size() * sizeof(Color4));
+	if (image.isNull())
+		return;
+
+	int w = maxWidth > 0 ? min(maxWidth, image.width()) : image.width();
+	int h = max(1, int(round(double(image.height()) * w / image.width())));
+	m_width = w;
+	m_height = h;
+
+	// the conditional tables of each row are built from its cells' luminance, and the marginal tables
+	// from the luminance of the rows weighted by their solid angle
+	vector<double> rowWeights(h);
+	m_conditionalCDF.resize(size_t(h) * (w + 1));
+	m_conditionalAlias.resize(size_t(h) * w);
+	progress.setNumSteps(h);
+	parallel_for(0, h, [&](int y)
+	{
+		vector<double> cells(w), scaled;
+		vector<uint32_t> small, large;
+		cellLuminances(image, w, h, y, cells.data());
+
+		double sum = 0.0;
+		for (double c : cells)
+			sum += c;
+		rowWeights[y] = sum / w * rowSolidAngle(y, h);
+
+		// rows without energy are never drawn, unless the whole map is black
+		if (sum <= 0.0)
+		{
+			fill(cells.begin(), cells.end(), 1.0);
+			sum = w;
+		}
+		buildCDF(cells.data(), w, sum, &m_conditionalCDF[size_t(y) * (w + 1)]);
+		buildAliasTable(cells.data(), w, sum, &m_conditionalAlias[size_t(y) * w], scaled, small, large);
+		++progress;
+	});
+
+	double total = 0.0;
+	for (double weight : rowWeights)
+		total += weight;
+	m_integral = float(total);
+	if (total <= 0.0)
+	{
+		// sample the sphere uniformly
+		total = 0.0;
+		for (int y = 0; y < h; ++y)
+			total += (rowWeights[y] = rowSolidAngle(y, h));
+	}
+
+	vector<double> scaled;
+	vector<uint32_t> small, large;
+	m_marginalCDF.resize(h + 1);
+	m_marginalAlias.resize(h);
+	buildCDF(rowWeights.data(), h, total, m_marginalCDF.data());
+	buildAliasTable(rowWeights.data(), h, total, m_marginalAlias.data(), scaled, small, large);
+
+	spdlog::get("console")->debug("Building the {}x{} sampling distribution of a {}x{} environment map took: {} seconds.",
+	                              w, h, image.width(), image.height(), (timer.elapsed()/1000.f));
+}
+
+
+Vector2f EnvMapDistribution::sample(const Vector2f & xi, float * pdf) const
+{
+	float dx, dy;
+	int y = invertCDF(m_marginalCDF.data(), m_height, xi.y(), dy);
+	int x = invertCDF(conditionalCDF(y), m_width, xi.x(), dx);
+	if (pdf)
+		*pdf = cellPDF(x, y);
+	return Vector2f(cellCoordinate(x, dx, m_width), cellCoordinate(y, dy, m_height));
+}
+
+
+Vector2f EnvMapDistribution::sampleAlias(const Vector2f & xi, float * pdf) const
+{
+	float dx, dy;
+	int y = sampleAliasTable(m_marginalAlias.data(), m_height, xi.y(), dy);
+	int x = sampleAliasTable(conditionalAlias(y), m_width, xi.x(), dx);
+	if (pdf)
+		*pdf = cellPDF(x, y);
+	return Vector2f(cellCoordinate(x, dx, m_width), cellCoordinate(y, dy, m_height));
+}
+
+
+float EnvMapDistribution::pdf(const Vector2f & uv) const
+{
+	return cellPDF(cellIndex(uv.x(), m_width), cellIndex(uv.y(), m_height));
+}
+
+
+HDRImage EnvMapDistribution::pdfImage() const
+{
+	HDRImage result(m_width, m_height);
+	parallel_for(0, m_height, [this,&result](int y)
+	{
+		for (int x = 0; x < m_width; ++x)
+			result(x, y) = Color4(Color3(cellPDF(x, y)), 1.f);
+	});
+	return result;
+}
+
+
+void EnvMapDistribution::save(const string & filename) const
+{
+	ofstream out(filename, ios::binary);
+	if (!out)
+		throw runtime_error(fmt::format("Cannot open \"{}\" for writing.", filename));
+
+	out.write(MAGIC, sizeof(MAGIC));
+	writeValue(out, VERSION);
+	writeValue(out, int32_t(m_width));
+	writeValue(out, int32_t(m_height));
+	writeValue(out, m_integral);
+	writeArray(out, m_marginalCDF);
+	writeArray(out, m_marginalAlias);
+	writeArray(out, m_conditionalCDF);
+	writeArray(out, m_conditionalAlias);
+
+	if (!out)
+		throw runtime_error(fmt::format("Error while writing \"{}\".", filename));
+}
+
+
+EnvMapDistribution EnvMapDistribution::load(const string & filename)
+{
+	ifstream in(filename, ios::binary | ios::ate);
+	if (!in)
+		throw runtime_error(fmt::format("Cannot open \"{}\" for reading.", filename));
+	size_t fileSize = size_t(in.tellg());
+	in.seekg(0);
+
+	char magic[sizeof(MAGIC)];
+	uint32_t version = 0;
+	int32_t width = 0, height = 0;
+	EnvMapDistribution d;
+	in.read(magic, sizeof(magic));
+	readValue(in, version);
+	readValue(in, width);
+	readValue(in, height);
+	readValue(in, d.m_integral);
+	if (!in || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+		throw runtime_error(fmt::format("\"{}\" is not an environment map sampling file.", filename));
+	if (version != VERSION)
+		throw runtime_error(fmt::format("Unsupported environment map sampling version {} in \"{}\".", version, filename));
+	// check the size before allocating the tables, so that a corrupt header cannot exhaust the memory
+	if (width <= 0 || height <= 0 || fileSize != HEADER_BYTES + tableBytes(width, height))
+		throw runtime_error(fmt::format("Invalid table size {}x{} in \"{}\".", width, height, filename));
+
+	d.m_width = width;
+	d.m_height = height;
+	readArray(in, d.m_marginalCDF, size_t(height) + 1);
+	readArray(in, d.m_marginalAlias, size_t(height));
+	readArray(in, d.m_conditionalCDF, size_t(height) * (width + 1));
+	readArray(in, d.m_conditionalAlias, size_t(height) * width);
+	if (!in)
+		throw runtime_error(fmt::format("Unexpected end of file while reading \"{}\".", filename));
+
+	auto validAliases = [](const vector<AliasEntry> & table, uint32_t n)
+	{
+		for (auto & entry : table)
+			if (entry.alias >= n)
+				return false;
+		return true;
+	};
+	if (!validAliases(d.m_marginalAlias, uint32_t(height)) || !validAliases(d.m_conditionalAlias, uint32_t(width)))
+		throw runtime_error(fmt::format("Invalid alias table in \"{}\".", filename));
+
+	return d;
+}
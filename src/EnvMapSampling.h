@@ -0,0 +1,118 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <cstdint>               // for uint32_t
+#include <string>                // for string
+#include <vector>                // for vector
+#include <Eigen/Core>            // for Vector2f
+#include "HDRImage.h"            // for HDRImage
+#include "Progress.h"            // for AtomicProgress
+
+
+/*!
+ * @brief Tables for importance sampling the directions of a lat-long environment map.
+ *
+ * Directions are drawn proportionally to the luminance of the map times the solid angle of its
+ * pixels, from a piecewise-constant distribution over a grid of cells in uv space: a row is drawn
+ * from the marginal distribution, and a column from the conditional distribution of that row.
+ * Each of these 1D distributions is kept both as a CDF, which is inverted by binary search and
+ * preserves the stratification of the random numbers, and as a Walker alias table [Walker 1977;
+ * Vose 1991], which draws a cell in constant time.
+ *
+ * The rows are built in parallel, and the tables can be saved to a binary sidecar file so that
+ * renderers load them instead of computing them at scene-load time.
+ */
+class EnvMapDistribution
+{
+public:
+	//! A cell of an alias table, which keeps the cell if a uniform number is below threshold, and draws alias otherwise
+	struct AliasEntry
+	{
+		float threshold;
+		float probability;      ///< The probability of the cell itself, for evaluating the density
+		uint32_t alias;
+	};
+
+	EnvMapDistribution() = default;
+
+	/*!
+	 * @brief Build the distribution of the lat-long map \a image.
+	 *
+	 * If \a maxWidth is positive and smaller than the width of the image, the luminance is first
+	 * box-filtered down to \a maxWidth cells across, keeping the aspect ratio. Negative and
+	 * non-finite values count as zero, and a map without any energy is sampled uniformly over
+	 * the sphere.
+	 */
+	explicit EnvMapDistribution(const HDRImage & image, int maxWidth = 0, AtomicProgress progress = AtomicProgress());
+
+	int width() const           {return m_width;}
+	int height() const          {return m_height;}
+	bool empty() const          {return m_width == 0 || m_height == 0;}
+	//! The integral of the luminance over the sphere, estimated from the cells
+	float integral() const      {return m_integral;}
+
+	//-----------------------------------------------------------------------
+	//@{ \name Tables
+	//-----------------------------------------------------------------------
+	//! The CDF of the rows, with height()+1 entries from 0 to 1
+	const std::vector<float> & marginalCDF() const                  {return m_marginalCDF;}
+	//! The alias table of the rows, with height() entries
+	const std::vector<AliasEntry> & marginalAlias() const           {return m_marginalAlias;}
+	//! The CDF of the columns of row \a y, with width()+1 entries from 0 to 1
+	const float * conditionalCDF(int y) const       {return &m_conditionalCDF[size_t(y) * (m_width + 1)];}
+	//! The alias table of the columns of row \a y, with width() entries
+	const AliasEntry * conditionalAlias(int y) const  {return &m_conditionalAlias[size_t(y) * m_width];}
+	//@}
+
+	//-----------------------------------------------------------------------
+	//@{ \name Sampling
+	//-----------------------------------------------------------------------
+	/*!
+	 * @brief Map the uniform numbers \a xi in [0,1)^2 to uv coordinates by inverting the CDFs.
+	 *
+	 * If \a pdf is not null, it is set to the density of the result, see pdf().
+	 */
+	Eigen::Vector2f sample(const Eigen::Vector2f & xi, float * pdf = nullptr) const;
+
+	//! Like sample(), but draws the cell with the alias tables and places the sample in it with the rest of \a xi
+	Eigen::Vector2f sampleAlias(const Eigen::Vector2f & xi, float * pdf = nullptr) const;
+
+	/*!
+	 * @brief The density of sample() and sampleAlias() at \a uv, with respect to area in uv space.
+	 *
+	 * The density with respect to solid angle is pdf(uv) / (2 pi^2 sin(pi v)).
+	 */
+	float pdf(const Eigen::Vector2f & uv) const;
+
+	//! The density of each cell with respect to area in uv space, in the color channels
+	HDRImage pdfImage() const;
+	//@}
+
+	//-----------------------------------------------------------------------
+	//@{ \name Sidecar files
+	//-----------------------------------------------------------------------
+	//! Write the tables to a binary file. Throws std::runtime_error on failure.
+	void save(const std::string & filename) const;
+
+	//! Read the tables written by save(). Throws std::runtime_error on failure.
+	static EnvMapDistribution load(const std::string & filename);
+	//@}
+
+private:
+	float cellPDF(int x, int y) const
+	{
+		return m_marginalAlias[y].probability * m_height * conditionalAlias(y)[x].probability * m_width;
+	}
+
+	int m_width = 0, m_height = 0;
+	float m_integral = 0.f;
+	std::vector<float> m_marginalCDF;
+	std::vector<AliasEntry> m_marginalAlias;
+	std::vector<float> m_conditionalCDF;            // width+1 entries per row
+	std::vector<AliasEntry> m_conditionalAlias;     // width entries per row
+};
@@ -0,0 +1,226 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "ExposureFusion.h"
+#include <algorithm>             // for min, max, find_if, remove_if
+#include <cmath>                 // for exp, pow, sqrt, fabs
+#include <cstdio>                // for sscanf
+#include <stdexcept>             // for invalid_argument
+#include "Colorspace.h"          // for LinearToSRGB, SRGBToLinear
+#include "Common.h"              // for clamp01
+#include "MemoryAccountant.h"    // for MemoryAccountant
+#include "ParallelFor.h"         // for parallel_for
+#include "Timer.h"               // for Timer
+#include <spdlog/spdlog.h>
+
+using namespace std;
+
+// local functions
+namespace
+{
+
+// Mertens et al. add this to every weight, so that pixels with no good exposure average them all
+const float MIN_WEIGHT = 1e-12f;
+
+// the sRGB-encoded color channels of \a image
+void encodedChannels(const HDRImage & image, Plane channels[3])
+{
+	int w = image.width(), h = image.height();
+	for (int c = 0; c < 3; ++c)
+		channels[c].resize(w, h);
+	parallel_for(0, h, [&image,channels,w](int y)
+	{
+		for (int x = 0; x < w; ++x)
+			for (int c = 0; c < 3; ++c)
+				channels[c](x, y) = LinearToSRGB(clamp01(image(x, y)[c]));
+	});
+}
+
+// the product of the quality measures of each pixel of the encoded \a channels
+Plane fusionWeight(const Plane channels[3], const ExposureFusionSpec & spec)
+{
+	int w = int(channels[0].rows()), h = int(channels[0].cols());
+	Plane gray = (channels[0] + channels[1] + channels[2]) / 3.f;
+	float exposednessScale = -0.5f / (spec.sigma * spec.sigma);
+
+	Plane weight(w, h);
+	parallel_for(0, h, [&,w,h](int y)
+	{
+		int y0 = max(y - 1, 0), y1 = min(y + 1, h - 1);
+		for (int x = 0; x < w; ++x)
+		{
+			int x0 = max(x - 1, 0), x1 = min(x + 1, w - 1);
+			float contrast = fabs(gray(x0, y) + gray(x1, y) + gray(x, y0) + gray(x, y1) - 4.f * gray(x, y));
+
+			float r = channels[0](x, y), g = channels[1](x, y), b = channels[2](x, y);
+			float mean = (r + g + b) / 3.f;
+			float saturation = sqrt(((r - mean) * (r - mean) + (g - mean) * (g - mean) + (b - mean) * (b - mean)) / 3.f);
+
+			float d2 = (r - 0.5f) * (r - 0.5f) + (g - 0.5f) * (g - 0.5f) + (b - 0.5f) * (b - 0.5f);
+			float exposedness = exp(exposednessScale * d2);
+
+			weight(x, y) = pow(contrast, spec.contrast) * pow(saturation, spec.saturation) *
+			               pow(exposedness, spec.exposedness) + MIN_WEIGHT;
+		}
+	});
+	return weight;
+}
+
+} // namespace
+
+
+ExposureFusionSpec ExposureFusionSpec::parse(const string & spec)
+{
+	ExposureFusionSpec s;
+	char c;
+	int n = sscanf(spec.c_str(), "%f,%f,%f,%f%c", &s.contrast, &s.saturation, &s.exposedness, &s.sigma, &c);
+	if (n != 3 && n != 4)
+		throw invalid_argument("Cannot parse the exposure fusion weights \"" + spec + "\".");
+	if (s.contrast < 0.f || s.saturation < 0.f || s.exposedness < 0.f || s.sigma <= 0.f)
+		throw invalid_argument("The exposure fusion exponents must not be negative, and sigma must be positive.");
+	return s;
+}
+
+string ExposureFusionSpec::description() const
+{
+	return fmt::format("contrast^{:g} * saturation^{:g} * exposedness^{:g} (sigma={:g})",
+	                   contrast, saturation, exposedness, sigma);
+}
+
+
+HDRImage ExposureFusion::fuse(const vector<shared_ptr<const HDRImage>> & images, const ExposureFusionSpec & spec,
+                              AtomicProgress progress)
+{
+	auto console = spdlog::get("console");
+	int n = int(images.size());
+	if (n < 2)
+		throw invalid_argument("Exposure fusion requires at least 2 images.");
+	int w = images[0]->width(), h = images[0]->height();
+	for (auto & image : images)
+		if (image->width() != w || image->height() != h)
+			throw invalid_argument(fmt::format("Cannot fuse images of size {}x{} and {}x{}.",
+			                                   w, h, image->width(), image->height()));
+
+	lock_guard<mutex> lock(m_mutex);
+	Timer timer;
+	int numLevels = fullPyramidLevels(w, h);
+
+	// reuse the inputs of the previous fusion, and drop those that are not fused again
+	vector<Input> inputs(n);
+	int numComputed = 0, numReweighted = 0;
+	for (int k = 0; k < n; ++k)
+	{
+		auto cached = find_if(m_inputs.begin(), m_inputs.end(),
+		                      [&](const Input & in) {return in.image.lock() == images[k];});
+		if (cached != m_inputs.end() && int(cached->weight.rows()) == w && int(cached->weight.cols()) == h)
+			inputs[k] = move(*cached);
+		inputs[k].image = images[k];
+	}
+	m_inputs.clear();
+
+	progress.setNumSteps(2 * n + 1);
+	for (auto & in : inputs)
+	{
+		if (!in.pyramids[0].empty() && in.spec == spec)
+		{
+			++progress;
+			continue;
+		}
+
+		auto image = in.image.lock();
+		Plane channels[3];
+		encodedChannels(*image, channels);
+		in.weight = fusionWeight(channels, spec);
+		in.spec = spec;
+		if (in.pyramids[0].empty())
+		{
+			for (int c = 0; c < 3; ++c)
+				in.pyramids[c] = laplacianPyramid(channels[c], numLevels);
+			++numComputed;
+		}
+		else
+			++numReweighted;
+		++progress;
+	}
+
+	// blend the pyramids with the Gaussian pyramids of the normalized weights
+	Plane total = Plane::Zero(w, h);
+	for (auto & in : inputs)
+		total += in.weight;
+
+	vector<Plane> blended[3];
+	for (int c = 0; c < 3; ++c)
+		for (auto & level : inputs[0].pyramids[c])
+			blended[c].push_back(Plane::Zero(level.rows(), level.cols()));
+
+	for (auto & in : inputs)
+	{
+		vector<Plane> weights = gaussianPyramid(in.weight / total, numLevels);
+		for (int l = 0; l < numLevels; ++l)
+		{
+			const Plane & weight = weights[l];
+			parallel_for(0, int(weight.cols()), [&,l](int y)
+			{
+				for (int c = 0; c < 3; ++c)
+					blended[c][l].col(y) += weight.col(y) * in.pyramids[c][l].col(y);
+			});
+		}
+		++progress;
+	}
+
+	Plane channels[3];
+	for (int c = 0; c < 3; ++c)
+		channels[c] = collapsedPyramid(blended[c]);
+
+	HDRImage result(w, h);
+	parallel_for(0, h, [&](int y)
+	{
+		for (int x = 0; x < w; ++x)
+			result(x, y) = Color4(SRGBToLinear(clamp01(channels[0](x, y))),
+			                      SRGBToLinear(clamp01(channels[1](x, y))),
+			                      SRGBToLinear(clamp01(channels[2](x, y))), 1.f);
+	});
+	++progress;
+
+	m_inputs = move(inputs);
+	updateMemoryUsage();
+	console->debug("Fusing {} exposures ({} new, {} reweighted) took: {} seconds.",
+	               n, numComputed, numReweighted, (timer.elapsed() / 1000.f));
+	return result;
+}
+
+ExposureFusion::~ExposureFusion()
+{
+	MemoryAccountant::global().remove(this);
+}
+
+void ExposureFusion::clear()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_inputs.clear();
+	updateMemoryUsage();
+}
+
+void ExposureFusion::pruneExpired()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_inputs.erase(remove_if(m_inputs.begin(), m_inputs.end(), [](const Input & in) {return in.image.expired();}),
+	               m_inputs.end());
+	updateMemoryUsage();
+}
+
+void ExposureFusion::updateMemoryUsage() const
+{
+	size_t total = 0;
+	for (auto & in : m_inputs)
+	{
+		total += in.weight.size() * sizeof(float);
+		for (auto & pyramid : in.pyramids)
+			for (auto & level : pyramid)
+				total += level.size() * sizeof(float);
+	}
+	MemoryAccountant::global().set(this, MemoryAccountant::CACHE, total);
+}
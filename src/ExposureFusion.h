@@ -0,0 +1,91 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <memory>                // for shared_ptr, weak_ptr
+#include <mutex>                 // for mutex
+#include <string>                // for string
+#include <vector>                // for vector
+#include "HDRImage.h"            // for HDRImage
+#include "Progress.h"            // for AtomicProgress
+#include "Pyramid.h"             // for Plane
+
+
+//! The exponents of the quality measures that weight each pixel in exposure fusion
+struct ExposureFusionSpec
+{
+	float contrast = 1.f;       ///< The exponent of the magnitude of the Laplacian of the gray values
+	float saturation = 1.f;     ///< The exponent of the standard deviation of the color channels
+	float exposedness = 1.f;    ///< The exponent of the closeness of the channels to mid-gray
+	float sigma = 0.2f;         ///< The standard deviation of the Gaussian that measures the closeness to mid-gray
+
+	/*!
+	 * @brief Parse the exponents "C,S,E", optionally followed by ",SIGMA".
+	 *
+	 * Throws std::invalid_argument if the specification cannot be parsed.
+	 */
+	static ExposureFusionSpec parse(const std::string & spec);
+
+	std::string description() const;
+
+	bool operator==(const ExposureFusionSpec & other) const
+	{
+		return contrast == other.contrast && saturation == other.saturation &&
+		       exposedness == other.exposedness && sigma == other.sigma;
+	}
+	bool operator!=(const ExposureFusionSpec & other) const {return !(*this == other);}
+};
+
+
+/*!
+ * @brief Fuses bracketed exposures directly into a display-referred image [Mertens et al. 2007].
+ *
+ * The sRGB-encoded inputs are blended level by level in a Laplacian pyramid, with each pixel
+ * weighted by its contrast, saturation and well-exposedness; the result is decoded back to linear
+ * values in [0,1].
+ *
+ * The weights and the Laplacian pyramids of the inputs of the previous fusion are kept, so fusing
+ * again after adding or removing an input only computes those of the new inputs, and changing
+ * the spec only recomputes the weights. The inputs are recognized by their pixels' address, so
+ * an input that is modified must be passed as a new image. The cache is shared by concurrent
+ * calls, which are serialized, and its memory is reported to MemoryAccountant::global().
+ */
+class ExposureFusion
+{
+public:
+	ExposureFusion() = default;
+	~ExposureFusion();
+
+	/*!
+	 * @brief Fuse \a images, which must all have the same size.
+	 *
+	 * Throws std::invalid_argument if there are fewer than two images, or if they differ in size.
+	 */
+	HDRImage fuse(const std::vector<std::shared_ptr<const HDRImage>> & images, const ExposureFusionSpec & spec,
+	              AtomicProgress progress = AtomicProgress());
+
+	//! Drop the cached weights and pyramids
+	void clear();
+
+	//! Drop the cached weights and pyramids of the inputs that no longer exist
+	void pruneExpired();
+
+private:
+	struct Input
+	{
+		std::weak_ptr<const HDRImage> image;
+		ExposureFusionSpec spec;                ///< The spec the weight was computed with
+		Plane weight;
+		std::vector<Plane> pyramids[3];         ///< The Laplacian pyramid of each encoded color channel
+	};
+
+	//! Report the memory held by the cached weights and pyramids, with m_mutex held
+	void updateMemoryUsage() const;
+
+	std::vector<Input> m_inputs;
+	std::mutex m_mutex;
+};
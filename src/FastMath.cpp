@@ -0,0 +1,55 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "FastMath.h"
+#include <algorithm>             // for fill
+
+using namespace std;
+
+#define FASTMATH_SPAN(name)                                         \
+	FASTMATH_DISPATCH void name(const float * in, float * out, size_t n) \
+	{                                                               \
+		for (size_t i = 0; i < n; ++i)                              \
+			out[i] = name(in[i]);                                   \
+	}
+
+FASTMATH_SPAN(fastLog2)
+FASTMATH_SPAN(fastExp2)
+FASTMATH_SPAN(fastLinearToSRGB)
+FASTMATH_SPAN(fastSRGBToLinear)
+FASTMATH_SPAN(fastLinearToAdobeRGB)
+FASTMATH_SPAN(fastAdobeRGBToLinear)
+FASTMATH_SPAN(fastNormalizedLogScale)
+
+#undef FASTMATH_SPAN
+
+FASTMATH_DISPATCH void fastPow(const float * in, float * out, size_t n, float p)
+{
+	if (p == 0.f)
+	{
+		fill(out, out + n, 1.f);
+		return;
+	}
+
+	float atZero = p > 0.f ? 0.f : INFINITY;
+	float atInf = p > 0.f ? INFINITY : 0.f;
+	for (size_t i = 0; i < n; ++i)
+		out[i] = fastmath_detail::powNonzero(in[i], p, atZero, atInf);
+}
+
+const char * fastMathInstructionSet()
+{
+#if FASTMATH_HAS_DISPATCH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return "avx512f";
+	if (__builtin_cpu_supports("avx2"))
+		return "avx2";
+	if (__builtin_cpu_supports("sse4.2"))
+		return "sse4.2";
+#endif
+	return "default";
+}
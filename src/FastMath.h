@@ -0,0 +1,334 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <cmath>                 // for INFINITY, NAN, fabs, sqrt, copysign
+#include <cstddef>               // for size_t
+#include <cstdint>               // for uint32_t, int32_t
+#include <cstring>               // for memcpy
+
+
+//
+// Fast, branch-free replacements for std::log2, std::exp2 and std::pow on floats, and the transfer
+// functions built from them. The scalar versions are inline so that loops calling them can be
+// vectorized; the span versions below are compiled for several instruction sets and pick the best
+// one for the running CPU. The error bounds are the maxima measured against double-precision
+// references over every finite float by "hdrview-bench --accuracy", plus a margin of about 10%.
+// The span versions are compiled without contracting multiplies and adds into FMAs (see
+// CMakeLists.txt), so every instruction set gives the same results; the inline versions are only
+// contracted if the including file targets FMA, which the baseline x86-64 and SSE4.2 do not.
+//
+
+// With GCC or Clang on x86 Linux, FASTMATH_DISPATCH compiles a function for several instruction sets;
+// the loader then binds each call to the best version for the running CPU. Elsewhere the loops are
+// vectorized for the baseline instruction set only.
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__)) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define FASTMATH_DISPATCH __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#define FASTMATH_HAS_DISPATCH 1
+#endif
+#endif
+
+#ifndef FASTMATH_DISPATCH
+#define FASTMATH_DISPATCH
+#endif
+
+namespace fastmath_detail
+{
+
+inline uint32_t asBits(float f)
+{
+	uint32_t i;
+	memcpy(&i, &f, sizeof(f));
+	return i;
+}
+
+inline float asFloat(uint32_t i)
+{
+	float f;
+	memcpy(&f, &i, sizeof(f));
+	return f;
+}
+
+// split log2(x) = e + l for finite x > 0, including denormals, with e an integer and |l| <= 1/2
+inline void log2Parts(float x, float & e, float & l)
+{
+	// scale denormals into the normal range
+	bool denormal = x < 1.17549435e-38f;
+	float s = denormal ? x * 16777216.f : x;
+
+	// s = m * 2^k with m in [sqrt(1/2), sqrt(2)), found by offsetting the bits by those of sqrt(1/2)
+	uint32_t bits = asBits(s);
+	int32_t k = int32_t(bits - 0x3f3504f3u) >> 23;
+	float m = asFloat(bits - (uint32_t(k) << 23));
+	e = float(k - (denormal ? 24 : 0));
+
+	// log2(m) = 2/ln(2) * atanh(t) with t = (m-1)/(m+1), |t| < 0.1716
+	float t = (m - 1.f) / (m + 1.f);
+	float t2 = t * t;
+	float p = 0.11111111f;
+	p = p * t2 + 0.14285715f;
+	p = p * t2 + 0.2f;
+	p = p * t2 + 0.33333334f;
+	l = t * (2.88539004f + 2.88539004f * t2 * p);
+}
+
+// 2^(n + f) for |f| <= 1, where \a shifted holds the integer n in its low mantissa bits (see below)
+inline float exp2Parts(float shifted, float f)
+{
+	// Taylor series of 2^f = e^(f ln2), the truncation error is below 5e-9 for |f| <= 1/2
+	float p = 1.52527338e-5f;
+	p = p * f + 1.54035304e-4f;
+	p = p * f + 1.33335581e-3f;
+	p = p * f + 9.61812911e-3f;
+	p = p * f + 5.55041087e-2f;
+	p = p * f + 2.40226507e-1f;
+	p = p * f + 6.93147181e-1f;
+	p = p * f + 1.f;
+
+	// scale by 2^n in two halves so that denormal results and overflow come out right
+	int32_t n = int32_t(asBits(shifted) - asBits(12582912.f));
+	int32_t n1 = n >> 1;
+	int32_t n2 = n - n1;
+	return p * asFloat(uint32_t(n1 + 127) << 23) * asFloat(uint32_t(n2 + 127) << 23);
+}
+
+// clamp y to the range where 2^y is neither 0 nor inf, mapping NaN to a finite value,
+// and round it to an integer n by adding 1.5 * 2^23, which leaves n in the low mantissa bits
+inline float roundClamped(float y)
+{
+	float c = y > -152.f ? (y < 129.f ? y : 129.f) : -152.f;
+	return c + 12582912.f;
+}
+
+// 2^y for y that is not NaN
+inline float exp2NotNaN(float y)
+{
+	float shifted = roundClamped(y);
+	float f = y - (shifted - 12582912.f);
+	return exp2Parts(shifted, f > -1.f ? (f < 1.f ? f : 1.f) : -1.f);
+}
+
+// the high part of a split p = ph + pl, with only 12 significant bits so that ph * e is exact
+inline float highPart(float p)
+{
+	return asFloat(asBits(p) & 0xfffff000u);
+}
+
+// 2^((ph + pl) (log2(x) + dl)) for ph + pl != 0, where 0 gives \a atZero and inf gives \a atInf.
+// Splitting p keeps the error independent of the size of p log2(x), and lets pl carry the
+// precision of constant exponents beyond that of a float.
+inline float powSplit(float x, float ph, float pl, float dl, float atZero, float atInf)
+{
+	float e, l;
+	log2Parts(x, e, l);
+
+	float hi = ph * e;
+	float lo = pl * e + (ph + pl) * (l + dl);
+
+	float shifted = roundClamped(hi + lo);
+	float f = (hi - (shifted - 12582912.f)) + lo;
+	float r = exp2Parts(shifted, f > -1.f ? (f < 1.f ? f : 1.f) : -1.f);
+
+	r = x == 0.f ? atZero : r;
+	r = x == INFINITY ? atInf : r;
+	return x >= 0.f ? r : NAN;
+}
+
+// x^p for p != 0, where 0^p is \a atZero and inf^p is \a atInf
+inline float powNonzero(float x, float p, float atZero, float atInf)
+{
+	float ph = highPart(p);
+	return powSplit(x, ph, p - ph, 0.f, atZero, atInf);
+}
+
+} // namespace fastmath_detail
+
+//
+// The special cases are handled by selects at the end of each function, rather than inside the
+// helpers above, so that compilers do not turn them into branches around the polynomials.
+//
+
+/*!
+ * @brief log2(x), within 3.3 ulp for x in [1/2, 2] and 1.35 ulp elsewhere.
+ *
+ * Denormals are handled; x == 0 gives -inf, x < 0 and NaN give NaN, and +inf gives +inf.
+ */
+inline float fastLog2(float x)
+{
+	float e, l;
+	fastmath_detail::log2Parts(x, e, l);
+	float r = e + l;
+	r = x == 0.f ? -INFINITY : r;
+	r = x == INFINITY ? INFINITY : r;
+	return x >= 0.f ? r : NAN;
+}
+
+
+//! 2^y, within 1.3 ulp, including denormal results; NaN propagates
+inline float fastExp2(float y)
+{
+	float r = fastmath_detail::exp2NotNaN(y);
+	return y == y ? r : y;
+}
+
+
+/*!
+ * @brief x^p for x >= 0 and finite p, computed as 2^(p log2 x).
+ *
+ * The error is about 1 + |p| ulp (1.65 ulp for p = 1/2.2, 3.7 ulp for p = 2.2) whatever the size of
+ * x^p, including denormal results. x^0 is 1, 0^p and inf^p are 0 or inf depending on the sign of p,
+ * and x < 0 gives NaN.
+ */
+inline float fastPow(float x, float p)
+{
+	return p == 0.f ? 1.f : fastmath_detail::powNonzero(x, p, p > 0.f ? 0.f : INFINITY, p > 0.f ? INFINITY : 0.f);
+}
+
+
+//! sRGB encoding of a linear value, within 5.3 ulp of the exact curve (see LinearToSRGB)
+inline float fastLinearToSRGB(float a)
+{
+	// 1/2.4 split as in fastmath_detail::powSplit
+	float b = 1.055f * fastmath_detail::powSplit(a, 0.416625977f, 4.06901054e-5f, 0.f, 0.f, INFINITY) - 0.055f;
+	return a < 0.0031308f ? 12.92f * a : b;
+}
+
+//! Linear value of an sRGB encoded value, within 4.4 ulp of the exact curve (see SRGBToLinear)
+inline float fastSRGBToLinear(float a)
+{
+	// ((a + 0.055) / 1.055)^2.4, keeping the rounding error of the sum (and of the constant 0.055)
+	// as a correction to its logarithm
+	float s = a + 0.055f;
+	float sa = s - a;
+	float err = (a - (s - sa)) + (0.055f - sa) + 2.98023224e-10f;
+	float dl = err / s * 1.44269504f - 0.0772429989f;
+	float b = fastmath_detail::powSplit(s, 2.39941406f, 5.85937523e-4f, dl, 0.f, INFINITY);
+	// 0.04045f is just below 0.04045, so <= picks the same branch as the exact curve
+	return a <= 0.04045f ? (1.f / 12.92f) * a : b;
+}
+
+//! AdobeRGB encoding of a linear value, within 1.7 ulp of the exact curve (see LinearToAdobeRGB)
+inline float fastLinearToAdobeRGB(float a)
+{
+	return fastmath_detail::powSplit(a, 0.454589844f, 1.17083429e-4f, 0.f, 0.f, INFINITY);
+}
+
+//! Linear value of an AdobeRGB encoded value, within 3.5 ulp of the exact curve (see AdobeRGBToLinear)
+inline float fastAdobeRGBToLinear(float a)
+{
+	// 2.19921875 has few enough bits to be its own high part
+	return fastmath_detail::powSplit(a, 2.19921875f, 0.f, 0.f, 0.f, INFINITY);
+}
+
+//! normalizedLogScale(val) (see Common.h), to within 2e-6 absolute
+inline float fastNormalizedLogScale(float val)
+{
+	// logScale(val) - logScale(0) = ln(1000 |val| + 1), which is divided by its value at val = 1
+	float w = val < 0.f ? -val : val;
+	bool huge = w > 1e30f;
+	float l = (fastLog2(huge ? w : 1000.f * w + 1.f) + (huge ? 9.96578428f : 0.f)) * 0.100328815f;
+	return val > 0.f ? l : (val == val ? -l : val);
+}
+
+
+
+//
+// Trigonometric functions for the direction conversions of environment maps (see EnvMap.h). They
+// are accurate to a few 1e-7 in absolute terms, which is all that angles and directions need.
+//
+
+/*!
+ * @brief sin(x) and cos(x), within 1e-7 absolute for |x| < 1e4.
+ *
+ * The argument is reduced to [-pi/4, pi/4], and the quadrant selects between the
+ * minimax polynomials of Cephes' sinf and cosf.
+ */
+inline void fastSinCos(float x, float & s, float & c)
+{
+	// x - q pi/2 with pi/2 split into three parts, the first two of which have few enough bits to make
+	// their products with q exact. q is rounded to the nearest integer by adding and subtracting
+	// 1.5 * 2^23, which gives the same result as nearbyint for |q| < 2^22 but needs no SSE4.1 to vectorize
+	float q = (x * 0.636619772f + 12582912.f) - 12582912.f;
+	float r = ((x - q * 1.5703125f) - q * 4.83751297e-4f) - q * 7.54978995e-8f;
+	float z = r * r;
+
+	float ps = ((-1.9515296e-4f * z + 8.3321609e-3f) * z - 1.66666546e-1f) * z * r + r;
+	float pc = ((2.44331571e-5f * z - 1.38873163e-3f) * z + 4.16666456e-2f) * z * z - 0.5f * z + 1.f;
+
+	int quadrant = int(q) & 3;
+	float sq = (quadrant & 1) ? pc : ps;
+	float cq = (quadrant & 1) ? ps : pc;
+	s = (quadrant & 2) ? -sq : sq;
+	c = ((quadrant + 1) & 2) ? -cq : cq;
+}
+
+
+/*!
+ * @brief atan2(y, x) in [-pi, pi], within 3.1e-7 absolute.
+ *
+ * The ratio of the smaller to the larger of |x| and |y| is reduced to |t| <= tan(pi/8), where the
+ * minimax polynomial of Cephes' atanf applies. atan2(0, 0) is 0; infinite and NaN arguments are
+ * not handled.
+ */
+inline float fastAtan2(float y, float x)
+{
+	float ax = std::fabs(x), ay = std::fabs(y);
+	float mx = ax > ay ? ax : ay, mn = ax > ay ? ay : ax;
+	float a = mx > 0.f ? mn / mx : 0.f;
+
+	// atan(a) = pi/4 + atan((a-1)/(a+1)) above tan(pi/8)
+	bool reduce = a > 0.414213562f;
+	float t = reduce ? (a - 1.f) / (a + 1.f) : a;
+	float z = t * t;
+	float r = (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * t + t;
+	r = reduce ? r + 0.785398163f : r;
+
+	r = ay > ax ? 1.57079633f - r : r;
+	r = x < 0.f ? 3.14159265f - r : r;
+	return std::copysign(r, y);
+}
+
+
+/*!
+ * @brief acos(x) for x in [-1, 1], within 5e-7 absolute.
+ *
+ * Uses acos(|x|) = sqrt(1 - |x|) P(|x|), with the polynomial P of Abramowitz and Stegun 4.4.45.
+ * Arguments outside [-1, 1] are clamped.
+ */
+inline float fastAcos(float x)
+{
+	float a = std::fabs(x);
+	a = a < 1.f ? a : 1.f;
+	float p = -0.0012624911f;
+	p = p * a + 0.0066700901f;
+	p = p * a - 0.0170881256f;
+	p = p * a + 0.0308918810f;
+	p = p * a - 0.0501743046f;
+	p = p * a + 0.0889789874f;
+	p = p * a - 0.2145988016f;
+	p = p * a + 1.5707963050f;
+	float r = std::sqrt(1.f - a) * p;
+	return x < 0.f ? 3.14159265f - r : r;
+}
+
+
+//
+// Span versions, which apply the function to the \a n values in \a in and write them to \a out.
+// \a in and \a out may be the same array, but must not otherwise overlap.
+//
+void fastLog2(const float * in, float * out, size_t n);
+void fastExp2(const float * in, float * out, size_t n);
+void fastPow(const float * in, float * out, size_t n, float p);
+void fastLinearToSRGB(const float * in, float * out, size_t n);
+void fastSRGBToLinear(const float * in, float * out, size_t n);
+void fastLinearToAdobeRGB(const float * in, float * out, size_t n);
+void fastAdobeRGBToLinear(const float * in, float * out, size_t n);
+void fastNormalizedLogScale(const float * in, float * out, size_t n);
+
+//! The instruction set the span versions use on this CPU, e.g. "avx2"
+const char * fastMathInstructionSet();
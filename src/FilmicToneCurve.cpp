@@ -8,8 +8,43 @@
 // which was released into the public domain through the CC0 Universal license
 
 #include "FilmicToneCurve.h"
+#include <algorithm>             // for min, max
+#include <cmath>                 // for exp2, fabs, log2
+#include "FastMath.h"            // for fastLog2, FASTMATH_DISPATCH
+#include "Timer.h"               // for Timer
 #include <spdlog/spdlog.h>
 
+// local functions
+namespace
+{
+
+// the table sizes tried by FilmicToneCurve::bake, and the number of stops the tables span. The
+// inverse of the default curve needs the largest size to be within 1e-4 (see bake)
+const int MIN_TABLE_SIZE = 1024;
+const int MAX_TABLE_SIZE = 131072;
+const float TABLE_STOPS = 20.f;
+
+inline float evalBaked(float x, const float * table, int size, float xMin, float xMax, float logMin,
+                       float invStep, float slope)
+{
+	float xc = std::min(x, xMax);
+	float t = (fastLog2(xc >= xMin ? xc : xMin) - logMin) * invStep;
+	int i = std::min(int(t), size - 2);
+	float f = t - i;
+	float y = table[i] + f * (table[i + 1] - table[i]);
+	return x >= xMin ? y : (x > 0.f ? x * slope : 0.f);
+}
+
+FASTMATH_DISPATCH void evalBaked(const float * __restrict in, float * __restrict out, size_t n,
+                                 const float * __restrict table, int size, float xMin, float xMax, float logMin,
+                                 float invStep, float slope)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = evalBaked(in[i], table, size, xMin, xMax, logMin, invStep, slope);
+}
+
+} // namespace
+
 float FilmicToneCurve::CurveSegment::eval(float x) const
 {
 	float x0 = (x - offsetX)*scaleX;
@@ -54,6 +89,28 @@ float FilmicToneCurve::FullCurve::evalInv(float y) const
 	return normX*W;
 }
 
+float FilmicToneCurve::BakedCurve::eval(float x) const
+{
+	return evalBaked(x, table.data(), int(table.size()), xMin, xMax, logMin, invStep, slope);
+}
+
+void FilmicToneCurve::BakedCurve::eval(const float * in, float * out, size_t n) const
+{
+	// the kernel does not allow in and out to alias, so work in place through a copy
+	if (in == out)
+	{
+		float tmp[256];
+		for (size_t i0 = 0; i0 < n; i0 += 256)
+		{
+			size_t m = std::min(size_t(256), n - i0);
+			std::copy(in + i0, in + i0 + m, tmp);
+			evalBaked(tmp, out + i0, m, table.data(), int(table.size()), xMin, xMax, logMin, invStep, slope);
+		}
+	}
+	else
+		evalBaked(in, out, n, table.data(), int(table.size()), xMin, xMax, logMin, invStep, slope);
+}
+
 // find a function of the form:
 //   f(x) = e^(lnA + Bln(x))
 // where
@@ -210,8 +267,60 @@ void FilmicToneCurve::createCurve(FullCurve& dstCurve, const CurveParamsDirect&
 
 		dstCurve.m_segments[2].offsetY *= invScale;
 		dstCurve.m_segments[2].scaleY *= invScale;
+
+		// evalInv picks the segments using these
+		dstCurve.y0 *= invScale;
+		dstCurve.y1 *= invScale;
+	}
+
+}
+
+FilmicToneCurve::BakedCurve FilmicToneCurve::bake(const FullCurve& curve, bool inverse, float tolerance)
+{
+	Timer timer;
+	auto f = [&curve,inverse](float x) {return inverse ? curve.evalInv(x) : curve.eval(x);};
+
+	// both the curve and its inverse saturate at the end of the shoulder
+	const CurveSegment & shoulder = curve.m_segments[2];
+	float end = inverse ? shoulder.offsetY : shoulder.offsetX * curve.W;
+
+	BakedCurve baked;
+	for (int size = MIN_TABLE_SIZE; size <= MAX_TABLE_SIZE; size *= 2)
+	{
+		baked.xMax = end;
+		baked.xMin = end * std::exp2(-TABLE_STOPS);
+		baked.logMin = std::log2(baked.xMin);
+		baked.invStep = (size - 1) / TABLE_STOPS;
+		baked.table.resize(size);
+		for (int i = 0; i < size; ++i)
+			baked.table[i] = f(std::exp2(baked.logMin + i / baked.invStep));
+		baked.slope = baked.table[0] / baked.xMin;
+
+		// measure the error in between the entries, and within the linear extension. The inverse
+		// is ill-conditioned where the curve flattens out, so its error is measured after mapping
+		// back through the curve
+		baked.maxError = 0.f;
+		for (int i = -1; i + 1 < size; ++i)
+			for (float frac : {0.25f, 0.5f, 0.75f})
+			{
+				float x = i < 0 ? frac * baked.xMin : std::exp2(baked.logMin + (i + frac) / baked.invStep);
+				float exact = f(x), approx = baked.eval(x);
+				float error = inverse ? std::fabs(curve.eval(approx) - curve.eval(exact))
+				                      : std::fabs(approx - exact) / std::max(1.f, std::fabs(exact));
+				baked.maxError = std::max(baked.maxError, error);
+			}
+
+		if (baked.maxError <= tolerance)
+			break;
 	}
 
+	auto console = spdlog::get("console");
+	console->debug("Baking the {}filmic curve into {} entries took: {} seconds; the largest error is {}.",
+	               inverse ? "inverse " : "", baked.table.size(), (timer.elapsed()/1000.f), baked.maxError);
+	if (baked.maxError > tolerance)
+		console->warn("The baked {}filmic curve is only within {:.3g} of the exact curve, above the tolerance of {:.3g}.",
+		              inverse ? "inverse " : "", baked.maxError, tolerance);
+	return baked;
 }
 
 void FilmicToneCurve::calcDirectParamsFromUser(CurveParamsDirect& dstParams, const CurveParamsUser& srcParams)
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <vector>                // for vector
 #include "Common.h"
 
 class FilmicToneCurve
@@ -124,6 +125,38 @@ public:
 		CurveSegment m_invSegments[3];
 	};
 
+	/*!
+	 * @brief A FullCurve, or its inverse, tabulated over the log2 of its input for fast evaluation.
+	 *
+	 * The table spans the stops below the end of the curve, where it saturates, with linear
+	 * interpolation in between the entries. Below the table the curve is extended linearly to 0,
+	 * above it the curve is constant, and negative inputs and NaNs map to 0.
+	 */
+	struct BakedCurve
+	{
+		float eval(float x) const;
+		//! Evaluate the curve at the \a n values of \a in, using a vectorized kernel
+		void eval(const float * in, float * out, size_t n) const;
+
+		float xMin = 1.f, xMax = 1.f;       ///< The input range of the table
+		float logMin = 0.f, invStep = 1.f;  ///< Map log2 of the input to the table index
+		float slope = 0.f;                  ///< Of the linear extension below xMin
+		std::vector<float> table;
+		float maxError = 0.f;               ///< The largest error in between entries (see bake)
+	};
+
 	static void createCurve(FullCurve& dstCurve, const CurveParamsDirect& srcParams);
+	/*!
+	 * @brief Tabulate \a curve, or its inverse, doubling the size of the table until it is within
+	 * \a tolerance of the exact curve, or reaches the largest size.
+	 *
+	 * The error of the curve is relative to values above 1. The error of the inverse is that of
+	 * its results mapped back through the curve, since the inverse is ill-conditioned where the
+	 * curve flattens out. There, in the last interval of the table, the error is about the
+	 * spacing of the entries, so the inverse of the default curve needs 131072 entries to be
+	 * within 1e-4 (4.9e-5), while the curve itself needs only 1024. The largest error is returned
+	 * in BakedCurve::maxError, and a warning is logged if it exceeds \a tolerance.
+	 */
+	static BakedCurve bake(const FullCurve& curve, bool inverse = false, float tolerance = 1e-4f);
 	static void calcDirectParamsFromUser(CurveParamsDirect& dstParams, const CurveParamsUser& srcParams);
 };
@@ -23,6 +23,7 @@ class MultiGraph;
 class EditImagePanel;
 class HistogramPanel;
 class ImageListPanel;
+class MemoryPanel;
 class Timer;
 template<typename T> class Range;
 
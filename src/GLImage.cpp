@@ -8,7 +8,11 @@
 #include "Common.h"
 #include "Timer.h"
 #include "Colorspace.h"
+#include "FastMath.h"
 #include "ParallelFor.h"
+#include "MemoryAccountant.h"
+#include "Trace.h"
+#include <atomic>
 #include <random>
 #include <nanogui/common.h>
 #include <nanogui/glutil.h>
@@ -20,11 +24,32 @@ using namespace nanogui;
 using namespace Eigen;
 using namespace std;
 
+namespace
+{
+
+// the versions of all images come from a single counter, so that they also tell images apart
+uint64_t nextImageVersion()
+{
+	static atomic<uint64_t> counter(0);
+	return ++counter;
+}
+
+} // namespace
+
+size_t ImageStatistics::bytes() const
+{
+	size_t total = 0;
+	for (auto & h : histogram)
+		total += sizeof(float) * (h.values.size() + h.xTicks.size());
+	return total;
+}
+
 shared_ptr<ImageStatistics> ImageStatistics::computeStatistics(const HDRImage &img, float exposure)
 {
 	static const int numBins = 256;
 	static const int numTicks = 8;
 	float displayMax = pow(2.f, -exposure);
+	TraceZone zone("histogram", traceImageId(&img), img.size() * sizeof(Color4));
 
 	auto ret = make_shared<ImageStatistics>();
 	for (int i = 0; i < ENumAxisScales; ++i)
@@ -39,18 +64,31 @@ shared_ptr<ImageStatistics> ImageStatistics::computeStatistics(const HDRImage &i
 	Color4 gain(pow(2.f, exposure), 1.f);
 	float d = 1.f / (img.width() * img.height());
 
-	for (Eigen::DenseIndex i = 0; i < img.size(); ++i)
-    {
-        Color4 val = gain * img(i);
-        ret->average += val[0] + val[1] + val[2];
-
-        for (int c = 0; c < 3; ++c)
-        {
-	        ret->histogram[ELinear].values(clamp(int(floor(val[c] * numBins)), 0, numBins - 1), c) += d;
-	        ret->histogram[ESRGB].values(clamp(int(floor(LinearToSRGB(val[c]) * numBins)), 0, numBins - 1), c) += d;
-	        ret->histogram[ELog].values(clamp(int(floor(normalizedLogScale(val[c]) * numBins)), 0, numBins - 1), c) += d;
-        }
-    }
+	// map the pixels to the sRGB and log axes a chunk at a time, using the vectorized span functions
+	const Eigen::DenseIndex chunkSize = 4096;
+	vector<float> linear(3 * chunkSize), sRGB(3 * chunkSize), logarithmic(3 * chunkSize);
+	for (Eigen::DenseIndex begin = 0; begin < img.size(); begin += chunkSize)
+	{
+		Eigen::DenseIndex count = std::min(chunkSize, img.size() - begin);
+		for (Eigen::DenseIndex i = 0; i < count; ++i)
+		{
+			Color4 val = gain * img(begin + i);
+			ret->average += val[0] + val[1] + val[2];
+			for (int c = 0; c < 3; ++c)
+				linear[3 * i + c] = val[c];
+		}
+
+		fastLinearToSRGB(linear.data(), sRGB.data(), 3 * count);
+		fastNormalizedLogScale(linear.data(), logarithmic.data(), 3 * count);
+
+		for (Eigen::DenseIndex i = 0; i < count; ++i)
+			for (int c = 0; c < 3; ++c)
+			{
+				ret->histogram[ELinear].values(clamp(int(floor(linear[3 * i + c] * numBins)), 0, numBins - 1), c) += d;
+				ret->histogram[ESRGB].values(clamp(int(floor(sRGB[3 * i + c] * numBins)), 0, numBins - 1), c) += d;
+				ret->histogram[ELog].values(clamp(int(floor(logarithmic[3 * i + c] * numBins)), 0, numBins - 1), c) += d;
+			}
+	}
 
 	ret->average /= 3 * img.width() * img.height();
 
@@ -102,6 +140,7 @@ bool LazyGLTextureLoader::uploadToGPU(const std::shared_ptr<const HDRImage> &img
 	if (!m_dirty && m_texture)
 		return false;
 
+	TraceZone zone("texture upload", traceImageId(img.get()));
 	Timer timer;
 	// Allocate texture memory for the image
 	if (!m_texture)
@@ -115,6 +154,8 @@ bool LazyGLTextureLoader::uploadToGPU(const std::shared_ptr<const HDRImage> &img
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
 		             img->width(), img->height(),
 		             0, GL_RGBA, GL_FLOAT, nullptr);
+		// the unsized GL_RGBA internal format is stored with 8 bits per channel by common drivers
+		m_bytes = size_t(img->width()) * img->height() * 4;
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 //		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -144,6 +185,7 @@ bool LazyGLTextureLoader::uploadToGPU(const std::shared_ptr<const HDRImage> &img
 		                GL_RGBA,			         // format
 		                GL_FLOAT,		             // type
 		                (const GLvoid *) img->data());
+		zone.addBytes(uint64_t(img->width()) * numLines * sizeof(Color4));
 
 		m_nextScanline += maxLines;
 
@@ -163,8 +205,10 @@ bool LazyGLTextureLoader::uploadToGPU(const std::shared_ptr<const HDRImage> &img
 	if (!m_dirty)
 	{
 		spdlog::get("console")->trace("Uploading texture to GPU took {} ms", m_uploadTime);
+		TraceZone mipmapZone("mipmaps", traceImageId(img.get()));
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
 		glGenerateMipmap(GL_TEXTURE_2D);  //Generate num_mipmaps number of mipmaps here.
+		m_bytes = m_bytes * 4 / 3;      // the mipmap chain adds about a third
 		spdlog::get("console")->trace("Generating mipmaps took {} ms", timer.lap());
 	}
 
@@ -175,6 +219,7 @@ bool LazyGLTextureLoader::uploadToGPU(const std::shared_ptr<const HDRImage> &img
 
 GLImage::GLImage() :
     m_image(make_shared<HDRImage>()),
+    m_version(nextImageVersion()),
     m_filename(),
     m_cachedHistogramExposure(NAN),
     m_histogramDirty(true),
@@ -186,7 +231,7 @@ GLImage::GLImage() :
 
 GLImage::~GLImage()
 {
-
+	MemoryAccountant::global().remove(this);
 }
 
 float GLImage::progress() const
@@ -208,7 +253,11 @@ void GLImage::asyncModify(const ImageCommandWithProgress & command)
 	// make sure any pending edits are done
 	waitForAsyncResult();
 
-	m_asyncCommand = make_shared<AsyncTask<ImageCommandResult>>([this,command](AtomicProgress & prog){return command(m_image, prog);});
+	m_asyncCommand = make_shared<AsyncTask<ImageCommandResult>>([this,command](AtomicProgress & prog)
+		{
+			TraceZone zone("command", traceImageId(this));
+			return command(m_image, prog);
+		});
 	m_asyncRetrieved = false;
 	m_asyncCommand->compute();
 }
@@ -218,7 +267,11 @@ void GLImage::asyncModify(const ImageCommand &command)
 	// make sure any pending edits are done
 	waitForAsyncResult();
 
-	m_asyncCommand = make_shared<AsyncTask<ImageCommandResult>>([this,command](void){return command(m_image);});
+	m_asyncCommand = make_shared<AsyncTask<ImageCommandResult>>([this,command](void)
+		{
+			TraceZone zone("command", traceImageId(this));
+			return command(m_image);
+		});
 	m_asyncRetrieved = false;
 	m_asyncCommand->compute();
 }
@@ -230,8 +283,10 @@ bool GLImage::undo()
 
 	if (m_history.undo(m_image))
 	{
+		m_version = nextImageVersion();
 		m_histogramDirty = true;
 		m_texture.setDirty();
+		updateMemoryUsage();
 		return true;
 	}
 	return false;
@@ -244,8 +299,10 @@ bool GLImage::redo()
 
 	if (m_history.redo(m_image))
 	{
+		m_version = nextImageVersion();
 		m_histogramDirty = true;
 		m_texture.setDirty();
+		updateMemoryUsage();
 		return true;
 	}
 	return false;
@@ -273,6 +330,8 @@ bool GLImage::waitForAsyncResult() const
 	if (!m_asyncCommand)
 		return false;
 
+	TraceZone zone("GLImage::waitForAsyncResult", traceImageId(this));
+
 	if (!m_asyncRetrieved)
 	{
 		// now retrieve the result and copy it out of the async task
@@ -289,13 +348,17 @@ bool GLImage::waitForAsyncResult() const
 		}
 		else
 		{
+			TraceZone historyZone("history snapshot", traceImageId(this));
 			m_history.addCommand(result.second);
 			m_image = result.first;
 		}
 
+		if (result.first)
+			m_version = nextImageVersion();
 		m_asyncRetrieved = true;
 		m_histogramDirty = true;
 		m_texture.setDirty();
+		updateMemoryUsage();
 
 		if (!result.first)
 		{
@@ -317,8 +380,23 @@ bool GLImage::waitForAsyncResult() const
 void GLImage::uploadToGPU() const
 {
 	if (m_texture.uploadToGPU(m_image))
+	{
+		updateMemoryUsage();
 		// now that we grabbed the results and uploaded to GPU, destroy the task
 		modifyFinished();
+	}
+}
+
+
+void GLImage::updateMemoryUsage() const
+{
+	auto & accountant = MemoryAccountant::global();
+	accountant.set(this, MemoryAccountant::IMAGE, m_image ? m_image->size() * sizeof(Color4) : 0);
+	accountant.set(this, MemoryAccountant::HISTORY, m_history.bytes());
+	accountant.set(this, MemoryAccountant::TEXTURE, m_texture.bytes());
+
+	accountant.set(this, MemoryAccountant::HISTOGRAM,
+	               m_histograms && m_histograms->ready() ? m_histograms->get()->bytes() : 0);
 }
 
 
@@ -339,7 +417,13 @@ bool GLImage::load(const std::string & filename)
     m_filename = filename;
     m_histogramDirty = true;
 	m_texture.setDirty();
-    return m_image->load(filename);
+    // load into a new image, since the current pixels may be shared, see sharedImage()
+    auto image = make_shared<HDRImage>();
+    bool loaded = image->load(filename);
+    m_image = image;
+    m_version = nextImageVersion();
+    updateMemoryUsage();
+    return loaded;
 }
 
 bool GLImage::save(const std::string & filename,
@@ -6,7 +6,7 @@
 
 #pragma once
 
-#include <cstdint>             // for uint32_t
+#include <cstdint>             // for uint32_t, uint64_t
 #include <Eigen/Core>          // for Vector2i, Matrix4f, Vector3f
 #include <functional>          // for function
 #include <iosfwd>              // for string
@@ -45,6 +45,8 @@ struct ImageStatistics
 
 	Histogram histogram[ENumAxisScales];
 
+	/// The memory held by the histograms
+	size_t bytes() const;
 
 	static std::shared_ptr<ImageStatistics> computeStatistics(const HDRImage &img, float exposure);
 };
@@ -79,11 +81,15 @@ public:
 
 	GLuint textureID() const {return m_texture;}
 
+	//! The estimated GPU memory used by the texture, including its mipmaps once they are generated
+	size_t bytes() const {return m_bytes;}
+
 private:
 	GLuint m_texture = 0;
 	int m_nextScanline = -1;
 	bool m_dirty = false;
 	double m_uploadTime = 0.0;
+	size_t m_bytes = 0;
 };
 
 /*!
@@ -118,6 +124,10 @@ public:
     std::string filename() const                    { return m_filename; }
 	bool isNull() const                             { checkAsyncResult(); return !m_image || m_image->isNull(); }
     const HDRImage & image() const                  { checkAsyncResult(); return *m_image; }
+    /// The pixels, shared with the caller; they are never modified, so every edit, undo and redo gives a new pointer
+    std::shared_ptr<const HDRImage> sharedImage() const { checkAsyncResult(); return m_image; }
+    /// A number that changes whenever the pixels are loaded, modified, undone or redone, and is never shared by two images
+    uint64_t version() const                        { checkAsyncResult(); return m_version; }
     int width() const                               { checkAsyncResult(); return m_image->width(); }
     int height() const                              { checkAsyncResult(); return m_image->height(); }
     Eigen::Vector2i size() const                    { return isNull() ? Eigen::Vector2i(0,0) : Eigen::Vector2i(m_image->width(), m_image->height()); }
@@ -128,6 +138,9 @@ public:
               float gain, float gamma,
               bool sRGB, bool dither) const;
 
+	/// Report the memory held by the image, its undo history, histograms and texture to MemoryAccountant::global()
+	void updateMemoryUsage() const;
+
 	float histogramExposure() const             { return m_cachedHistogramExposure; }
 	bool histogramDirty() const                 { return m_histogramDirty; }
 	LazyHistogramPtr histograms() const         { return m_histograms; }
@@ -144,6 +157,7 @@ private:
 	void modifyFinished() const;
 
 	mutable std::shared_ptr<HDRImage> m_image;
+	mutable uint64_t m_version;
     std::string m_filename;
 	mutable LazyGLTextureLoader m_texture;
     mutable float m_cachedHistogramExposure;
@@ -5,23 +5,49 @@
 //
 
 #include <ctype.h>                       // for tolower
+#include <csignal>                       // for signal, SIGPIPE
+#include <cstring>                       // for strerror, strncpy
+#include <sys/stat.h>                    // for stat, lstat, S_ISSOCK
 #include <docopt.h>                      // for docopt
 #include <Eigen/Core>                    // for Vector2f
 #include <iostream>                      // for string
-#include <random>                        // for normal_distribution, mt19937
+#include <fstream>                       // for ofstream
+#include <future>                        // for async, future
+#include <mutex>                         // for mutex, lock_guard
+#include <thread>                        // for thread
+#include "Benchmark.h"                   // for StageTimings, benchmarkReport
+#include "ColorLUT.h"                    // for ColorLUT
 #include "Common.h"                      // for getBasename, getExtension
 #include "HDRImage.h"                    // for HDRImage
-#include "EnvMap.h"                      // for XYZToAngularMap, XYZToCubeMap
+#include "ImageCache.h"                  // for DiskImageCache, FileVersion
+#include "ImageMetrics.h"                // for computeMetrics, metricNames
+#include "ImageOps.h"                    // for ImageOpChain, parseImageOp
+#include "EnvMapSampling.h"              // for EnvMapDistribution
+#include "ExposureFusion.h"              // for ExposureFusion, ExposureFusionSpec
+#include "ImageStack.h"                  // for stackImages, StackMethod, mergeExposures
+#include "ImageStats.h"                  // for ImageStats
+#include "MemoryAccountant.h"            // for MemoryAccountant, MemoryCharge
+#include "Noise.h"                       // for noisy, NoiseSpec
 #include "HDRViewer.h"                   // for spdlog
+#include "ParallelFor.h"                 // for set_parallel_for_threads
+#include "Json.h"                        // for Json
+#include "Pipeline.h"                    // for OrderedPrefetcher, ConsumerPool
+#include "Timer.h"                       // for Timer
+#include "Trace.h"                       // for startTracing, writeChromeTrace
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/ostr.h>
 
+#if !defined(_WIN32)
+#include <sys/socket.h>                  // for socket, bind, listen, accept
+#include <sys/un.h>                      // for sockaddr_un
+#include <unistd.h>                      // for close, unlink
+#endif
+
 using namespace std;
 namespace spd = spdlog;
 
 namespace
 {
-std::mt19937 g_rand(53);
 
 HDRImage::BorderMode parseBorderMode(const string &mode)
 {
@@ -36,6 +62,160 @@ HDRImage::BorderMode parseBorderMode(const string &mode)
 
 	throw invalid_argument(fmt::format("Invalid border mode \"{}\".", mode));
 }
+
+// an input image handed from the reader threads to the processing stage
+struct LoadedImage
+{
+	size_t index = 0;
+	size_t bytes = 0;
+	bool valid = false;
+	HDRImage image;
+	shared_ptr<const HDRImage> reference;   // the paired reference, if any
+	string referenceError;                  // why the paired reference could not be read
+};
+
+// a processed image handed from the processing stage to the writer threads
+struct SaveJob
+{
+	string filename;
+	size_t bytes = 0;
+	HDRImage image;
+};
+
+// statistics about a batch run, reported at the end of a run or a server job
+struct BatchStats
+{
+	size_t numFiles = 0;
+	double megapixels = 0.0;
+	double seconds = 0.0;
+	Json report;            ///< Per-file metric scores, if --metrics was given
+	StageTimingList timings;
+};
+
+// Decoded reference images, kept across server jobs and reloaded only when the file changes on disk.
+// Images missing from memory are looked up in the optional on-disk cache before being decoded.
+class ReferenceCache
+{
+public:
+	void setDiskCache(const string & dir)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		if (dir != m_diskDir)
+		{
+			m_diskDir = dir;
+			m_disk = DiskImageCache(dir);
+		}
+	}
+
+	/*!
+	 * Return the decoded image \a filename. Images are only kept in memory if \a retain is true,
+	 * which allows paired references, used only once, to be streamed. Safe to call concurrently.
+	 */
+	shared_ptr<const HDRImage> get(const string & filename, bool retain = true)
+	{
+		auto console = spd::get("console");
+		FileVersion version = {};
+		readFileVersion(filename, version);
+		DiskImageCache disk;
+		{
+			lock_guard<mutex> lock(m_mutex);
+			auto it = m_images.find(filename);
+			if (it != m_images.end() && it->second.first == version)
+			{
+				console->info("Using cached reference image \"{}\".", filename);
+				return it->second.second;
+			}
+			disk = m_disk;
+		}
+
+		auto image = make_shared<HDRImage>();
+		if (!disk.load(filename, *image))
+		{
+			console->info("Reading reference image \"{}\"...", filename);
+			if (!image->load(filename))
+				throw invalid_argument(fmt::format("Cannot read image \"{}\".", filename));
+			disk.store(filename, *image);
+		}
+
+		if (retain)
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_images[filename] = make_pair(version, image);
+
+			size_t bytes = 0;
+			for (auto & entry : m_images)
+				bytes += entry.second.second->size() * sizeof(Color4);
+			MemoryAccountant::global().set(this, MemoryAccountant::CACHE, bytes);
+		}
+		return image;
+	}
+
+	~ReferenceCache()
+	{
+		MemoryAccountant::global().remove(this);
+	}
+
+private:
+	mutex m_mutex;
+	string m_diskDir;
+	DiskImageCache m_disk;
+	map<string, pair<FileVersion, shared_ptr<const HDRImage>>> m_images;
+};
+
+// Build the name of the reference paired with the input \a filename by replacing the tokens
+// {dir}, {name} and {ext} in \a pattern with the input's directory, basename and extension
+string expandReferencePattern(const string & pattern, const string & filename)
+{
+	auto lastSlash = filename.find_last_of("/\\");
+	string dir = lastSlash == string::npos ? "." : filename.substr(0, lastSlash);
+
+	string result;
+	for (size_t i = 0; i < pattern.size(); ++i)
+	{
+		if (pattern.compare(i, 5, "{dir}") == 0)
+		{
+			result += dir;
+			i += 4;
+		}
+		else if (pattern.compare(i, 6, "{name}") == 0)
+		{
+			result += getBasename(filename);
+			i += 5;
+		}
+		else if (pattern.compare(i, 5, "{ext}") == 0)
+		{
+			result += getExtension(filename);
+			i += 4;
+		}
+		else
+			result += pattern[i];
+	}
+	return result;
+}
+
+size_t imageBytes(const HDRImage & img)
+{
+	return size_t(img.width()) * img.height() * sizeof(Color4);
+}
+
+// rough estimate of the memory needed to process an image: the image itself plus a couple
+// of full-size temporaries created by the filters
+size_t workingSetBytes(const HDRImage & img)
+{
+	return 3 * imageBytes(img);
+}
+
+// Choose how many threads a processing job should use for its pixel-level parallelism.
+//
+// The hardware threads are split evenly among the jobs that can run side by side. Many small
+// images therefore run file-parallel with a single thread each, while large images, of which
+// only a few fit in the memory budget at once, fall back to multi-threading within each file.
+size_t threadsPerJob(size_t workingSet, int numJobs, size_t maxBytes)
+{
+	size_t numCPUs = max(1u, thread::hardware_concurrency());
+	size_t concurrent = min(size_t(numJobs), max(size_t(1), maxBytes / max(size_t(1), workingSet)));
+	return max(size_t(1), numCPUs / concurrent);
+}
 }
 
 static const char USAGE[] =
@@ -46,9 +226,21 @@ processing high-dynamic range images. HDRBatch is freely
 available under a 3-clause BSD license.
 
 Usage:
-  hdrbatch [options FILE...]
+  hdrbatch [options] [--op=SPEC]... [--merge=PARTIAL]... [FILE...]
+  hdrbatch --list-ops
   hdrbatch -h | --help | --version
 
+Server mode:
+  Running with --server or --socket starts a long-running process that
+  accepts jobs as newline-delimited JSON objects and keeps decoded reference
+  images in memory between jobs. Each job's "inputs" array lists the files to
+  process, and its other members are passed on as the options below, e.g.:
+    {"id": 1, "inputs": ["a.exr"], "filter": "gaussian,2,2", "save": true}
+  One JSON status message per line is written back for each job:
+  "started", then either "done" (with timings) or "error" (with a message).
+  Options that can be repeated, such as "op", take an array of values.
+  The job {"command": "shutdown"} stops the server.
+
 Options:
   -e E, --exposure=E       Desired power of 2 EV or exposure value
                            (gain = 2^exposure) [default: 0].
@@ -111,14 +303,40 @@ Options:
   --remap=M,M,[S],[L]      Remap the input image from one environment map
                            format to another. M,M are the input and output
                            environment map formats respectively.
-                           MAP : (latlong | angularmap | mirrorball | cubemap).
+                           MAP : (latlong | angularmap | mirrorball |
+                           cylindrical | cubemap | cubemap-hcross |
+                           cubemap-strip), where cubemap is a vertical cross,
+                           cubemap-hcross a horizontal cross, and
+                           cubemap-strip has the six faces side by side.
                            The optional S results in SxS super-sampling, where
                            the default is S=1: one centered sample per pixel.
+                           S can also be 'filtered', which anti-aliases each
+                           pixel by sampling a mip level and the direction
+                           of its footprint in the input, computed from the
+                           derivatives of the mappings.
                            The optional L parameter specifies the sampling lookup
                            mode: L : (nearest | bilinear | bicubic).
                            Specifying the same M parameter twice results in no
                            change. Combine with --resize to specify output file
                            dimensions.
+  --op=SPEC                Apply the operation SPEC, given as NAME[:ARGS],
+                           for instance 'exposure:1' or 'gaussian:2,2'. Can be
+                           repeated to build a processing chain, which is
+                           applied in order after --filter, --resize and
+                           --remap. Adjacent pointwise operations are fused
+                           into a single pass over the image. Use --list-ops
+                           to list the available operations.
+  --list-ops               List the operations supported by --op.
+  --bake-lut=N[,MAX]       Bake each run of adjacent color operations of --op,
+                           such as exposure, filmic and hue-saturation, into
+                           an NxNxN 3D LUT, which is much faster to apply to
+                           large images than long chains of operations, but
+                           clamps values to [0,MAX]. A MAX above 1 adds a
+                           logarithmic shaper to spread the LUT evenly over
+                           the stops [default MAX: 64].
+  --save-lut=FILE          Bake the --op operations, which must all be color
+                           operations, into a 3D LUT of the --bake-lut size
+                           (33 if not given) and save it as the .cube FILE.
   --border-mode=MODE,MODE  Specifies what x- and y-modes to use when accessing pixels
                            outside the bounds of the image.
                            MODE : (black | mirror | edge | repeat)
@@ -130,494 +348,1429 @@ Options:
                            The 'TYPE' is appended to the saved filename (before
                            image sequence number).
   --reference=FILE         Specify the reference image for error computation.
+  --reference-pattern=PAT  Compare each image to its own reference, whose name
+                           is built by replacing the tokens {dir}, {name} and
+                           {ext} in PAT with the image's directory, basename and
+                           extension, e.g. '{dir}/ref/{name}.exr'. References
+                           are read concurrently with the images, and take
+                           precedence over --reference.
+  --image-cache=DIR        Keep the decoded reference images as raw floats in
+                           the directory DIR, so that later runs can map them
+                           into memory instead of decoding them again. Entries
+                           are invalidated when the source file changes.
+  --metrics=LIST           Compare the images to the reference image specified
+                           with --reference or --reference-pattern, using the
+                           comma-separated metrics
+                           in LIST: (psnr | ssim | ms-ssim | flip).
+                           'psnr' is capped at 100 dB, the score of identical
+                           images.
+                           'flip' is an HDR-aware perceptual difference in the
+                           spirit of NVIDIA's FLIP. The scores are logged, and
+                           returned in the "done" message in server mode.
+  --report=FILE            Write the per-file metric scores as JSON to FILE.
+  --metric-maps            Save each metric's per-pixel map, using the output
+                           filename with '-METRIC' appended. Maps are saved in
+                           the --format file format, or as OpenEXR.
   -a FILE, --average=FILE  Average all loaded images and save to FILE
                            (all images must have the same dimensions).
   --variance=FILE          Compute an unbiased reference-less sample variance
                            of FILEs and save to FILE. This uses the FILEs
                            themselves to compute the mean, and uses the (n-1)
                            Bessel correction factor.
+  --minimum=FILE           Save the per-pixel minimum of FILEs to FILE.
+  --maximum=FILE           Save the per-pixel maximum of FILEs to FILE.
+  --sample-count=FILE      Save the per-pixel number of finite samples to FILE.
+                           Samples containing NaNs or INFs are left out of all
+                           per-pixel statistics (unless replaced using --nan).
+  --partial=PARTIAL        Save the accumulated per-pixel statistics to the
+                           binary file PARTIAL, so that they can be combined
+                           with those of other runs using --merge.
+  --merge=PARTIAL          Combine the statistics saved with --partial by
+                           another run with those of FILEs before computing
+                           --average, --variance, etc. Can be repeated.
+  --stack=FILE             Merge all FILEs into one image using the robust
+                           per-pixel statistic given by --stack-method and save
+                           it to FILE. The images are read and merged in bands
+                           of scanlines that fit within --max-memory, so large
+                           stacks can be merged without loading every image.
+                           OpenEXR and PFM files are decoded band by band, other
+                           formats are decoded in full.
+  --stack-method=METHOD    The per-pixel statistic used by --stack:
+                           METHOD : (median | trimmed[:FRACTION] |
+                                     sigma-clip[:KAPPA[,ITERATIONS]]).
+                           'trimmed' drops FRACTION (0.1 if omitted) of the
+                           samples at each end before averaging. 'sigma-clip'
+                           iteratively rejects samples further than KAPPA (3)
+                           standard deviations from the median, for at most
+                           ITERATIONS (5) passes [default: median].
+  --hdr-merge=FILE         Merge all FILEs, bracketed exposures of a static
+                           scene, into one high-dynamic range image and save it
+                           to FILE. Like --stack, the brackets are merged in
+                           bands of scanlines that fit within --max-memory.
+                           Raw and LDR files are decoded one at a time, and
+                           written to temporary files if they do not all fit.
+  --hdr-merge-ev=LIST      The comma-separated exposures of the FILEs in stops,
+                           e.g. -2,0,2. Estimated from the images if omitted.
+  --hdr-merge-ghost=STOPS  Down-weight pixels whose radiance differs from that
+                           of the middle exposure by more than about STOPS, to
+                           remove the ghosts of moving objects. 0 disables
+                           deghosting [default: 0].
+  --hdr-merge-response     Recover the camera response from the brackets
+                           instead of treating their values as linear.
+  --fuse=FILE              Fuse all FILEs, bracketed exposures of a static
+                           scene, directly into one display-referred image and
+                           save it to FILE [Mertens et al. 2007]. Unlike
+                           --hdr-merge, all FILEs are loaded at once.
+  --fuse-weights=C,S,E     The exponents of the contrast, saturation and
+                           well-exposedness measures that weight each pixel in
+                           --fuse, optionally followed by the standard
+                           deviation of the well-exposedness measure as
+                           C,S,E,SIGMA [default: 1,1,1].
+  --env-sampling=WIDTH     Build the tables for importance sampling each
+                           processed image as a lat-long environment map: the
+                           marginal and conditional CDFs of its luminance,
+                           weighted by the solid angle of its pixels, and the
+                           equivalent alias tables. The luminance is first
+                           box-filtered down to WIDTH cells across, or kept at
+                           full resolution if WIDTH is 0. The tables take 16
+                           bytes per cell, and are saved to the binary sidecar
+                           named by --env-sampling-out.
+  --env-sampling-out=PAT   The name of the --env-sampling sidecar of each
+                           file, built from the tokens {dir}, {name} and {ext}
+                           like --reference-pattern
+                           [default: {dir}/{name}.envsamp].
   --random-noise=M,V       Generate random Gaussian noise with mean M and
                            variance V.
+  --noise-seed=N           Seed for --random-noise. The noise of each file
+                           only depends on the seed and the file's position on
+                           the command line, not on the number of threads or
+                           --jobs [default: 53].
   -n R,G,B, --nan=R,G,B    Replace all NaNs and INFs with (R,G,B)
   --dry-run                Don't actually save any files, just report what would
                            be done.
+  --readers=N              Number of threads loading images ahead of processing
+                           [default: 2].
+  --writers=N              Number of threads saving processed images
+                           [default: 2].
+  --queue-depth=N          Maximum number of images that are loaded ahead of
+                           processing, and that wait to be saved after
+                           processing [default: 4].
+  --max-memory=MB          Soft limit in megabytes on the memory used by images
+                           waiting in the load and save queues, and separately
+                           on the estimated working memory of the files being
+                           processed concurrently. At least one image is always
+                           in flight [default: 4096].
+  --timings=FORMAT         Report the wall time, CPU time, throughput and the
+                           bytes read and written by each processing stage
+                           once all files are done.
+                           FORMAT : (text | json).
+  --timings-file=FILE      Write the --timings report to FILE instead of the
+                           standard output.
+  --benchmark=N            Time N complete runs over all FILEs, after --warmup
+                           untimed runs, and report the median and standard
+                           deviation of each stage. Implies --timings=text
+                           unless another format is given.
+  --warmup=N               The number of untimed runs before the timed runs of
+                           --benchmark [default: 1].
+  --trace=FILE             Record the time spent in each processing stage,
+                           parallel loop, loader and filter on every thread,
+                           and write it to FILE in the Chrome trace format,
+                           which chrome://tracing and ui.perfetto.dev can
+                           display. Only the most recent 65536 zones are kept.
+  --server                 Read jobs from standard input and write status
+                           messages to standard output. Log messages are
+                           written to standard error.
+  --socket=PATH            Listen for jobs on the Unix domain socket PATH.
+  -j N, --jobs=N           Process up to N files concurrently, or one per
+                           hardware thread if N is 0. The available threads
+                           are divided among the files that fit in the
+                           --max-memory budget: many small images are processed
+                           side by side with one thread each, while large
+                           images are each processed with several threads.
+                           The --average and --variance images are still
+                           accumulated in input order [default: 1].
 )";
 
 
-int main(int argc, char **argv)
+namespace
 {
-    vector<string> argVector = { argv + 1, argv + argc };
-    map<string, docopt::value> docargs;
+
+// Process the files and options described by the parsed command-line arguments.
+//
+// Decoded reference images are taken from (and added to) the reference cache so that they
+// can be reused by subsequent jobs in server mode.
+BatchStats runBatch(map<string, docopt::value> & docargs, ReferenceCache & references)
+{
+    auto console = spd::get("console");
     string ext = "",
            avgFilename = "",
            varFilename = "",
+           minFilename = "",
+           maxFilename = "",
+           countFilename = "",
+           partialFilename = "",
+           stackFilename = "",
+           hdrMergeFilename = "",
+           fuseFilename = "",
+           reportFilename = "",
            basename = "",
-           filterType = "",
-           filterParams = "",
            errorType = "",
-           referenceFile = "";
-    int verbosity = 0, absoluteWidth, absoluteHeight, samples = 1;
-    float gamma, exposure, relativeWidth = 100.f, relativeHeight = 100.f,
+           referenceFile = "",
+           referencePattern = "",
+           envSamplingPattern = "";
+    int numReaders = 2, numWriters = 2, queueDepth = 4, maxMemoryMB = 4096, numJobs = 1,
+        envSamplingWidth = 0;
+    float gamma, exposure,
           noiseMean = 0, noiseVar = 0;
     bool dither = true,
          sRGB = true,
          dryRun = true,
          fixNaNs = false,
-         resize = false,
-         remap = false,
-         relativeSize = true,
          saveFiles = false,
          makeNoise = false,
-         invert = false;
+         invert = false,
+         saveMetricMaps = false;
     HDRImage::BorderMode borderModeX, borderModeY;
     Color3 nanColor(0.0f,0.0f,0.0f);
-    // by default use a no-op passthrough warp function
-    function<Vector2f(const Vector2f&)> warp = [](const Vector2f & uv) {return uv;};
-    // use bilinear lookup by default
-    HDRImage::Sampler sampler = HDRImage::BILINEAR;
-    // no filter by default
-    function<HDRImage(const HDRImage &)> filter;
+    StackMethod stackMethod;
+    ExposureMergeOptions mergeOptions;
+    ExposureFusionSpec fusionSpec;
+    // the filters, resizing, remapping and --op operations, in the order they are applied
+    ImageOpChain ops;
 
-    vector<string> inFiles;
-    normal_distribution<float> normalDist(0,0);
+    vector<string> inFiles, mergeFiles, metrics;
+    NoiseSpec noise;
 
-    try
+    // exposure
+    exposure = strtof(docargs["--exposure"].asString().c_str(), (char **)NULL);
+    console->info("Setting intensity scale to {:f}", powf(2.0f, exposure));
+
+    // gamma or sRGB
+    if (docargs["--gamma"])
     {
+        sRGB = false;
+        gamma = max(0.1f, strtof(docargs["--gamma"].asString().c_str(), (char **)NULL));
+        console->info("Setting gamma correction to g={:f}.", gamma);
+    }
+    else
+        console->info("Using sRGB response curve.");
 
-#if defined(__APPLE__)
-        bool launched_from_finder = false;
-        // check whether -psn is set, and remove it from the arguments
-        for (vector<string>::iterator i = argVector.begin(); i != argVector.end(); ++i)
+    // dithering
+    dither = !docargs["--no-dither"].asBool();
+
+    // border mode
+    if (docargs["--border-mode"])
+    {
+        if (docargs["--border-mode"].isString())
         {
-            if (strncmp("-psn", i->c_str(), 4) == 0)
-            {
-                launched_from_finder = true;
-                argVector.erase(i);
-                break;
-            }
+            char first[22], second[32];
+            if (sscanf(docargs["--border-mode"].asString().c_str(), "%20[^','],%20s", first, second) != 2)
+                throw invalid_argument(
+                    fmt::format("Invalid border mode \"{}\".", docargs["--border-mode"].asString()));
+
+            borderModeX = parseBorderMode(first);
+            borderModeY = parseBorderMode(second);
         }
-#endif
-        docargs = docopt::docopt(USAGE, argVector,
-                                 true,             // show help if requested
-                                 "HDRBatch " HDRVIEW_VERSION);  // version string
+        else
+            throw invalid_argument(fmt::format("Invalid border mode \"{}\".", docargs["--border-mode"].asString()));
+    }
 
-        verbosity = docargs["--verbose"].asLong();
+    console->info("Setting border mode to: {}.", docargs["--border-mode"].asString());
 
-        // Console logger with color
-        auto console = spd::stdout_color_mt("console");
-        spd::set_pattern("[%l] %v");
-        spd::set_level(spd::level::level_enum(2));
+    saveFiles = docargs["--save"].asBool();
+    invert = docargs["--invert"].asBool();
 
-        if (verbosity < spd::level::trace || verbosity > spd::level::off)
-        {
-            console->error("Invalid verbosity threshold. Setting to default \"2\"");
-            verbosity = 2;
-        }
+    if (docargs["--format"].isString())
+    {
+        ext = docargs["--format"].asString();
+        console->info("Converting to \"{}\".", ext);
+    }
+    else
+        console->info("Keeping original image file formats.");
 
-        spd::set_level(spd::level::level_enum(verbosity));
+    if (docargs["--out"].isString())
+    {
+        basename = docargs["--out"].asString();
+        console->info("Setting base filename to \"{}\".", basename);
+    }
 
-        console->flush_on(spd::level::level_enum(verbosity));
+    if (docargs["--average"].isString())
+    {
+        avgFilename = docargs["--average"].asString();
+        console->info("Saving average image to \"{}\".", avgFilename);
+        if (docargs["FILE"].asStringList().size() < 2 && docargs["--merge"].asStringList().empty())
+            console->error("Computing an average from less than 2 images!");
+    }
 
-        console->info("Welcome to HDRView!");
-        console->info("Verbosity threshold set to level {:d}.", verbosity);
+    if (docargs["--variance"].isString())
+    {
+        varFilename = docargs["--variance"].asString();
+        if (docargs["FILE"].asStringList().size() < 2 && docargs["--merge"].asStringList().empty())
+            throw invalid_argument("Computing reference-less variance requires at least 2 images.");
+        console->info("Saving variance image to \"{}\".", varFilename);
+    }
 
-        console->debug("Running with the following commands/arguments/options:");
-        for (auto const& arg : docargs)
-            console->debug("{:<13}: {}", arg.first, arg.second);
+    if (docargs["--minimum"].isString())
+    {
+        minFilename = docargs["--minimum"].asString();
+        console->info("Saving minimum image to \"{}\".", minFilename);
+    }
 
-        // exposure
-        exposure = strtof(docargs["--exposure"].asString().c_str(), (char **)NULL);
-        console->info("Setting intensity scale to {:f}", powf(2.0f, exposure));
+    if (docargs["--maximum"].isString())
+    {
+        maxFilename = docargs["--maximum"].asString();
+        console->info("Saving maximum image to \"{}\".", maxFilename);
+    }
 
-        // gamma or sRGB
-        if (docargs["--gamma"])
-        {
-            sRGB = false;
-            gamma = max(0.1f, strtof(docargs["--gamma"].asString().c_str(), (char **)NULL));
-            console->info("Setting gamma correction to g={:f}.", gamma);
-        }
-        else
-            console->info("Using sRGB response curve.");
+    if (docargs["--sample-count"].isString())
+    {
+        countFilename = docargs["--sample-count"].asString();
+        console->info("Saving per-pixel sample count image to \"{}\".", countFilename);
+    }
 
-        // dithering
-        dither = !docargs["--no-dither"].asBool();
+    if (docargs["--partial"].isString())
+    {
+        partialFilename = docargs["--partial"].asString();
+        console->info("Saving partial statistics to \"{}\".", partialFilename);
+    }
 
-        // border mode
-        if (docargs["--border-mode"])
-        {
-            if (docargs["--border-mode"].isString())
-            {
-                char first[22], second[32];
-                if (sscanf(docargs["--border-mode"].asString().c_str(), "%20[^','],%20s", first, second) != 2)
-                    throw invalid_argument(
-                        fmt::format("Invalid border mode \"{}\".", docargs["--border-mode"].asString()));
+    mergeFiles = docargs["--merge"].asStringList();
 
-                borderModeX = parseBorderMode(first);
-                borderModeY = parseBorderMode(second);
-            }
-            else
-                throw invalid_argument(fmt::format("Invalid border mode \"{}\".", docargs["--border-mode"].asString()));
-        }
+    if (docargs["--stack"].isString())
+    {
+        stackFilename = docargs["--stack"].asString();
+        stackMethod = StackMethod::parse(docargs["--stack-method"].asString());
+        console->info("Saving the {} of all images to \"{}\".", stackMethod.description(), stackFilename);
+    }
 
-        console->info("Setting border mode to: {}.", docargs["--border-mode"].asString());
+    if (docargs["--hdr-merge"].isString())
+    {
+        hdrMergeFilename = docargs["--hdr-merge"].asString();
+        if (docargs["--hdr-merge-ev"].isString())
+            mergeOptions.exposures = ExposureMergeOptions::parseExposures(docargs["--hdr-merge-ev"].asString());
+        mergeOptions.ghostThreshold = strtof(docargs["--hdr-merge-ghost"].asString().c_str(), (char **)NULL);
+        mergeOptions.recoverResponse = docargs["--hdr-merge-response"].asBool();
+        console->info("Saving the exposures merged with {} to \"{}\".", mergeOptions.description(), hdrMergeFilename);
+    }
 
-        saveFiles = docargs["--save"].asBool();
-        invert = docargs["--invert"].asBool();
+    if (docargs["--fuse"].isString())
+    {
+        fuseFilename = docargs["--fuse"].asString();
+        fusionSpec = ExposureFusionSpec::parse(docargs["--fuse-weights"].asString());
+        console->info("Saving the exposures fused with weights {} to \"{}\".", fusionSpec.description(), fuseFilename);
+    }
 
-        if (docargs["--format"].isString())
-        {
-            ext = docargs["--format"].asString();
-            console->info("Converting to \"{}\".", ext);
-        }
+    if (docargs["--env-sampling"].isString())
+    {
+        envSamplingWidth = max(0, atoi(docargs["--env-sampling"].asString().c_str()));
+        envSamplingPattern = docargs["--env-sampling-out"].asString();
+        if (envSamplingWidth > 0)
+            console->info("Saving importance sampling tables at most {:d} cells across to \"{}\".",
+                          envSamplingWidth, envSamplingPattern);
         else
-            console->info("Keeping original image file formats.");
+            console->info("Saving full-resolution importance sampling tables to \"{}\".", envSamplingPattern);
+    }
 
-        if (docargs["--out"].isString())
-        {
-            basename = docargs["--out"].asString();
-            console->info("Setting base filename to \"{}\".", basename);
-        }
+    if (docargs["--error"].isString())
+    {
+        char type[22];
+        if (sscanf(docargs["--error"].asString().c_str(), "%s", type) != 1)
+            throw invalid_argument(fmt::format("Cannot parse command-line parameter: --error:\t{}", docargs["--error"].asString()));
 
-        if (docargs["--average"].isString())
-        {
-            avgFilename = docargs["--average"].asString();
-            console->info("Saving average image to \"{}\".", avgFilename);
-            if (docargs["FILE"].asStringList().size() < 2)
-                console->error("Computing an average from less than 2 images!");
-        }
+        errorType = type;
+        if (errorType != "squared" && errorType != "absolute" && errorType != "relative-squared")
+            throw invalid_argument(fmt::format("Invalid error TYPE specified in --error:\t{}", docargs["--error"].asString()));
+
+        if (!docargs["--reference"].isString() && !docargs["--reference-pattern"].isString())
+            throw invalid_argument("Need to specify a reference file for error computation.");
 
-        if (docargs["--variance"].isString())
+        console->info("Computing {} error.", errorType);
+    }
+
+    if (docargs["--metrics"].isString())
+    {
+        string list = docargs["--metrics"].asString();
+        for (size_t begin = 0, end = 0; end != string::npos; begin = end + 1)
         {
-            varFilename = docargs["--variance"].asString();
-            if (docargs["FILE"].asStringList().size() < 2)
-                throw invalid_argument("Computing reference-less variance requires at least 2 images.");
-            console->info("Saving variance image to \"{}\".", varFilename);
+            end = list.find(',', begin);
+            string name = toLower(list.substr(begin, end == string::npos ? string::npos : end - begin));
+            if (find(metricNames().begin(), metricNames().end(), name) == metricNames().end())
+                throw invalid_argument(fmt::format("Unrecognized metric \"{}\" in --metrics.", name));
+            metrics.push_back(name);
         }
 
-        if (docargs["--filter"].isString())
-        {
-            float filterArg1, filterArg2;
-            char type[22], params[32];
-            if (sscanf(docargs["--filter"].asString().c_str(), "%20[^','],%30s", type, params) != 2)
-                throw invalid_argument(fmt::format("Cannot parse command-line parameter: --filter:\t{}", docargs["--filter"].asString()));
-
-            filterParams = params;
-            if (sscanf(filterParams.c_str(), "%f,%f", &filterArg1, &filterArg2) != 2)
-                throw invalid_argument(fmt::format("Cannot parse command-line parameter: --filter:\t{}", docargs["--filter"].asString()));
-
-            filterType = type;
-            transform(filterType.begin(), filterType.end(), filterType.begin(), ::tolower);
-
-            AtomicProgress progress;
-            if (filterType == "gaussian")
-                filter = [filterArg1, filterArg2, progress, borderModeX, borderModeY](const HDRImage & i) {return i
-                    .GaussianBlurred(filterArg1, filterArg2, progress, borderModeX, borderModeY);};
-            else if (filterType == "box")
-                filter = [filterArg1, filterArg2, progress, borderModeX, borderModeY](const HDRImage & i) {return i
-                    .boxBlurred(filterArg1, filterArg2, progress, borderModeX, borderModeY);};
-            else if (filterType == "fast-gaussian")
-                filter = [filterArg1, filterArg2, progress, borderModeX, borderModeY](const HDRImage & i) {return i
-                    .fastGaussianBlurred(filterArg1, filterArg2, progress, borderModeX, borderModeY);};
-            else if (filterType == "median")
-                filter = [filterArg1, filterArg2, progress, borderModeX, borderModeY](const HDRImage & i) {return i
-                    .medianFiltered(filterArg1, filterArg2, progress, borderModeX, borderModeY);};
-            else if (filterType == "bilateral")
-                filter = [filterArg1, filterArg2, progress, borderModeX, borderModeY](const HDRImage & i) {return i
-                    .bilateralFiltered(filterArg1, filterArg2, progress, borderModeX, borderModeY);};
-            else if (filterType == "unsharp")
-                filter = [filterArg1, filterArg2, progress, borderModeX, borderModeY](const HDRImage & i) {return i
-                    .unsharpMasked(filterArg1, filterArg2, progress, borderModeX, borderModeY);};
-            else
-                throw invalid_argument(fmt::format("Unrecognized filter type: \"{}\".", filterType));
+        if (!docargs["--reference"].isString() && !docargs["--reference-pattern"].isString())
+            throw invalid_argument("Need to specify a reference file for computing metrics.");
 
-            console->info("Filtering using {}({:f},{:f}).", filterType, filterArg1, filterArg2);
-        }
+        saveMetricMaps = docargs["--metric-maps"].asBool();
+        if (docargs["--report"].isString())
+            reportFilename = docargs["--report"].asString();
 
-        if (docargs["--error"].isString())
-        {
-            char type[22];
-            if (sscanf(docargs["--error"].asString().c_str(), "%s", type) != 1)
-                throw invalid_argument(fmt::format("Cannot parse command-line parameter: --error:\t{}", docargs["--error"].asString()));
+        console->info("Computing metrics {}.", list);
+    }
 
-            errorType = type;
-            if (errorType != "squared" && errorType != "absolute" && errorType != "relative-squared")
-                throw invalid_argument(fmt::format("Invalid error TYPE specified in --error:\t{}", docargs["--error"].asString()));
+    if (docargs["--reference-pattern"].isString())
+    {
+        referencePattern = docargs["--reference-pattern"].asString();
+        console->info("Using the paired references \"{}\".", referencePattern);
+    }
+    else if (docargs["--reference"].isString())
+    {
+        referenceFile = docargs["--reference"].asString();
+        console->info("Using \"{}\" as reference.", referenceFile);
+    }
 
-            if (docargs["--reference"].isString())
-                referenceFile = docargs["--reference"].asString();
-            else
-                throw invalid_argument("Need to specify a reference file for error computation.");
+    references.setDiskCache(docargs["--image-cache"].isString() ? docargs["--image-cache"].asString() : "");
 
-            console->info("Computing {} error using {} as reference.", errorType, referenceFile);
-        }
+    // the legacy --filter, --resize and --remap options are applied first, in that order
+    if (docargs["--filter"].isString())
+    {
+        // "--filter TYPE,A,B" is equivalent to "--op TYPE:A,B"
+        string filter = docargs["--filter"].asString();
+        size_t comma = filter.find(',');
+        if (comma == string::npos)
+            throw invalid_argument(fmt::format("Cannot parse command-line parameter: --filter:\t{}", filter));
+        ops.add(parseImageOp(filter.substr(0, comma) + ":" + filter.substr(comma + 1), borderModeX, borderModeY));
+    }
 
+    if (docargs["--remap"].isString())
+    {
+        string remap = "remap:" + docargs["--remap"].asString();
         if (docargs["--resize"].isString())
-        {
-            if (sscanf(docargs["--resize"].asString().c_str(), "%dx%d", &absoluteWidth, &absoluteHeight) == 2)
-                relativeSize = false;
-            else if (sscanf(docargs["--resize"].asString().c_str(), "%f%%x%f%%", &relativeWidth, &relativeHeight) == 2)
-                relativeSize = true;
-            else
-                throw invalid_argument(fmt::format("Cannot parse --resize parameters:\t{}", docargs["--resize"].asString()));
+            remap += "," + docargs["--resize"].asString();
+        ops.add(parseImageOp(remap, borderModeX, borderModeY));
+    }
+    else if (docargs["--resize"].isString())
+        ops.add(parseImageOp("resize:" + docargs["--resize"].asString()));
 
-            resize = true;
-            if (relativeSize)
-                console->info("Resizing images to a relative size of {:.1f}% x {:.1f}%.", relativeWidth, relativeHeight);
-            else
-                console->info("Resizing images to an absolute size of {:d} x {:d}.", absoluteWidth, absoluteHeight);
-        }
+    for (auto & spec : docargs["--op"].asStringList())
+        ops.add(parseImageOp(spec, borderModeX, borderModeY));
+
+    if (docargs["--bake-lut"].isString() || docargs["--save-lut"].isString())
+    {
+        int lutSize = 33;
+        float lutMax = 64.f;
+        if (docargs["--bake-lut"].isString() &&
+            sscanf(docargs["--bake-lut"].asString().c_str(), "%d,%f", &lutSize, &lutMax) < 1)
+            throw invalid_argument("Cannot parse command-line parameter: --bake-lut");
 
-        if (docargs["--remap"].isString())
+        if (docargs["--save-lut"].isString())
         {
-            char s1[32], s2[32], s3[32] = "bilinear";
-            if (sscanf(docargs["--remap"].asString().c_str(), "%30[^','],%30[^','],%d,%30[^',']", s1, s2, &samples, s3) < 2)
-                throw invalid_argument(fmt::format("Cannot parse --remap parameters:\t{}", docargs["--remap"].asString()));
+            string lutFilename = docargs["--save-lut"].asString();
+            ColorLUT lut = ops.bakedLUT(lutSize, lutMax);
+            lut.title = ops.description();
+            lut.save(lutFilename);
+            console->info("Saved the {} of \"{}\" to \"{}\".", lut.description(), ops.description(), lutFilename);
+        }
+
+        if (docargs["--bake-lut"].isString())
+            console->info("Baked {:d} stage(s) of color operations into {:d}^3 LUTs.",
+                          ops.bakePointwise(lutSize, lutMax), lutSize);
+    }
 
-            remap = true;
+    if (!ops.empty())
+        console->info("Processing images with: {}.", ops.description());
 
-            UV2XYZFn * dst2xyz;
-            XYZ2UVFn * xyz2src;
+    if (docargs["--random-noise"].isString())
+    {
+        makeNoise = true;
+        if (sscanf(docargs["--random-noise"].asString().c_str(), "%f,%f", &noiseMean, &noiseVar) != 2)
+            throw invalid_argument("Cannot parse command-line parameter: --random-noise");
+        noise.distribution = NoiseSpec::GAUSSIAN;
+        noise.a = noiseMean;
+        noise.b = sqrt(noiseVar);
+        noise.seed = uint64_t(docargs["--noise-seed"].asLong());
+        console->info("Replacing images with random-noise({:f},{:f}).", noiseMean, noiseVar);
+    }
 
-            string from = s1, to = s2;
+    if (docargs["--nan"].isString())
+    {
+        if (sscanf(docargs["--nan"].asString().c_str(), "%f,%f,%f", &nanColor[0], &nanColor[1], &nanColor[2]) != 3)
+            throw invalid_argument("Cannot parse command-line parameter: --nan");
 
-            if (from != to)
-            {
-                if (from == "angularmap")
-                    xyz2src = XYZToAngularMap;
-                else if (from == "mirrorball")
-                    xyz2src = XYZToMirrorBall;
-                else if (from == "latlong")
-                    xyz2src = XYZToLatLong;
-                else if (from == "cubemap")
-                    xyz2src = XYZToCubeMap;
-                else
-                    throw invalid_argument(fmt::format("Cannot parse --remap parameters, unrecognized mapping type \"{}\"", from));
-
-                if (to == "angularmap")
-                    dst2xyz = angularMapToXYZ;
-                else if (to == "mirrorball")
-                    dst2xyz = mirrorBallToXYZ;
-                else if (to == "latlong")
-                    dst2xyz = latLongToXYZ;
-                else if (to == "cubemap")
-                    dst2xyz = cubeMapToXYZ;
-                else
-                    throw invalid_argument(fmt::format("Cannot parse --remap parameters, unrecognized mapping type \"{}\"", to));
-
-                warp = [&](const Vector2f & uv) {return xyz2src(dst2xyz(Vector2f(uv(0), uv(1))));};
-            }
+        console->info("Replacing NaNs and Infinities with ({}).", nanColor);
+        fixNaNs = true;
+    }
 
-            string interp = s3;
-            if (interp == "nearest")
-                sampler = HDRImage::NEAREST;
-            else if (interp == "bilinear")
-                sampler = HDRImage::BILINEAR;
-            else if (interp == "bicubic")
-                sampler = HDRImage::BICUBIC;
-            else
-                throw invalid_argument(fmt::format("Cannot parse --remap parameters, unrecognized sampler type \"{}\"", interp));
+    dryRun = docargs["--dry-run"].asBool();
+    if (dryRun)
+        console->info("Only testing. Will not write files.");
 
-            console->info("Remapping from {} to {} using {} interpolation with {:d} samples.", from, to, interp, samples);
-        }
+    numReaders = max(1, (int)docargs["--readers"].asLong());
+    numWriters = max(1, (int)docargs["--writers"].asLong());
+    queueDepth = max(1, (int)docargs["--queue-depth"].asLong());
+    maxMemoryMB = max(1, (int)docargs["--max-memory"].asLong());
+    console->info("Using {:d} reader and {:d} writer threads with a queue depth of {:d} and a {:d} MB memory limit.",
+                  numReaders, numWriters, queueDepth, maxMemoryMB);
+
+    numJobs = (int)docargs["--jobs"].asLong();
+    if (numJobs <= 0)
+        numJobs = max(1u, thread::hardware_concurrency());
+    if (numJobs > 1)
+        console->info("Processing up to {:d} files concurrently.", numJobs);
+
+    // list of filenames
+    inFiles = docargs["FILE"].asStringList();
+
+
+    // now actually do stuff
+    if (!inFiles.size() && !mergeFiles.size())
+        throw invalid_argument("No files specified!");
+
+    StageTimings timings;
+    shared_ptr<const HDRImage> reference = make_shared<HDRImage>();
+    if (!referenceFile.empty())
+    {
+        StageTimings::Scope scope(&timings, "read reference");
+        scope.addBytesRead(fileBytes(referenceFile));
+        reference = references.get(referenceFile);
+        scope.setMegapixels(1e-6 * reference->width() * reference->height());
+        console->info("Reference image size: {:d}x{:d}", reference->width(), reference->height());
+    }
+    const HDRImage & referenceImage = *reference;
+
+    if (!stackFilename.empty())
+    {
+        if (inFiles.size() < 2)
+            throw invalid_argument("Stacking requires at least 2 images.");
 
-        if (docargs["--random-noise"].isString())
+        if (dryRun)
+            console->info("Skipping stacking in dry run.");
+        else
         {
-            makeNoise = true;
-            if (sscanf(docargs["--random-noise"].asString().c_str(), "%f,%f", &noiseMean, &noiseVar) != 2)
-                throw invalid_argument("Cannot parse command-line parameter: --random-noise");
-            normalDist = normal_distribution<float>(noiseMean, sqrt(noiseVar));
-            console->info("Replacing images with random-noise({:f},{:f}).", noiseMean, noiseVar);
+            // the stacker streams bands of all files itself, bypassing the per-file pipeline below
+            Timer timer;
+            HDRImage stacked;
+            {
+                StageTimings::Scope scope(&timings, "stack");
+                for (auto & filename : inFiles)
+                    scope.addBytesRead(fileBytes(filename));
+                stacked = stackImages(inFiles, stackMethod, size_t(maxMemoryMB) << 20);
+                scope.setMegapixels(1e-6 * stacked.width() * stacked.height() * inFiles.size());
+            }
+            console->info("Stacked {:d} images in {:.2f} seconds.", inFiles.size(), timer.elapsed() / 1000.0);
+
+            console->info("Writing stacked image to \"{}\"...", stackFilename);
+            StageTimings::Scope scope(&timings, "write", 1e-6 * stacked.width() * stacked.height());
+            if (!stacked.save(stackFilename, powf(2.0f, exposure), gamma, sRGB, dither))
+                console->error("Cannot write image \"{}\".", stackFilename);
+            scope.addBytesWritten(fileBytes(stackFilename));
         }
+    }
 
-        if (docargs["--nan"].isString())
+    if (!hdrMergeFilename.empty())
+    {
+        if (inFiles.size() < 2)
+            throw invalid_argument("Merging exposures requires at least 2 images.");
+
+        if (dryRun)
+            console->info("Skipping exposure merging in dry run.");
+        else
         {
-            if (sscanf(docargs["--nan"].asString().c_str(), "%f,%f,%f", &nanColor[0], &nanColor[1], &nanColor[2]) != 3)
-                throw invalid_argument("Cannot parse command-line parameter: --nan");
+            // like the stacker, the merge streams bands of all files itself
+            Timer timer;
+            HDRImage merged;
+            {
+                StageTimings::Scope scope(&timings, "hdr merge");
+                for (auto & filename : inFiles)
+                    scope.addBytesRead(fileBytes(filename));
+                merged = mergeExposures(inFiles, mergeOptions, size_t(maxMemoryMB) << 20);
+                scope.setMegapixels(1e-6 * merged.width() * merged.height() * inFiles.size());
+            }
+            console->info("Merged {:d} exposures in {:.2f} seconds.", inFiles.size(), timer.elapsed() / 1000.0);
 
-            console->info("Replacing NaNs and Infinities with ({}).", nanColor);
-            fixNaNs = true;
+            console->info("Writing merged image to \"{}\"...", hdrMergeFilename);
+            StageTimings::Scope scope(&timings, "write", 1e-6 * merged.width() * merged.height());
+            if (!merged.save(hdrMergeFilename, powf(2.0f, exposure), gamma, sRGB, dither))
+                console->error("Cannot write image \"{}\".", hdrMergeFilename);
+            scope.addBytesWritten(fileBytes(hdrMergeFilename));
         }
+    }
 
-        dryRun = docargs["--dry-run"].asBool();
-        if (dryRun)
-            console->info("Only testing. Will not write files.");
+    if (!fuseFilename.empty())
+    {
+        if (inFiles.size() < 2)
+            throw invalid_argument("Exposure fusion requires at least 2 images.");
 
-        // list of filenames
-        inFiles = docargs["FILE"].asStringList();
+        if (dryRun)
+            console->info("Skipping exposure fusion in dry run.");
+        else
+        {
+            Timer timer;
+            vector<shared_ptr<const HDRImage>> brackets;
+            {
+                StageTimings::Scope scope(&timings, "read");
+                for (auto & filename : inFiles)
+                {
+                    auto image = make_shared<HDRImage>();
+                    if (!image->load(filename))
+                        throw runtime_error(fmt::format("Cannot read image \"{}\".", filename));
+                    scope.addBytesRead(fileBytes(filename));
+                    brackets.push_back(image);
+                }
+            }
 
+            HDRImage fused;
+            {
+                StageTimings::Scope scope(&timings, "fuse");
+                fused = ExposureFusion().fuse(brackets, fusionSpec);
+                scope.setMegapixels(1e-6 * fused.width() * fused.height() * inFiles.size());
+            }
+            console->info("Fused {:d} exposures in {:.2f} seconds.", inFiles.size(), timer.elapsed() / 1000.0);
 
-        // now actually do stuff
-        if (!inFiles.size())
-            throw invalid_argument("No files specified!");
+            console->info("Writing fused image to \"{}\"...", fuseFilename);
+            StageTimings::Scope scope(&timings, "write", 1e-6 * fused.width() * fused.height());
+            if (!fused.save(fuseFilename, powf(2.0f, exposure), gamma, sRGB, dither))
+                console->error("Cannot write image \"{}\".", fuseFilename);
+            scope.addBytesWritten(fileBytes(fuseFilename));
+        }
+    }
 
-        HDRImage referenceImage;
-        if (!referenceFile.empty())
+    if (!stackFilename.empty() || !hdrMergeFilename.empty() || !fuseFilename.empty())
+    {
+        // skip loading every file again if no per-file output was requested
+        bool perFileOutput = saveFiles || !errorType.empty() || !avgFilename.empty() || !varFilename.empty() ||
+                             !minFilename.empty() || !maxFilename.empty() || !countFilename.empty() ||
+                             !partialFilename.empty() || !envSamplingPattern.empty();
+        if (!perFileOutput)
         {
-            console->info("Reading reference image \"{}\"...", referenceFile);
-            if (!referenceImage.load(referenceFile))
-                throw invalid_argument(fmt::format("Cannot read image \"{}\".", referenceFile));
-            console->info("Reference image size: {:d}x{:d}", referenceImage.width(), referenceImage.height());
+            BatchStats stats;
+            stats.numFiles = inFiles.size();
+            stats.timings = timings.stages();
+            return stats;
         }
+    }
 
-        HDRImage avgImg;
-        HDRImage varImg;
-        int varN = 0;
-
-        for (size_t i = 0; i < inFiles.size(); ++i)
+    // per-pixel statistics, seeded with any partial results from other runs
+    ImageStats pixelStats;
+    bool accumulateStats = !avgFilename.empty() || !varFilename.empty() || !minFilename.empty() ||
+                           !maxFilename.empty() || !countFilename.empty() || !partialFilename.empty();
+    for (auto & partial : mergeFiles)
+    {
+        console->info("Merging partial statistics from \"{}\"...", partial);
+        StageTimings::Scope scope(&timings, "merge");
+        scope.addBytesRead(fileBytes(partial));
+        pixelStats.merge(ImageStats::load(partial));
+    }
+    size_t numProcessed = 0;
+    double totalMegapixels = 0.0;
+    Timer runTimer;
+
+    // the images held by this run, under the null owner, for the summary at the end
+    MemoryAccountant memory;
+
+    // The files flow through a bounded three-stage pipeline: reader threads load images ahead
+    // of time, one or more processing jobs consume them, and writer threads save the results
+    // while the next images are being processed.
+    //
+    // Like the jobs, the readers and writers work on one file at a time, so the parallel loops of
+    // the loaders and savers are limited to a job's share of the hardware threads.
+    size_t ioThreads = max(size_t(1), size_t(max(1u, thread::hardware_concurrency())) / size_t(numJobs));
+    OrderedPrefetcher<LoadedImage> reader(
+        inFiles.size(), numReaders, max(queueDepth, numJobs), size_t(maxMemoryMB) << 20,
+        [&inFiles,&referencePattern,&references,&timings,console,ioThreads](size_t i)
         {
-            HDRImage image;
+            set_parallel_for_threads(ioThreads);
+            LoadedImage loaded;
+            loaded.index = i;
+
+            // decode the paired reference alongside the image. It is used only once, so it is not
+            // kept in the reference cache's memory
+            future<shared_ptr<const HDRImage>> reference;
+            if (!referencePattern.empty())
+                reference = async(launch::async, [&references,&timings,ioThreads](const string & filename)
+                                  {
+                                      set_parallel_for_threads(ioThreads);
+                                      StageTimings::Scope scope(&timings, "read reference");
+                                      scope.addBytesRead(fileBytes(filename));
+                                      auto image = references.get(filename, false);
+                                      scope.setMegapixels(1e-6 * image->width() * image->height());
+                                      return image;
+                                  }, expandReferencePattern(referencePattern, inFiles[i]));
+
             console->info("Reading image \"{}\"...", inFiles[i]);
-            if (!image.load(inFiles[i]))
             {
-                console->error("Cannot read image \"{}\". Skipping...\n", inFiles[i]);
-                continue;
+                StageTimings::Scope scope(&timings, "read");
+                scope.addBytesRead(fileBytes(inFiles[i]));
+                loaded.valid = loaded.image.load(inFiles[i]);
+                scope.setMegapixels(1e-6 * loaded.image.width() * loaded.image.height());
             }
-            console->info("Image size: {:d}x{:d}", image.width(), image.height());
+            loaded.bytes = imageBytes(loaded.image);
 
-            varN += 1;
-            // initialize variables for average and variance
-            if (varN == 1)
+            if (reference.valid())
             {
-                // set images to zeros
-                varImg = avgImg = image.unaryExpr([](const Color4 & c)
+                try
+                {
+                    loaded.reference = reference.get();
+                    loaded.bytes += imageBytes(*loaded.reference);
+                }
+                catch (const exception & e)
                 {
-                    return Color4(0,0,0,0);
-                });
+                    loaded.referenceError = e.what();
+                }
             }
+            return loaded;
+        },
+        [&memory](const LoadedImage & loaded)
+        {
+            memory.add(nullptr, MemoryAccountant::IMAGE, int64_t(loaded.bytes));
+            return loaded.bytes;
+        });
 
-            if (fixNaNs || !dryRun)
-                image = image.unaryExpr([nanColor](const Color4 & c)
-                {
-                    return isfinite(c.sum()) ? c : Color4(nanColor, c[3]);
-                });
+    // free the memory charged to a loaded image, letting the readers get ahead again
+    auto releaseImage = [&reader,&memory](size_t bytes)
+    {
+        reader.release(bytes);
+        memory.add(nullptr, MemoryAccountant::IMAGE, -int64_t(bytes));
+    };
 
-            if (!avgFilename.empty() || !varFilename.empty())
+    ConsumerPool<SaveJob> writer(
+        numWriters, queueDepth,
+        [&](SaveJob & job)
+        {
+            set_parallel_for_threads(ioThreads);
+            console->info("Writing image to \"{}\"...", job.filename);
+            if (!dryRun)
             {
-                if (avgImg.width() != image.width() || avgImg.height() != image.height())
-                    throw invalid_argument("Images do not have the same size.");
-
-                // incremental average and variance computation
-                auto delta = image - avgImg;
-                avgImg += delta/Color4(varN,varN,varN,varN);
-                auto delta2 = image - avgImg;
-                varImg += delta * delta2;
+                StageTimings::Scope scope(&timings, "write", 1e-6 * job.image.width() * job.image.height());
+                if (!job.image.save(job.filename, powf(2.0f, exposure), gamma, sRGB, dither))
+                    console->error("Cannot write image \"{}\".", job.filename);
+                scope.addBytesWritten(fileBytes(job.filename));
             }
 
-            if (filter)
+            // free the image before letting the readers get ahead again
+            job.image = HDRImage();
+            releaseImage(job.bytes);
+        });
+
+    // the output filename for file i, without extension
+    auto outputStem = [&](size_t i, const string & extra)
+    {
+        string thisBasename = basename.size() ? basename : getBasename(inFiles[i]);
+        if (inFiles.size() == 1 || !basename.size())
+            return fmt::format("{}{}", thisBasename, extra);
+        else
+            return fmt::format("{}{}{:03d}", thisBasename, extra, i);
+    };
+
+    vector<Json> reportEntries(inFiles.size());
+    mutex reportMutex;
+
+    // The order-dependent average and variance updates are made one file at a time, in input
+    // order, while the rest of the processing of concurrent jobs is limited by the memory budget.
+    OrderedSection accumulate;
+    MemoryBudget budget(size_t(maxMemoryMB) << 20);
+
+    auto processImage = [&](LoadedImage & loaded)
+    {
+        size_t i = loaded.index;
+        HDRImage image = std::move(loaded.image);
+        if (!loaded.valid)
+        {
+            accumulate.run(i, []{});
+            console->error("Cannot read image \"{}\". Skipping...\n", inFiles[i]);
+            releaseImage(loaded.bytes);
+            return;
+        }
+        if (!referencePattern.empty() && !loaded.reference)
+        {
+            accumulate.run(i, []{});
+            console->error("Cannot read the reference of \"{}\": {} Skipping...\n", inFiles[i], loaded.referenceError);
+            releaseImage(loaded.bytes);
+            return;
+        }
+        console->info("Image size: {:d}x{:d}", image.width(), image.height());
+
+        // the paired reference in --reference-pattern mode, otherwise the shared one
+        const HDRImage & ref = loaded.reference ? *loaded.reference : referenceImage;
+
+        double megapixels = 1e-6 * image.width() * image.height();
+        auto replaceNaNs = [&image,&timings,nanColor,megapixels]
+        {
+            StageTimings::Scope scope(&timings, "nan", megapixels);
+            image = image.unaryExpr([nanColor](const Color4 & c)
             {
-                console->info("Filtering image with {}({})...", filterType, filterParams);
+                return isfinite(c.sum()) ? c : Color4(nanColor, c[3]);
+            });
+        };
+
+        if (fixNaNs)
+            replaceNaNs();
+
+        // unless replaced with --nan, non-finite samples are left out of the per-pixel statistics
+        accumulate.run(i, [&]
+        {
+            numProcessed += 1;
+            totalMegapixels += megapixels;
 
-                if (!dryRun)
-                    image = filter(image);
+            if (accumulateStats)
+            {
+                StageTimings::Scope scope(&timings, "accumulate", megapixels);
+                pixelStats.add(image);
             }
+        });
+
+        if (!fixNaNs && !dryRun)
+            replaceNaNs();
 
-            if (resize || remap)
+        size_t workingSet = workingSetBytes(image);
+        MemoryBudget::Reservation reservation(budget, workingSet);
+        MemoryCharge working(memory, nullptr, MemoryAccountant::WORKING, workingSet);
+        set_parallel_for_threads(threadsPerJob(workingSet, numJobs, budget.maxBytes()));
+
+        if (!ops.empty())
+        {
+            if (dryRun)
+                console->info("Skipping {:d} processing stage(s) in dry run.", ops.numStages());
+            else
             {
-                int w = (int)round(relativeWidth/100.f*image.width());
-                int h = (int)round(relativeHeight/100.f*image.height());
-                if (!relativeSize)
+                Timer timer;
+                ops.apply(image, AtomicProgress(), &timings, uint32_t(i));
+                console->debug("Processing took {} seconds.", timer.elapsed() / 1000.f);
+            }
+        }
+
+        if (makeNoise)
+        {
+            // each file uses its own stream, so the result does not depend on the processing order
+            StageTimings::Scope scope(&timings, "noise", megapixels);
+            HDRImage black(image.width(), image.height());
+            black.setConstant(Color4(0.f, 0.f, 0.f, 1.f));
+            image = noisy(black, noise, uint32_t(i));
+        }
+
+        if (!envSamplingPattern.empty())
+        {
+            string filename = expandReferencePattern(envSamplingPattern, inFiles[i]);
+            if (dryRun)
+                console->info("Skipping the importance sampling tables \"{}\" in dry run.", filename);
+            else
+            {
+                EnvMapDistribution distribution;
                 {
-                    w = absoluteWidth;
-                    h = absoluteHeight;
+                    StageTimings::Scope scope(&timings, "env sampling", megapixels);
+                    distribution = EnvMapDistribution(image, envSamplingWidth);
                 }
-
-                if (!remap)
+                console->info("Writing {:d}x{:d} importance sampling tables to \"{}\"...",
+                              distribution.width(), distribution.height(), filename);
+                StageTimings::Scope scope(&timings, "write");
+                try
                 {
-                    console->info("Resizing image to {:d}x{:d}...", w, h);
-                    image = image.resized(w, h);
+                    distribution.save(filename);
+                    scope.addBytesWritten(fileBytes(filename));
                 }
-                else
+                catch (const runtime_error & e)
                 {
-                    console->info("Remapping image to {:d}x{:d}...", w, h);
-                    AtomicProgress progress;
-                    image = image.resampled(w, h, progress, warp, samples,
-                                            sampler, borderModeX, borderModeY);
+                    console->error("Cannot write the importance sampling tables of \"{}\": {}", inFiles[i], e.what());
                 }
             }
+        }
 
-            if (makeNoise)
+        if (!metrics.empty())
+        {
+            Json entry = Json::object();
+            entry["file"] = inFiles[i];
+            if (!referencePattern.empty())
+                entry["reference"] = expandReferencePattern(referencePattern, inFiles[i]);
+            try
             {
-                for (int y = 0; y < image.height(); ++y)
-                    for (int x = 0; x < image.width(); ++x)
+                Timer timer;
+                vector<MetricResult> results;
+                {
+                    StageTimings::Scope scope(&timings, "metrics", megapixels);
+                    results = computeMetrics(metrics, image, ref);
+                }
+                console->debug("Computing metrics took {} seconds.", timer.elapsed() / 1000.f);
+
+                Json scores = Json::object();
+                for (auto & result : results)
+                {
+                    scores[result.name] = result.score;
+                    console->info("{} of \"{}\": {:.6f}.", result.name, inFiles[i], result.score);
+
+                    if (saveMetricMaps)
                     {
-                        image(x,y) = Color4(normalDist(g_rand), normalDist(g_rand),
-                                      normalDist(g_rand), 1.0f);
+                        SaveJob job;
+                        job.filename = fmt::format("{}.{}", outputStem(i, "-" + result.name), ext.size() ? ext : "exr");
+                        job.image = std::move(result.map);
+                        writer.push(std::move(job));
                     }
+                }
+                entry["metrics"] = scores;
+            }
+            catch (const invalid_argument & e)
+            {
+                console->error("Cannot compute metrics for \"{}\": {}", inFiles[i], e.what());
+                entry["error"] = e.what();
+            }
+
+            lock_guard<mutex> lock(reportMutex);
+            reportEntries[i] = entry;
+        }
+
+        if (!errorType.empty())
+        {
+            if (image.width() != ref.width() ||
+                image.height() != ref.height())
+            {
+                console->error("Images must have same dimensions!");
+                releaseImage(loaded.bytes);
+                return;
             }
 
-            if (!errorType.empty())
+            StageTimings::Scope scope(&timings, "error", megapixels);
+            if (errorType == "squared")
+                image = (image-ref).square();
+            else if (errorType == "absolute")
+                image = (image-ref).abs();
+            else //if (errorType == "relative-squared")
+                image = (image-ref).square() / (ref.square() + Color4(1e-3f, 1e-3f, 1e-3f, 1e-3f));
+
+            Color4 meanError = image.mean();
+            Color4 maxError = image.max();
+
+            image.setAlpha(1.0f);
+
+            console->info(fmt::format("Mean {} error: {}.", errorType, meanError));
+            console->info(fmt::format("Max {} error: {}.", errorType, maxError));
+        }
+
+        if (invert)
+        {
+            StageTimings::Scope scope(&timings, "invert", megapixels);
+            image = Color4(1.0f, 1.0f, 1.0f, 2.0f) - image;
+        }
+
+        if (saveFiles)
+        {
+            string thisExt = ext.size() ? ext : getExtension(inFiles[i]);
+            string extra = (errorType.empty()) ? "" : fmt::format("-{}-error", errorType);
+            string filename = fmt::format("{}.{}", outputStem(i, extra), thisExt);
+
+            SaveJob job;
+            job.filename = filename;
+            job.bytes = loaded.bytes;
+            job.image = std::move(image);
+            writer.push(std::move(job));
+        }
+        else
+            releaseImage(loaded.bytes);
+    };
+
+    auto runJob = [&]
+    {
+        LoadedImage loaded;
+        while (reader.pop(loaded))
+            processImage(loaded);
+    };
+
+    if (numJobs == 1)
+        runJob();
+    else
+    {
+        exception_ptr error;
+        mutex errorMutex;
+        vector<future<void>> jobs;
+        for (int j = 0; j < numJobs; ++j)
+            jobs.push_back(async(launch::async, [&]
             {
-                if (image.width() != referenceImage.width() ||
-                    image.height() != referenceImage.height())
+                try
                 {
-                    console->error("Images must have same dimensions!");
-                    continue;
+                    runJob();
                 }
+                catch (...)
+                {
+                    // remember the first error, and stop the other jobs
+                    {
+                        lock_guard<mutex> lock(errorMutex);
+                        if (!error)
+                            error = current_exception();
+                    }
+                    accumulate.abort();
+                }
+            }));
+        for (auto & job : jobs)
+            job.get();
+        if (error)
+            rethrow_exception(error);
+    }
 
-                if (errorType == "squared")
-                    image = (image-referenceImage).square();
-                else if (errorType == "absolute")
-                    image = (image-referenceImage).abs();
-                else //if (errorType == "relative-squared")
-                    image = (image-referenceImage).square() / (referenceImage.square() + Color4(1e-3f, 1e-3f, 1e-3f, 1e-3f));
+    // wait for the writers to drain the save queue
+    writer.finish();
 
-                Color4 meanError = image.mean();
-                Color4 maxError = image.max();
+    double seconds = runTimer.elapsed() / 1000.0;
+    console->info("Processed {:d} files ({:.1f} MP) in {:.2f} seconds: {:.2f} files/s, {:.2f} MP/s.",
+                  numProcessed, totalMegapixels, seconds,
+                  numProcessed / max(seconds, 1e-3), totalMegapixels / max(seconds, 1e-3));
+    console->info("Memory: {}; {} in the reference cache; peak resident set {}.", memory.summary(true),
+                  formatBytes(MemoryAccountant::global().total(MemoryAccountant::CACHE)),
+                  formatBytes(peakResidentBytes()));
 
-                image.setAlpha(1.0f);
+    BatchStats stats;
+    stats.numFiles = numProcessed;
+    stats.megapixels = totalMegapixels;
+    stats.seconds = seconds;
 
-                console->info(fmt::format("Mean {} error: {}.", errorType, meanError));
-                console->info(fmt::format("Max {} error: {}.", errorType, maxError));
+    if (!metrics.empty())
+    {
+        stats.report = Json::object();
+        if (referencePattern.empty())
+            stats.report["reference"] = referenceFile;
+        else
+            stats.report["reference-pattern"] = referencePattern;
+        stats.report["metrics"] = Json::array();
+        for (auto & name : metrics)
+            stats.report["metrics"].push_back(name);
+        stats.report["files"] = Json::array();
+        for (auto & entry : reportEntries)
+            if (!entry.isNull())
+                stats.report["files"].push_back(entry);
+
+        if (!reportFilename.empty())
+        {
+            console->info("Writing metrics report to \"{}\"...", reportFilename);
+            if (!dryRun)
+            {
+                ofstream out(reportFilename);
+                out << stats.report.dump(2) << endl;
+                if (!out)
+                    console->error("Cannot write \"{}\".", reportFilename);
             }
+        }
+    }
+
+    if (accumulateStats && pixelStats.empty())
+        throw invalid_argument("No images were accumulated.");
+
+    auto saveStatistic = [&](const string & filename, const char * what, const HDRImage & img)
+    {
+        if (filename.empty())
+            return;
+        console->info("Writing {} image to \"{}\"...", what, filename);
+        if (!dryRun)
+        {
+            StageTimings::Scope scope(&timings, "write", 1e-6 * img.width() * img.height());
+            img.save(filename, powf(2.0f, exposure), gamma, sRGB, dither);
+            scope.addBytesWritten(fileBytes(filename));
+        }
+    };
+
+    saveStatistic(avgFilename, "average", pixelStats.mean());
+
+    if (!varFilename.empty())
+    {
+        if (pixelStats.numImages() < 2)
+            throw invalid_argument("Computing reference-less variance requires at least 2 images.");
+
+        HDRImage varImg = pixelStats.variance();
+        // set alpha channel to 1
+        varImg.setAlpha(1.0f);
+        saveStatistic(varFilename, "variance", varImg);
+    }
+
+    saveStatistic(minFilename, "minimum", pixelStats.minimum());
+    saveStatistic(maxFilename, "maximum", pixelStats.maximum());
+    saveStatistic(countFilename, "sample count", pixelStats.sampleCount());
+
+    if (!partialFilename.empty())
+    {
+        console->info("Writing partial statistics of {:d} images to \"{}\"...", pixelStats.numImages(), partialFilename);
+        if (!dryRun)
+        {
+            StageTimings::Scope scope(&timings, "write");
+            pixelStats.save(partialFilename);
+            scope.addBytesWritten(fileBytes(partialFilename));
+        }
+    }
+
+    stats.timings = timings.stages();
+    return stats;
+}
+
+BenchmarkRun benchmarkRun(const BatchStats & stats, double wallSeconds, double cpuSeconds)
+{
+    BenchmarkRun run;
+    run.stages = stats.timings;
+    run.wallSeconds = wallSeconds;
+    run.cpuSeconds = cpuSeconds;
+    run.numFiles = stats.numFiles;
+    run.megapixels = stats.megapixels;
+    return run;
+}
+
+// Run the batch once, or --warmup plus --benchmark times, and write the --timings report
+void runTimedBatch(map<string, docopt::value> & docargs, ReferenceCache & references)
+{
+    auto console = spd::get("console");
+    bool benchmark = docargs["--benchmark"].isString();
+    string format = docargs["--timings"].isString() ? toLower(docargs["--timings"].asString()) :
+                    benchmark ? "text" : "";
+    if (!format.empty() && format != "text" && format != "json")
+        throw invalid_argument(fmt::format("Invalid timings format \"{}\".", format));
+
+    int repeats = benchmark ? max(1, (int)docargs["--benchmark"].asLong()) : 1;
+    int warmup = benchmark ? max(0, (int)docargs["--warmup"].asLong()) : 0;
+
+    for (int i = 0; i < warmup; ++i)
+    {
+        console->info("Warm-up run {:d} of {:d}...", i + 1, warmup);
+        runBatch(docargs, references);
+    }
+
+    vector<BenchmarkRun> runs;
+    for (int i = 0; i < repeats; ++i)
+    {
+        if (benchmark)
+            console->info("Timed run {:d} of {:d}...", i + 1, repeats);
+        Timer timer;
+        double cpuStart = processCPUSeconds();
+        BatchStats stats = runBatch(docargs, references);
+        runs.push_back(benchmarkRun(stats, timer.elapsed() / 1000.0, processCPUSeconds() - cpuStart));
+    }
+
+    if (format.empty())
+        return;
+
+    Json report = benchmarkReport(runs, warmup);
+    report["version"] = HDRVIEW_VERSION;
+    report["hardware_threads"] = thread::hardware_concurrency();
+    string text = format == "json" ? report.dump(2) + "\n" : benchmarkTable(report);
+
+    if (docargs["--timings-file"].isString())
+    {
+        string filename = docargs["--timings-file"].asString();
+        console->info("Writing timings to \"{}\"...", filename);
+        ofstream out(filename);
+        out << text;
+        if (!out)
+            console->error("Cannot write \"{}\".", filename);
+    }
+    else
+        cout << text << flush;
+}
+
+// Convert a JSON job description into hdrbatch command-line arguments.
+//
+// Members of "args" are passed through verbatim, and "inputs" are appended as FILE arguments.
+// Every other member "name" becomes the option "--name=value", or just "--name" if the value
+// is true. The "id" member is only echoed back in the status messages.
+vector<string> jobArguments(const Json & job)
+{
+    if (!job.isObject())
+        throw invalid_argument("A job must be a JSON object.");
+
+    vector<string> args;
+    for (auto & arg : job["args"].items())
+        args.push_back(arg.toString());
+
+    for (auto & member : job.members())
+    {
+        const string & key = member.first;
+        const Json & value = member.second;
+        if (key == "id" || key == "args" || key == "inputs" || key == "command")
+            continue;
+        if (key == "server" || key == "socket")
+            throw invalid_argument(fmt::format("Option \"--{}\" cannot be used within a job.", key));
+
+        if (value.isArray())
+        {
+            // repeated options, e.g. "op": ["exposure:1", "srgb"]
+            for (auto & item : value.items())
+                args.push_back("--" + key + "=" + item.toString());
+        }
+        else if (value.isBool())
+        {
+            if (value.asBool())
+                args.push_back("--" + key);
+        }
+        else if (!value.isNull())
+            args.push_back("--" + key + "=" + value.toString());
+    }
+
+    for (auto & input : job["inputs"].items())
+        args.push_back(input.toString());
 
-            if (invert)
+    return args;
+}
+
+// Run newline-delimited JSON jobs read using readLine, and write one JSON status message per line
+// using writeLine: "started" when a job is accepted, followed by either "done" (with timings and
+// throughput) or "error" (with a message). Returns true if a shutdown command was received.
+bool serveJobs(const function<bool(string &)> & readLine,
+               const function<void(const string &)> & writeLine,
+               ReferenceCache & references)
+{
+    auto console = spd::get("console");
+    string line;
+    while (readLine(line))
+    {
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+
+        Timer timer;
+        Json status = Json::object();
+        try
+        {
+            Json job = Json::parse(line);
+            status["id"] = job["id"];
+
+            string command = job["command"].isString() ? job["command"].asString() : "";
+            if (command == "shutdown")
             {
-                image = Color4(1.0f, 1.0f, 1.0f, 2.0f) - image;
+                status["status"] = "shutdown";
+                writeLine(status.dump());
+                return true;
             }
-
-            if (saveFiles)
+            else if (command == "ping")
             {
-                string thisExt = ext.size() ? ext : getExtension(inFiles[i]);
-                string thisBasename = basename.size() ? basename : getBasename(inFiles[i]);
-                string filename;
-                string extra = (errorType.empty()) ? "" : fmt::format("-{}-error", errorType);
-                if (inFiles.size() == 1 || !basename.size())
-                    filename = fmt::format("{}{}.{}", thisBasename, extra, thisExt);
-                else
-                    filename = fmt::format("{}{}{:03d}.{}", thisBasename, extra, i, thisExt);
-
-                console->info("Writing image to \"{}\"...", filename);
-
-                if (!dryRun)
-                    image.save(filename, powf(2.0f, exposure), gamma, sRGB, dither);
+                status["status"] = "pong";
+                writeLine(status.dump());
+                continue;
             }
+            else if (!command.empty())
+                throw invalid_argument(fmt::format("Unknown command \"{}\".", command));
+
+            vector<string> args = jobArguments(job);
+            status["status"] = "started";
+            writeLine(status.dump());
+
+            console->info("Running job {}...", status["id"].dump());
+            auto docargs = docopt::docopt_parse(USAGE, args, false, false);
+            double cpuStart = processCPUSeconds();
+            BatchStats stats = runBatch(docargs, references);
+
+            status["status"] = "done";
+            status["files"] = stats.numFiles;
+            status["megapixels"] = stats.megapixels;
+            status["processing_seconds"] = stats.seconds;
+            status["files_per_second"] = stats.numFiles / max(stats.seconds, 1e-3);
+            status["megapixels_per_second"] = stats.megapixels / max(stats.seconds, 1e-3);
+            if (!stats.report.isNull())
+                status["report"] = stats.report;
+            if (docargs["--timings"].isString())
+                status["timings"] = benchmarkReport({benchmarkRun(stats, timer.elapsed() / 1000.0,
+                                                                  processCPUSeconds() - cpuStart)}, 0);
+        }
+        catch (const std::exception & e)
+        {
+            console->error("Job {} failed: {}", status["id"].dump(), e.what());
+            status["status"] = "error";
+            status["message"] = e.what();
         }
+        status["seconds"] = timer.elapsed() / 1000.0;
+        writeLine(status.dump());
+    }
+    return false;
+}
 
-        if (!avgFilename.empty())
+// Serve jobs from standard input, writing status messages to standard output
+void runStdioServer(ReferenceCache & references)
+{
+    spd::get("console")->info("Reading jobs from standard input...");
+    serveJobs([](string & line) {return bool(getline(cin, line));},
+              [](const string & line) {cout << line << endl;},
+              references);
+}
+
+// Serve jobs sent to a Unix domain socket, one connection at a time, until a shutdown command
+void runSocketServer(const string & path, ReferenceCache & references)
+{
+#if defined(_WIN32)
+    throw runtime_error("Unix domain sockets are not supported on this platform.");
+#else
+    auto console = spd::get("console");
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw invalid_argument(fmt::format("Socket path \"{}\" is too long.", path));
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0)
+        throw runtime_error(fmt::format("Cannot create socket: {}", strerror(errno)));
+
+    // a client disconnecting early should not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // remove a stale socket left behind by a previous server, but never any other kind of file
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0)
+    {
+        if (!S_ISSOCK(info.st_mode))
         {
-            // avgImg *= Color4(1.0f/inFiles.size());
+            close(server);
+            throw runtime_error(fmt::format("Cannot listen on \"{}\": the file exists and is not a socket.", path));
+        }
+        unlink(path.c_str());
+    }
+    if (::bind(server, (sockaddr *) &address, sizeof(address)) < 0 || listen(server, 8) < 0)
+    {
+        string error = strerror(errno);
+        close(server);
+        throw runtime_error(fmt::format("Cannot listen on socket \"{}\": {}", path, error));
+    }
 
-            console->info("Writing average image to \"{}\"...", avgFilename);
+    console->info("Listening for jobs on \"{}\"...", path);
 
-            if (!dryRun)
-                avgImg.save(avgFilename, powf(2.0f, exposure), gamma, sRGB, dither);
+    bool shutdown = false;
+    while (!shutdown)
+    {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            string error = strerror(errno);
+            close(server);
+            throw runtime_error(fmt::format("Cannot accept connection: {}", error));
         }
+        console->debug("Accepted connection.");
 
-        if (!varFilename.empty())
+        string buffer;
+        auto readLine = [client,&buffer](string & line)
         {
-            varImg /= Color4(varN - 1, varN - 1, varN - 1, varN - 1);
+            size_t newline;
+            while ((newline = buffer.find('\n')) == string::npos)
+            {
+                char chunk[4096];
+                ssize_t n = recv(client, chunk, sizeof(chunk), 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                {
+                    // hand out a final unterminated line, if any
+                    line.swap(buffer);
+                    buffer.clear();
+                    return !line.empty();
+                }
+                buffer.append(chunk, size_t(n));
+            }
+            line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            return true;
+        };
+        auto writeLine = [client](const string & line)
+        {
+            string message = line + "\n";
+            size_t sent = 0;
+            while (sent < message.size())
+            {
+                ssize_t n = send(client, message.data() + sent, message.size() - sent, 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return;
+                sent += size_t(n);
+            }
+        };
+
+        shutdown = serveJobs(readLine, writeLine, references);
+        close(client);
+        console->debug("Closed connection.");
+    }
+
+    close(server);
+    unlink(path.c_str());
+    console->info("Server shut down.");
+#endif
+}
+
+
+// Stop tracing and write the trace to \a filename, which is also done when processing failed
+bool finishTracing(const string & filename)
+{
+    stopTracing();
+    spd::get("console")->info("Writing trace to \"{}\"...", filename);
+    try
+    {
+        writeChromeTrace(filename);
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        spd::get("console")->error("Could not write trace: {}", e.what());
+        return false;
+    }
+}
+} // namespace
+
+
+int main(int argc, char **argv)
+{
+    vector<string> argVector = { argv + 1, argv + argc };
+    map<string, docopt::value> docargs;
+    int verbosity = 0;
+    string traceFilename;
+
+    try
+    {
 
-            // set alpha channel to 1
-            varImg = varImg.unaryExpr([](const Color4 & c)
+#if defined(__APPLE__)
+        bool launched_from_finder = false;
+        // check whether -psn is set, and remove it from the arguments
+        for (vector<string>::iterator i = argVector.begin(); i != argVector.end(); ++i)
+        {
+            if (strncmp("-psn", i->c_str(), 4) == 0)
             {
-                return Color4(c.r,c.g,c.b,1);
-            });
+                launched_from_finder = true;
+                argVector.erase(i);
+                break;
+            }
+        }
+#endif
+        docargs = docopt::docopt(USAGE, argVector,
+                                 true,             // show help if requested
+                                 "HDRBatch " HDRVIEW_VERSION);  // version string
 
-            console->info("Writing variance image to \"{}\"...", varFilename);
+        verbosity = docargs["--verbose"].asLong();
 
-            if (!dryRun)
-                varImg.save(varFilename, powf(2.0f, exposure), gamma, sRGB, dither);
+        // Console logger with color. In server mode, standard output is reserved for job status messages.
+        bool serverMode = docargs["--server"].asBool() || docargs["--socket"].isString();
+        auto console = serverMode ? spd::stderr_color_mt("console") : spd::stdout_color_mt("console");
+        spd::set_pattern("[%l] %v");
+        spd::set_level(spd::level::level_enum(2));
+
+        if (verbosity < spd::level::trace || verbosity > spd::level::off)
+        {
+            console->error("Invalid verbosity threshold. Setting to default \"2\"");
+            verbosity = 2;
+        }
+
+        spd::set_level(spd::level::level_enum(verbosity));
+
+        console->flush_on(spd::level::level_enum(verbosity));
+
+        console->info("Welcome to HDRView!");
+        console->info("Verbosity threshold set to level {:d}.", verbosity);
+
+        console->debug("Running with the following commands/arguments/options:");
+        for (auto const& arg : docargs)
+            console->debug("{:<13}: {}", arg.first, arg.second);
+
+        if (docargs["--list-ops"].asBool())
+        {
+            printf("%s\n", imageOpUsage().c_str());
+            return EXIT_SUCCESS;
         }
+
+        if (docargs["--trace"].isString())
+        {
+            traceFilename = docargs["--trace"].asString();
+            startTracing();
+        }
+
+        ReferenceCache references;
+        if (docargs["--socket"].isString())
+            runSocketServer(docargs["--socket"].asString(), references);
+        else if (docargs["--server"].asBool())
+            runStdioServer(references);
+        else
+            runTimedBatch(docargs, references);
+
+        if (!traceFilename.empty() && !finishTracing(traceFilename))
+            return EXIT_FAILURE;
     }
     // Exceptions will only be thrown upon failed logger or sink construction (not during logging)
     catch (const spd::spdlog_ex& e)
@@ -628,6 +1781,8 @@ int main(int argc, char **argv)
     catch (const std::exception &e)
     {
         spd::get("console")->critical("Error: {}", e.what());
+        if (!traceFilename.empty())
+            finishTracing(traceFilename);
         fprintf(stderr, "%s", USAGE);
         return -1;
     }
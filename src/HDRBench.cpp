@@ -0,0 +1,1326 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include <algorithm>                     // for replace, equal, all_of
+#include <cmath>                         // for pow, sin, log2, exp2, nextafter
+#include <cstdio>                        // for remove, sscanf
+#include <cstdint>                       // for int64_t, uint32_t
+#include <cstring>                       // for memcpy
+#include <docopt.h>                      // for docopt
+#include <fstream>                       // for ofstream
+#include <functional>                    // for function
+#include <iostream>                      // for cout
+#include <limits>                        // for numeric_limits
+#include <memory>                        // for make_shared
+#include <mutex>                         // for mutex, lock_guard
+#include <stdexcept>                     // for invalid_argument, runtime_error
+#include <thread>                        // for thread
+#include "Benchmark.h"                   // for summaryStatistics, peakResidentBytes
+#include "ColorLUT.h"                    // for ColorLUT
+#include "Colorspace.h"                  // for LinearToSRGB, convertColorSpace
+#include "Common.h"                      // for toLower, createTemporaryFile
+#include "EnvMap.h"                      // for convertEnvMappingUV, batchEnvMapUVToXYZ, envMappingNames, ...
+#include "EnvMapSampling.h"              // for EnvMapDistribution
+#include "ExposureFusion.h"              // for ExposureFusion, ExposureFusionSpec
+#include "FastMath.h"                    // for fastLinearToSRGB, fastPow, fastAtan2, ...
+#include "GLImage.h"                     // for ImageStatistics
+#include "HDRImage.h"                    // for HDRImage
+#include "ImageStack.h"                  // for mergeExposures, ExposureMergeOptions
+#include "LocalTonemap.h"                // for locallyTonemapped, LocalTonemapSpec
+#include "Noise.h"                       // for noisy, NoiseSpec, Philox
+#include "ParallelFor.h"                 // for set_parallel_for_threads
+#include "Timer.h"                       // for Timer
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/ostr.h>
+
+using namespace std;
+using namespace Eigen;
+namespace spd = spdlog;
+
+static const char USAGE[] =
+R"(hdrview-bench. Copyright (c) Wojciech Jarosz.
+
+Micro-benchmarks of HDRView's image processing routines, run on synthetic
+images that are identical on every run and platform. The results are written
+as JSON, and results of different versions can be compared using
+scripts/compare-bench.py.
+
+Usage:
+  hdrview-bench [options]
+  hdrview-bench --accuracy [options]
+  hdrview-bench --list
+  hdrview-bench -h | --help | --version
+
+Options:
+  -s LIST, --sizes=LIST    Comma-separated list of image sizes WxH to run all
+                           benchmarks at [default: 512x512,1024x1024].
+  -r N, --repeats=N        Number of timed repetitions of each benchmark
+                           [default: 5].
+  -w N, --warmup=N         Number of untimed repetitions before the timed ones
+                           [default: 1].
+  -f TEXT, --filter=TEXT   Only run the benchmarks whose name contains TEXT.
+  -t N, --threads=N        Maximum number of threads used by parallel loops, or
+                           0 to use all hardware threads [default: 0].
+  -o FILE, --out=FILE      Write the JSON results to FILE instead of the
+                           standard output.
+  --list                   List the names of all benchmarks.
+  --accuracy               Instead of timing, measure the error of the fast
+                           functions in FastMath.h against the exact
+                           functions, evaluated in double precision, over
+                           every finite float in their domains, compare the
+                           batch color space and environment map conversions
+                           with the per-color and double-precision ones,
+                           merge raw brackets written as DNG files, and
+                           check the Philox generator against its known
+                           answers. Exits with a non-zero status if an error
+                           exceeds its documented bound or an answer does
+                           not match.
+  --stride=N               With --accuracy, only test every N-th float
+                           [default: 1].
+  -v T, --verbose=T        Set the verbosity threshold of the log messages,
+                           which are written to the standard error
+                           T : (0 | 1 | 2 | 3 | 4 | 5 | 6) [default: 3].
+  -h, --help               Display this message.
+  --version                Show the version.
+)";
+
+namespace
+{
+
+// results are folded into this value, so that the compiler cannot skip any work
+volatile float g_sink = 0.f;
+
+void consume(const HDRImage & img)
+{
+	if (!img.isNull())
+		g_sink = g_sink + img(0, 0)[0];
+}
+
+template <typename F>
+double timed(F f)
+{
+	Timer timer;
+	f();
+	return timer.elapsed() / 1000.0;
+}
+
+// A benchmark runs its operation once on the input image and returns the time taken by the
+// operation itself, in seconds, excluding any set-up
+struct Benchmark
+{
+	string name;
+	Json params;
+	function<double(const HDRImage &)> run;
+};
+
+// a smooth HDR gradient spanning 8 stops, with ripples and Gaussian noise
+HDRImage syntheticImage(int w, int h)
+{
+	HDRImage img(w, h);
+	for (int y = 0; y < h; ++y)
+		for (int x = 0; x < w; ++x)
+		{
+			float u = (x + 0.5f) / w, v = (y + 0.5f) / h;
+			float stops = pow(2.f, 8.f * u - 4.f);
+			img(x, y) = Color4(stops * (0.6f + 0.4f * sin(40.f * v)),
+			                   stops * (0.6f + 0.4f * sin(23.f * u + 31.f * v)),
+			                   stops * v, 1.f);
+		}
+
+	NoiseSpec noise;
+	noise.distribution = NoiseSpec::GAUSSIAN;
+	noise.a = 0.f;
+	noise.b = 0.05f;
+	noise.seed = 1;
+	return noisy(img, noise);
+}
+
+
+Json params(const string & key, const Json & value)
+{
+	Json p = Json::object();
+	p[key] = value;
+	return p;
+}
+
+Json params(const string & key1, const Json & value1, const string & key2, const Json & value2)
+{
+	Json p = params(key1, value1);
+	p[key2] = value2;
+	return p;
+}
+
+string borderName(HDRImage::BorderMode mode)
+{
+	return toLower(HDRImage::borderModeNames()[mode]);
+}
+
+string samplerName(HDRImage::Sampler sampler)
+{
+	static const char * names[] = {"nearest", "bilinear", "bicubic"};
+	return names[sampler];
+}
+
+// all benchmarks, named "function/param=value/...", so that names are stable across versions
+vector<Benchmark> allBenchmarks()
+{
+	vector<Benchmark> b;
+	const HDRImage::BorderMode borders[] = {HDRImage::BLACK, HDRImage::EDGE, HDRImage::REPEAT, HDRImage::MIRROR};
+	const HDRImage::Sampler samplers[] = {HDRImage::NEAREST, HDRImage::BILINEAR, HDRImage::BICUBIC};
+
+	for (int radius : {2, 7})
+		for (auto border : {HDRImage::EDGE, HDRImage::MIRROR})
+		{
+			// a normalized Gaussian kernel of size (2*radius+1)^2
+			ArrayXXf kernel(2 * radius + 1, 2 * radius + 1);
+			for (int j = 0; j < kernel.cols(); ++j)
+				for (int i = 0; i < kernel.rows(); ++i)
+					kernel(i, j) = exp(-0.5f * (pow(i - radius, 2.f) + pow(j - radius, 2.f)) / pow(0.5f * radius, 2.f));
+			kernel /= kernel.sum();
+
+			b.push_back({fmt::format("convolved/radius={}/border={}", radius, borderName(border)),
+			             params("radius", radius, "border", borderName(border)),
+			             [kernel,border](const HDRImage & img)
+			             {
+				             return timed([&]{consume(img.convolved(kernel, AtomicProgress(), border, border));});
+			             }});
+		}
+
+	for (float sigma : {1.f, 4.f, 16.f})
+		b.push_back({fmt::format("GaussianBlurred/sigma={:g}", sigma), params("sigma", sigma),
+		             [sigma](const HDRImage & img)
+		             {
+			             return timed([&]{consume(img.GaussianBlurred(sigma, sigma, AtomicProgress()));});
+		             }});
+
+	for (float sigma : {4.f, 16.f})
+		b.push_back({fmt::format("fastGaussianBlurred/sigma={:g}", sigma), params("sigma", sigma),
+		             [sigma](const HDRImage & img)
+		             {
+			             return timed([&]{consume(img.fastGaussianBlurred(sigma, sigma, AtomicProgress()));});
+		             }});
+
+	for (int radius : {2, 16})
+	{
+		for (auto border : borders)
+			b.push_back({fmt::format("boxBlurredX/radius={}/border={}", radius, borderName(border)),
+			             params("radius", radius, "border", borderName(border)),
+			             [radius,border](const HDRImage & img)
+			             {
+				             return timed([&]{consume(img.boxBlurredX(radius, AtomicProgress(), border));});
+			             }});
+
+		b.push_back({fmt::format("boxBlurredY/radius={}/border=edge", radius),
+		             params("radius", radius, "border", "edge"),
+		             [radius](const HDRImage & img)
+		             {
+			             return timed([&]{consume(img.boxBlurredY(radius, AtomicProgress()));});
+		             }});
+	}
+
+	for (float radius : {1.f, 3.f})
+		b.push_back({fmt::format("medianFiltered/radius={:g}", radius), params("radius", radius),
+		             [radius](const HDRImage & img)
+		             {
+			             return timed([&]{consume(img.medianFiltered(radius, AtomicProgress()));});
+		             }});
+
+	for (float sigmaDomain : {1.f, 2.f})
+		b.push_back({fmt::format("bilateralFiltered/sigma_range=0.1/sigma_domain={:g}", sigmaDomain),
+		             params("sigma_range", 0.1, "sigma_domain", sigmaDomain),
+		             [sigmaDomain](const HDRImage & img)
+		             {
+			             return timed([&]{consume(img.bilateralFiltered(0.1f, sigmaDomain, AtomicProgress()));});
+		             }});
+
+	// the local tone mapping operators, at full resolution
+	for (auto op : {LocalTonemapSpec::REINHARD, LocalTonemapSpec::DURAND, LocalTonemapSpec::LOCAL_LAPLACIAN})
+	{
+		string name = toLower(LocalTonemapSpec::operatorNames()[op]);
+		replace(name.begin(), name.end(), ' ', '-');
+		b.push_back({"locallyTonemapped/op=" + name, params("op", name),
+		             [op](const HDRImage & img)
+		             {
+			             LocalTonemapSpec spec;
+			             spec.op = op;
+			             return timed([&]{consume(locallyTonemapped(img, spec));});
+		             }});
+	}
+
+	// fusing three brackets of the image, from scratch and with all but one of them cached
+	for (bool cached : {false, true})
+		b.push_back({fmt::format("exposureFusion/cached={}", cached), params("cached", cached),
+		             [cached](const HDRImage & img)
+		             {
+			             vector<shared_ptr<const HDRImage>> brackets;
+			             for (float stops : {-2.f, 0.f, 2.f})
+				             brackets.push_back(make_shared<HDRImage>(img * Color4(exp2(stops), exp2(stops), exp2(stops), 1.f)));
+			             ExposureFusion fusion;
+			             if (cached)
+				             fusion.fuse({brackets[0], brackets[1]}, ExposureFusionSpec());
+			             return timed([&]{consume(fusion.fuse(brackets, ExposureFusionSpec()));});
+		             }});
+
+	for (float scale : {0.5f, 2.f})
+		for (auto sampler : samplers)
+			for (auto border : {HDRImage::REPEAT, HDRImage::EDGE})
+			{
+				Json p = params("scale", scale, "sampler", samplerName(sampler));
+				p["border"] = borderName(border);
+				b.push_back({fmt::format("resampled/scale={:g}/sampler={}/border={}",
+				                         scale, samplerName(sampler), borderName(border)), p,
+				             [scale,sampler,border](const HDRImage & img)
+				             {
+					             return timed([&]
+					             {
+						             consume(img.resampled(int(scale * img.width()), int(scale * img.height()),
+						                                   AtomicProgress(), [](const Vector2f & uv) {return uv;},
+						                                   1, sampler, border, border));
+					             });
+				             }});
+			}
+
+	// remapping the image, treated as a lat-long map, to a mirror ball a quarter of its width across,
+	// with a fixed super-sampling grid and with sampling adapted to each pixel's footprint
+	for (int samples : {1, 8, 0})
+	{
+		string filter = samples ? fmt::format("supersampled{}", samples) : "filtered";
+		b.push_back({"remap/latlong-mirrorball/filter=" + filter, params("filter", filter),
+		             [samples](const HDRImage & img)
+		             {
+			             int size = max(1, img.width() / 4);
+			             auto warp = [](const Vector2f & uv) {return convertEnvMappingUV(LAT_LONG, MIRROR_BALL, uv);};
+			             auto jacobian = [](const Vector2f & uv) {return convertEnvMappingUVJacobian(LAT_LONG, MIRROR_BALL, uv);};
+			             return timed([&]
+			             {
+				             consume(samples ? img.resampled(size, size, AtomicProgress(), warp, samples, HDRImage::BILINEAR)
+				                             : img.filteredResampled(size, size, AtomicProgress(), warp, jacobian));
+			             });
+		             }});
+	}
+
+	// converting the uv coordinates of all pixels to directions and back, one pixel at a time
+	// through function pointers, and in batches
+	const char * mapNames[] = {"angularmap", "mirrorball", "latlong", "cylindrical", "cubemap", "cubemap-hcross", "cubemap-strip"};
+	for (int m = ANGULAR_MAP; m <= CUBE_MAP_STRIP; ++m)
+		for (bool batch : {false, true})
+		{
+			auto mode = EEnvMappingUVMode(m);
+			string impl = batch ? "batch" : "scalar";
+			b.push_back({fmt::format("envMapRoundTrip/map={}/impl={}", mapNames[m], impl),
+			             params("map", mapNames[m], "impl", impl),
+			             [mode,batch](const HDRImage & img)
+			             {
+				             UVArray uv(img.size(), 2);
+				             for (int y = 0, i = 0; y < img.height(); ++y)
+					             for (int x = 0; x < img.width(); ++x, ++i)
+						             uv.row(i) << (x + 0.5f) / img.width(), (y + 0.5f) / img.height();
+				             return timed([&]
+				             {
+					             UVArray result(uv.rows(), 2);
+					             if (batch)
+					             {
+						             XYZArray xyz;
+						             batchEnvMapUVToXYZ(mode, uv, xyz);
+						             batchXYZToEnvMapUV(mode, xyz, result);
+					             }
+					             else
+					             {
+						             UV2XYZFn * toXYZ = envMapUVToXYZ(mode);
+						             XYZ2UVFn * toUV = XYZToEnvMapUV(mode);
+						             for (Eigen::Index i = 0; i < uv.rows(); ++i)
+							             result.row(i) = toUV(toXYZ(uv.row(i).transpose())).transpose();
+					             }
+					             g_sink = g_sink + result(0, 0);
+				             });
+			             }});
+		}
+
+	// building the importance sampling tables of the image, treated as a lat-long map, at full
+	// resolution and downsampled to a quarter of its width
+	for (int divisor : {1, 4})
+		b.push_back({fmt::format("envMapDistribution/downsample={}", divisor), params("downsample", divisor),
+		             [divisor](const HDRImage & img)
+		             {
+			             return timed([&]
+			             {
+				             EnvMapDistribution distribution(img, img.width() / divisor);
+				             g_sink = g_sink + distribution.integral();
+			             });
+		             }});
+
+	b.push_back({"demosaicMalvar", Json::object(),
+	             [](const HDRImage & img)
+	             {
+		             HDRImage raw = img;
+		             raw.bayerMosaic(Vector2i(0, 0));
+		             return timed([&]{raw.demosaicMalvar(Vector2i(0, 0));});
+	             }});
+
+	// whole-image conversions, compared against converting each pixel on its own
+	for (auto dst : {CIELab_CS, HLS_CS})
+	{
+		string name = dst == CIELab_CS ? "lab" : "hsl";
+		b.push_back({"convertedColorSpace/to=" + name, params("to", name),
+		             [dst](const HDRImage & img)
+		             {
+			             return timed([&]{consume(img.convertedColorSpace(dst, LinearSRGB_CS));});
+		             }});
+		b.push_back({"convertPerPixel/to=" + name, params("to", name),
+		             [dst](const HDRImage & img)
+		             {
+			             return timed([&]
+			                          {
+				                          consume(img.unaryExpr([dst](const Color4 & c)
+				                                                {return c.convert(dst, LinearSRGB_CS);}).eval());
+			                          });
+		             }});
+	}
+
+	// the transfer functions applied when saving LDR images, exact and fast
+	b.push_back({"LinearToSRGB/impl=exact", params("impl", "exact"),
+	             [](const HDRImage & img)
+	             {
+		             return timed([&]
+		                          {
+			                          consume(img.unaryExpr([](const Color4 & c) {return LinearToSRGB(c);}).eval());
+		                          });
+	             }});
+	b.push_back({"LinearToSRGB/impl=fast", params("impl", "fast"),
+	             [](const HDRImage & img)
+	             {
+		             HDRImage copy = img;
+		             return timed([&]
+		                          {
+			                          copy.transformColorChannels([](const float * in, float * out, size_t n)
+			                                                      {fastLinearToSRGB(in, out, n);});
+			                          consume(copy);
+		                          });
+	             }});
+	b.push_back({"pow/impl=exact", params("impl", "exact"),
+	             [](const HDRImage & img)
+	             {
+		             return timed([&]{consume(img.pow(Color4(1.f / 2.2f, 1.f)).eval());});
+	             }});
+	b.push_back({"pow/impl=fast", params("impl", "fast"),
+	             [](const HDRImage & img)
+	             {
+		             HDRImage copy = img;
+		             return timed([&]
+		                          {
+			                          copy.transformColorChannels([](const float * in, float * out, size_t n)
+			                                                      {fastPow(in, out, n, 1.f / 2.2f);});
+			                          consume(copy);
+		                          });
+	             }});
+
+	// a 33^3 LUT with a shaper, baked from a filmic-like curve and a saturation matrix
+	auto lut = make_shared<ColorLUT>(ColorLUT::bake([](const Color3 & c)
+	                                                {
+		                                                Color3 t(c.r / (1.f + c.r), c.g / (1.f + c.g), c.b / (1.f + c.b));
+		                                                float l = 0.2126f * t.r + 0.7152f * t.g + 0.0722f * t.b;
+		                                                return Color3(l) + 1.2f * (t - Color3(l));
+	                                                }, 33, 64.f));
+	for (auto interp : {ColorLUT::TETRAHEDRAL, ColorLUT::TRILINEAR})
+	{
+		string name = toLower(ColorLUT::interpolationNames()[interp]);
+		b.push_back({"ColorLUT/interp=" + name, params("interp", name),
+		             [lut,interp](const HDRImage & img)
+		             {
+			             HDRImage copy = img;
+			             return timed([&]
+			                          {
+				                          lut->apply(copy, interp);
+				                          consume(copy);
+			                          });
+		             }});
+	}
+
+	b.push_back({"demosaicAHD", Json::object(),
+	             [](const HDRImage & img)
+	             {
+		             HDRImage raw = img;
+		             raw.bayerMosaic(Vector2i(0, 0));
+		             return timed([&]{raw.demosaicAHD(Vector2i(0, 0), Matrix3f::Identity());});
+	             }});
+
+	b.push_back({"computeStatistics", Json::object(),
+	             [](const HDRImage & img)
+	             {
+		             return timed([&]{g_sink = g_sink + ImageStatistics::computeStatistics(img, 0.f)->average;});
+	             }});
+
+	// the files are decoded from the operating system's file cache, so these measure decoding
+	// and encoding rather than disk speed
+	for (string ext : {"exr", "pfm", "hdr", "png"})
+	{
+		b.push_back({"save/format=" + ext, params("format", ext),
+		             [ext](const HDRImage & img)
+		             {
+			             string filename = createTemporaryFile("hdrview-bench", ext);
+			             double seconds = timed([&]{img.save(filename, 1.f, 2.2f, true, false);});
+			             remove(filename.c_str());
+			             return seconds;
+		             }});
+
+		b.push_back({"load/format=" + ext, params("format", ext),
+		             [ext](const HDRImage & img)
+		             {
+			             string filename = createTemporaryFile("hdrview-bench", ext);
+			             img.save(filename, 1.f, 2.2f, true, false);
+			             HDRImage loaded;
+			             double seconds = timed([&]{loaded.load(filename);});
+			             remove(filename.c_str());
+			             consume(loaded);
+			             return seconds;
+		             }});
+	}
+
+	return b;
+}
+
+// the error of one fast function against its exact counterpart over an interval of floats
+struct AccuracyTest
+{
+	string name;
+	float lo, hi;
+	bool absolute;                                   // measure the absolute error instead of ulps
+	double bound;                                    // the largest error documented in FastMath.h
+	function<void(const float *, float *, size_t)> fast;
+	function<double(double)> exact;
+};
+
+// the floats ordered by value, as consecutive integers
+int64_t floatOrdinal(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(f));
+	return (bits & 0x80000000u) ? -int64_t(bits & 0x7fffffffu) : int64_t(bits);
+}
+
+float ordinalFloat(int64_t o)
+{
+	uint32_t bits = o < 0 ? (uint32_t(-o) | 0x80000000u) : uint32_t(o);
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+// the error of \a value in units in the last place of the correctly rounded \a exact value
+double ulpError(float value, double exact)
+{
+	float rounded = float(exact);
+	if (std::isinf(rounded) || std::isinf(value))
+		return value == rounded ? 0.0 : std::numeric_limits<double>::infinity();
+	if (std::isnan(value) || std::isnan(exact))
+		return std::isnan(value) == std::isnan(exact) ? 0.0 : std::numeric_limits<double>::infinity();
+
+	float magnitude = std::fabs(rounded);
+	double ulp = double(nextafter(magnitude, std::numeric_limits<float>::infinity())) - magnitude;
+	return std::fabs(value - exact) / ulp;
+}
+
+vector<AccuracyTest> allAccuracyTests()
+{
+	const float maxFloat = std::numeric_limits<float>::max();
+	const float minDenormal = std::numeric_limits<float>::denorm_min();
+	auto exactLinearToSRGB = [](double a) {return a < 0.0031308 ? 12.92 * a : 1.055 * pow(a, 1.0/2.4) - 0.055;};
+	auto exactSRGBToLinear = [](double a) {return a < 0.04045 ? (1.0 / 12.92) * a : pow((a + 0.055) * (1.0 / 1.055), 2.4);};
+
+	auto log2Fast = [](const float * in, float * out, size_t n) {fastLog2(in, out, n);};
+	auto log2Exact = [](double x) {return log2(x);};
+
+	// Each bound is the maximum error of an exhaustive sweep (stride 1) plus a margin of about 10%,
+	// rounded up, and matches the figure documented in FastMath.h. A bound that fails therefore
+	// points to a regression rather than to an input the sweep missed.
+	return
+	{
+		{"log2/x<1/2", minDenormal, 0.49999997f, false, 1.35, log2Fast, log2Exact},
+		{"log2/x in [1/2,2]", 0.5f, 2.f, false, 3.3, log2Fast, log2Exact},
+		{"log2/x>2", 2.00000024f, maxFloat, false, 1.35, log2Fast, log2Exact},
+		{"exp2", -150.f, 128.f, false, 1.3,
+		 [](const float * in, float * out, size_t n) {fastExp2(in, out, n);},
+		 [](double y) {return exp2(y);}},
+		{"pow/p=1/2.2", 0.f, maxFloat, false, 1.65,
+		 [](const float * in, float * out, size_t n) {fastPow(in, out, n, 1.f / 2.2f);},
+		 [](double x) {return pow(x, double(1.f / 2.2f));}},
+		{"pow/p=2.2", 0.f, 3e17f, false, 3.7,
+		 [](const float * in, float * out, size_t n) {fastPow(in, out, n, 2.2f);},
+		 [](double x) {return pow(x, double(2.2f));}},
+		{"LinearToSRGB", 0.f, maxFloat, false, 5.3,
+		 [](const float * in, float * out, size_t n) {fastLinearToSRGB(in, out, n);},
+		 exactLinearToSRGB},
+		{"SRGBToLinear", 0.f, 1e16f, false, 4.4,
+		 [](const float * in, float * out, size_t n) {fastSRGBToLinear(in, out, n);},
+		 exactSRGBToLinear},
+		{"LinearToAdobeRGB", 0.f, maxFloat, false, 1.7,
+		 [](const float * in, float * out, size_t n) {fastLinearToAdobeRGB(in, out, n);},
+		 [](double a) {return pow(a, 1.0 / 2.19921875);}},
+		{"AdobeRGBToLinear", 0.f, 1e17f, false, 3.5,
+		 [](const float * in, float * out, size_t n) {fastAdobeRGBToLinear(in, out, n);},
+		 [](double a) {return pow(a, 2.19921875);}},
+		{"normalizedLogScale", -maxFloat, maxFloat, true, 2e-6,
+		 [](const float * in, float * out, size_t n) {fastNormalizedLogScale(in, out, n);},
+		 [](double v) {return (v > 0 ? 1.0 : -1.0) * log(1000.0 * std::fabs(v) + 1.0) / log(1001.0);}},
+		{"sin", -1e4f, 1e4f, true, 1e-7,
+		 [](const float * in, float * out, size_t n) {float c; for (size_t i = 0; i < n; ++i) fastSinCos(in[i], out[i], c);},
+		 [](double x) {return sin(x);}},
+		{"cos", -1e4f, 1e4f, true, 1e-7,
+		 [](const float * in, float * out, size_t n) {float s; for (size_t i = 0; i < n; ++i) fastSinCos(in[i], s, out[i]);},
+		 [](double x) {return cos(x);}},
+		{"atan2/x=1", -maxFloat, maxFloat, true, 3.1e-7,
+		 [](const float * in, float * out, size_t n) {for (size_t i = 0; i < n; ++i) out[i] = fastAtan2(in[i], 1.f);},
+		 [](double y) {return atan2(y, 1.0);}},
+		{"atan2/y=1", -maxFloat, maxFloat, true, 3.1e-7,
+		 [](const float * in, float * out, size_t n) {for (size_t i = 0; i < n; ++i) out[i] = fastAtan2(1.f, in[i]);},
+		 [](double x) {return atan2(1.0, x);}},
+		{"acos", -1.f, 1.f, true, 5e-7,
+		 [](const float * in, float * out, size_t n) {for (size_t i = 0; i < n; ++i) out[i] = fastAcos(in[i]);},
+		 [](double x) {return acos(x);}}
+	};
+}
+
+// check the Philox generator against the known-answer vectors of the Random123 library, which
+// Noise.cpp must reproduce bit for bit for its noise to match other implementations
+Json philoxReport()
+{
+	struct KnownAnswer
+	{
+		uint32_t counter[4];
+		uint64_t seed;
+		uint32_t expected[4];
+	};
+	const KnownAnswer answers[] =
+	{
+		{{0x00000000, 0x00000000, 0x00000000, 0x00000000}, 0x0000000000000000ull,
+		 {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+		{{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, 0xffffffffffffffffull,
+		 {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+		{{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, 0x299f31d0a4093822ull,
+		 {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}}
+	};
+
+	bool passed = true;
+	Json report = Json::object();
+	report["vectors"] = Json::array();
+	for (auto & answer : answers)
+	{
+		uint32_t out[4];
+		Philox(answer.seed).generate(answer.counter, out);
+		bool matches = equal(out, out + 4, answer.expected);
+
+		Json entry = Json::object();
+		entry["counter"] = fmt::format("{:08x} {:08x} {:08x} {:08x}", answer.counter[0], answer.counter[1],
+		                               answer.counter[2], answer.counter[3]);
+		entry["seed"] = fmt::format("{:016x}", answer.seed);
+		entry["output"] = fmt::format("{:08x} {:08x} {:08x} {:08x}", out[0], out[1], out[2], out[3]);
+		entry["passed"] = matches;
+		report["vectors"].push_back(entry);
+
+		if (!matches)
+		{
+			spdlog::get("console")->error("Philox: wrong output {} for counter {} and seed {}.",
+			                              entry["output"].asString(), entry["counter"].asString(), entry["seed"].asString());
+			passed = false;
+		}
+	}
+	if (passed)
+		spdlog::get("console")->info("Philox: all {} known answers match.", sizeof(answers) / sizeof(answers[0]));
+	report["passed"] = passed;
+	return report;
+}
+
+// compare the batch convertColorSpace() with the per-color version for every pair of color spaces,
+// over a grid of linear sRGB colors converted to the source space, against the bounds of Colorspace.h
+Json colorSpaceReport()
+{
+	const int N = 90;
+	vector<float> r, g, b;
+	for (float scale : {1.f, 8.f, 1000.f})
+		for (int i = 0; i <= N; ++i)
+			for (int j = 0; j <= N; ++j)
+				for (int k = 0; k <= N; ++k)
+				{
+					r.push_back(scale * i / N);
+					g.push_back(scale * j / N);
+					b.push_back(scale * k / N);
+				}
+	size_t n = r.size();
+
+	const int numSpaces = int(colorSpaceNames().size());
+	auto isHue = [](EColorSpace cs) {return cs == HLS_CS || cs == HSV_CS;};
+	auto isCIELuminance = [](EColorSpace cs) {return cs == CIELab_CS || cs == CIELuv_CS;};
+
+	vector<Json> entries(numSpaces * numSpaces);
+	vector<char> pairPassed(numSpaces * numSpaces, true);
+	parallel_for(0, numSpaces * numSpaces, [&](int pair)
+	{
+		EColorSpace src = EColorSpace(pair / numSpaces), dst = EColorSpace(pair % numSpaces);
+		if (src == dst)
+			return;
+
+		vector<float> A(n), B(n), C(n), a(n), bb(n), c(n);
+		for (size_t i = 0; i < n; ++i)
+			convertColorSpace(src, &A[i], &B[i], &C[i], LinearSRGB_CS, r[i], g[i], b[i]);
+		convertColorSpace(dst, a.data(), bb.data(), c.data(), src, A.data(), B.data(), C.data(), n);
+
+		double maxError = 0.0;
+		size_t worst = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			float exact[3], batch[3] = {a[i], bb[i], c[i]};
+			convertColorSpace(dst, &exact[0], &exact[1], &exact[2], src, A[i], B[i], C[i]);
+			// the hue and saturation of nearly gray colors are ill-conditioned, so compare their RGB values
+			if (isHue(dst))
+			{
+				convertColorSpace(LinearSRGB_CS, &exact[0], &exact[1], &exact[2], dst, exact[0], exact[1], exact[2]);
+				convertColorSpace(LinearSRGB_CS, &batch[0], &batch[1], &batch[2], dst, batch[0], batch[1], batch[2]);
+			}
+
+			double magnitude = 1e-3, difference = 0.0;
+			for (int ch = 0; ch < 3; ++ch)
+			{
+				magnitude = max(magnitude, double(std::fabs(exact[ch])));
+				difference = max(difference, std::fabs(double(batch[ch]) - exact[ch]));
+			}
+			double error = difference / magnitude;
+			if (error > maxError || std::isnan(error))
+			{
+				maxError = error;
+				worst = i;
+			}
+		}
+
+		double bound = isCIELuminance(src) || isCIELuminance(dst) ? 4e-6 : 2e-6;
+		string name = colorSpaceNames()[src] + " -> " + colorSpaceNames()[dst];
+		Json entry = Json::object();
+		entry["name"] = name;
+		entry["max_rel_error"] = maxError;
+		entry["worst_input"] = fmt::format("{:g} {:g} {:g}", A[worst], B[worst], C[worst]);
+		entry["bound"] = bound;
+		entry["passed"] = maxError <= bound;
+		entries[pair] = entry;
+
+		if (!(maxError <= bound))
+		{
+			spdlog::get("console")->error("convertColorSpace {}: the relative error {:.3g} at ({}) exceeds the "
+			                              "documented bound of {:g}.", name, maxError, entry["worst_input"].asString(), bound);
+			pairPassed[pair] = false;
+		}
+	});
+
+	Json report = Json::object();
+	report["colors"] = n;
+	report["pairs"] = Json::array();
+	for (auto & entry : entries)
+		if (entry.contains("name"))
+			report["pairs"].push_back(entry);
+	bool passed = all_of(pairPassed.begin(), pairPassed.end(), [](char p) {return bool(p);});
+	if (passed)
+		spdlog::get("console")->info("convertColorSpace: the batch conversions of all {} pairs are within their bounds.",
+		                             report["pairs"].size());
+	report["passed"] = passed;
+	return report;
+}
+
+// a cube map layout in double precision, independent of the one in EnvMap.cpp: the cell of each
+// face in a grid of cols x rows faces, and the directions that right and down in the image point to
+struct ExactCubeLayout
+{
+	int cols, rows;
+	int col[6], row[6];
+	double right[6][3], down[6][3];
+};
+
+const ExactCubeLayout & exactCubeLayout(EEnvMappingUVMode mode)
+{
+	static const ExactCubeLayout verticalCross =
+	{
+		3, 4, {2, 0, 1, 1, 1, 1}, {1, 1, 0, 2, 1, 3},
+		{{0,0,-1}, {0,0,1}, {1,0,0}, {1,0,0}, {1,0,0}, {1,0,0}},
+		{{0,-1,0}, {0,-1,0}, {0,0,1}, {0,0,-1}, {0,-1,0}, {0,1,0}}
+	};
+	static const ExactCubeLayout horizontalCross =
+	{
+		4, 3, {2, 0, 1, 1, 1, 3}, {1, 1, 0, 2, 1, 1},
+		{{0,0,-1}, {0,0,1}, {1,0,0}, {1,0,0}, {1,0,0}, {-1,0,0}},
+		{{0,-1,0}, {0,-1,0}, {0,0,1}, {0,0,-1}, {0,-1,0}, {0,-1,0}}
+	};
+	static const ExactCubeLayout strip =
+	{
+		6, 1, {0, 1, 2, 3, 4, 5}, {0, 0, 0, 0, 0, 0},
+		{{0,0,-1}, {0,0,1}, {1,0,0}, {1,0,0}, {1,0,0}, {-1,0,0}},
+		{{0,-1,0}, {0,-1,0}, {0,0,1}, {0,0,-1}, {0,-1,0}, {0,-1,0}}
+	};
+	return mode == CUBE_MAP_STRIP ? strip : mode == CUBE_MAP_HORIZONTAL_CROSS ? horizontalCross : verticalCross;
+}
+
+// the environment map conversions of EnvMap.h in double precision, evaluated at float inputs
+Vector3d exactEnvMapUVToXYZ(EEnvMappingUVMode mode, const Vector2f & uv)
+{
+	double X = 2.0 * uv(0) - 1, Y = 2.0 * uv(1) - 1, r = sqrt(X * X + Y * Y);
+	double theta = 1.5 * M_PI - 2 * M_PI * uv(0);
+	switch (mode)
+	{
+		case ANGULAR_MAP:
+		case MIRROR_BALL:
+		{
+			double phi = mode == ANGULAR_MAP ? min(r, 1.0) * M_PI : 2 * asin(min(r, 1.0));
+			double angle = atan2(Y, X);
+			return Vector3d(sin(phi) * cos(angle), -sin(phi) * sin(angle), cos(phi));
+		}
+		case LAT_LONG:
+		case CYLINDRICAL:
+		{
+			double cosPhi = mode == LAT_LONG ? cos(M_PI * uv(1)) : 1 - 2.0 * uv(1);
+			double sinPhi = mode == LAT_LONG ? sin(M_PI * uv(1)) : sqrt(max(0.0, 1 - cosPhi * cosPhi));
+			return Vector3d(sinPhi * cos(theta), cosPhi, sinPhi * sin(theta));
+		}
+		default:
+		{
+			const ExactCubeLayout & layout = exactCubeLayout(mode);
+			// the cell is picked from the coordinates scaled in floats, like the batch version
+			float fu = uv(0) * layout.cols, fv = uv(1) * layout.rows;
+			int c = clamp(int(floor(fu)), 0, layout.cols - 1), row = clamp(int(floor(fv)), 0, layout.rows - 1);
+			// cells without a face belong to the face in the same column and the row of +z
+			int f = -1, equatorFace = 4;
+			for (int i = 0; i < 6; ++i)
+				if (layout.col[i] == c && layout.row[i] == row)
+					f = i;
+				else if (layout.col[i] == c && layout.row[i] == layout.row[4])
+					equatorFace = i;
+			f = f < 0 ? equatorFace : f;
+			double s = 2.0 * (fu - layout.col[f]) - 1, t = 2.0 * (fv - layout.row[f]) - 1;
+			if (row != layout.row[f])
+				t = clamp(t, -1.0, 1.0);
+			Vector3d p = s * Map<const Vector3d>(layout.right[f]) + t * Map<const Vector3d>(layout.down[f]);
+			p(f / 2) += (f & 1) ? -1.0 : 1.0;
+			return p.normalized();
+		}
+	}
+}
+
+Vector2d exactXYZToEnvMapUV(EEnvMappingUVMode mode, const Vector3f & xyz)
+{
+	double x = xyz(0), y = xyz(1), z = xyz(2);
+	double longitude = (1.5 * M_PI - atan2(z, x)) / (2 * M_PI);
+	longitude -= floor(longitude);
+	switch (mode)
+	{
+		case ANGULAR_MAP:
+		case MIRROR_BALL:
+		{
+			double phi = acos(clamp(z, -1.0, 1.0)), angle = atan2(y, x);
+			double radius = mode == ANGULAR_MAP ? phi / M_PI : sin(phi / 2);
+			return Vector2d(0.5 * (radius * cos(angle) + 1), 0.5 * (1 - radius * sin(angle)));
+		}
+		case LAT_LONG:
+			return Vector2d(longitude, acos(clamp(y, -1.0, 1.0)) / M_PI);
+		case CYLINDRICAL:
+			return Vector2d(longitude, 0.5 * (1 - y));
+		default:
+		{
+			const ExactCubeLayout & layout = exactCubeLayout(mode);
+			// the major axis, with ties going to x, then y
+			int axis = fabs(xyz(1)) > fabs(xyz(0)) ? 1 : 0;
+			axis = fabs(xyz(2)) > fabs(xyz(axis)) ? 2 : axis;
+			int f = 2 * axis + (xyz(axis) > 0 ? 0 : 1);
+			Vector3d temp = xyz.cast<double>() / fabs(double(xyz(axis)));
+			double s = temp.dot(Map<const Vector3d>(layout.right[f])), t = temp.dot(Map<const Vector3d>(layout.down[f]));
+			return Vector2d((layout.col[f] + 0.5 * (s + 1)) / layout.cols, (layout.row[f] + 0.5 * (t + 1)) / layout.rows);
+		}
+	}
+}
+
+// compare the batch environment map conversions with their double-precision counterparts, in both
+// directions, over a grid of uv coordinates and of directions, against the bounds of EnvMap.h
+Json envMapReport()
+{
+	const int N = 1000;
+	UVArray uv((N + 1) * (N + 1), 2);
+	XYZArray xyz((N + 1) * (N + 1), 3);
+	for (int j = 0, i = 0; j <= N; ++j)
+		for (int k = 0; k <= N; ++k, ++i)
+		{
+			uv.row(i) << float(k) / N, float(j) / N;
+			// directions on a lat-long grid, including the poles and the seam
+			xyz.row(i) = exactEnvMapUVToXYZ(LAT_LONG, uv.row(i).transpose()).cast<float>().transpose();
+		}
+
+	bool passed = true;
+	Json report = Json::object();
+	report["points"] = uv.rows();
+	report["conversions"] = Json::array();
+	for (int m = ANGULAR_MAP; m <= CUBE_MAP_STRIP; ++m)
+		for (bool toXYZ : {true, false})
+		{
+			auto mode = EEnvMappingUVMode(m);
+			XYZArray batchXYZ;
+			UVArray batchUV;
+			if (toXYZ)
+				batchEnvMapUVToXYZ(mode, uv, batchXYZ);
+			else
+				batchXYZToEnvMapUV(mode, xyz, batchUV);
+
+			double maxError = 0.0;
+			Eigen::Index worst = 0;
+			for (Eigen::Index i = 0; i < uv.rows(); ++i)
+			{
+				double error;
+				if (toXYZ)
+					error = (batchXYZ.row(i).transpose().matrix().cast<double>() - exactEnvMapUVToXYZ(mode, uv.row(i).transpose())).cwiseAbs().maxCoeff();
+				else
+				{
+					Vector2d difference = (batchUV.row(i).transpose().matrix().cast<double>() - exactXYZToEnvMapUV(mode, xyz.row(i).transpose())).cwiseAbs();
+					// the longitude wraps around at the seam, and is undefined at the poles
+					if (mode == LAT_LONG || mode == CYLINDRICAL)
+						difference(0) = xyz(i, 0) == 0.f && xyz(i, 2) == 0.f ? 0.0 : min(difference(0), 1 - difference(0));
+					error = difference.maxCoeff();
+				}
+				if (error > maxError || std::isnan(error))
+				{
+					maxError = error;
+					worst = i;
+				}
+			}
+
+			double bound = 6e-7;
+			string name = envMappingNames()[m] + (toXYZ ? " uv -> xyz" : " xyz -> uv");
+			Json entry = Json::object();
+			entry["name"] = name;
+			entry["max_abs_error"] = maxError;
+			entry["worst_input"] = toXYZ ? fmt::format("{:g} {:g}", uv(worst, 0), uv(worst, 1))
+			                             : fmt::format("{:g} {:g} {:g}", xyz(worst, 0), xyz(worst, 1), xyz(worst, 2));
+			entry["bound"] = bound;
+			entry["passed"] = maxError <= bound;
+			report["conversions"].push_back(entry);
+
+			spdlog::get("console")->info("{}: max error {:.3g} at ({}).", name, maxError, entry["worst_input"].asString());
+			if (!(maxError <= bound))
+			{
+				spdlog::get("console")->error("{}: the error exceeds the documented bound of {:g}.", name, bound);
+				passed = false;
+			}
+		}
+	report["passed"] = passed;
+	return report;
+}
+
+// a TIFF directory entry; rationals are stored as pairs of numerator and denominator values
+struct TIFFEntry
+{
+	uint16_t tag, type;
+	vector<uint32_t> values;
+};
+
+/*!
+ * Write the 16-bit RGGB mosaic \a raw as a minimal uncompressed DNG file, whose color matrix
+ * makes the developed colors the camera's colors, without white balance.
+ */
+void writeRawDNG(const string & filename, const vector<uint16_t> & raw, int w, int h)
+{
+	const uint16_t BYTE = 1, SHORT = 3, LONG = 4, RATIONAL = 5, SRATIONAL = 10;
+
+	// the color matrix maps XYZ D50 to camera colors, which develop() maps to linear sRGB with
+	// its inverse, so using the XYZ D50 to linear sRGB matrix makes the conversion the identity
+	const double XYZD50TosRGB[9] = {3.2404542, -1.5371385, -0.4985314,
+	                                -0.9692660, 1.8760108, 0.0415560,
+	                                0.0556434, -0.2040259, 1.0572252};
+	vector<uint32_t> colorMatrix;
+	for (double m : XYZD50TosRGB)
+	{
+		colorMatrix.push_back(uint32_t(int32_t(lround(m * 1e7))));
+		colorMatrix.push_back(10000000);
+	}
+
+	vector<TIFFEntry> entries = {
+		{254, LONG, {0}},                                            // NewSubFileType: the main image
+		{256, LONG, {uint32_t(w)}},                                  // ImageWidth
+		{257, LONG, {uint32_t(h)}},                                  // ImageLength
+		{258, SHORT, {16}},                                          // BitsPerSample
+		{259, SHORT, {1}},                                           // Compression: none
+		{262, SHORT, {32803}},                                       // PhotometricInterpretation: CFA
+		{273, LONG, {0}},                                            // StripOffsets, set below
+		{277, SHORT, {1}},                                           // SamplesPerPixel
+		{278, LONG, {uint32_t(h)}},                                  // RowsPerStrip
+		{279, LONG, {uint32_t(2 * raw.size())}},                     // StripByteCounts
+		{284, SHORT, {1}},                                           // PlanarConfiguration: chunky
+		{33421, SHORT, {2, 2}},                                      // CFARepeatPatternDim
+		{33422, BYTE, {0, 1, 1, 2}},                                 // CFAPattern: red, green, green, blue
+		{50706, BYTE, {1, 4, 0, 0}},                                 // DNGVersion
+		{50714, SHORT, {0}},                                         // BlackLevel
+		{50717, SHORT, {65535}},                                     // WhiteLevel
+		{50721, SRATIONAL, colorMatrix},                             // ColorMatrix1
+		{50722, SRATIONAL, colorMatrix},                             // ColorMatrix2
+		{50728, RATIONAL, {1, 1, 1, 1, 1, 1}},                       // AsShotNeutral
+		{50778, SHORT, {21}},                                        // CalibrationIlluminant1: D65
+		{50779, SHORT, {21}},                                        // CalibrationIlluminant2: D65
+		{50829, LONG, {0, 0, uint32_t(h), uint32_t(w)}}              // ActiveArea: top, left, bottom, right
+	};
+	auto valueSize = [=](uint16_t type) {return type == BYTE ? 1 : type == SHORT ? 2 : 4;};
+
+	// the header, the directory, the values that do not fit in their entries, and then the pixels
+	size_t extraOffset = 8 + 2 + 12 * entries.size() + 4, dataOffset = extraOffset;
+	for (auto & e : entries)
+	{
+		size_t bytes = e.values.size() * valueSize(e.type);
+		if (bytes > 4)
+			dataOffset += bytes + bytes % 2;
+	}
+	entries[6].values[0] = uint32_t(dataOffset);
+
+	vector<uint8_t> file(dataOffset + 2 * raw.size());
+	auto put = [&file](size_t pos, uint32_t v, int size)
+	{
+		for (int i = 0; i < size; ++i)
+			file[pos + i] = uint8_t(v >> (8 * i));
+	};
+	file[0] = file[1] = 'I';
+	put(2, 42, 2);
+	put(4, 8, 4);
+	put(8, uint32_t(entries.size()), 2);
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		auto & e = entries[i];
+		size_t pos = 10 + 12 * i, size = valueSize(e.type), bytes = e.values.size() * size;
+		put(pos, e.tag, 2);
+		put(pos + 2, e.type, 2);
+		put(pos + 4, uint32_t(e.type == RATIONAL || e.type == SRATIONAL ? e.values.size() / 2 : e.values.size()), 4);
+		size_t valuePos = pos + 8;
+		if (bytes > 4)
+		{
+			put(pos + 8, uint32_t(extraOffset), 4);
+			valuePos = extraOffset;
+			extraOffset += bytes + bytes % 2;
+		}
+		for (size_t k = 0; k < e.values.size(); ++k)
+			put(valuePos + k * size, e.values[k], int(size));
+	}
+	put(10 + 12 * entries.size(), 0, 4);
+	for (size_t i = 0; i < raw.size(); ++i)
+		put(dataOffset + 2 * i, raw[i], 2);
+
+	ofstream out(filename, ios::binary);
+	out.write(reinterpret_cast<const char *>(file.data()), file.size());
+	if (!out)
+		throw runtime_error(fmt::format("Could not write \"{}\".", filename));
+}
+
+/*!
+ * Merge raw brackets of a synthetic scene, written as DNG files and developed by the same loader as
+ * any other raw file, and compare the result with the developed middle bracket. Nothing clips, so
+ * the brackets only differ by their exposure and rounding.
+ */
+Json rawBracketReport()
+{
+	const int w = 64, h = 48;
+	const float evs[] = {-2.f, 0.f, 2.f};
+
+	bool passed = true;
+	Json report = Json::object();
+	report["width"] = w;
+	report["height"] = h;
+	report["merges"] = Json::array();
+
+	vector<string> filenames;
+	try
+	{
+		for (float ev : evs)
+		{
+			vector<uint16_t> raw(size_t(w) * h);
+			for (int y = 0; y < h; ++y)
+				for (int x = 0; x < w; ++x)
+				{
+					// a smooth scene between 2% and 20% of white, so that the brightest bracket does not clip
+					float u = (x + 0.5f) / w, v = (y + 0.5f) / h;
+					float scene[3] = {0.02f + 0.18f * u,
+					                  0.02f + 0.09f * (1.f + sin(6.f * v)),
+					                  0.02f + 0.18f * v * (1.f - u)};
+					float value = pow(2.f, ev) * scene[x % 2 + y % 2];
+					raw[y * size_t(w) + x] = uint16_t(lround(clamp(value, 0.f, 1.f) * 65535.f));
+				}
+			filenames.push_back(createTemporaryFile("hdrview-bench", "dng"));
+			writeRawDNG(filenames.back(), raw, w, h);
+		}
+
+		HDRImage reference;
+		if (!reference.load(filenames[1]) || reference.width() != w || reference.height() != h)
+			throw runtime_error("Could not develop the middle bracket.");
+
+		for (bool estimate : {false, true})
+		{
+			ExposureMergeOptions options;
+			if (!estimate)
+				options.exposures.assign(begin(evs), end(evs));
+			HDRImage merged = mergeExposures(filenames, options, size_t(1) << 30);
+
+			// the relative error, which is measured against 1% of white in the darkest pixels
+			double maxError = 0.0;
+			Vector2i worst(0, 0);
+			for (int y = 0; y < h; ++y)
+				for (int x = 0; x < w; ++x)
+					for (int c = 0; c < 3; ++c)
+					{
+						double error = std::fabs(merged(x, y)[c] - reference(x, y)[c]) /
+						               max(std::fabs(double(reference(x, y)[c])), 0.01);
+						if (error > maxError || std::isnan(error))
+						{
+							maxError = error;
+							worst = Vector2i(x, y);
+						}
+					}
+
+			// the 16-bit rounding of the darkest bracket and the demosaicing of each bracket differ by about 4e-4
+			double bound = 2e-3;
+			string name = estimate ? "estimated exposures" : "given exposures";
+			Json entry = Json::object();
+			entry["name"] = name;
+			entry["max_rel_error"] = maxError;
+			entry["worst_pixel"] = fmt::format("{} {}", worst.x(), worst.y());
+			entry["bound"] = bound;
+			entry["passed"] = maxError <= bound;
+			report["merges"].push_back(entry);
+
+			spdlog::get("console")->info("Raw brackets, {}: max relative error {:.3g} at ({}).", name, maxError,
+			                             entry["worst_pixel"].asString());
+			if (!(maxError <= bound))
+			{
+				spdlog::get("console")->error("Raw brackets, {}: the error exceeds the bound of {:g}.", name, bound);
+				passed = false;
+			}
+		}
+	}
+	catch (const exception & e)
+	{
+		spdlog::get("console")->error("Raw brackets: {}", e.what());
+		report["error"] = e.what();
+		passed = false;
+	}
+
+	for (auto & filename : filenames)
+		remove(filename.c_str());
+
+	report["passed"] = passed;
+	return report;
+}
+
+// sweep every \a stride-th float of each test's interval, in parallel blocks, and check the errors
+// against their documented bounds
+Json accuracyReport(int stride)
+{
+	bool passed = true;
+	const int64_t blockSize = 1 << 16;
+
+	Json report = Json::object();
+	report["version"] = HDRVIEW_VERSION;
+	report["instruction_set"] = fastMathInstructionSet();
+	report["stride"] = stride;
+	report["tests"] = Json::array();
+
+	for (auto & test : allAccuracyTests())
+	{
+		Timer timer;
+		int64_t first = floatOrdinal(test.lo), last = floatOrdinal(test.hi);
+		int64_t numBlocks = ((last - first) / stride + blockSize) / blockSize;
+
+		mutex m;
+		double maxError = 0.0;
+		float worst = test.lo;
+		parallel_for(0, int(numBlocks), [&](int block)
+		{
+			vector<float> in, out;
+			in.reserve(blockSize);
+			for (int64_t i = 0, o = first + block * blockSize * stride; i < blockSize && o <= last; ++i, o += stride)
+				in.push_back(ordinalFloat(o));
+			out.resize(in.size());
+			test.fast(in.data(), out.data(), in.size());
+
+			double blockError = 0.0;
+			float blockWorst = test.lo;
+			for (size_t i = 0; i < in.size(); ++i)
+			{
+				double exact = test.exact(in[i]);
+				double error = test.absolute ? std::fabs(out[i] - exact) : ulpError(out[i], exact);
+				if (error > blockError)
+				{
+					blockError = error;
+					blockWorst = in[i];
+				}
+			}
+
+			lock_guard<mutex> lock(m);
+			if (blockError > maxError)
+			{
+				maxError = blockError;
+				worst = blockWorst;
+			}
+		});
+
+		Json entry = Json::object();
+		entry["name"] = test.name;
+		entry["lo"] = test.lo;
+		entry["hi"] = test.hi;
+		entry[test.absolute ? "max_abs_error" : "max_ulp_error"] = maxError;
+		entry["worst_input"] = worst;
+		entry["bound"] = test.bound;
+		entry["passed"] = maxError <= test.bound;
+		report["tests"].push_back(entry);
+
+		spdlog::get("console")->info("{}: max error {:.3g} {} at {:g} ({:.1f} s).", test.name, maxError,
+		                             test.absolute ? "absolute" : "ulp", worst, timer.elapsed() / 1000.0);
+		if (maxError > test.bound)
+		{
+			spdlog::get("console")->error("{}: the error exceeds the documented bound of {:g}.", test.name, test.bound);
+			passed = false;
+		}
+	}
+
+	report["philox"] = philoxReport();
+	passed = passed && report["philox"]["passed"].asBool();
+	report["color_spaces"] = colorSpaceReport();
+	passed = passed && report["color_spaces"]["passed"].asBool();
+	report["env_maps"] = envMapReport();
+	passed = passed && report["env_maps"]["passed"].asBool();
+	report["raw_brackets"] = rawBracketReport();
+	passed = passed && report["raw_brackets"]["passed"].asBool();
+
+	report["passed"] = passed;
+	return report;
+}
+
+vector<Vector2i> parseSizes(const string & list)
+{
+	vector<Vector2i> sizes;
+	for (size_t begin = 0, end = 0; end != string::npos; begin = end + 1)
+	{
+		end = list.find(',', begin);
+		string size = list.substr(begin, end == string::npos ? string::npos : end - begin);
+		Vector2i s;
+		char c;
+		if (sscanf(size.c_str(), "%dx%d%c", &s.x(), &s.y(), &c) != 2 || s.x() <= 0 || s.y() <= 0)
+			throw invalid_argument(fmt::format("Cannot parse the image size \"{}\".", size));
+		sizes.push_back(s);
+	}
+	return sizes;
+}
+
+} // namespace
+
+
+int main(int argc, char **argv)
+{
+	try
+	{
+		vector<string> argVector = {argv + 1, argv + argc};
+		auto docargs = docopt::docopt(USAGE, argVector, true, "hdrview-bench " HDRVIEW_VERSION);
+
+		// standard output is reserved for the results
+		auto console = spd::stderr_color_mt("console");
+		spd::set_pattern("[%l] %v");
+		int verbosity = clamp((int)docargs["--verbose"].asLong(), (int)spd::level::trace, (int)spd::level::off);
+		spd::set_level(spd::level::level_enum(verbosity));
+
+		Json results;
+		if (docargs["--accuracy"].asBool())
+		{
+			set_parallel_for_threads(max(0, (int)docargs["--threads"].asLong()));
+			results = accuracyReport(max(1, (int)docargs["--stride"].asLong()));
+		}
+		else
+		{
+			vector<Benchmark> benchmarks = allBenchmarks();
+			if (docargs["--list"].asBool())
+			{
+				for (auto & benchmark : benchmarks)
+					cout << benchmark.name << "\n";
+				return EXIT_SUCCESS;
+			}
+
+			string filter = docargs["--filter"].isString() ? docargs["--filter"].asString() : "";
+			vector<Vector2i> sizes = parseSizes(docargs["--sizes"].asString());
+			int repeats = max(1, (int)docargs["--repeats"].asLong());
+			int warmup = max(0, (int)docargs["--warmup"].asLong());
+			int threads = max(0, (int)docargs["--threads"].asLong());
+			set_parallel_for_threads(threads);
+
+			results = Json::object();
+			results["version"] = HDRVIEW_VERSION;
+			results["hardware_threads"] = thread::hardware_concurrency();
+			results["threads"] = parallel_for_threads();
+			results["repeats"] = repeats;
+			results["warmup"] = warmup;
+			results["benchmarks"] = Json::array();
+
+			Timer total;
+			for (auto & size : sizes)
+			{
+				HDRImage input = syntheticImage(size.x(), size.y());
+				double megapixels = 1e-6 * input.width() * input.height();
+
+				for (auto & benchmark : benchmarks)
+				{
+					if (benchmark.name.find(filter) == string::npos)
+						continue;
+
+					console->info("Running {} on a {}x{} image...", benchmark.name, size.x(), size.y());
+					for (int i = 0; i < warmup; ++i)
+						benchmark.run(input);
+
+					vector<double> seconds, throughput;
+					for (int i = 0; i < repeats; ++i)
+					{
+						seconds.push_back(benchmark.run(input));
+						throughput.push_back(megapixels / max(seconds.back(), 1e-9));
+					}
+
+					Json p = benchmark.params;
+					p["width"] = size.x();
+					p["height"] = size.y();
+
+					Json entry = Json::object();
+					entry["name"] = benchmark.name;
+					entry["params"] = p;
+					entry["megapixels"] = megapixels;
+					entry["seconds"] = summaryStatistics(seconds);
+					entry["megapixels_per_second"] = summaryStatistics(throughput);
+					results["benchmarks"].push_back(entry);
+
+					console->info("{}: median {:.4f} s, {:.2f} MP/s.", benchmark.name,
+					              entry["seconds"]["median"].asNumber(), entry["megapixels_per_second"]["median"].asNumber());
+				}
+			}
+			results["seconds"] = total.elapsed() / 1000.0;
+			results["peak_rss_bytes"] = peakResidentBytes();
+		}
+
+		if (docargs["--out"].isString())
+		{
+			ofstream out(docargs["--out"].asString());
+			out << results.dump(2) << endl;
+			if (!out)
+				throw runtime_error(fmt::format("Cannot write \"{}\".", docargs["--out"].asString()));
+		}
+		else
+			cout << results.dump(2) << endl;
+
+		// the accuracy report is still written when a bound is exceeded, so that it can be inspected
+		if (results.contains("passed") && !results["passed"].asBool())
+			return EXIT_FAILURE;
+	}
+	// Exceptions will only be thrown upon failed logger or sink construction (not during logging)
+	catch (const spd::spdlog_ex& e)
+	{
+		fprintf(stderr, "Log init failed: %s\n", e.what());
+		return 1;
+	}
+	catch (const std::exception &e)
+	{
+		fprintf(stderr, "Error: %s\n%s", e.what(), USAGE);
+		return -1;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -15,9 +15,10 @@
 #include <string>                // for allocator, operator==, basic_string
 #include <vector>                // for vector
 #include "Common.h"              // for lerp, mod, clamp, getExtension
-#include "Colorspace.h"
+#include "Colorspace.h"          // for convertColorSpace
 #include "ParallelFor.h"
 #include "Timer.h"
+#include "Trace.h"
 #include <spdlog/spdlog.h>
 
 
@@ -33,10 +34,14 @@ namespace
 {
 
 const Color4 g_blackPixel(0,0,0,0);
+// the number of pixels whose channels transformColors() splits into separate arrays at a time
+const int g_colorTileSize = 256;
 
 // create a vector containing the normalized values of a 1D Gaussian filter
 ArrayXXf horizontalGaussianKernel(float sigma, float truncate);
 int wrapCoord(int p, int maxP, HDRImage::BorderMode m);
+// successively halve the resolution of image with a 2x2 box filter, down to a single pixel
+vector<HDRImage> boxMipPyramid(const HDRImage & image, HDRImage::BorderMode mX, HDRImage::BorderMode mY);
 void bilinearGreen(HDRImage &raw, int offsetX, int offsetY);
 void PhelippeauGreen(HDRImage &raw, const Vector2i & redOffset);
 void MalvarGreen(HDRImage &raw, int c, const Vector2i & redOffset);
@@ -171,32 +176,120 @@ HDRImage HDRImage::resampled(int w, int h,
                              AtomicProgress progress,
                              function<Vector2f(const Vector2f &)> warpFn,
                              int superSample, Sampler sampler, BorderMode mX, BorderMode mY) const
+{
+    // warp the samples of each row one at a time
+    BatchWarpFn batchWarpFn = [&warpFn](const Array<float, Dynamic, 2> & dstUV, Array<float, Dynamic, 2> & srcUV)
+    {
+        srcUV.resize(dstUV.rows(), 2);
+        for (Index i = 0; i < dstUV.rows(); ++i)
+            srcUV.row(i) = warpFn(dstUV.row(i).transpose()).transpose();
+    };
+    return resampled(w, h, progress, batchWarpFn, superSample, sampler, mX, mY);
+}
+
+
+HDRImage HDRImage::resampled(int w, int h,
+                             AtomicProgress progress,
+                             const BatchWarpFn & warpFn,
+                             int superSample, Sampler sampler, BorderMode mX, BorderMode mY) const
 {
     HDRImage result(w, h);
 
     Timer timer;
+    TraceZone zone("resampled", traceImageId(this), size() * sizeof(Color4));
+    int samplesPerPixel = superSample * superSample;
     progress.setNumSteps(result.height());
-    // for every pixel in the image
-    parallel_for(0, result.height(), [this,w,h,&progress,&warpFn,&result,superSample,sampler,mX,mY](int y)
+    parallel_for(0, result.height(), [this,w,h,&progress,&warpFn,&result,superSample,samplesPerPixel,sampler,mX,mY](int y)
     {
-        for (int x = 0; x < result.width(); ++x)
+        // the samples of all pixels in this row
+        Array<float, Dynamic, 2> dstUV(result.width() * samplesPerPixel, 2), srcUV;
+        for (int x = 0, i = 0; x < result.width(); ++x)
+            for (int yy = 0; yy < superSample; ++yy)
+                for (int xx = 0; xx < superSample; ++xx, ++i)
+                    dstUV.row(i) << (x + (xx + 0.5f) / superSample) / w, (y + (yy + 0.5f) / superSample) / h;
+
+        warpFn(dstUV, srcUV);
+
+        for (int x = 0, i = 0; x < result.width(); ++x)
         {
             Color4 sum(0, 0, 0, 0);
-            for (int yy = 0; yy < superSample; ++yy)
+            for (int s = 0; s < samplesPerPixel; ++s, ++i)
+                sum += sample(srcUV(i, 0) * width(), srcUV(i, 1) * height(), sampler, mX, mY);
+            result(x, y) = sum / samplesPerPixel;
+        }
+        ++progress;
+    });
+    spdlog::get("console")->trace("Resampling took: {} seconds.", (timer.elapsed()/1000.f));
+    return result;
+}
+
+
+HDRImage HDRImage::filteredResampled(int w, int h,
+                                     AtomicProgress progress,
+                                     function<Vector2f(const Vector2f &)> warpFn,
+                                     function<Matrix2f(const Vector2f &)> jacobianFn,
+                                     Sampler sampler, BorderMode mX, BorderMode mY, int maxSamples) const
+{
+    HDRImage result(w, h);
+
+    Timer timer;
+    TraceZone zone("filteredResampled", traceImageId(this), size() * sizeof(Color4));
+
+    maxSamples = std::max(1, maxSamples);
+
+    // the levels below this full-resolution image
+    vector<HDRImage> mips = boxMipPyramid(*this, mX, mY);
+
+    // converts derivatives in uv coordinates to source pixels per destination pixel
+    Matrix2f toSource = Vector2f(width(), height()).asDiagonal();
+    Matrix2f fromDestination = Vector2f(1.f / w, 1.f / h).asDiagonal();
+
+    progress.setNumSteps(result.height());
+    parallel_for(0, result.height(), [&,w,h](int y)
+    {
+        for (int x = 0; x < result.width(); ++x)
+        {
+            Vector2f uv((x + 0.5f) / w, (y + 0.5f) / h);
+            Vector2f srcPixel = warpFn(uv).array() * Array2f(width(), height());
+
+            // the edges of the parallelogram this pixel covers in the source image
+            Matrix2f J = toSource * jacobianFn(uv) * fromDestination;
+            if (!J.allFinite() || !srcPixel.allFinite())
             {
-                float j = (yy + 0.5f) / superSample;
-                for (int xx = 0; xx < superSample; ++xx)
+                result(x, y) = sample(srcPixel(0), srcPixel(1), sampler, mX, mY);
+                continue;
+            }
+
+            // stratify the parallelogram with about one sample per texel along each edge, moving to
+            // coarser mip levels until that takes at most maxSamples samples
+            float lengthX = std::min(J.col(0).norm(), 1e6f), lengthY = std::min(J.col(1).norm(), 1e6f);
+            int level = 0, nX, nY;
+            for (;; ++level)
+            {
+                float texel = float(1 << level);
+                nX = std::max(1, int(std::ceil(lengthX / texel - 1e-3f)));
+                nY = std::max(1, int(std::ceil(lengthY / texel - 1e-3f)));
+                if (nX * nY <= maxSamples || level == int(mips.size()))
+                    break;
+            }
+            nX = std::min(nX, maxSamples);
+            nY = std::min(nY, maxSamples / nX);
+
+            const HDRImage & mip = level ? mips[level - 1] : *this;
+            Vector2f scale(float(mip.width()) / width(), float(mip.height()) / height());
+
+            Color4 sum(0, 0, 0, 0);
+            for (int j = 0; j < nY; ++j)
+                for (int i = 0; i < nX; ++i)
                 {
-                    float i = (xx + 0.5f) / superSample;
-                    Vector2f srcUV = warpFn(Vector2f((x + i) / w, (y + j) / h)).array() * Array2f(width(), height());
-                    sum += sample(srcUV(0), srcUV(1), sampler, mX, mY);
+                    Vector2f p = (srcPixel + J * Vector2f((i + 0.5f) / nX - 0.5f, (j + 0.5f) / nY - 0.5f)).cwiseProduct(scale);
+                    sum += mip.sample(p(0), p(1), sampler, mX, mY);
                 }
-            }
-            result(x, y) = sum / (superSample * superSample);
+            result(x, y) = sum / float(nX * nY);
         }
         ++progress;
     });
-    spdlog::get("console")->trace("Resampling took: {} seconds.", (timer.elapsed()/1000.f));
+    spdlog::get("console")->trace("Filtered resampling took: {} seconds.", (timer.elapsed()/1000.f));
     return result;
 }
 
@@ -210,6 +303,7 @@ HDRImage HDRImage::convolved(const ArrayXXf &kernel, AtomicProgress progress,
     int centerY = int((kernel.cols()-1.0)/2.0);
 
     Timer timer;
+    TraceZone zone("convolved", traceImageId(this), size() * sizeof(Color4));
 	progress.setNumSteps(result.width());
     // for every pixel in the image
     parallel_for(0, result.width(), [this,&progress,kernel,mX,mY,&result,centerX,centerY](int x)
@@ -276,6 +370,7 @@ HDRImage HDRImage::medianFiltered(float radius, int channel, AtomicProgress prog
     HDRImage tempBuffer = *this;
 
     Timer timer;
+    TraceZone zone("medianFiltered", traceImageId(this), size() * sizeof(Color4));
     progress.setNumSteps(height());
     // for every pixel in the image
     parallel_for(0, height(), [this,&tempBuffer,&progress,radius,radiusi,channel,mX,mY,round](int y)
@@ -327,6 +422,7 @@ HDRImage HDRImage::bilateralFiltered(float sigmaRange, float sigmaDomain,
     int radius = int(std::ceil(truncateDomain * sigmaDomain));
 
     Timer timer;
+    TraceZone zone("bilateralFiltered", traceImageId(this), size() * sizeof(Color4));
     progress.setNumSteps(height());
     // for every pixel in the image
     parallel_for(0, filtered.height(), [this,&filtered,&progress,radius,sigmaRange,sigmaDomain,mX,mY](int y)
@@ -417,6 +513,7 @@ HDRImage HDRImage::fastGaussianBlurred(float sigmaX, float sigmaY,
                                        BorderMode mX, BorderMode mY) const
 {
     Timer timer;
+    TraceZone zone("fastGaussianBlurred", traceImageId(this), size() * sizeof(Color4));
     // See comments in HDRImage::iteratedBoxBlurred for derivation of width
     int hw = std::round((std::sqrt(12.f/6) * sigmaX - 1)/2.f);
     int hh = std::round((std::sqrt(12.f/6) * sigmaY - 1)/2.f);
@@ -458,6 +555,7 @@ HDRImage HDRImage::boxBlurredX(int leftSize, int rightSize, AtomicProgress progr
     HDRImage filtered(width(), height());
 
     Timer timer;
+    TraceZone zone("boxBlurredX", traceImageId(this), size() * sizeof(Color4));
 	progress.setNumSteps(filtered.height());
     // for every pixel in the image
     parallel_for(0, filtered.height(), [this,&filtered,&progress,leftSize,rightSize,mX](int y)
@@ -484,6 +582,7 @@ HDRImage HDRImage::boxBlurredY(int leftSize, int rightSize, AtomicProgress progr
     HDRImage filtered(width(), height());
 
     Timer timer;
+    TraceZone zone("boxBlurredY", traceImageId(this), size() * sizeof(Color4));
 	progress.setNumSteps(filtered.width());
     // for every pixel in the image
     parallel_for(0, filtered.width(), [this,&filtered,&progress,leftSize,rightSize,mY](int x)
@@ -796,6 +895,7 @@ HDRImage HDRImage::medianFilterBayerArtifacts() const
  */
 void HDRImage::demosaicAHD(const Vector2i &redOffset, const Matrix3f &cameraToXYZ)
 {
+    TraceZone zone("demosaicAHD", traceImageId(this), size() * sizeof(Color4));
     using Image3f = Array<Vector3f,Dynamic,Dynamic>;
     using HomoMap = Array<uint8_t,Dynamic,Dynamic>;
     HDRImage rgbH = *this;
@@ -935,13 +1035,12 @@ void HDRImage::demosaicBorder(size_t border)
             Vector3f sum = Vector3f::Zero();
             Vector3i count = Vector3i::Zero();
 
-            for (size_t ys = y - 1; ys <= y + 1; ++ys)
+            // the neighbors are signed, since y - 1 would wrap around and end the loop on the first row
+            for (int ys = int(y) - 1; ys <= int(y) + 1; ++ys)
             {
-                for (size_t xs = x - 1; xs <= x + 1; ++xs)
+                for (int xs = int(x) - 1; xs <= int(x) + 1; ++xs)
                 {
-                    // rely on xs and ys = -1 to wrap around to max value
-                    // since they are unsigned
-                    if (ys < (size_t)height() && xs < (size_t)width())
+                    if (ys >= 0 && ys < height() && xs >= 0 && xs < width())
                     {
                         int c = bayerColor(xs, ys);
                         sum(c) += (*this)(xs,ys)[c];
@@ -1061,6 +1160,95 @@ HDRImage HDRImage::inverted() const
 
 
 
+HDRImage HDRImage::convertedColorSpace(EColorSpace dst, EColorSpace src, AtomicProgress progress) const
+{
+    Timer timer;
+    TraceZone zone("convertedColorSpace", traceImageId(this), size() * sizeof(Color4));
+    int w = width();
+    HDRImage result(w, height());
+
+    progress.setNumSteps(height());
+    parallel_for(0, height(), [this,&result,dst,src,w,&progress](int y)
+    {
+        // gather the row into planar arrays, convert them, and scatter them back
+        vector<float> a(w), b(w), c(w);
+        for (int x = 0; x < w; ++x)
+        {
+            const Color4 & p = (*this)(x, y);
+            a[x] = p.r;
+            b[x] = p.g;
+            c[x] = p.b;
+        }
+
+        convertColorSpace(dst, a.data(), b.data(), c.data(), src, a.data(), b.data(), c.data(), w);
+
+        for (int x = 0; x < w; ++x)
+            result(x, y) = Color4(a[x], b[x], c[x], (*this)(x, y).a);
+        ++progress;
+    });
+    spdlog::get("console")->trace("Color space conversion took: {} seconds.", (timer.elapsed()/1000.f));
+    return result;
+}
+
+void HDRImage::transformColorChannels(const function<void(const float *, float *, size_t)> & f,
+                                      AtomicProgress progress)
+{
+    Timer timer;
+    TraceZone zone("transformColorChannels", traceImageId(this), size() * sizeof(Color4));
+    int w = width();
+
+    progress.setNumSteps(height());
+    parallel_for(0, height(), [this,&f,w,&progress](int y)
+    {
+        // each row is contiguous, so transform its 4*w floats at once and then restore alpha
+        vector<float> alpha(w);
+        for (int x = 0; x < w; ++x)
+            alpha[x] = (*this)(x, y).a;
+
+        float * row = reinterpret_cast<float *>(data() + y * size_t(w));
+        f(row, row, 4 * size_t(w));
+
+        for (int x = 0; x < w; ++x)
+            (*this)(x, y).a = alpha[x];
+        ++progress;
+    });
+    spdlog::get("console")->trace("Transforming color channels took: {} seconds.", (timer.elapsed()/1000.f));
+}
+
+void HDRImage::transformColors(const function<void(float *, float *, float *, size_t)> & f,
+                               AtomicProgress progress)
+{
+    int w = width();
+
+    progress.setNumSteps(height());
+    parallel_for(0, height(), [this,&f,w,&progress](int y)
+    {
+        float r[g_colorTileSize], g[g_colorTileSize], b[g_colorTileSize];
+        for (int x0 = 0; x0 < w; x0 += g_colorTileSize)
+        {
+            int n = std::min(g_colorTileSize, w - x0);
+            Color4 * pixels = &(*this)(x0, y);
+            for (int i = 0; i < n; ++i)
+            {
+                r[i] = pixels[i].r;
+                g[i] = pixels[i].g;
+                b[i] = pixels[i].b;
+            }
+
+            f(r, g, b, n);
+
+            for (int i = 0; i < n; ++i)
+            {
+                pixels[i].r = r[i];
+                pixels[i].g = g[i];
+                pixels[i].b = b[i];
+            }
+        }
+        ++progress;
+    });
+}
+
+
 // local functions
 namespace
 {
@@ -1089,6 +1277,25 @@ ArrayXXf horizontalGaussianKernel(float sigma, float truncate)
     return fData;
 }
 
+vector<HDRImage> boxMipPyramid(const HDRImage & image, HDRImage::BorderMode mX, HDRImage::BorderMode mY)
+{
+    vector<HDRImage> levels;
+    const HDRImage * prev = &image;
+    while (max(prev->width(), prev->height()) > 1)
+    {
+        HDRImage level((prev->width() + 1) / 2, (prev->height() + 1) / 2);
+        parallel_for(0, level.height(), [prev,&level,mX,mY](int y)
+        {
+            for (int x = 0; x < level.width(); ++x)
+                level(x, y) = 0.25f * (prev->pixel(2*x, 2*y, mX, mY) + prev->pixel(2*x+1, 2*y, mX, mY) +
+                                       prev->pixel(2*x, 2*y+1, mX, mY) + prev->pixel(2*x+1, 2*y+1, mX, mY));
+        });
+        levels.push_back(level);
+        prev = &levels.back();
+    }
+    return levels;
+}
+
 int wrapCoord(int p, int maxP, HDRImage::BorderMode m)
 {
     if (p >= 0 && p < maxP)
@@ -126,6 +126,31 @@ public:
                        std::function<Eigen::Vector2f(const Eigen::Vector2f &)> warpFn =
                        [](const Eigen::Vector2f &uv) { return uv; },
                        int superSample = 1, Sampler s = NEAREST, BorderMode mX = REPEAT, BorderMode mY = REPEAT) const;
+    //! Warps the uv coordinates in each row of its first argument, writing them to the rows of the second
+    using BatchWarpFn = std::function<void(const Eigen::Array<float, Eigen::Dynamic, 2> &,
+                                           Eigen::Array<float, Eigen::Dynamic, 2> &)>;
+    //! A version of resampled() that warps the samples of each row of the result with a single call of \a warpFn
+    HDRImage resampled(int width, int height,
+                       AtomicProgress progress,
+                       const BatchWarpFn & warpFn,
+                       int superSample = 1, Sampler s = NEAREST, BorderMode mX = REPEAT, BorderMode mY = REPEAT) const;
+    /*!
+     * @brief Anti-aliased version of resampled() that adapts its sampling to the warp's footprint.
+     *
+     * \a jacobianFn returns the derivatives of \a warpFn at a destination uv coordinate, which map
+     * each destination pixel to a parallelogram in the source image. Magnified pixels take a single
+     * sample with the sampler \a s, while minified ones are stratified with about one sample per
+     * source pixel along each edge of the parallelogram. When that would take more than
+     * \a maxSamples samples, they are instead taken from the coarsest level of a box-filtered mip
+     * pyramid that stays within that budget. Pixels with a non-finite Jacobian (at the singularities
+     * of the warp) fall back to a single sample.
+     */
+    HDRImage filteredResampled(int width, int height,
+                               AtomicProgress progress,
+                               std::function<Eigen::Vector2f(const Eigen::Vector2f &)> warpFn,
+                               std::function<Eigen::Matrix2f(const Eigen::Vector2f &)> jacobianFn,
+                               Sampler s = BILINEAR, BorderMode mX = REPEAT, BorderMode mY = REPEAT,
+                               int maxSamples = 64) const;
     //@}
 
 
@@ -184,6 +209,30 @@ public:
     //-----------------------------------------------------------------------
     HDRImage inverted() const;
 	HDRImage brightnessContrast(float brightness, float contrast, bool linear, EChannel c) const;
+    /*!
+     * @brief Convert all pixels from color space \a src to \a dst, keeping alpha.
+     *
+     * Rows are converted in parallel using the planar convertColorSpace(), which is several
+     * times faster than converting each Color4 on its own.
+     */
+    HDRImage convertedColorSpace(EColorSpace dst, EColorSpace src,
+                                 AtomicProgress progress = AtomicProgress()) const;
+    /*!
+     * @brief Apply the span function \a f (e.g. fastLinearToSRGB from FastMath.h) to the
+     * color channels of all pixels in place, keeping alpha.
+     *
+     * \a f is called once per row, on all of the row's channels at once, in parallel.
+     */
+    void transformColorChannels(const std::function<void(const float *, float *, size_t)> & f,
+                                AtomicProgress progress = AtomicProgress());
+    /*!
+     * @brief Apply \a f to the color channels of all pixels in place, keeping alpha.
+     *
+     * The rows are processed in parallel, in tiles of pixels whose red, green and blue values
+     * are first split into separate arrays, so that \a f can use vectorized planar kernels.
+     */
+    void transformColors(const std::function<void(float *, float *, float *, size_t)> & f,
+                         AtomicProgress progress = AtomicProgress());
     HDRImage convolved(const Eigen::ArrayXXf &kernel,
                        AtomicProgress progress,
                        BorderMode mX = EDGE, BorderMode mY = EDGE) const;
@@ -22,10 +22,14 @@
 #include <stdexcept>             // for runtime_error, out_of_range
 #include <string>                // for allocator, operator==, basic_string
 #include <vector>                // for vector
+#include <sys/stat.h>            // for stat
 #include "Common.h"              // for lerp, mod, clamp, getExtension
+#include "ColorPipeline.h"       // for ColorPipeline
 #include "Colorspace.h"
+#include "FastMath.h"
 #include "ParallelFor.h"
 #include "Timer.h"
+#include "Trace.h"
 #include <Eigen/Dense>
 #include <spdlog/spdlog.h>
 
@@ -85,17 +89,18 @@ void copyPixelsFromArray(HDRImage & img, float * data, int w, int h, int n, bool
 		throw runtime_error("Only 3- and 4-channel images are supported.");
 
 	// for every pixel in the image
-	parallel_for(0, h, [&img,w,n,data,convertToLinear](int y)
+	parallel_for(0, h, [&img,w,n,data](int y)
 	{
 		for (int x = 0; x < w; ++x)
-		{
-			Color4 c(data[n * (x + y * w) + 0],
-			         data[n * (x + y * w) + 1],
-			         data[n * (x + y * w) + 2],
-			         (n == 3) ? 1.f : data[4 * (x + y * w) + 3]);
-			img(x, y) = convertToLinear ? SRGBToLinear(c) : c;
-		}
+			img(x, y) = Color4(data[n * (x + y * w) + 0],
+			                   data[n * (x + y * w) + 1],
+			                   data[n * (x + y * w) + 2],
+			                   (n == 3) ? 1.f : data[4 * (x + y * w) + 3]);
 	});
+
+	if (convertToLinear)
+		img.transformColorChannels([](const float * in, float * out, size_t count)
+		                           {fastSRGBToLinear(in, out, count);});
 }
 
 bool isSTBImage(const string & filename)
@@ -132,6 +137,10 @@ bool isSTBImage(const string & filename)
 bool HDRImage::load(const string & filename)
 {
 	auto console = spdlog::get("console");
+	TraceZone zone("load ", filename, traceImageId(this));
+	struct stat info;
+	if (tracingEnabled() && stat(filename.c_str(), &info) == 0)
+		zone.setBytes(uint64_t(info.st_size));
     string errors;
 	string extension = getExtension(filename);
 	transform(extension.begin(),
@@ -420,6 +429,7 @@ bool HDRImage::save(const string & filename,
                     bool sRGB, bool dither) const
 {
 	auto console = spdlog::get("console");
+	TraceZone zone("save ", filename, traceImageId(this), size() * sizeof(Color4));
     string extension = getExtension(filename);
 
     transform(extension.begin(),
@@ -435,23 +445,25 @@ bool HDRImage::save(const string & filename,
     // if we need to tonemap, then modify a copy of the image data
     if (gain != 1.0f || sRGB || gamma != 1.0f)
     {
-        Color4 gainC = Color4(gain, gain, gain, 1.0f);
-        Color4 gammaC = Color4(1.0f / gamma, 1.0f / gamma, 1.0f / gamma, 1.0f);
-
         imgCopy = *this;
         img = &imgCopy;
 
-        if (gain != 1.0f)
-            imgCopy *= gainC;
+        // apply the gain and the curve in a single pass
+        ColorPipeline tonemap;
+        tonemap.addGain(Color3(gain), "gain");
 
         // only do gamma or sRGB tonemapping if we are saving to an LDR format
         if (!hdrFormat)
         {
             if (sRGB)
-                imgCopy = imgCopy.unaryExpr(ptr_fun((Color4 (*)(const Color4 &)) LinearToSRGB));
+                tonemap.addCurve([](float v) {return fastLinearToSRGB(v);}, "sRGB",
+                                 [](const float * in, float * out, size_t n) {fastLinearToSRGB(in, out, n);});
             else if (gamma != 1.0f)
-                imgCopy = imgCopy.pow(gammaC);
+                tonemap.addCurve([gamma](float v) {return fastPow(v, 1.0f / gamma);}, "gamma",
+                                 [gamma](const float * in, float * out, size_t n) {fastPow(in, out, n, 1.0f / gamma);});
         }
+
+        tonemap.compiled().apply(imgCopy);
     }
 
     if (extension == "hdr")
@@ -654,17 +666,12 @@ HDRImage develop(vector<float> & raw,
 	developed.demosaicAHD(redOffset, XYZD50ToXYZD65 * CameraToXYZD50);
 
 	// color correction
-	// also undo the white balance since the color correction matrix already includes it
-	parallel_for(0, developed.height(), [&developed,&CameraTosRGB,&wb](int y)
-	{
-		for (int x = 0; x < developed.width(); x++)
-		{
-			Vector3f rgb(developed(x,y).r, developed(x,y).g, developed(x,y).b);
-			rgb = rgb.cwiseProduct(wb);
-			Vector3f sRGB = CameraTosRGB * rgb;
-			developed(x,y) = Color4(sRGB.x(),sRGB.y(),sRGB.z(),1.f);
-		}
-	});
+	// also undo the white balance since the color correction matrix already includes it,
+	// which is folded into the same matrix
+	ColorPipeline correction;
+	correction.addGain(Color3(wb(0), wb(1), wb(2)), "white balance");
+	correction.addMatrix(CameraTosRGB, Vector3f::Zero(), "camera to sRGB");
+	correction.compiled().apply(developed);
 
 	spdlog::get("console")->debug("Developing DNG image took {} seconds.", (timer.elapsed()/1000.f));
 	return developed;
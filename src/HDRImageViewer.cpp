@@ -6,7 +6,10 @@
 
 #include "HDRImageViewer.h"
 #include "HDRViewer.h"
+#include "EnvMapSampling.h"
 #include <tinydir.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
 #include <utility>
 using namespace std;
 
@@ -15,6 +18,10 @@ namespace
 const float MIN_ZOOM = 0.01f;
 
 const float MAX_ZOOM = 512.f;
+
+// the number of cells across of the sampling density overlay, and its opacity
+const int PDF_OVERLAY_WIDTH = 512;
+const float PDF_OVERLAY_ALPHA = 0.6f;
 }
 
 HDRImageViewer::HDRImageViewer(Widget* parent, HDRViewScreen* screen)
@@ -142,6 +149,26 @@ void HDRImageViewer::zoomOut()
 	m_zoomCallback(m_zoom);
 }
 
+bool HDRImageViewer::mouseButtonEvent(const Vector2i& p, int button, bool down, int modifiers)
+{
+	if (Widget::mouseButtonEvent(p, button, down, modifiers))
+		return true;
+
+	// while a pick callback is set, clicking on the image picks a pixel instead of starting to pan
+	if (m_pickCallback && m_currentImage && down && button == GLFW_MOUSE_BUTTON_LEFT)
+	{
+		Vector2i pixel = imageCoordinateAt((p - mPos).cast<float>()).cast<int>();
+		if (m_currentImage->contains(pixel))
+		{
+			// copy the callback, since calling it may reset it
+			auto pick = m_pickCallback;
+			pick(pixel);
+			return true;
+		}
+	}
+	return false;
+}
+
 bool HDRImageViewer::mouseDragEvent(const Vector2i& p, const Vector2i& rel, int button, int /*modifiers*/)
 {
 	if (button & (1 << GLFW_MOUSE_BUTTON_LEFT))
@@ -240,6 +267,8 @@ void HDRImageViewer::draw(NVGcontext* ctx)
 	glClearColor(0.15f, 0.15f, 0.15f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
+	dropFinishedPDFTasks();
+
 	if (m_currentImage && !m_currentImage->isNull())
 	{
 		Vector2f pCurrent, sCurrent;
@@ -251,16 +280,20 @@ void HDRImageViewer::draw(NVGcontext* ctx)
 			imagePositionAndScale(pReference, sReference, m_referenceImage);
 			m_shader
 				.draw(m_currentImage->glTextureId(), m_referenceImage->glTextureId(), sCurrent, pCurrent, sReference,
-					  pReference, powf(2.0f, m_exposure), m_gamma, m_sRGB, m_dither, m_channel, m_blendMode);
+					  pReference, powf(2.0f, m_exposure), m_gamma, m_sRGB, m_dither, m_channel, m_blendMode,
+					  m_colorMatrix);
 		}
 		else
 		{
 			m_shader.draw(m_currentImage->glTextureId(), sCurrent, pCurrent, powf(2.0f, m_exposure), m_gamma, m_sRGB,
-						  m_dither, m_channel, m_blendMode);
+						  m_dither, m_channel, m_blendMode, m_colorMatrix);
 		}
 
 		drawImageBorder(ctx);
 
+		if (m_drawSamplingPDF)
+			drawSamplingPDF(ctx);
+
 		if (helpersVisible())
 			drawHelpers(ctx);
 	}
@@ -405,4 +438,105 @@ void HDRImageViewer::drawPixelInfo(NVGcontext* ctx) const
 			nvgTextBox(ctx, pos.x(), pos.y(), m_zoom, text.c_str(), nullptr);
 		}
 	}
-}
\ No newline at end of file
+}
+
+void HDRImageViewer::setDrawSamplingPDF(bool b)
+{
+	m_drawSamplingPDF = b;
+	if (b)
+		return;
+
+	if (m_pdfTask && !m_pdfTask->ready())
+		m_abandonedPDFTasks.push_back(m_pdfTask);
+	m_pdfTask = nullptr;
+	m_pdfVersion = 0;
+	if (m_pdfOverlay)
+		nvgDeleteImage(m_screen->nvgContext(), m_pdfOverlay);
+	m_pdfOverlay = 0;
+}
+
+void HDRImageViewer::dropFinishedPDFTasks()
+{
+	m_abandonedPDFTasks.erase(remove_if(m_abandonedPDFTasks.begin(), m_abandonedPDFTasks.end(),
+	                                    [](const shared_ptr<AsyncTask<HDRImage>> & task) {return task->ready();}),
+	                          m_abandonedPDFTasks.end());
+}
+
+void HDRImageViewer::drawSamplingPDF(NVGcontext* ctx)
+{
+	// build the distribution in the background whenever the pixels change, and hide the stale overlay meanwhile
+	if (m_currentImage->version() != m_pdfVersion)
+	{
+		m_pdfVersion = m_currentImage->version();
+		if (m_pdfTask && !m_pdfTask->ready())
+			m_abandonedPDFTasks.push_back(m_pdfTask);
+		auto source = m_currentImage->sharedImage();
+		m_pdfTask = make_shared<AsyncTask<HDRImage>>([source](AtomicProgress & progress)
+		{
+			return EnvMapDistribution(*source, PDF_OVERLAY_WIDTH, progress).pdfImage();
+		});
+		m_pdfTask->compute();
+		if (m_pdfOverlay)
+			nvgDeleteImage(ctx, m_pdfOverlay);
+		m_pdfOverlay = 0;
+	}
+
+	if (m_pdfTask && m_pdfTask->ready())
+	{
+		// false-color the logarithm of the density between its smallest and largest positive values,
+		// leaving the cells that are never drawn transparent
+		HDRImage pdf;
+		try
+		{
+			pdf = std::move(m_pdfTask->get());
+		}
+		catch (const exception & e)
+		{
+			// the task cannot be retried, so give up on the overlay instead of taking down the render loop
+			spdlog::get("console")->error("Cannot compute the sampling density: {}", e.what());
+			m_pdfTask = nullptr;
+			setDrawSamplingPDF(false);
+			return;
+		}
+		float lo = numeric_limits<float>::max(), hi = 0.f;
+		for (int y = 0; y < pdf.height(); ++y)
+			for (int x = 0; x < pdf.width(); ++x)
+				if (pdf(x, y).r > 0.f)
+				{
+					lo = min(lo, pdf(x, y).r);
+					hi = max(hi, pdf(x, y).r);
+				}
+		float logLo = log2(lo), logRange = max(log2(hi) - logLo, 1e-3f);
+
+		vector<uint8_t> rgba(size_t(pdf.width()) * pdf.height() * 4, 0);
+		for (int y = 0; y < pdf.height(); ++y)
+			for (int x = 0; x < pdf.width(); ++x)
+			{
+				float p = pdf(x, y).r;
+				if (p <= 0.f)
+					continue;
+				float t = clamp01((log2(p) - logLo) / logRange);
+				uint8_t * c = &rgba[(size_t(y) * pdf.width() + x) * 4];
+				c[0] = uint8_t(255 * clamp01(t < 0.7f ? 4 * t - 1.5f : -4 * t + 4.5f));
+				c[1] = uint8_t(255 * clamp01(t < 0.5f ? 4 * t - 0.5f : -4 * t + 3.5f));
+				c[2] = uint8_t(255 * clamp01(t < 0.3f ? 4 * t + 0.5f : -4 * t + 2.5f));
+				c[3] = 255;
+			}
+		m_pdfOverlay = nvgCreateImageRGBA(ctx, pdf.width(), pdf.height(), NVG_IMAGE_NEAREST, rgba.data());
+		m_pdfTask = nullptr;
+	}
+
+	if (!m_pdfOverlay)
+		return;
+
+	Vector2f position = positionF() + m_offset + centerOffset(m_currentImage);
+	Vector2f size = scaledImageSizeF(m_currentImage);
+	nvgSave(ctx);
+	nvgScissor(ctx, mPos.x(), mPos.y(), mSize.x(), mSize.y());
+	nvgBeginPath(ctx);
+	nvgRect(ctx, position.x(), position.y(), size.x(), size.y());
+	nvgFillPaint(ctx, nvgImagePattern(ctx, position.x(), position.y(), size.x(), size.y(), 0.f, m_pdfOverlay,
+	                                  PDF_OVERLAY_ALPHA));
+	nvgFill(ctx);
+	nvgRestore(ctx);
+}
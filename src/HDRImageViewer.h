@@ -9,11 +9,13 @@
 #pragma once
 
 #include <nanogui/widget.h>
+#include <memory>
 #include <vector>
 #include "Fwd.h"
 #include "Common.h"
 #include "GLImage.h"
 #include "ImageShader.h"
+#include "Async.h"
 
 using namespace nanogui;
 using namespace Eigen;
@@ -32,6 +34,7 @@ public:
 
 	// overridden Widget virtual functions
 	void draw(NVGcontext* ctx) override;
+	bool mouseButtonEvent(const Vector2i &p, int button, bool down, int modifiers) override;
 	bool mouseDragEvent(const Vector2i &p, const Vector2i &rel, int button, int modifiers) override;
 	bool mouseMotionEvent(const Vector2i &p, const Vector2i &rel, int button, int modifiers) override;
 	bool scrollEvent(const Vector2i &p, const Vector2f &rel) override;
@@ -137,6 +140,18 @@ public:
 	bool drawValuesOn() const   {return m_drawValues;}
 	void setDrawValues(bool b)  {m_drawValues = b;}
 
+	/// Whether to overlay the density of importance sampling the current image as a lat-long environment map
+	bool drawSamplingPDFOn() const      {return m_drawSamplingPDF;}
+	//! Turning the overlay off also frees it, so it must happen while the NanoVG context is alive
+	void setDrawSamplingPDF(bool b);
+
+	/// The matrix the colors of the current image are multiplied by when drawn, used to preview color edits
+	const Matrix3f & colorMatrix() const        {return m_colorMatrix;}
+	void setColorMatrix(const Matrix3f & m)     {m_colorMatrix = m;}
+	/// The LUT the colors are looked up in after the color matrix, used to preview edits baked into a LUT
+	const std::shared_ptr<const ColorLUT> & previewLUT() const {return m_previewLUT;}
+	void setPreviewLUT(std::shared_ptr<const ColorLUT> lut)   {m_previewLUT = std::move(lut); m_shader.setLUT(m_previewLUT.get());}
+
 	// Callback functions
 
 	/// Callback executed whenever the gamma value has been changed, e.g. via @ref setGamma
@@ -155,6 +170,10 @@ public:
 	const std::function<void(float)>& zoomCallback() const { return m_zoomCallback; }
 	void setZoomCallback(const std::function<void(float)> &callback) { m_zoomCallback = callback; }
 
+	/// Callback executed when the image is clicked while it is set, instead of panning, provides the pixel coordinates
+	const std::function<void(const Vector2i &)>& pickCallback() const { return m_pickCallback; }
+	void setPickCallback(const std::function<void(const Vector2i &)> &callback) { m_pickCallback = callback; }
+
 	/// Callback executed when mouse hovers over different parts of the image, provides pixel coordinates and values
 	const std::function<void(const Vector2i &, const Color4 &, const Color4 &)> pixelHoverCallback() const { return m_pixelHoverCallback; }
 	void setPixelHoverCallback(const std::function<void(const Vector2i &, const Color4 &, const Color4 &)> &callback) { m_pixelHoverCallback = callback; }
@@ -174,6 +193,8 @@ private:
 	void drawHelpers(NVGcontext* ctx) const;
 	void drawPixelGrid(NVGcontext* ctx) const;
 	void drawPixelInfo(NVGcontext *ctx) const;
+	void drawSamplingPDF(NVGcontext *ctx);
+	void dropFinishedPDFTasks();
 	void imagePositionAndScale(Vector2f & position, Vector2f & scale,
 	                           ConstImagePtr image);
 
@@ -189,7 +210,18 @@ private:
 	bool m_sRGB = true,
 		 m_dither = true,
 		 m_drawGrid = true,
-		 m_drawValues = true;
+		 m_drawValues = true,
+		 m_drawSamplingPDF = false;
+	Matrix3f m_colorMatrix = Matrix3f::Identity();
+	std::shared_ptr<const ColorLUT> m_previewLUT;
+
+	// The sampling density overlay, computed in the background from the version of the image it was last
+	// requested for, and drawn from a NanoVG image. Destroying a running task would wait for it, so the tasks
+	// of versions that changed before they finished are kept until they are done
+	uint64_t m_pdfVersion = 0;
+	std::shared_ptr<AsyncTask<HDRImage>> m_pdfTask;
+	std::vector<std::shared_ptr<AsyncTask<HDRImage>>> m_abandonedPDFTasks;
+	int m_pdfOverlay = 0;
 
 
 	// Image display parameters.
@@ -212,6 +244,7 @@ private:
 	std::function<void(bool)> m_sRGBCallback;
 	std::function<void(float)> m_zoomCallback;
 	std::function<void(const Vector2i &, const Color4 &, const Color4 &)> m_pixelHoverCallback;
+	std::function<void(const Vector2i &)> m_pickCallback;
 
 public:
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
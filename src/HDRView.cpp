@@ -8,6 +8,8 @@
 #include <iostream>
 #include <docopt.h>
 #include "HDRViewer.h"
+#include "MemoryAccountant.h"
+#include "Trace.h"
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/ostr.h>
 
@@ -34,6 +36,12 @@ Options:
   -g G, --gamma=G          Desired gamma value for exposure+gamma tonemapping.
                            An sRGB curve is used if gamma is not specified.
   -d, --no-dither          Disable dithering.
+  --memory-budget=MB       Warn when the open images, their undo history and
+                           textures use more than MB megabytes.
+  --trace=FILE             Record the time spent loading, editing, computing
+                           histograms and uploading textures on every thread,
+                           and write it to FILE in the Chrome trace format
+                           on exit. Only the most recent 65536 zones are kept.
   -v T, --verbose=T        Set verbosity threshold with lower values meaning
                            more verbose and higher values removing low-priority
                            messages.
@@ -121,9 +129,19 @@ int main(int argc, char **argv)
         // dithering
         dither = !docargs["--no-dither"].asBool();
 
+        if (docargs["--memory-budget"])
+        {
+            auto budget = uint64_t(max(0L, docargs["--memory-budget"].asLong())) << 20;
+            MemoryAccountant::global().setBudget(budget);
+            console->info("Setting the memory budget to {}.", formatBytes(budget));
+        }
+
 	    // list of filenames
 	    inFiles = docargs["FILE"].asStringList();
 
+        if (docargs["--trace"].isString())
+            startTracing();
+
         console->info("Launching GUI.");
         nanogui::init();
 
@@ -139,6 +157,13 @@ int main(int argc, char **argv)
         }
 
         nanogui::shutdown();
+
+        if (docargs["--trace"].isString())
+        {
+            stopTracing();
+            console->info("Writing trace to \"{}\"...", docargs["--trace"].asString());
+            writeChromeTrace(docargs["--trace"].asString());
+        }
     }
     // Exceptions will only be thrown upon failed logger or sink construction (not during logging)
     catch (const spd::spdlog_ex& e)
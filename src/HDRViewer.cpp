@@ -8,6 +8,8 @@
 #include "GLImage.h"
 #include "EditImagePanel.h"
 #include "ImageListPanel.h"
+#include "MemoryAccountant.h"
+#include "MemoryPanel.h"
 #include <iostream>
 #include "Common.h"
 #include "CommandHistory.h"
@@ -132,6 +134,27 @@ HDRViewScreen::HDRViewScreen(float exposure, float gamma, bool sRGB, bool dither
 	 });
 	editPanel->performLayout(mNVGContext);
 
+    //
+    // create memory panel
+    //
+
+	btn = new Button(m_sidePanelContents, "Memory", ENTYPO_ICON_CHEVRON_LEFT);
+	btn->setFlags(Button::ToggleButton);
+	btn->setFontSize(18);
+	btn->setIconPosition(Button::IconPosition::Right);
+
+	auto memoryPanel = new MemoryPanel(m_sidePanelContents, m_imagesPanel);
+	memoryPanel->setVisible(false);
+
+	btn->setChangeCallback([this,btn,memoryPanel](bool value)
+	 {
+		 btn->setIcon(value ? ENTYPO_ICON_CHEVRON_DOWN : ENTYPO_ICON_CHEVRON_LEFT);
+		 memoryPanel->setVisible(value);
+		 updateLayout();
+		 m_sidePanelContents->performLayout(mNVGContext);
+	 });
+	memoryPanel->performLayout(mNVGContext);
+
     //
     // create top panel controls
     //
@@ -308,6 +331,11 @@ HDRViewScreen::HDRViewScreen(float exposure, float gamma, bool sRGB, bool dither
                  [&](bool v) { m_imageView->setDrawGrid(v); }))->setChecked(m_imageView->drawGridOn());
     (new CheckBox(m_topPanel, "RGB values  ",
                  [&](bool v) { m_imageView->setDrawValues(v); }))->setChecked(m_imageView->drawValuesOn());
+    m_samplingPDFCheckBox = new CheckBox(m_topPanel, "Sampling PDF  ",
+                                         [&](bool v) { m_imageView->setDrawSamplingPDF(v); });
+    m_samplingPDFCheckBox->setChecked(m_imageView->drawSamplingPDFOn());
+    m_samplingPDFCheckBox->setTooltip("Overlay the density of importance sampling the image as a lat-long environment map, "
+                            "in false color from the least (blue) to the most (red) likely directions.");
 
 	dropEvent(args);
 
@@ -325,7 +353,8 @@ HDRViewScreen::HDRViewScreen(float exposure, float gamma, bool sRGB, bool dither
 
 HDRViewScreen::~HDRViewScreen()
 {
-    // empty
+    // free the sampling density overlay while the NanoVG context, which Screen deletes before its children, exists
+    m_imageView->setDrawSamplingPDF(false);
 }
 
 
@@ -497,14 +526,14 @@ void HDRViewScreen::flipImage(bool h)
 		    [](const shared_ptr<const HDRImage> & img) -> ImageCommandResult
 		    {
 			    return {make_shared<HDRImage>(img->flippedHorizontal()),
-			            make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { *img2 = img2->flippedHorizontal(); })};
+			            make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { img2 = make_shared<HDRImage>(img2->flippedHorizontal()); })};
 		    });
     else
 		m_imagesPanel->modifyImage(
 		    [](const shared_ptr<const HDRImage> & img) -> ImageCommandResult
 		    {
 			    return {make_shared<HDRImage>(img->flippedVertical()),
-			            make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { *img2 = img2->flippedVertical(); })};
+			            make_shared<LambdaUndo>([](shared_ptr<HDRImage> & img2) { img2 = make_shared<HDRImage>(img2->flippedVertical()); })};
 		    });
 }
 
@@ -848,8 +877,22 @@ void HDRViewScreen::updateLayout()
 	performLayout();
 }
 
+void HDRViewScreen::checkMemoryBudget()
+{
+	// warn once each time the open images go over the budget, whether or not the memory panel is shown
+	auto & accountant = MemoryAccountant::global();
+	bool overBudget = accountant.overBudget();
+	if (overBudget && !m_warnedOverBudget)
+		console->warn("Open images use {}, which exceeds the memory budget of {}.",
+		              formatBytes(accountant.total()), formatBytes(accountant.budget()));
+	m_warnedOverBudget = overBudget;
+}
+
 void HDRViewScreen::drawContents()
 {
 	m_imagesPanel->runRequestedCallbacks();
+	checkMemoryBudget();
+	// the viewer turns the overlay off if it cannot be computed
+	m_samplingPDFCheckBox->setChecked(m_imageView->drawSamplingPDFOn());
 	updateLayout();
 }
\ No newline at end of file
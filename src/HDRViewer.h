@@ -43,6 +43,7 @@ public:
 private:
 	void toggleHelpWindow();
 	void updateLayout();
+	void checkMemoryBudget();
 	bool atSidePanelEdge(const Eigen::Vector2i& p)
 	{
 		return p.x() - m_sidePanel->fixedWidth() < 10 && p.x() - m_sidePanel->fixedWidth() > -5;
@@ -59,6 +60,7 @@ private:
 	HelpWindow* m_helpWindow = nullptr;
 	Label * m_zoomLabel = nullptr;
 	Label * m_pixelInfoLabel = nullptr;
+	CheckBox * m_samplingPDFCheckBox = nullptr;
 
 	VScrollPanel * m_sideScrollPanel = nullptr;
 	Widget * m_sidePanelContents = nullptr;
@@ -75,6 +77,7 @@ private:
     MessageDialog * m_okToQuitDialog = nullptr;
 
 	bool m_draggingSidePanel = false;
+	bool m_warnedOverBudget = false;
 
     std::shared_ptr<spdlog::logger> console;
 };
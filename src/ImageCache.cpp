@@ -0,0 +1,229 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "ImageCache.h"
+#include <sys/stat.h>            // for stat, mkdir
+#include <atomic>                // for atomic
+#include <cstdint>               // for uint32_t, uint64_t, int64_t
+#include <cstdio>                // for rename, remove
+#include <cstring>               // for memcpy, memcmp
+#include <fstream>               // for ifstream, ofstream
+#include <vector>                // for vector
+#include "Timer.h"               // for Timer
+#include <spdlog/spdlog.h>
+
+#if defined(_WIN32)
+#include <direct.h>              // for _mkdir
+#include <process.h>             // for _getpid
+#else
+#include <fcntl.h>               // for open, O_RDONLY
+#include <sys/mman.h>            // for mmap, munmap
+#include <unistd.h>              // for close, getpid
+#endif
+
+using namespace std;
+
+namespace
+{
+
+const char MAGIC[8] = {'H', 'D', 'R', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t VERSION = 2;
+
+// the fixed-size part of a cache entry, followed by the source path and the pixels
+struct EntryHeader
+{
+	char magic[8];
+	uint32_t version;
+	int32_t width, height;
+	uint32_t pathLength;
+	FileVersion source;
+};
+
+// the pixels start at the first multiple of 16 bytes after the path
+size_t pixelOffset(size_t pathLength)
+{
+	return (sizeof(EntryHeader) + pathLength + 15) / 16 * 16;
+}
+
+// 64-bit FNV-1a
+uint64_t hashBytes(const void * data, size_t n, uint64_t hash = 14695981039346656037ull)
+{
+	const unsigned char * bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < n; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+bool validHeader(const EntryHeader & header, const string & filename, const FileVersion & source)
+{
+	return memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION &&
+	       header.width >= 0 && header.height >= 0 &&
+	       header.source == source && header.pathLength == filename.size();
+}
+
+} // namespace
+
+
+bool readFileVersion(const string & filename, FileVersion & version)
+{
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+		return false;
+	version.mtime = int64_t(info.st_mtime);
+	version.ctime = int64_t(info.st_ctime);
+#if defined(__APPLE__)
+	version.mtimeNanos = int64_t(info.st_mtimespec.tv_nsec);
+	version.ctimeNanos = int64_t(info.st_ctimespec.tv_nsec);
+#elif defined(_WIN32)
+	version.mtimeNanos = version.ctimeNanos = 0;
+#else
+	version.mtimeNanos = int64_t(info.st_mtim.tv_nsec);
+	version.ctimeNanos = int64_t(info.st_ctim.tv_nsec);
+#endif
+	version.inode = uint64_t(info.st_ino);
+	version.size = uint64_t(info.st_size);
+	return true;
+}
+
+
+DiskImageCache::DiskImageCache(const string & dir) : m_dir(dir)
+{
+	if (m_dir.empty())
+		return;
+
+#if defined(_WIN32)
+	_mkdir(m_dir.c_str());
+#else
+	mkdir(m_dir.c_str(), 0755);
+#endif
+}
+
+string DiskImageCache::entryFilename(const string & filename) const
+{
+	FileVersion source = {};
+	readFileVersion(filename, source);
+
+	uint64_t hash = hashBytes(filename.data(), filename.size());
+	hash = hashBytes(&source, sizeof(source), hash);
+	return fmt::format("{}/{:016x}.hdrcache", m_dir, hash);
+}
+
+bool DiskImageCache::load(const string & filename, HDRImage & image) const
+{
+	if (!enabled())
+		return false;
+
+	FileVersion source;
+	if (!readFileVersion(filename, source))
+		return false;
+
+	Timer timer;
+	string entry = entryFilename(filename);
+
+#if defined(_WIN32)
+	ifstream in(entry, ios::binary);
+	if (!in)
+		return false;
+
+	EntryHeader header;
+	in.read(reinterpret_cast<char *>(&header), sizeof(header));
+	string path(header.pathLength < 65536 ? header.pathLength : 0, '\0');
+	in.read(&path[0], path.size());
+	if (!in || !validHeader(header, filename, source) || path != filename)
+		return false;
+
+	in.seekg(pixelOffset(header.pathLength));
+	image.resize(header.width, header.height);
+	in.read(reinterpret_cast<char *>(image.data()), streamsize(image.size() * sizeof(Color4)));
+	if (!in)
+	{
+		image.resize(0, 0);
+		return false;
+	}
+#else
+	int fd = open(entry.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(EntryHeader))
+	{
+		close(fd);
+		return false;
+	}
+
+	size_t length = size_t(info.st_size);
+	void * mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+
+	const char * bytes = static_cast<const char *>(mapped);
+	EntryHeader header;
+	memcpy(&header, bytes, sizeof(header));
+	bool valid = validHeader(header, filename, source) &&
+	             length >= pixelOffset(header.pathLength) + size_t(header.width) * header.height * sizeof(Color4) &&
+	             memcmp(bytes + sizeof(EntryHeader), filename.data(), filename.size()) == 0;
+	if (valid)
+	{
+		image.resize(header.width, header.height);
+		memcpy((float *) image.data(), bytes + pixelOffset(header.pathLength), image.size() * sizeof(Color4));
+	}
+	munmap(mapped, length);
+	if (!valid)
+		return false;
+#endif
+
+	spdlog::get("console")->debug("Reading \"{}\" from the image cache took: {} seconds.", filename, timer.elapsed() / 1000.f);
+	return true;
+}
+
+void DiskImageCache::store(const string & filename, const HDRImage & image) const
+{
+	if (!enabled())
+		return;
+
+	EntryHeader header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.width = image.width();
+	header.height = image.height();
+	header.pathLength = uint32_t(filename.size());
+	if (!readFileVersion(filename, header.source))
+		return;
+
+	// write to a uniquely named temporary file first, so concurrent readers never see partial entries
+	static atomic<unsigned> counter(0);
+#if defined(_WIN32)
+	int pid = _getpid();
+#else
+	int pid = getpid();
+#endif
+	string entry = entryFilename(filename);
+	string temp = fmt::format("{}.{}.{}.tmp", entry, pid, counter++);
+	{
+		ofstream out(temp, ios::binary);
+		out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		out.write(filename.data(), filename.size());
+		vector<char> padding(pixelOffset(filename.size()) - sizeof(header) - filename.size(), 0);
+		out.write(padding.data(), padding.size());
+		out.write(reinterpret_cast<const char *>(image.data()), streamsize(image.size() * sizeof(Color4)));
+		if (!out)
+		{
+			spdlog::get("console")->warn("Cannot write image cache entry \"{}\".", temp);
+			out.close();
+			remove(temp.c_str());
+			return;
+		}
+	}
+
+#if defined(_WIN32)
+	// rename does not replace existing files on Windows
+	remove(entry.c_str());
+#endif
+	if (rename(temp.c_str(), entry.c_str()) != 0)
+		remove(temp.c_str());
+}
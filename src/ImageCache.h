@@ -0,0 +1,69 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <cstdint>               // for int64_t, uint64_t
+#include <string>                // for string
+#include "HDRImage.h"            // for HDRImage
+
+
+/*!
+ * @brief What identifies a version of a file on disk.
+ *
+ * Modification times only have a resolution of a second on some systems, and are
+ * preserved by "cp -p" or "rsync -t", so the inode and the change time, which no copy
+ * can set, are included along with the nanoseconds where they are available.
+ */
+struct FileVersion
+{
+	int64_t mtime, mtimeNanos;
+	int64_t ctime, ctimeNanos;
+	uint64_t inode;
+	uint64_t size;
+
+	bool operator==(const FileVersion & o) const
+	{
+		return mtime == o.mtime && mtimeNanos == o.mtimeNanos && ctime == o.ctime &&
+		       ctimeNanos == o.ctimeNanos && inode == o.inode && size == o.size;
+	}
+};
+
+//! Read the version of \a filename into \a version, returning false if it cannot be found.
+bool readFileVersion(const std::string & filename, FileVersion & version);
+
+
+/*!
+ * @brief A persistent on-disk cache of decoded images, stored as raw floats.
+ *
+ * Each image is stored in its own file in the cache directory, named after a hash of
+ * the source file's path and FileVersion, so editing or replacing a source file
+ * invalidates its cache entry, even when a copy preserves the modification time.
+ * Both are also stored in the entry and verified on lookup. Entries are memory-mapped
+ * when read, which is much faster than decoding compressed formats such as OpenEXR.
+ *
+ * Lookups and stores are safe to call concurrently, also from several processes:
+ * entries are written to a temporary file and atomically renamed into place.
+ */
+class DiskImageCache
+{
+public:
+	//! Use the directory \a dir, which is created if needed. An empty \a dir disables the cache.
+	explicit DiskImageCache(const std::string & dir = std::string());
+
+	bool enabled() const        {return !m_dir.empty();}
+
+	//! Read the cached decoded version of \a filename into \a image, returning false on a cache miss.
+	bool load(const std::string & filename, HDRImage & image) const;
+
+	//! Store the decoded \a image of \a filename. Failures are logged and otherwise ignored.
+	void store(const std::string & filename, const HDRImage & image) const;
+
+private:
+	std::string entryFilename(const std::string & filename) const;
+
+	std::string m_dir;
+};
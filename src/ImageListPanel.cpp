@@ -8,6 +8,7 @@
 #include "HDRViewer.h"
 #include "GLImage.h"
 #include "ImageButton.h"
+#include "MemoryAccountant.h"
 #include "HDRImageViewer.h"
 #include "MultiGraph.h"
 #include "Well.h"
@@ -276,8 +277,15 @@ void ImageListPanel::updateButtons()
         btn->setCaption(img->filename());
         btn->setIsModified(img->isModified());
         btn->setProgress(img->progress());
+        img->updateMemoryUsage();
+        auto & accountant = MemoryAccountant::global();
         btn->setTooltip(
-                fmt::format("Path: {:s}\n\nResolution: ({:d}, {:d})", img->filename(), img->width(), img->height()));
+                fmt::format("Path: {:s}\n\nResolution: ({:d}, {:d})\n\nMemory: {} ({} image, {} history, {} texture)",
+                            img->filename(), img->width(), img->height(),
+                            formatBytes(accountant.bytes(img.get())),
+                            formatBytes(accountant.bytes(img.get(), MemoryAccountant::IMAGE)),
+                            formatBytes(accountant.bytes(img.get(), MemoryAccountant::HISTORY)),
+                            formatBytes(accountant.bytes(img.get(), MemoryAccountant::TEXTURE))));
     }
 
     m_histogramUpdateRequested = true;
@@ -366,6 +374,8 @@ void ImageListPanel::draw(NVGcontext *ctx)
 		m_graph->setCenterHeader(fmt::format("{:.3f}", lazyHist->get()->average));
 		m_graph->setRightHeader(fmt::format("{:.3f}", lazyHist->get()->maximum));
 		m_histogramDirty = false;
+		// report the new histograms now, instead of when the memory panel is next updated
+		currentImage()->updateMemoryUsage();
 	}
 	enableDisableButtons();
 
@@ -614,6 +624,19 @@ void ImageListPanel::loadImages(const vector<string> & filenames)
 	setCurrentImageIndex(int(m_images.size() - 1));
 }
 
+void ImageListPanel::newImage(const string & filename, const ImageCommandWithProgress & command)
+{
+	shared_ptr<GLImage> image = make_shared<GLImage>();
+	image->setImageModifyDoneCallback([this](){m_imageModifyDoneRequested = true;});
+	image->setFilename(filename);
+	image->asyncModify(command);
+	image->recomputeHistograms(m_imageViewer->exposure());
+	m_images.emplace_back(image);
+
+	m_numImagesCallback();
+	setCurrentImageIndex(int(m_images.size() - 1));
+}
+
 bool ImageListPanel::saveImage(const string & filename, float exposure, float gamma, bool sRGB, bool dither)
 {
 	if (!currentImage() || !filename.size())
@@ -34,6 +34,9 @@ public:
 	ConstImagePtr image(int index) const;
 	     ImagePtr image(int index);
 
+	//! The viewer the current image is displayed in
+	HDRImageViewer * imageViewer() const   {return m_imageViewer;}
+
 	bool setCurrentImageIndex(int newIndex, bool forceCallback = false);
 	bool setReferenceImageIndex(int newIndex);
 	bool swapCurrentSelectedWithPrevious() {printf("current: %d; previous: %d\n", m_current, m_previous);return isValid(m_previous) ? setCurrentImageIndex(m_previous) : false;}
@@ -43,6 +46,8 @@ public:
 
 	// Loading, saving, closing, and rearranging the images in the image stack
 	void loadImages(const std::vector<std::string> & filenames);
+	//! Add a new image named \a filename, whose pixels are computed asynchronously by \a command
+	void newImage(const std::string & filename, const ImageCommandWithProgress & command);
 	bool saveImage(const std::string & filename, float exposure = 0.f, float gamma = 2.2f,
 				   bool sRGB = true, bool dither = true);
 	bool closeImage();
@@ -0,0 +1,381 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "ImageMetrics.h"
+#include <algorithm>             // for min, max, nth_element
+#include <cmath>                 // for log10, log2, pow, sqrt, isfinite
+#include <stdexcept>             // for invalid_argument
+#include "Colorspace.h"          // for LinearToSRGB
+#include "Common.h"              // for clamp
+#include "ParallelFor.h"         // for parallel_for
+#include <spdlog/fmt/fmt.h>
+
+using namespace std;
+
+namespace
+{
+
+const float SSIM_C1 = 0.01f * 0.01f;
+const float SSIM_C2 = 0.03f * 0.03f;
+const float SSIM_SIGMA = 1.5f;
+const float SSIM_TRUNCATE = 3.5f;   // an 11x11 window for sigma 1.5
+const double MAX_PSNR = 100.0;     // in dB, the score of identical images
+
+// Fill an image by evaluating f(x,y) for each pixel, in parallel over rows
+template <typename F>
+HDRImage generate(int w, int h, F f)
+{
+	HDRImage result(w, h);
+	parallel_for(0, h, [&result,&f,w](int y)
+	{
+		for (int x = 0; x < w; ++x)
+			result(x,y) = f(x, y);
+	});
+	return result;
+}
+
+// The mean of channel c of an image, accumulated in double precision with per-row partial sums
+double channelMean(const HDRImage & img, int c)
+{
+	vector<double> rowSums(img.height(), 0.0);
+	parallel_for(0, img.height(), [&img,&rowSums,c](int y)
+	{
+		double sum = 0.0;
+		for (int x = 0; x < img.width(); ++x)
+			sum += img(x,y)[c];
+		rowSums[y] = sum;
+	});
+
+	double sum = 0.0;
+	for (double s : rowSums)
+		sum += s;
+	return sum / max(1, img.width() * img.height());
+}
+
+// A single-channel image stored in all color channels, with alpha 1
+Color4 gray(float v)
+{
+	return Color4(v, v, v, 1.f);
+}
+
+float encodedLuminance(const Color4 & c)
+{
+	return LinearToSRGB(::clamp(c.luminance(), 0.f, 1.f));
+}
+
+// Per-pixel luminance (l) and contrast-structure (cs) terms of SSIM for two single-channel images
+void ssimTerms(const HDRImage & x, const HDRImage & y, HDRImage & l, HDRImage & cs)
+{
+	int w = x.width(), h = x.height();
+
+	// blur the first and second moments of both images at once, four channels at a time
+	HDRImage moments = generate(w, h, [&x,&y](int i, int j)
+	{
+		float a = x(i,j).r, b = y(i,j).r;
+		return Color4(a, b, a*a, b*b);
+	}).GaussianBlurred(SSIM_SIGMA, SSIM_SIGMA, AtomicProgress(), HDRImage::EDGE, HDRImage::EDGE,
+	                   SSIM_TRUNCATE, SSIM_TRUNCATE);
+	HDRImage cross = generate(w, h, [&x,&y](int i, int j)
+	{
+		return gray(x(i,j).r * y(i,j).r);
+	}).GaussianBlurred(SSIM_SIGMA, SSIM_SIGMA, AtomicProgress(), HDRImage::EDGE, HDRImage::EDGE,
+	                   SSIM_TRUNCATE, SSIM_TRUNCATE);
+
+	l = generate(w, h, [&moments](int i, int j)
+	{
+		const Color4 & m = moments(i,j);
+		return gray((2.f * m[0] * m[1] + SSIM_C1) / (m[0] * m[0] + m[1] * m[1] + SSIM_C1));
+	});
+	cs = generate(w, h, [&moments,&cross](int i, int j)
+	{
+		const Color4 & m = moments(i,j);
+		float varX = max(0.f, m[2] - m[0] * m[0]);
+		float varY = max(0.f, m[3] - m[1] * m[1]);
+		float covar = cross(i,j).r - m[0] * m[1];
+		return gray((2.f * covar + SSIM_C2) / (varX + varY + SSIM_C2));
+	});
+}
+
+// Average 2x2 blocks of pixels
+HDRImage downsample(const HDRImage & img)
+{
+	int w = max(1, img.width() / 2), h = max(1, img.height() / 2);
+	return generate(w, h, [&img](int x, int y)
+	{
+		int x1 = min(2*x + 1, img.width() - 1), y1 = min(2*y + 1, img.height() - 1);
+		return (img(2*x, 2*y) + img(x1, 2*y) + img(2*x, y1) + img(x1, y1)) * 0.25f;
+	});
+}
+
+HDRImage encodedLuminanceImage(const HDRImage & img)
+{
+	return generate(img.width(), img.height(), [&img](int x, int y) {return gray(encodedLuminance(img(x,y)));});
+}
+
+MetricResult psnr(const HDRImage & test, const HDRImage & reference)
+{
+	MetricResult result;
+	result.name = "psnr";
+
+	float peak = 1.f;
+	for (int y = 0; y < reference.height(); ++y)
+		for (int x = 0; x < reference.width(); ++x)
+			peak = max(peak, Color3(reference(x,y)).max());
+
+	result.map = generate(test.width(), test.height(), [&test,&reference](int x, int y)
+	{
+		Color3 d = Color3(test(x,y)) - Color3(reference(x,y));
+		return gray((d * d).average());
+	});
+
+	// identical images have an MSE of 0, so clamp the score at MAX_PSNR instead of returning +inf,
+	// which JSON cannot represent
+	double mse = channelMean(result.map, 0);
+	result.score = min(MAX_PSNR, 10.0 * log10(double(peak) * peak / mse));
+	return result;
+}
+
+// SSIM from the full-resolution terms computed by ssimTerms
+MetricResult ssim(const HDRImage & l, const HDRImage & cs)
+{
+	MetricResult result;
+	result.name = "ssim";
+
+	result.map = l * cs;
+	result.map.setAlpha(1.f);
+	result.score = channelMean(result.map, 0);
+	return result;
+}
+
+// MS-SSIM of the encoded luminances x and y, reusing the full-resolution SSIM terms l0 and cs0
+MetricResult msssim(HDRImage x, HDRImage y, const HDRImage & l0, const HDRImage & cs0)
+{
+	static const float weights[] = {0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f};
+
+	MetricResult result;
+	result.name = "ms-ssim";
+
+	int w = x.width(), h = x.height();
+
+	// use fewer scales for small images, and renormalize the weights of the remaining scales
+	int numScales = 1;
+	while (numScales < 5 && min(w, h) >> numScales >= 11)
+		++numScales;
+	float weightSum = 0.f;
+	for (int s = 0; s < numScales; ++s)
+		weightSum += weights[s];
+
+	result.map = HDRImage::Constant(w, h, gray(1.f));
+	result.score = 1.0;
+	for (int s = 0; s < numScales; ++s)
+	{
+		HDRImage l, cs;
+		if (s == 0)
+		{
+			l = l0;
+			cs = cs0;
+		}
+		else
+			ssimTerms(x, y, l, cs);
+
+		// the luminance term is only used at the coarsest scale
+		HDRImage term = s == numScales - 1 ? HDRImage(l * cs) : cs;
+		float weight = weights[s] / weightSum;
+		result.score *= pow(max(0.0, channelMean(term, 0)), double(weight));
+
+		HDRImage upsampled = s == 0 ? term : term.resized(w, h);
+		result.map = result.map.binaryExpr(upsampled, [weight](const Color4 & a, const Color4 & b)
+		{
+			return gray(a.r * pow(max(0.f, b.r), weight));
+		});
+
+		if (s < numScales - 1)
+		{
+			x = downsample(x);
+			y = downsample(y);
+		}
+	}
+	return result;
+}
+
+// the ACES filmic tone curve approximation by Krzysztof Narkowicz, also used by FLIP
+float acesToneMap(float v)
+{
+	v = max(0.f, v) * 0.6f;
+	return ::clamp((v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f), 0.f, 1.f);
+}
+
+// the HyAB distance between two CIELab colors
+float hyab(const Color3 & a, const Color3 & b)
+{
+	Color3 d = a - b;
+	return fabs(d[0]) + sqrt(d[1] * d[1] + d[2] * d[2]);
+}
+
+// Edge and point features of a single-channel image blurred by sigma, normalized so that a
+// unit step edge or an isolated feature of the blur's size have a response of about 1
+HDRImage features(const HDRImage & luminance, float sigma)
+{
+	HDRImage blurred = luminance.GaussianBlurred(sigma, sigma, AtomicProgress());
+	int w = blurred.width(), h = blurred.height();
+	float edgeScale = sqrt(2.f * float(M_PI)) * sigma, pointScale = sigma * sigma;
+	return generate(w, h, [&blurred,w,h,edgeScale,pointScale](int x, int y)
+	{
+		int xm = max(x - 1, 0), xp = min(x + 1, w - 1), ym = max(y - 1, 0), yp = min(y + 1, h - 1);
+		float c = blurred(x,y).r;
+		float dx = 0.5f * (blurred(xp,y).r - blurred(xm,y).r);
+		float dy = 0.5f * (blurred(x,yp).r - blurred(x,ym).r);
+		float laplacian = blurred(xp,y).r + blurred(xm,y).r + blurred(x,yp).r + blurred(x,ym).r - 4.f * c;
+		return Color4(edgeScale * sqrt(dx * dx + dy * dy), pointScale * fabs(laplacian), 0.f, 1.f);
+	});
+}
+
+// The FLIP-style error of two tone-mapped (display-referred) images
+HDRImage ldrFlip(const HDRImage & test, const HDRImage & reference, float pixelsPerDegree)
+{
+	static const float colorExponent = 0.7f, featureExponent = 0.5f;
+	static const float maxHyab = hyab(Color3(0.f, 1.f, 0.f).convert(CIELab_CS, LinearSRGB_CS),
+	                                  Color3(0.f, 0.f, 1.f).convert(CIELab_CS, LinearSRGB_CS));
+
+	// a Gaussian approximation of the contrast sensitivity function, and the feature detector width
+	float colorSigma = max(0.5f, pixelsPerDegree / 67.f);
+	float featureSigma = 0.5f * 0.082f * pixelsPerDegree;
+
+	HDRImage testFiltered = test.GaussianBlurred(colorSigma, colorSigma, AtomicProgress());
+	HDRImage refFiltered = reference.GaussianBlurred(colorSigma, colorSigma, AtomicProgress());
+
+	auto luminanceOf = [](const HDRImage & img)
+	{
+		return generate(img.width(), img.height(), [&img](int x, int y) {return gray(img(x,y).luminance());});
+	};
+	HDRImage testFeatures = features(luminanceOf(test), featureSigma);
+	HDRImage refFeatures = features(luminanceOf(reference), featureSigma);
+
+	return generate(test.width(), test.height(), [&](int x, int y)
+	{
+		Color3 a = Color3(testFiltered(x,y)).convert(CIELab_CS, LinearSRGB_CS);
+		Color3 b = Color3(refFiltered(x,y)).convert(CIELab_CS, LinearSRGB_CS);
+		float colorError = min(1.f, pow(hyab(a, b) / maxHyab, colorExponent));
+
+		float edge = fabs(testFeatures(x,y).r - refFeatures(x,y).r);
+		float point = fabs(testFeatures(x,y).g - refFeatures(x,y).g);
+		float featureError = min(1.f, pow(max(edge, point) / sqrt(2.f), featureExponent));
+
+		return gray(pow(colorError, 1.f - featureError));
+	});
+}
+
+MetricResult flip(const HDRImage & test, const HDRImage & reference, float pixelsPerDegree)
+{
+	MetricResult result;
+	result.name = "flip";
+
+	// choose the exposure range so that both the brightest and the typical (median) reference
+	// luminances are mapped to the visible range of the tone curve at some exposure
+	vector<float> luminances;
+	luminances.reserve(size_t(reference.width()) * reference.height());
+	for (int y = 0; y < reference.height(); ++y)
+		for (int x = 0; x < reference.width(); ++x)
+		{
+			float l = reference(x,y).luminance();
+			if (isfinite(l) && l > 0.f)
+				luminances.push_back(l);
+		}
+
+	float start = 0.f, stop = 0.f;
+	if (!luminances.empty())
+	{
+		auto median = luminances.begin() + luminances.size() / 2;
+		nth_element(luminances.begin(), median, luminances.end());
+		float maxLuminance = *max_element(luminances.begin(), luminances.end());
+		start = log2(1.f / maxLuminance);
+		stop = max(start, log2(1.f / *median));
+	}
+	int numExposures = ::clamp(int(ceil(stop - start)) + 1, 1, 16);
+
+	result.map = HDRImage::Constant(test.width(), test.height(), gray(0.f));
+	for (int e = 0; e < numExposures; ++e)
+	{
+		float exposure = numExposures > 1 ? start + (stop - start) * e / (numExposures - 1) : start;
+		float scale = pow(2.f, exposure);
+		auto toneMap = [scale](const Color4 & c)
+		{
+			return Color4(acesToneMap(scale * c.r), acesToneMap(scale * c.g), acesToneMap(scale * c.b), 1.f);
+		};
+
+		HDRImage error = ldrFlip(test.unaryExpr(toneMap), reference.unaryExpr(toneMap), pixelsPerDegree);
+		result.map = result.map.binaryExpr(error, [](const Color4 & a, const Color4 & b) {return a.max(b);});
+	}
+
+	result.score = channelMean(result.map, 0);
+	return result;
+}
+
+} // namespace
+
+
+const vector<string> & metricNames()
+{
+	static const vector<string> names = {"psnr", "ssim", "ms-ssim", "flip"};
+	return names;
+}
+
+MetricResult computeMetric(const string & name, const HDRImage & test, const HDRImage & reference,
+                           float pixelsPerDegree)
+{
+	return computeMetrics(vector<string>(1, name), test, reference, pixelsPerDegree).front();
+}
+
+vector<MetricResult> computeMetrics(const vector<string> & names, const HDRImage & test, const HDRImage & reference,
+                                    float pixelsPerDegree)
+{
+	for (auto & name : names)
+		if (find(metricNames().begin(), metricNames().end(), name) == metricNames().end())
+			throw invalid_argument(fmt::format("Unrecognized metric \"{}\".", name));
+
+	if (test.width() != reference.width() || test.height() != reference.height())
+		throw invalid_argument(fmt::format("Cannot compare a {}x{} image to a {}x{} reference.",
+		                                   test.width(), test.height(), reference.width(), reference.height()));
+
+	// replace non-finite values so that they do not poison the filtered statistics
+	auto finite = [](const Color4 & c)
+	{
+		return Color4(isfinite(c.r) ? c.r : 0.f, isfinite(c.g) ? c.g : 0.f, isfinite(c.b) ? c.b : 0.f, c.a);
+	};
+	HDRImage t = test.unaryExpr(finite), r = reference.unaryExpr(finite);
+
+	// the encoded luminances and full-resolution SSIM terms are shared by ssim and ms-ssim
+	HDRImage x, y, l, cs;
+	auto computeSSIMTerms = [&]
+	{
+		if (x.isNull())
+		{
+			x = encodedLuminanceImage(t);
+			y = encodedLuminanceImage(r);
+			ssimTerms(x, y, l, cs);
+		}
+	};
+
+	vector<MetricResult> results;
+	for (auto & name : names)
+	{
+		if (name == "psnr")
+			results.push_back(psnr(t, r));
+		else if (name == "ssim")
+		{
+			computeSSIMTerms();
+			results.push_back(ssim(l, cs));
+		}
+		else if (name == "ms-ssim")
+		{
+			computeSSIMTerms();
+			results.push_back(msssim(x, y, l, cs));
+		}
+		else
+			results.push_back(flip(t, r, pixelsPerDegree));
+	}
+	return results;
+}
@@ -0,0 +1,59 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <string>                // for string
+#include <vector>                // for vector
+#include "HDRImage.h"            // for HDRImage
+
+
+//! The scalar score and per-pixel map of an image comparison metric
+struct MetricResult
+{
+	std::string name;
+	double score = 0.0;         ///< Higher is better for psnr/ssim/ms-ssim, lower is better for flip
+	HDRImage map;               ///< Per-pixel error or similarity, stored in the color channels
+};
+
+
+/*!
+ * @brief Compare \a test against \a reference using the metric \a name.
+ *
+ * Supported metrics:
+ *  - "psnr":    Peak signal-to-noise ratio in dB over the RGB channels. The peak is the largest
+ *               reference value, but at least 1, so HDR references are not clipped.
+ *               The score is clamped to 100 dB, which identical images reach.
+ *               The map holds the per-pixel mean squared error.
+ *  - "ssim":    Structural similarity of the sRGB-encoded luminance, clamped to [0,1],
+ *               using an 11x11 Gaussian window (sigma = 1.5). The map holds the local SSIM.
+ *  - "ms-ssim": Multi-scale SSIM over up to five dyadic scales, with the weights of Wang et al.
+ *               The map combines the per-scale maps, upsampled to full resolution.
+ *  - "flip":    An HDR perceptual difference in the spirit of NVIDIA's FLIP: both images are
+ *               tone mapped at several exposures, compared using a color (HyAB) and a feature
+ *               (edge/point) term, and the maximum error over all exposures is kept.
+ *               The map and score are in [0,1].
+ *
+ * Throws std::invalid_argument if the metric is unknown or the images differ in size.
+ *
+ * @param pixelsPerDegree	Viewing condition used by the "flip" metric
+ */
+MetricResult computeMetric(const std::string & name, const HDRImage & test, const HDRImage & reference,
+                           float pixelsPerDegree = 67.f);
+
+/*!
+ * @brief Compute several metrics at once.
+ *
+ * Work shared between metrics, such as the luminance conversion and the full-resolution
+ * SSIM statistics used by both "ssim" and "ms-ssim", is only done once.
+ * The results are returned in the order of \a names.
+ */
+std::vector<MetricResult> computeMetrics(const std::vector<std::string> & names,
+                                         const HDRImage & test, const HDRImage & reference,
+                                         float pixelsPerDegree = 67.f);
+
+//! The names accepted by computeMetric
+const std::vector<std::string> & metricNames();
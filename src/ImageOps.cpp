@@ -0,0 +1,738 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "ImageOps.h"
+#include <cmath>                 // for pow, round, isfinite
+#include <cstdio>                // for sscanf
+#include <cstdlib>               // for strtof, strtoull
+#include <memory>                // for shared_ptr, make_shared
+#include <stdexcept>             // for invalid_argument, runtime_error
+#include "Benchmark.h"           // for StageTimings
+#include "ColorLUT.h"            // for ColorLUT
+#include "ColorPipeline.h"       // for ColorPipeline
+#include "Colorspace.h"          // for chromaticAdaptation, temperatureTintToLinearSRGB
+#include "Common.h"              // for toLower, clamp
+#include "EnvMap.h"              // for batchConvertEnvMappingUV, convertEnvMappingUVJacobian
+#include "FastMath.h"            // for fastPow, fastLinearToSRGB, fastSRGBToLinear
+#include "FilmicToneCurve.h"     // for FilmicToneCurve
+#include "LocalTonemap.h"        // for locallyTonemapped, LocalTonemapSpec
+#include "Noise.h"               // for noisy, NoiseSpec
+#include "ParallelFor.h"         // for parallel_for
+#include <spdlog/fmt/fmt.h>
+
+using namespace std;
+using namespace Eigen;
+
+// local functions
+namespace
+{
+
+// split a comma-separated argument list, keeping the arguments in order
+vector<string> splitArgs(const string & args)
+{
+	vector<string> result;
+	if (args.empty())
+		return result;
+
+	size_t begin = 0;
+	while (true)
+	{
+		size_t end = args.find(',', begin);
+		result.push_back(args.substr(begin, end == string::npos ? string::npos : end - begin));
+		if (end == string::npos)
+			return result;
+		begin = end + 1;
+	}
+}
+
+void checkNumArgs(const string & spec, const vector<string> & args, size_t minArgs, size_t maxArgs)
+{
+	if (args.size() < minArgs || args.size() > maxArgs)
+	{
+		if (minArgs == maxArgs)
+			throw invalid_argument(fmt::format("Operation \"{}\" expects {} argument(s), but got {}.",
+			                                   spec, minArgs, args.size()));
+		throw invalid_argument(fmt::format("Operation \"{}\" expects between {} and {} arguments, but got {}.",
+		                                   spec, minArgs, maxArgs, args.size()));
+	}
+}
+
+float parseFloat(const string & spec, const string & arg)
+{
+	char * end = nullptr;
+	float value = strtof(arg.c_str(), &end);
+	if (arg.empty() || *end != '\0')
+		throw invalid_argument(fmt::format("Cannot parse \"{}\" as a number in operation \"{}\".", arg, spec));
+	return value;
+}
+
+// parse the i-th argument, or return a default value if there are fewer arguments
+float floatArg(const string & spec, const vector<string> & args, size_t i, float defaultValue)
+{
+	return i < args.size() ? parseFloat(spec, args[i]) : defaultValue;
+}
+
+// parse the name of a chromatic adaptation transform, in the order of EChromaticAdaptation
+bool parseChromaticAdaptation(const string & arg, EChromaticAdaptation & method)
+{
+	static const vector<string> names = {"xyz", "von-kries", "bradford", "cat02"};
+	for (size_t i = 0; i < names.size(); ++i)
+		if (toLower(arg) == names[i])
+		{
+			method = EChromaticAdaptation(i);
+			return true;
+		}
+	return false;
+}
+
+// parse an absolute ("640x480") or relative ("50%x25%") image size
+struct ImageSize
+{
+	bool relative = true;
+	float width = 100.f, height = 100.f;
+
+	static bool parse(const string & s, ImageSize & size)
+	{
+		int w, h;
+		char c;
+		if (sscanf(s.c_str(), "%f%%x%f%%%c", &size.width, &size.height, &c) == 2)
+		{
+			size.relative = true;
+			return true;
+		}
+		if (sscanf(s.c_str(), "%dx%d%c", &w, &h, &c) == 2)
+		{
+			size.relative = false;
+			size.width = float(w);
+			size.height = float(h);
+			return true;
+		}
+		return false;
+	}
+
+	int widthFor(const HDRImage & img) const
+	{
+		return relative ? max(1, (int)round(width/100.f*img.width())) : (int)width;
+	}
+
+	int heightFor(const HDRImage & img) const
+	{
+		return relative ? max(1, (int)round(height/100.f*img.height())) : (int)height;
+	}
+};
+
+EEnvMappingUVMode envMappingMode(const string & mapping)
+{
+	if (mapping == "angularmap")
+		return ANGULAR_MAP;
+	else if (mapping == "mirrorball")
+		return MIRROR_BALL;
+	else if (mapping == "latlong")
+		return LAT_LONG;
+	else if (mapping == "cylindrical")
+		return CYLINDRICAL;
+	else if (mapping == "cubemap")
+		return CUBE_MAP;
+	else if (mapping == "cubemap-hcross")
+		return CUBE_MAP_HORIZONTAL_CROSS;
+	else if (mapping == "cubemap-strip")
+		return CUBE_MAP_STRIP;
+
+	throw invalid_argument(fmt::format("Unrecognized environment mapping type \"{}\".", mapping));
+}
+
+ImageOp makePointwise(const string & spec, ImageOp::PointwiseFunc f)
+{
+	ImageOp op;
+	op.name = spec;
+	op.pointwise = f;
+	return op;
+}
+
+// a pointwise operation that only changes colors, see ImageOp::color
+ImageOp makeColor(const string & spec, const ColorPipeline & color)
+{
+	ImageOp op = makePointwise(spec, [color](const Color4 & c) {return Color4(color(Color3(c.r, c.g, c.b)), c.a);});
+	op.color = color;
+	return op;
+}
+
+ImageOp makeCurve(const string & spec, const ColorPipeline::CurveFunc & f,
+                  const ColorPipeline::SpanFunc & span = nullptr, float lo = 0.f, float hi = 1.f)
+{
+	ColorPipeline color;
+	color.addCurve(f, spec, span, lo, hi);
+	return makeColor(spec, color);
+}
+
+ImageOp makeApply(const string & spec, ImageOp::ApplyFunc f)
+{
+	ImageOp op;
+	op.name = spec;
+	op.apply = f;
+	return op;
+}
+
+// for the operations that do not draw random numbers
+ImageOp makeApply(const string & spec, const function<HDRImage(const HDRImage &, AtomicProgress)> & f)
+{
+	return makeApply(spec, [f](const HDRImage & img, uint32_t, AtomicProgress progress) {return f(img, progress);});
+}
+
+} // namespace
+
+
+const string & imageOpUsage()
+{
+	static const string usage =
+R"(Pointwise operations (adjacent ones are fused into a single pass, in which
+adjacent exposures/inversions and adjacent curves are folded together):
+  exposure:E               Multiply the color channels by 2^E.
+  gamma:G                  Raise the color channels to the power 1/G.
+  clamp:LO,HI              Clamp the color channels to [LO,HI].
+  invert                   Compute 1-color (alpha is unchanged).
+  nan:R,G,B                Replace pixels containing NaNs or infinities.
+  alpha:A                  Set the alpha channel to A.
+  srgb                     Convert linear values to the sRGB curve.
+  linear                   Convert sRGB-encoded values to linear.
+  filmic[:TS,TL,SS,SL,SA,G]
+                           Apply a filmic tone curve with the given toe
+                           strength/length, shoulder strength/length/angle
+                           and gamma [default: .25,.25,4,.5,.5,1].
+  filmic-inverse[:TS,TL,SS,SL,SA,G]
+                           Undo the filmic tone curve with the given
+                           parameters.
+  hue-saturation:H,S,L     Rotate the hue by H degrees, and change the
+                           saturation and lightness by S and L in
+                           [-100,100].
+  white-balance:T,TINT[,CAT] or white-balance:R,G,B[,CAT]
+                           Adapt the white of an illuminant with temperature
+                           T (in Kelvin) and TINT in [-100,100], or the
+                           neutral color R,G,B, to the D65 white, with
+                           CAT : (xyz | von-kries | bradford | cat02)
+                           [default: bradford].
+  lut:FILE[,INTERP]        Apply the 1D/3D LUT in the .cube or .3dl FILE,
+                           with INTERP : (tetrahedral | trilinear)
+                           [default: tetrahedral].
+Other operations:
+  gaussian:SX,SY           Gaussian blur.
+  fast-gaussian:SX,SY      Fast Gaussian approximation using box blurs.
+  box:WX,WY                Box blur.
+  median:R[,CHANNEL]       Median filter with radius R, optionally only
+                           filtering a single CHANNEL (0-3).
+  bilateral:SR,SD          Bilateral filter with range/domain sigmas.
+  unsharp:S,STRENGTH       Unsharp mask.
+  brightness-contrast:B,C  Adjust brightness and contrast in [-1,1].
+  resize:SIZE              Resize to an absolute ('640x480') or relative
+                           ('50%x50%') SIZE.
+  remap:M,M[,S][,L][,SIZE] Convert between environment map formats, see
+                           --remap. S can also be 'filtered'.
+  flip-h, flip-v           Flip horizontally or vertically.
+  rotate-cw, rotate-ccw    Rotate by 90 degrees.
+  noise:TYPE,A[,B][,SEED]  Add reproducible random noise, where TYPE is
+                           uniform (in [A,B]), gaussian (mean A, standard
+                           deviation B) or poisson (shot noise with A photons
+                           per unit intensity). Each input file gets its own
+                           independent noise.
+  reinhard[:KEY,PHI,EPS,SAT]
+                           Local tone mapping with the photographic operator
+                           of Reinhard et al., with the given key, sharpening
+                           and threshold, and saturation exponent SAT
+                           [default: .18,8,.05,1].
+  durand[:C,SS,SR,SAT]     Local tone mapping with the bilateral base/detail
+                           decomposition of Durand and Dorsey, compressing
+                           the base to C stops, with spatial sigma SS (as a
+                           fraction of the image size) and range sigma SR
+                           (in stops) [default: 5,.02,1.3,1].
+  local-laplacian[:A,B,SR,SAT]
+                           Local tone mapping with the local Laplacian filter
+                           of Paris et al., raising details smaller than SR
+                           stops to the power A and compressing larger edges
+                           by B [default: 1,.3,1.3,1].)";
+	return usage;
+}
+
+
+ImageOp parseImageOp(const string & spec, HDRImage::BorderMode mX, HDRImage::BorderMode mY)
+{
+	size_t colon = spec.find(':');
+	string name = toLower(spec.substr(0, colon));
+	vector<string> args = splitArgs(colon == string::npos ? "" : spec.substr(colon + 1));
+
+	//
+	// pointwise operations
+	//
+	if (name == "exposure")
+	{
+		checkNumArgs(spec, args, 1, 1);
+		ColorPipeline color;
+		color.addGain(Color3(pow(2.f, parseFloat(spec, args[0]))), spec);
+		return makeColor(spec, color);
+	}
+	else if (name == "gamma")
+	{
+		checkNumArgs(spec, args, 1, 1);
+		float invGamma = 1.f / max(0.0001f, parseFloat(spec, args[0]));
+		return makeCurve(spec, [invGamma](float v) {return fastPow(v, invGamma);},
+		                 [invGamma](const float * in, float * out, size_t n) {fastPow(in, out, n, invGamma);});
+	}
+	else if (name == "clamp")
+	{
+		checkNumArgs(spec, args, 2, 2);
+		float lo = parseFloat(spec, args[0]), hi = parseFloat(spec, args[1]);
+		return makeCurve(spec, [lo,hi](float v) {return ::clamp(v, lo, hi);});
+	}
+	else if (name == "invert")
+	{
+		checkNumArgs(spec, args, 0, 0);
+		ColorPipeline color;
+		color.addMatrix(-Eigen::Matrix3f::Identity(), Eigen::Vector3f::Ones(), spec);
+		return makeColor(spec, color);
+	}
+	else if (name == "nan")
+	{
+		checkNumArgs(spec, args, 3, 3);
+		Color3 nanColor(parseFloat(spec, args[0]), parseFloat(spec, args[1]), parseFloat(spec, args[2]));
+		return makePointwise(spec, [nanColor](const Color4 & c)
+		{
+			return isfinite(c.sum()) ? c : Color4(nanColor, c[3]);
+		});
+	}
+	else if (name == "alpha")
+	{
+		checkNumArgs(spec, args, 1, 1);
+		float a = parseFloat(spec, args[0]);
+		return makePointwise(spec, [a](const Color4 & c) {return Color4(c.r, c.g, c.b, a);});
+	}
+	else if (name == "srgb")
+	{
+		checkNumArgs(spec, args, 0, 0);
+		return makeCurve(spec, [](float v) {return fastLinearToSRGB(v);},
+		                 [](const float * in, float * out, size_t n) {fastLinearToSRGB(in, out, n);});
+	}
+	else if (name == "linear")
+	{
+		checkNumArgs(spec, args, 0, 0);
+		return makeCurve(spec, [](float v) {return fastSRGBToLinear(v);},
+		                 [](const float * in, float * out, size_t n) {fastSRGBToLinear(in, out, n);});
+	}
+	else if (name == "filmic" || name == "filmic-inverse")
+	{
+		checkNumArgs(spec, args, 0, 6);
+		FilmicToneCurve::CurveParamsUser params;
+		params.toeStrength = floatArg(spec, args, 0, params.toeStrength);
+		params.toeLength = floatArg(spec, args, 1, params.toeLength);
+		params.shoulderStrength = floatArg(spec, args, 2, params.shoulderStrength);
+		params.shoulderLength = floatArg(spec, args, 3, params.shoulderLength);
+		params.shoulderAngle = floatArg(spec, args, 4, params.shoulderAngle);
+		params.gamma = floatArg(spec, args, 5, params.gamma);
+
+		FilmicToneCurve::CurveParamsDirect directParams;
+		FilmicToneCurve::calcDirectParamsFromUser(directParams, params);
+		FilmicToneCurve::FullCurve curve;
+		FilmicToneCurve::createCurve(curve, directParams);
+
+		// the baked curve saturates at its xMax, so composed tables only need to cover [0, xMax]
+		auto baked = make_shared<FilmicToneCurve::BakedCurve>(FilmicToneCurve::bake(curve, name == "filmic-inverse"));
+		return makeCurve(spec, [baked](float v) {return baked->eval(v);},
+		                 [baked](const float * in, float * out, size_t n) {baked->eval(in, out, n);},
+		                 0.f, baked->xMax);
+	}
+	else if (name == "hue-saturation")
+	{
+		checkNumArgs(spec, args, 3, 3);
+		float h = parseFloat(spec, args[0]);
+		float sat = (parseFloat(spec, args[1]) + 100.f) / 100.f;
+		float l = parseFloat(spec, args[2]) / 100.f;
+		ColorPipeline color;
+		color.addFunction([h,sat,l](const Color3 & c)
+		{
+			Color4 v = Color4(c, 1.f).HSLAdjust(h, sat, l);
+			return Color3(v.r, v.g, v.b);
+		}, spec);
+		return makeColor(spec, color);
+	}
+
+	else if (name == "white-balance")
+	{
+		checkNumArgs(spec, args, 2, 4);
+		EChromaticAdaptation method = BRADFORD_CA;
+		if (parseChromaticAdaptation(args.back(), method))
+			args.pop_back();
+
+		if (args.size() != 2 && args.size() != 3)
+			throw invalid_argument(fmt::format("Operation \"{}\" expects a temperature and tint, or a neutral color.", spec));
+		Color3 white = args.size() == 2 ?
+		               temperatureTintToLinearSRGB(parseFloat(spec, args[0]), parseFloat(spec, args[1])) :
+		               Color3(parseFloat(spec, args[0]), parseFloat(spec, args[1]), parseFloat(spec, args[2]));
+
+		ColorPipeline color;
+		try
+		{
+			color.addMatrix(chromaticAdaptation(white, Color3(1.f), method), Vector3f::Zero(), spec);
+		}
+		catch (const invalid_argument & e)
+		{
+			throw invalid_argument(fmt::format("{} In operation \"{}\".", e.what(), spec));
+		}
+		return makeColor(spec, color);
+	}
+
+	//
+	// color lookup tables
+	//
+	else if (name == "lut")
+	{
+		checkNumArgs(spec, args, 1, 2);
+		ColorLUT::Interpolation interp = ColorLUT::TETRAHEDRAL;
+		if (args.size() == 2)
+		{
+			string mode = toLower(args[1]);
+			if (mode == "trilinear")
+				interp = ColorLUT::TRILINEAR;
+			else if (mode != "tetrahedral")
+				throw invalid_argument(fmt::format("Unrecognized interpolation \"{}\" in operation \"{}\".", args[1], spec));
+		}
+
+		shared_ptr<const ColorLUT> lut;
+		try
+		{
+			lut = make_shared<ColorLUT>(ColorLUT::load(args[0]));
+		}
+		catch (const runtime_error & e)
+		{
+			throw invalid_argument(e.what());
+		}
+		ColorPipeline color;
+		color.addLUT(lut, interp, spec);
+		return makeColor(spec, color);
+	}
+
+	//
+	// filters
+	//
+	else if (name == "gaussian" || name == "fast-gaussian" || name == "box" ||
+	         name == "bilateral" || name == "unsharp")
+	{
+		checkNumArgs(spec, args, 2, 2);
+		float a = parseFloat(spec, args[0]), b = parseFloat(spec, args[1]);
+		if (name == "gaussian")
+			return makeApply(spec, [a,b,mX,mY](const HDRImage & img, AtomicProgress progress)
+			{
+				return img.GaussianBlurred(a, b, progress, mX, mY);
+			});
+		else if (name == "fast-gaussian")
+			return makeApply(spec, [a,b,mX,mY](const HDRImage & img, AtomicProgress progress)
+			{
+				return img.fastGaussianBlurred(a, b, progress, mX, mY);
+			});
+		else if (name == "box")
+			return makeApply(spec, [a,b,mX,mY](const HDRImage & img, AtomicProgress progress)
+			{
+				return img.boxBlurred(int(a), int(b), progress, mX, mY);
+			});
+		else if (name == "bilateral")
+			return makeApply(spec, [a,b,mX,mY](const HDRImage & img, AtomicProgress progress)
+			{
+				return img.bilateralFiltered(a, b, progress, mX, mY);
+			});
+		else
+			return makeApply(spec, [a,b,mX,mY](const HDRImage & img, AtomicProgress progress)
+			{
+				return img.unsharpMasked(a, b, progress, mX, mY);
+			});
+	}
+	else if (name == "median")
+	{
+		checkNumArgs(spec, args, 1, 2);
+		float radius = parseFloat(spec, args[0]);
+		if (args.size() == 2)
+		{
+			int channel = ::clamp(int(parseFloat(spec, args[1])), 0, 3);
+			return makeApply(spec, [radius,channel,mX,mY](const HDRImage & img, AtomicProgress progress)
+			{
+				return img.medianFiltered(radius, channel, progress, mX, mY);
+			});
+		}
+		return makeApply(spec, [radius,mX,mY](const HDRImage & img, AtomicProgress progress)
+		{
+			return img.medianFiltered(radius, progress, mX, mY);
+		});
+	}
+	else if (name == "brightness-contrast")
+	{
+		checkNumArgs(spec, args, 2, 2);
+		float b = parseFloat(spec, args[0]), c = parseFloat(spec, args[1]);
+		return makeApply(spec, [b,c](const HDRImage & img, AtomicProgress)
+		{
+			return img.brightnessContrast(b, c, false, RGB);
+		});
+	}
+
+	//
+	// geometric transformations
+	//
+	else if (name == "resize")
+	{
+		checkNumArgs(spec, args, 1, 1);
+		ImageSize size;
+		if (!ImageSize::parse(args[0], size))
+			throw invalid_argument(fmt::format("Cannot parse image size \"{}\" in operation \"{}\".", args[0], spec));
+		return makeApply(spec, [size](const HDRImage & img, AtomicProgress)
+		{
+			return img.resized(size.widthFor(img), size.heightFor(img));
+		});
+	}
+	else if (name == "remap")
+	{
+		checkNumArgs(spec, args, 2, 5);
+		EEnvMappingUVMode from = envMappingMode(toLower(args[0])), to = envMappingMode(toLower(args[1]));
+
+		int samples = 1;
+		bool filtered = false;
+		HDRImage::Sampler sampler = HDRImage::BILINEAR;
+		ImageSize size;
+		for (size_t i = 2; i < args.size(); ++i)
+		{
+			string arg = toLower(args[i]);
+			int n;
+			char c;
+			if (sscanf(arg.c_str(), "%d%c", &n, &c) == 1)
+				samples = max(1, n);
+			else if (arg == "filtered")
+				filtered = true;
+			else if (arg == "nearest")
+				sampler = HDRImage::NEAREST;
+			else if (arg == "bilinear")
+				sampler = HDRImage::BILINEAR;
+			else if (arg == "bicubic")
+				sampler = HDRImage::BICUBIC;
+			else if (!ImageSize::parse(arg, size))
+				throw invalid_argument(fmt::format("Cannot parse argument \"{}\" in operation \"{}\".", args[i], spec));
+		}
+
+		function<Vector2f(const Vector2f &)> warp = [](const Vector2f & uv) {return uv;};
+		function<Matrix2f(const Vector2f &)> jacobian = [](const Vector2f &) -> Matrix2f {return Matrix2f::Identity();};
+		if (from != to)
+		{
+			warp = [from,to](const Vector2f & uv) {return convertEnvMappingUV(from, to, uv);};
+			jacobian = [from,to](const Vector2f & uv) {return convertEnvMappingUVJacobian(from, to, uv);};
+		}
+
+		return makeApply(spec, [from,to,warp,jacobian,filtered,samples,sampler,size,mX,mY](const HDRImage & img, AtomicProgress progress)
+		{
+			if (filtered)
+				return img.filteredResampled(size.widthFor(img), size.heightFor(img), progress, warp, jacobian,
+				                             sampler, mX, mY);
+			if (from != to)
+				return img.resampled(size.widthFor(img), size.heightFor(img), progress,
+				                     [from,to](const UVArray & dstUV, UVArray & srcUV)
+				                     {
+					                     batchConvertEnvMappingUV(from, to, dstUV, srcUV);
+				                     },
+				                     samples, sampler, mX, mY);
+			return img.resampled(size.widthFor(img), size.heightFor(img), progress, warp, samples, sampler, mX, mY);
+		});
+	}
+	else if (name == "flip-h")
+	{
+		checkNumArgs(spec, args, 0, 0);
+		return makeApply(spec, [](const HDRImage & img, AtomicProgress) {return img.flippedHorizontal();});
+	}
+	else if (name == "flip-v")
+	{
+		checkNumArgs(spec, args, 0, 0);
+		return makeApply(spec, [](const HDRImage & img, AtomicProgress) {return img.flippedVertical();});
+	}
+	else if (name == "rotate-cw")
+	{
+		checkNumArgs(spec, args, 0, 0);
+		return makeApply(spec, [](const HDRImage & img, AtomicProgress) {return img.rotated90CW();});
+	}
+	else if (name == "rotate-ccw")
+	{
+		checkNumArgs(spec, args, 0, 0);
+		return makeApply(spec, [](const HDRImage & img, AtomicProgress) {return img.rotated90CCW();});
+	}
+	else if (name == "noise")
+	{
+		checkNumArgs(spec, args, 2, 4);
+		NoiseSpec noise;
+		string type = toLower(args[0]);
+		if (type == "uniform")
+			noise.distribution = NoiseSpec::UNIFORM;
+		else if (type == "gaussian")
+			noise.distribution = NoiseSpec::GAUSSIAN;
+		else if (type == "poisson")
+			noise.distribution = NoiseSpec::POISSON;
+		else
+			throw invalid_argument(fmt::format("Unrecognized noise type \"{}\" in \"{}\".", args[0], spec));
+
+		noise.a = parseFloat(spec, args[1]);
+		noise.b = floatArg(spec, args, 2, 1.f);
+		if (args.size() > 3)
+		{
+			char * end = nullptr;
+			noise.seed = strtoull(args[3].c_str(), &end, 10);
+			if (args[3].empty() || *end != '\0')
+				throw invalid_argument(fmt::format("Cannot parse \"{}\" as a seed in operation \"{}\".", args[3], spec));
+		}
+		if (noise.distribution == NoiseSpec::POISSON && noise.a <= 0.f)
+			throw invalid_argument(fmt::format("Poisson noise needs a positive photon count in \"{}\".", spec));
+		return makeApply(spec, [noise](const HDRImage & img, uint32_t stream, AtomicProgress progress)
+		{
+			return noisy(img, noise, stream, progress);
+		});
+	}
+
+	else if (name == "reinhard" || name == "durand" || name == "local-laplacian")
+	{
+		checkNumArgs(spec, args, 0, 4);
+		LocalTonemapSpec tonemap;
+		if (name == "reinhard")
+		{
+			tonemap.op = LocalTonemapSpec::REINHARD;
+			tonemap.key = floatArg(spec, args, 0, tonemap.key);
+			tonemap.sharpening = floatArg(spec, args, 1, tonemap.sharpening);
+			tonemap.threshold = floatArg(spec, args, 2, tonemap.threshold);
+			if (tonemap.key <= 0.f || tonemap.threshold <= 0.f)
+				throw invalid_argument(fmt::format("The key and threshold must be positive in \"{}\".", spec));
+		}
+		else if (name == "durand")
+		{
+			tonemap.op = LocalTonemapSpec::DURAND;
+			tonemap.contrast = floatArg(spec, args, 0, tonemap.contrast);
+			tonemap.sigmaSpatial = floatArg(spec, args, 1, tonemap.sigmaSpatial);
+			tonemap.sigmaRange = floatArg(spec, args, 2, tonemap.sigmaRange);
+		}
+		else
+		{
+			tonemap.op = LocalTonemapSpec::LOCAL_LAPLACIAN;
+			tonemap.detail = floatArg(spec, args, 0, tonemap.detail);
+			tonemap.compression = floatArg(spec, args, 1, tonemap.compression);
+			tonemap.sigmaRange = floatArg(spec, args, 2, tonemap.sigmaRange);
+		}
+		tonemap.saturation = floatArg(spec, args, 3, tonemap.saturation);
+		if (tonemap.sigmaSpatial <= 0.f || tonemap.sigmaRange <= 0.f)
+			throw invalid_argument(fmt::format("The sigmas must be positive in \"{}\".", spec));
+		return makeApply(spec, [tonemap](const HDRImage & img, AtomicProgress progress)
+		{
+			return locallyTonemapped(img, tonemap, progress);
+		});
+	}
+
+	throw invalid_argument(fmt::format("Unrecognized operation \"{}\".", spec));
+}
+
+
+void ImageOpChain::add(const ImageOp & op)
+{
+	if (!op.isPointwise() && !op.apply)
+		throw invalid_argument(fmt::format("Operation \"{}\" does nothing.", op.name));
+
+	// fuse with the previous stage if both are pointwise, and the previous one is not baked yet
+	if (op.isPointwise() && !m_stages.empty() && m_stages.back().pointwise && !m_stages.back().lut)
+		m_stages.back().ops.push_back(op);
+	else
+		m_stages.emplace_back(op);
+
+	// recompile the color transforms of the whole stage
+	Stage & stage = m_stages.back();
+	if (stage.bakeable())
+	{
+		ColorPipeline color;
+		for (auto & o : stage.ops)
+			color.append(o.color);
+		stage.color = color.compiled();
+	}
+}
+
+string ImageOpChain::description() const
+{
+	string out;
+	for (size_t s = 0; s < m_stages.size(); ++s)
+		out += (s ? " -> " : "") + m_stages[s].description();
+	return out;
+}
+
+string ImageOpChain::Stage::description() const
+{
+	string out = ops.size() > 1 ? "[" : "";
+	for (size_t i = 0; i < ops.size(); ++i)
+		out += (i ? " + " : "") + ops[i].name;
+	out = ops.size() > 1 ? out + "]" : out;
+	return lut ? fmt::format("{} as {}^3 LUT", out, lut->size3D()) : out;
+}
+
+bool ImageOpChain::Stage::bakeable() const
+{
+	if (!pointwise || lut)
+		return false;
+	for (auto & op : ops)
+		if (!op.isColor())
+			return false;
+	return true;
+}
+
+int ImageOpChain::bakePointwise(int size, float maxValue)
+{
+	int numBaked = 0;
+	for (auto & stage : m_stages)
+		if (stage.bakeable())
+		{
+			stage.lut = make_shared<ColorLUT>(ColorLUT::bake(stage.color, size, maxValue));
+			++numBaked;
+		}
+	return numBaked;
+}
+
+ColorLUT ImageOpChain::bakedLUT(int size, float maxValue) const
+{
+	if (m_stages.size() != 1 || !m_stages.front().bakeable())
+		throw invalid_argument(fmt::format("Only color operations can be baked into a LUT, but got \"{}\".",
+		                                   description()));
+	return ColorLUT::bake(m_stages.front().color, size, maxValue);
+}
+
+void ImageOpChain::apply(HDRImage & image, AtomicProgress progress, StageTimings * timings, uint32_t stream) const
+{
+	progress.setNumSteps(int(m_stages.size()));
+	for (auto & stage : m_stages)
+	{
+		StageTimings::Scope scope(timings, "op " + stage.description(), 1e-6 * image.width() * image.height());
+		if (stage.lut)
+			stage.lut->apply(image, ColorLUT::TETRAHEDRAL, AtomicProgress(progress, 1.f/m_stages.size()));
+		else if (stage.bakeable())
+			stage.color.apply(image, AtomicProgress(progress, 1.f/m_stages.size()));
+		else if (stage.pointwise)
+		{
+			vector<ImageOp::PointwiseFunc> fns;
+			for (auto & op : stage.ops)
+				fns.push_back(op.pointwise);
+			applyPointwise(image, fns);
+		}
+		else
+			image = stage.ops.front().apply(image, stream, AtomicProgress(progress, 1.f/m_stages.size()));
+		++progress;
+	}
+}
+
+void ImageOpChain::applyPointwise(HDRImage & image, const vector<ImageOp::PointwiseFunc> & fns)
+{
+	if (fns.empty())
+		return;
+
+	parallel_for(0, image.height(), [&image,&fns](int y)
+	{
+		for (int x = 0; x < image.width(); ++x)
+		{
+			Color4 c = image(x,y);
+			for (auto & f : fns)
+				c = f(c);
+			image(x,y) = c;
+		}
+	});
+}
@@ -0,0 +1,123 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <functional>            // for function
+#include <memory>                // for shared_ptr
+#include <string>                // for string
+#include <vector>                // for vector
+#include "ColorLUT.h"            // for ColorLUT
+#include "ColorPipeline.h"       // for ColorPipeline
+#include "HDRImage.h"            // for HDRImage, Color4
+
+class StageTimings;
+
+/*!
+ * @brief A single operation of an image processing chain.
+ *
+ * Pointwise operations, whose result for a pixel only depends on that pixel's value,
+ * set \a pointwise. All other operations set \a apply, which also gets the stream of the
+ * image, so that operations drawing random numbers give each image of a batch its own.
+ */
+struct ImageOp
+{
+	using PointwiseFunc = std::function<Color4(const Color4 &)>;
+	using ApplyFunc = std::function<HDRImage(const HDRImage &, uint32_t stream, AtomicProgress)>;
+
+	std::string name;           ///< The specification this operation was created from
+	PointwiseFunc pointwise;    ///< Per-pixel function, for pointwise operations
+	ApplyFunc apply;            ///< Whole-image function, for all other operations
+	ColorPipeline color;        ///< For pointwise operations that only change colors and keep alpha
+
+	bool isPointwise() const {return bool(pointwise);}
+	bool isColor() const {return !color.empty();}
+};
+
+
+/*!
+ * @brief Create an image operation from a specification of the form "NAME[:ARG,ARG,...]".
+ *
+ * See imageOpUsage() for the list of supported operations.
+ * Throws std::invalid_argument if the specification cannot be parsed.
+ *
+ * @param spec	The operation specification, for instance "gaussian:2,2" or "resize:50%x50%"
+ * @param mX	The border mode in the x direction, used by filters and resampling
+ * @param mY	The border mode in the y direction, used by filters and resampling
+ */
+ImageOp parseImageOp(const std::string & spec,
+                     HDRImage::BorderMode mX = HDRImage::EDGE,
+                     HDRImage::BorderMode mY = HDRImage::EDGE);
+
+//! A human-readable list of the supported operations and their arguments
+const std::string & imageOpUsage();
+
+
+/*!
+ * @brief A sequence of image operations applied in order.
+ *
+ * Runs of consecutive pointwise operations are fused into a single stage, which is applied in
+ * place with one parallel pass over the image. When all of them only change colors, their
+ * transforms are compiled into a single ColorPipeline, which folds adjacent matrices and curves.
+ * The other stages hand their result to the next stage by move, so only the current input and
+ * output images are alive at any time.
+ */
+class ImageOpChain
+{
+public:
+	void add(const ImageOp & op);
+
+	bool empty() const                   {return m_stages.empty();}
+	size_t numStages() const             {return m_stages.size();}
+
+	//! Describes the stages, for instance: "gaussian:2,2 -> [exposure:1 + srgb]"
+	std::string description() const;
+
+	/*!
+	 * @brief Run all stages on \a image, in place.
+	 *
+	 * If \a timings is given, each stage is recorded in it as "op DESCRIPTION". Operations
+	 * that add noise use \a stream, so pass a different one for each image of a batch.
+	 */
+	void apply(HDRImage & image, AtomicProgress progress = AtomicProgress(),
+	           StageTimings * timings = nullptr, uint32_t stream = 0) const;
+
+	/*!
+	 * @brief Replace each stage of pointwise operations that only change colors by a \a size^3 3D LUT.
+	 *
+	 * A LUT costs the same whatever the operations, so this speeds up long or expensive chains at
+	 * the price of interpolation error. Values outside of [0, \a maxValue] are clamped.
+	 *
+	 * @return The number of stages that were baked
+	 */
+	int bakePointwise(int size, float maxValue);
+
+	/*!
+	 * @brief Bake the whole chain into a single 3D LUT, see bakePointwise().
+	 *
+	 * Throws std::invalid_argument if the chain has operations that cannot be baked.
+	 */
+	ColorLUT bakedLUT(int size, float maxValue) const;
+
+	//! Apply all pointwise operations of a single stage in place, in one parallel pass
+	static void applyPointwise(HDRImage & image, const std::vector<ImageOp::PointwiseFunc> & fns);
+
+private:
+	struct Stage
+	{
+		explicit Stage(const ImageOp & op) : ops{op}, pointwise(op.isPointwise()) {}
+
+		std::vector<ImageOp> ops;
+		bool pointwise;
+		std::shared_ptr<const ColorLUT> lut;    ///< The LUT the pointwise operations were baked into, if any
+		ColorPipeline color;                    ///< The compiled transforms, if all operations only change colors
+
+		std::string description() const;
+		bool bakeable() const;
+	};
+
+	std::vector<Stage> m_stages;
+};
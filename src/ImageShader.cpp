@@ -5,9 +5,12 @@
 //
 
 #include "ImageShader.h"
+#include "ColorLUT.h"
 #include "Common.h"
 #include "DitherMatrix256.h"
+#include <algorithm>
 #include <random>
+#include <vector>
 
 using namespace nanogui;
 using namespace Eigen;
@@ -58,6 +61,17 @@ constexpr char const *const fragmentShader =
 	uniform bool hasReference;
 
 	uniform int blendMode;
+    uniform mat3 colorMatrix;
+
+    uniform sampler2D lutShaper;
+    uniform int lutSize1D;
+    uniform vec3 lutMin1D;
+    uniform vec3 lutMax1D;
+    uniform sampler3D lut3D;
+    uniform int lutSize3D;
+    uniform vec3 lutMin3D;
+    uniform vec3 lutMax3D;
+
     uniform float gain;
     uniform int channel;
     uniform float gamma;
@@ -265,6 +279,32 @@ constexpr char const *const fragmentShader =
         return vec4(0.0);
     }
 
+	// the shaper is stored in rows of 1024 texels, and interpolated here like on the CPU
+	vec3 shaperTexel(int i)
+	{
+		return texelFetch(lutShaper, ivec2(i % 1024, i / 1024), 0).rgb;
+	}
+
+	vec3 applyLUT(vec3 col)
+	{
+		if (lutSize1D > 0)
+		{
+			vec3 x = clamp((col - lutMin1D) / (lutMax1D - lutMin1D), 0.0, 1.0) * float(lutSize1D - 1);
+			for (int c = 0; c < 3; ++c)
+			{
+				int i = min(int(x[c]), lutSize1D - 2);
+				col[c] = mix(shaperTexel(i)[c], shaperTexel(i + 1)[c], x[c] - float(i));
+			}
+		}
+		if (lutSize3D > 0)
+		{
+			// the ends of the domain map to the centers of the first and last texels
+			vec3 t = clamp((col - lutMin3D) / (lutMax3D - lutMin3D), 0.0, 1.0);
+			col = texture(lut3D, (t * float(lutSize3D - 1) + 0.5) / float(lutSize3D)).rgb;
+		}
+		return col;
+	}
+
 	vec3 dither(vec3 color)
 	{
 		if (!hasDither)
@@ -289,6 +329,7 @@ constexpr char const *const fragmentShader =
         }
 
         vec4 imageVal = texture(image, imageUV);
+        imageVal.rgb = applyLUT(colorMatrix * imageVal.rgb);
 
 		if (hasReference)
 		{
@@ -320,11 +361,12 @@ void setImageParams(GLShader & shader,
                     const Vector2f & scale,
                     const Vector2f & position,
                     float gain, float gamma, bool sRGB,
-                    EChannel channel)
+                    EChannel channel, const Matrix3f & colorMatrix)
 {
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, imageId);
 
+	shader.setUniform("colorMatrix", colorMatrix);
 	shader.setUniform("gain", gain);
 	shader.setUniform("gamma", gamma);
 	shader.setUniform("sRGB", (int)sRGB);
@@ -350,6 +392,25 @@ void setReferenceParams(GLShader & shader,
 	shader.setUniform("blendMode", (int)blendMode);
 }
 
+void setLUTParams(GLShader & shader, GLuint shaperId, GLuint lut3DId,
+                  int size1D, const Vector3f & min1D, const Vector3f & max1D,
+                  int size3D, const Vector3f & min3D, const Vector3f & max3D)
+{
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, shaperId);
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_3D, lut3DId);
+
+	shader.setUniform("lutShaper", 3);
+	shader.setUniform("lutSize1D", size1D);
+	shader.setUniform("lutMin1D", min1D);
+	shader.setUniform("lutMax1D", max1D);
+	shader.setUniform("lut3D", 4);
+	shader.setUniform("lutSize3D", size3D);
+	shader.setUniform("lutMin3D", min3D);
+	shader.setUniform("lutMax3D", max3D);
+}
+
 } // namespace
 
 #define DEFINE_PARAMS(parent,name) m_shader.define(#name, to_string(parent::name))
@@ -412,17 +473,83 @@ ImageShader::~ImageShader()
 	m_shader.free();
 	if (m_ditherTexId)
 		glDeleteTextures(1, &m_ditherTexId);
+	if (m_lutShaperTexId)
+		glDeleteTextures(1, &m_lutShaperTexId);
+	if (m_lut3DTexId)
+		glDeleteTextures(1, &m_lut3DTexId);
+}
+
+void ImageShader::setLUT(const ColorLUT * lut)
+{
+	m_lutSize1D = lut ? lut->size1D() : 0;
+	m_lutSize3D = lut ? lut->size3D() : 0;
+	if (!lut)
+		return;
+
+	// GLImage uploads images over several frames, so restore the unpacking state it relies on
+	GLint rowLength, skipRows;
+	glGetIntegerv(GL_UNPACK_ROW_LENGTH, &rowLength);
+	glGetIntegerv(GL_UNPACK_SKIP_ROWS, &skipRows);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+	if (m_lutSize1D)
+	{
+		// interleave the channels, in rows of 1024 entries
+		int w = min(m_lutSize1D, 1024), h = (m_lutSize1D + 1023) / 1024;
+		vector<float> texels(3 * size_t(w) * h, 0.f);
+		for (int i = 0; i < m_lutSize1D; ++i)
+			for (int c = 0; c < 3; ++c)
+				texels[3 * i + c] = lut->table1D(c)[i];
+
+		if (!m_lutShaperTexId)
+			glGenTextures(1, &m_lutShaperTexId);
+		glBindTexture(GL_TEXTURE_2D, m_lutShaperTexId);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, w, h, 0, GL_RGB, GL_FLOAT, (const GLvoid *) texels.data());
+		m_lutMin1D = Vector3f(lut->min1D().r, lut->min1D().g, lut->min1D().b);
+		m_lutMax1D = Vector3f(lut->max1D().r, lut->max1D().g, lut->max1D().b);
+	}
+
+	if (m_lutSize3D)
+	{
+		// the red input varies fastest in both the tables and the texture
+		vector<float> texels(3 * lut->table3D(0).size());
+		for (size_t i = 0; i < lut->table3D(0).size(); ++i)
+			for (int c = 0; c < 3; ++c)
+				texels[3 * i + c] = lut->table3D(c)[i];
+
+		if (!m_lut3DTexId)
+			glGenTextures(1, &m_lut3DTexId);
+		glBindTexture(GL_TEXTURE_3D, m_lut3DTexId);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB32F, m_lutSize3D, m_lutSize3D, m_lutSize3D,
+		             0, GL_RGB, GL_FLOAT, (const GLvoid *) texels.data());
+		m_lutMin3D = Vector3f(lut->min3D().r, lut->min3D().g, lut->min3D().b);
+		m_lutMax3D = Vector3f(lut->max3D().r, lut->max3D().g, lut->max3D().b);
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, skipRows);
 }
 
 void ImageShader::draw(GLuint imageId,
 						const Vector2f & imageScale, const Vector2f & imagePosition,
 						float gain, float gamma, bool sRGB, bool hasDither,
-						EChannel channel, EBlendMode mode)
+						EChannel channel, EBlendMode mode,
+						const Matrix3f & colorMatrix)
 {
 	m_shader.bind();
 
 	setDitherParams(m_shader, m_ditherTexId, hasDither);
-	setImageParams(m_shader, imageId, imageScale, imagePosition, gain, gamma, sRGB, channel);
+	setImageParams(m_shader, imageId, imageScale, imagePosition, gain, gamma, sRGB, channel, colorMatrix);
+	setLUTParams(m_shader, m_lutShaperTexId, m_lut3DTexId, m_lutSize1D, m_lutMin1D, m_lutMax1D,
+	             m_lutSize3D, m_lutMin3D, m_lutMax3D);
 	m_shader.setUniform("hasImage", (int)true);
 	m_shader.setUniform("hasReference", (int)false);
 
@@ -434,12 +561,15 @@ void ImageShader::draw(GLuint imageId,
                        const Vector2f & imageScale, const Vector2f & imagePosition,
                        const Vector2f & referenceScale, const Vector2f & referencePosition,
                        float gain, float gamma, bool sRGB, bool hasDither,
-                       EChannel channel, EBlendMode mode)
+                       EChannel channel, EBlendMode mode,
+                       const Matrix3f & colorMatrix)
 {
 	m_shader.bind();
 
 	setDitherParams(m_shader, m_ditherTexId, hasDither);
-	setImageParams(m_shader, imageId, imageScale, imagePosition, gain, gamma, sRGB, channel);
+	setImageParams(m_shader, imageId, imageScale, imagePosition, gain, gamma, sRGB, channel, colorMatrix);
+	setLUTParams(m_shader, m_lutShaperTexId, m_lut3DTexId, m_lutSize1D, m_lutMin1D, m_lutMax1D,
+	             m_lutSize3D, m_lutMin3D, m_lutMax3D);
 	setReferenceParams(m_shader, referenceId, referenceScale, referencePosition, mode);
 	m_shader.setUniform("hasImage", (int)true);
 	m_shader.setUniform("hasReference", (int)true);
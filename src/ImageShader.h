@@ -10,8 +10,13 @@
 #include <nanogui/glutil.h>
 #include "Common.h"
 
+class ColorLUT;
+
 /*!
  * Draws an image to the screen, optionally with high-quality dithering.
+ *
+ * The colors of the image are multiplied by \a colorMatrix and then looked up in the LUT of
+ * setLUT() before blending and tonemapping, which previews color edits without modifying the image.
  */
 class ImageShader
 {
@@ -24,7 +29,8 @@ public:
 	          const Eigen::Vector2f & position,
 	          float gain, float gamma,
 	          bool sRGB, bool dither,
-	          EChannel channel, EBlendMode mode);
+	          EChannel channel, EBlendMode mode,
+	          const Eigen::Matrix3f & colorMatrix);
 
 	void draw(GLuint imageId,
 	          GLuint referenceId,
@@ -34,9 +40,21 @@ public:
 	          const Eigen::Vector2f & referencePosition,
 	          float gain, float gamma,
 	          bool sRGB, bool dither,
-	          EChannel channel, EBlendMode mode);
+	          EChannel channel, EBlendMode mode,
+	          const Eigen::Matrix3f & colorMatrix);
+
+	/*!
+	 * @brief Upload \a lut to apply it to the image, or stop applying a LUT if it is null.
+	 *
+	 * The shaper is interpolated like ColorLUT::lookup(), but the 3D LUT uses the trilinear filtering
+	 * of the texture, so a LUT applied with tetrahedral interpolation is only approximated.
+	 */
+	void setLUT(const ColorLUT * lut);
 
 private:
 	nanogui::GLShader m_shader;
 	GLuint m_ditherTexId = 0;
+	GLuint m_lutShaperTexId = 0, m_lut3DTexId = 0;
+	int m_lutSize1D = 0, m_lutSize3D = 0;       ///< Both are 0 if no LUT is applied
+	Eigen::Vector3f m_lutMin1D, m_lutMax1D, m_lutMin3D, m_lutMax3D;
 };
\ No newline at end of file
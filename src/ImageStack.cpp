@@ -0,0 +1,860 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "ImageStack.h"
+#include <ImfArray.h>            // for Array2D
+#include <ImfRgbaFile.h>         // for RgbaInputFile
+#include <ImathBox.h>            // for Box2i
+#include <ImfTestFile.h>         // for isOpenExrFile
+#include <ImfRgba.h>             // for Rgba
+#include <algorithm>             // for nth_element, sort, max_element
+#include <cmath>                 // for isfinite, sqrt, floor, log2, exp
+#include <cstdint>               // for int64_t
+#include <cstdio>                // for FILE, fopen, sscanf, remove
+#include <cstdlib>               // for strtof
+#include <limits>                // for numeric_limits
+#include <numeric>               // for iota
+#include <stdexcept>             // for invalid_argument, runtime_error
+#include <Eigen/Dense>           // for MatrixXd, VectorXd
+#include "Colorspace.h"          // for LinearToSRGB
+#include "Common.h"              // for clamp01, lerp, createTemporaryFile
+#include "ParallelFor.h"         // for parallel_for
+#include "PFM.h"                 // for readPFMHeader, readPFMRows, writePFMImage
+#include "Timer.h"               // for Timer
+#include <spdlog/spdlog.h>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>        // for getrlimit
+#endif
+
+using namespace std;
+
+namespace
+{
+
+// decodes bands of an OpenEXR file on demand
+class EXRScanlineReader : public ScanlineReader
+{
+public:
+	explicit EXRScanlineReader(const string & filename) :
+		m_filename(filename), m_file(new Imf::RgbaInputFile(filename.c_str()))
+	{
+		m_dataWindow = m_file->dataWindow();
+		m_width = m_dataWindow.max.x - m_dataWindow.min.x + 1;
+		m_height = m_dataWindow.max.y - m_dataWindow.min.y + 1;
+	}
+
+	bool isStreaming() const override {return true;}
+
+	void read(int y0, int y1, HDRImage & band) override
+	{
+		if (!m_file)
+			m_file.reset(new Imf::RgbaInputFile(m_filename.c_str()));
+
+		int h = y1 - y0;
+		m_pixels.resizeErase(h, m_width);
+		m_file->setFrameBuffer(&m_pixels[0][0] - m_dataWindow.min.x - (m_dataWindow.min.y + y0) * m_width, 1, m_width);
+		m_file->readPixels(m_dataWindow.min.y + y0, m_dataWindow.min.y + y1 - 1);
+
+		band.resize(m_width, h);
+		for (int y = 0; y < h; ++y)
+			for (int x = 0; x < m_width; ++x)
+			{
+				const Imf::Rgba & p = m_pixels[y][x];
+				band(x, y) = Color4(p.r, p.g, p.b, p.a);
+			}
+	}
+
+	void close() override
+	{
+		m_file.reset();
+	}
+
+private:
+	string m_filename;
+	unique_ptr<Imf::RgbaInputFile> m_file;
+	Imath::Box2i m_dataWindow;
+	Imf::Array2D<Imf::Rgba> m_pixels;
+};
+
+// reads bands of a 3-channel PFM file on demand
+class PFMScanlineReader : public ScanlineReader
+{
+public:
+	explicit PFMScanlineReader(const string & filename) : m_filename(filename), m_file(fopen(filename.c_str(), "rb"))
+	{
+		if (!m_file)
+			throw runtime_error("Cannot open \"" + filename + "\".");
+
+		int numChannels;
+		try
+		{
+			readPFMHeader(m_file, &m_width, &m_height, &numChannels, &m_scale);
+			if (numChannels != 3)
+				throw runtime_error("Only 3-channel PFMs are currently supported.");
+		}
+		catch (...)
+		{
+			fclose(m_file);
+			throw;
+		}
+		m_dataOffset = ftell(m_file);
+	}
+
+	~PFMScanlineReader()
+	{
+		close();
+	}
+
+	bool isStreaming() const override {return true;}
+
+	void read(int y0, int y1, HDRImage & band) override
+	{
+		if (!m_file && !(m_file = fopen(m_filename.c_str(), "rb")))
+			throw runtime_error("Cannot reopen \"" + m_filename + "\".");
+
+		int h = y1 - y0;
+		m_data.resize(size_t(m_width) * h * 3);
+		readPFMRows(m_file, m_dataOffset, m_width, 3, m_scale, y0, y1, m_data.data());
+
+		band.resize(m_width, h);
+		for (int y = 0; y < h; ++y)
+			for (int x = 0; x < m_width; ++x)
+			{
+				const float * p = &m_data[3 * (size_t(y) * m_width + x)];
+				band(x, y) = Color4(p[0], p[1], p[2], 1.f);
+			}
+	}
+
+	void close() override
+	{
+		if (m_file)
+			fclose(m_file);
+		m_file = nullptr;
+	}
+
+private:
+	string m_filename;
+	FILE * m_file;
+	int64_t m_dataOffset = 0;
+	float m_scale = 1.f;
+	vector<float> m_data;
+};
+
+// formats without scanline access are decoded in full up front
+class FullImageReader : public ScanlineReader
+{
+public:
+	explicit FullImageReader(const string & filename)
+	{
+		if (!m_image.load(filename))
+			throw runtime_error("Cannot read image \"" + filename + "\".");
+		m_width = m_image.width();
+		m_height = m_image.height();
+	}
+
+	bool isStreaming() const override {return false;}
+
+	void read(int y0, int y1, HDRImage & band) override
+	{
+		band = m_image.block(0, y0, m_width, y1 - y0);
+	}
+
+private:
+	HDRImage m_image;
+};
+
+// reads bands of an image that is already in memory
+class MemoryScanlineReader : public ScanlineReader
+{
+public:
+	explicit MemoryScanlineReader(const shared_ptr<const HDRImage> & image) : m_image(image)
+	{
+		m_width = m_image->width();
+		m_height = m_image->height();
+	}
+
+	bool isStreaming() const override {return true;}
+
+	void read(int y0, int y1, HDRImage & band) override
+	{
+		band = m_image->block(0, y0, m_width, y1 - y0);
+	}
+
+private:
+	shared_ptr<const HDRImage> m_image;
+};
+
+// a uniquely named file in the temporary directory, removed when the object is destroyed
+class TemporaryFile
+{
+public:
+	explicit TemporaryFile(const string & ext) : m_filename(createTemporaryFile("hdrview-merge", ext)) {}
+
+	~TemporaryFile()
+	{
+		remove(m_filename.c_str());
+	}
+
+	TemporaryFile(const TemporaryFile &) = delete;
+	TemporaryFile & operator=(const TemporaryFile &) = delete;
+
+	const string & filename() const {return m_filename;}
+
+private:
+	string m_filename;
+};
+
+// the number of files the readers may keep open at once, which leaves the other half of the process's
+// limit to the rest of the program and to the readers that are reopened for each band
+size_t maxOpenReaders()
+{
+#if defined(_WIN32)
+	// OpenEXR and PFM files are both read through the C runtime's streams
+	return size_t(_getmaxstdio()) / 2;
+#else
+	rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+		return 128;
+	if (limit.rlim_cur == RLIM_INFINITY)
+		return numeric_limits<size_t>::max();
+	return size_t(limit.rlim_cur) / 2;
+#endif
+}
+
+/*!
+ * Open \a filenames for reading in bands. Files that cannot be read in bands, such as raw or LDR
+ * images, are decoded one at a time; they are kept in memory while they fit within \a maxBytes,
+ * and otherwise written to temporary PFM files, added to \a spills, that are then read in bands.
+ * \a decodedBytes is set to the memory taken by the images that are kept. Unless \a keepOpen, the
+ * files are closed again once opened, and the caller closes each after reading a band from it.
+ */
+vector<unique_ptr<ScanlineReader>> openBandReaders(const vector<string> & filenames, size_t maxBytes, bool keepOpen,
+                                                   vector<unique_ptr<TemporaryFile>> & spills, size_t & decodedBytes)
+{
+	vector<unique_ptr<ScanlineReader>> readers;
+	decodedBytes = 0;
+	for (auto & filename : filenames)
+	{
+		readers.push_back(ScanlineReader::open(filename));
+		auto & r = readers.back();
+		if (r->isStreaming())
+		{
+			if (!keepOpen)
+				r->close();
+			continue;
+		}
+
+		size_t bytes = size_t(r->width()) * r->height() * sizeof(Color4);
+		if (decodedBytes + bytes <= maxBytes)
+		{
+			decodedBytes += bytes;
+			continue;
+		}
+
+		HDRImage image;
+		r->read(0, r->height(), image);
+		r.reset();
+
+		spills.emplace_back(new TemporaryFile("pfm"));
+		const string & spill = spills.back()->filename();
+		if (!writePFMImage(spill.c_str(), image.width(), image.height(), 4, reinterpret_cast<const float *>(image.data())))
+			throw runtime_error("Cannot write temporary file \"" + spill + "\".");
+		r.reset(new PFMScanlineReader(spill));
+		if (!keepOpen)
+			r->close();
+		spdlog::get("console")->debug("Wrote \"{}\" to \"{}\" to read it in bands.", filename, spill);
+	}
+	return readers;
+}
+
+} // namespace
+
+
+unique_ptr<ScanlineReader> ScanlineReader::open(const string & filename)
+{
+	if (Imf::isOpenExrFile(filename.c_str()))
+		return unique_ptr<ScanlineReader>(new EXRScanlineReader(filename));
+
+	if (isPFMImage(filename.c_str()))
+	{
+		try
+		{
+			return unique_ptr<ScanlineReader>(new PFMScanlineReader(filename));
+		}
+		catch (const runtime_error &)
+		{
+			// fall back to the general loader below
+		}
+	}
+
+	return unique_ptr<ScanlineReader>(new FullImageReader(filename));
+}
+
+
+StackMethod StackMethod::parse(const string & spec)
+{
+	StackMethod method;
+	char c;
+	if (spec == "median")
+		method.type = MEDIAN;
+	else if (spec == "trimmed" ||
+	         sscanf(spec.c_str(), "trimmed:%f%c", &method.trim, &c) == 1)
+	{
+		method.type = TRIMMED_MEAN;
+		if (method.trim < 0.f || method.trim >= 0.5f)
+			throw invalid_argument("The trimmed fraction must be in [0,0.5).");
+	}
+	else if (spec == "sigma-clip" ||
+	         sscanf(spec.c_str(), "sigma-clip:%f%c", &method.kappa, &c) == 1 ||
+	         sscanf(spec.c_str(), "sigma-clip:%f,%d%c", &method.kappa, &method.iterations, &c) == 2)
+	{
+		method.type = SIGMA_CLIP;
+		if (method.kappa <= 0.f || method.iterations < 1)
+			throw invalid_argument("Sigma clipping needs a positive threshold and at least one iteration.");
+	}
+	else
+		throw invalid_argument("Unrecognized stacking method \"" + spec + "\".");
+
+	return method;
+}
+
+string StackMethod::description() const
+{
+	switch (type)
+	{
+		case MEDIAN:        return "median";
+		case TRIMMED_MEAN:  return fmt::format("{:g}% trimmed mean", 100.f * trim);
+		default:            return fmt::format("{:g}-sigma clipped mean ({} iterations)", kappa, iterations);
+	}
+}
+
+float StackMethod::operator()(vector<float> & samples) const
+{
+	samples.erase(remove_if(samples.begin(), samples.end(), [](float v) {return !isfinite(v);}), samples.end());
+	size_t n = samples.size();
+	if (n == 0)
+		return 0.f;
+
+	switch (type)
+	{
+		case MEDIAN:
+		{
+			auto mid = samples.begin() + n / 2;
+			nth_element(samples.begin(), mid, samples.end());
+			if (n % 2)
+				return *mid;
+			// average the two middle values
+			return 0.5f * (*mid + *max_element(samples.begin(), mid));
+		}
+
+		case TRIMMED_MEAN:
+		{
+			sort(samples.begin(), samples.end());
+			size_t cut = min(size_t(floor(trim * n)), (n - 1) / 2);
+			double sum = 0.0;
+			for (size_t i = cut; i < n - cut; ++i)
+				sum += samples[i];
+			return float(sum / (n - 2 * cut));
+		}
+
+		default:
+		{
+			// iteratively reject samples further than kappa standard deviations from the median
+			size_t begin = 0, end = n;
+			sort(samples.begin(), samples.end());
+			double mean = 0.0;
+			for (int i = 0; i < iterations; ++i)
+			{
+				size_t m = end - begin;
+				double sum = 0.0, sum2 = 0.0;
+				for (size_t j = begin; j < end; ++j)
+					sum += samples[j];
+				mean = sum / m;
+				for (size_t j = begin; j < end; ++j)
+					sum2 += (samples[j] - mean) * (samples[j] - mean);
+				double sigma = sqrt(sum2 / max(size_t(1), m - 1));
+				double median = m % 2 ? samples[begin + m/2] : 0.5 * (samples[begin + m/2 - 1] + samples[begin + m/2]);
+
+				// the samples are sorted, so the kept ones form a contiguous range
+				size_t newBegin = begin, newEnd = end;
+				while (newBegin < newEnd && median - samples[newBegin] > kappa * sigma)
+					++newBegin;
+				while (newEnd > newBegin && samples[newEnd - 1] - median > kappa * sigma)
+					--newEnd;
+				if ((newBegin == begin && newEnd == end) || newBegin == newEnd)
+					break;
+				begin = newBegin;
+				end = newEnd;
+
+				sum = 0.0;
+				for (size_t j = begin; j < end; ++j)
+					sum += samples[j];
+				mean = sum / (end - begin);
+			}
+			return float(mean);
+		}
+	}
+}
+
+
+HDRImage stackImages(const vector<string> & filenames, const StackMethod & method,
+                     size_t maxBytes, AtomicProgress progress)
+{
+	auto console = spdlog::get("console");
+	if (filenames.empty())
+		throw invalid_argument("No images to stack.");
+
+	Timer timer;
+
+	// large stacks, such as those of astrophotography, would run out of file descriptors if every file
+	// stayed open, so they reopen each file for every band instead
+	bool keepOpen = filenames.size() <= maxOpenReaders();
+
+	// declared before the readers, so the files are removed only after they are closed
+	vector<unique_ptr<TemporaryFile>> spills;
+	size_t decodedBytes;
+	vector<unique_ptr<ScanlineReader>> readers = openBandReaders(filenames, maxBytes, keepOpen, spills, decodedBytes);
+	for (size_t i = 1; i < readers.size(); ++i)
+		if (readers[i]->width() != readers[0]->width() || readers[i]->height() != readers[0]->height())
+			throw invalid_argument(fmt::format("Cannot stack \"{}\" ({}x{}) with images of size {}x{}.",
+			                                   filenames[i], readers[i]->width(), readers[i]->height(),
+			                                   readers[0]->width(), readers[0]->height()));
+
+	int w = readers.front()->width(), h = readers.front()->height();
+	int n = int(readers.size());
+
+	// the bands of all images, plus each reader's decoding buffer, in what the decoded images leave
+	size_t bytesPerRow = 2 * size_t(n) * w * sizeof(Color4);
+	size_t bandBytes = maxBytes - min(maxBytes, decodedBytes);
+	int bandHeight = int(max(size_t(1), min(size_t(h), bandBytes / max(size_t(1), bytesPerRow))));
+	int numBands = (h + bandHeight - 1) / bandHeight;
+	console->info("Stacking {} images of size {}x{} using the {}, in {} band(s) of {} scanlines.",
+	              n, w, h, method.description(), numBands, bandHeight);
+	if (!keepOpen)
+		console->info("Reopening the files for every band, as there are more than {} of them.", maxOpenReaders());
+
+	HDRImage result(w, h);
+	vector<HDRImage> bands(n);
+	progress.setNumSteps(numBands);
+	for (int y0 = 0; y0 < h; y0 += bandHeight)
+	{
+		int y1 = min(h, y0 + bandHeight);
+
+		// every reader works on its own file, so the bands can be decoded concurrently
+		parallel_for(0, n, [&readers,&bands,keepOpen,y0,y1](int i)
+		{
+			readers[i]->read(y0, y1, bands[i]);
+			if (!keepOpen)
+				readers[i]->close();
+		});
+
+		parallel_for(y0, y1, [&](int y)
+		{
+			vector<float> samples(n);
+			for (int x = 0; x < w; ++x)
+			{
+				Color4 c;
+				for (int ch = 0; ch < 4; ++ch)
+				{
+					// the statistic drops non-finite samples, so restore the full size first
+					samples.resize(n);
+					for (int i = 0; i < n; ++i)
+						samples[i] = bands[i](x, y - y0)[ch];
+					c[ch] = method(samples);
+				}
+				result(x, y) = c;
+			}
+		});
+		++progress;
+	}
+
+	console->debug("Stacking took: {} seconds.", (timer.elapsed() / 1000.f));
+	return result;
+}
+
+
+vector<float> ExposureMergeOptions::parseExposures(const string & list)
+{
+	vector<float> exposures;
+	const char * p = list.c_str();
+	while (true)
+	{
+		char * end;
+		float stops = strtof(p, &end);
+		if (end == p || !isfinite(stops) || (*end != ',' && *end != '\0'))
+			throw invalid_argument("Cannot parse the list of exposures \"" + list + "\".");
+		exposures.push_back(stops);
+		if (*end == '\0')
+			return exposures;
+		p = end + 1;
+	}
+}
+
+string ExposureMergeOptions::description() const
+{
+	string result;
+	if (exposures.empty())
+		result = "estimated exposures";
+	else
+	{
+		result = "exposures of ";
+		for (size_t i = 0; i < exposures.size(); ++i)
+			result += fmt::format(i ? ",{:g}" : "{:g}", exposures[i]);
+		result += " stops";
+	}
+	if (ghostThreshold > 0.f)
+		result += fmt::format(", deghosting beyond {:g} stops", ghostThreshold);
+	if (recoverResponse)
+		result += ", recovered camera response";
+	return result;
+}
+
+
+namespace
+{
+
+// the exposures and the response are estimated from a grid of pixels on a few evenly spaced scanlines
+const int SAMPLE_ROWS = 16;
+const int SAMPLES_PER_ROW = 256;
+
+inline float maxChannel(const Color4 & c)
+{
+	return max(max(c.r, c.g), c.b);
+}
+
+// the confidence in a value z in [0,1]: low near black, where noise dominates, and near white, where it clips
+inline float hat(float z)
+{
+	if (!(z > 0.f) || z >= 1.f)
+		return 0.f;
+	float t = 2.f * z - 1.f, t2 = t * t, t4 = t2 * t2;
+	return 1.f - t4 * t4 * t4;
+}
+
+inline int sRGBCode(float v)
+{
+	return int(round(255.f * LinearToSRGB(clamp01(v))));
+}
+
+// maps the 8-bit sRGB codes of each channel to linear values
+struct ResponseCurve
+{
+	float table[3][256];
+
+	float operator()(int ch, float v) const
+	{
+		float code = 255.f * LinearToSRGB(clamp01(v));
+		int i = min(int(code), 254);
+		return lerp(table[ch][i], table[ch][i + 1], code - i);
+	}
+};
+
+// the exposure of each bracket in stops, relative to the darkest one, chained from the median ratio of
+// the pixels that are well exposed in consecutive brackets in order of brightness
+vector<float> estimateExposures(const vector<vector<Color4>> & samples, const vector<string> & names)
+{
+	int n = int(samples.size());
+	vector<double> brightness(n, 0.0);
+	for (int j = 0; j < n; ++j)
+		for (auto & c : samples[j])
+			if (isfinite(maxChannel(c)))
+				brightness[j] += clamp01(maxChannel(c));
+
+	vector<int> order(n);
+	iota(order.begin(), order.end(), 0);
+	sort(order.begin(), order.end(), [&brightness](int a, int b) {return brightness[a] < brightness[b];});
+
+	vector<float> stops(n, 0.f);
+	for (int k = 1; k < n; ++k)
+	{
+		int a = order[k - 1], b = order[k];
+		vector<float> ratios;
+		for (size_t i = 0; i < samples[a].size(); ++i)
+		{
+			float va = maxChannel(samples[a][i]), vb = maxChannel(samples[b][i]);
+			if (va > 0.02f && va < 0.9f && vb > 0.02f && vb < 0.9f)
+				ratios.push_back(vb / va);
+		}
+		if (ratios.size() < 16)
+			throw runtime_error(fmt::format("Cannot estimate the exposure of \"{}\" relative to \"{}\": too few pixels "
+			                                "are well exposed in both. Please specify the exposures.", names[b], names[a]));
+
+		auto mid = ratios.begin() + ratios.size() / 2;
+		nth_element(ratios.begin(), mid, ratios.end());
+		stops[b] = stops[a] + log2(*mid);
+	}
+	return stops;
+}
+
+// solve for the inverse response of channel ch from the codes of the same pixels in every bracket,
+// with a smoothness penalty on its second derivative [Debevec and Malik 1997]
+void solveResponse(const vector<vector<Color4>> & samples, const vector<float> & stops,
+                   const vector<int> & pixels, int ch, float * table)
+{
+	const int numCodes = 256, numBrackets = int(samples.size()), numPixels = int(pixels.size());
+	const double lambda = 50.0;
+	auto weight = [](int z) {return double(z <= 127 ? z + 1 : 256 - z);};
+
+	// the unknowns are the log inverse response at each code followed by the log radiance of each pixel
+	Eigen::MatrixXd A = Eigen::MatrixXd::Zero(numPixels * numBrackets + numCodes - 1, numCodes + numPixels);
+	Eigen::VectorXd b = Eigen::VectorXd::Zero(A.rows());
+	int row = 0;
+	for (int i = 0; i < numPixels; ++i)
+		for (int j = 0; j < numBrackets; ++j, ++row)
+		{
+			int z = sRGBCode(samples[j][pixels[i]][ch]);
+			double w = weight(z);
+			A(row, z) = w;
+			A(row, numCodes + i) = -w;
+			b(row) = w * stops[j] * log(2.0);
+		}
+
+	// fix the arbitrary scale at the middle code
+	A(row++, numCodes / 2) = 1.0;
+	for (int z = 1; z < numCodes - 1; ++z, ++row)
+	{
+		double w = lambda * weight(z);
+		A(row, z - 1) = w;
+		A(row, z) = -2.0 * w;
+		A(row, z + 1) = w;
+	}
+
+	Eigen::VectorXd g = A.householderQr().solve(b);
+
+	// like linear values, the curve should map white to 1, but the codes near white are mostly clipped
+	// pixels; so extrapolate white from a power law fitted to the upper mid-tones
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	int count = 0;
+	for (int z = numCodes / 2; z < numCodes - 16; ++z, ++count)
+	{
+		double lx = log(z / 255.0);
+		sx += lx;
+		sy += g(z);
+		sxx += lx * lx;
+		sxy += lx * g(z);
+	}
+	double slope = (count * sxy - sx * sy) / (count * sxx - sx * sx);
+	double white = (sy - slope * sx) / count;
+
+	// keep the curve non-decreasing
+	for (int z = 0; z < numCodes; ++z)
+		table[z] = max(float(exp(g(z) - white)), z ? table[z - 1] : 0.f);
+}
+
+// the pixels used to recover the response: finite in every bracket, and spread evenly over the
+// range of values of the reference bracket
+vector<int> responsePixels(const vector<vector<Color4>> & samples, int reference)
+{
+	int n = int(samples.size());
+	vector<int> candidates;
+	for (int i = 0; i < int(samples[reference].size()); ++i)
+	{
+		bool finite = true;
+		for (int j = 0; j < n && finite; ++j)
+			finite = isfinite(samples[j][i].r) && isfinite(samples[j][i].g) && isfinite(samples[j][i].b);
+		if (finite)
+			candidates.push_back(i);
+	}
+	sort(candidates.begin(), candidates.end(),
+	     [&](int a, int b) {return maxChannel(samples[reference][a]) < maxChannel(samples[reference][b]);});
+
+	// enough equations to determine all 256 codes, with some redundancy
+	size_t count = min(candidates.size(), size_t(max(64, 2 * 256 / (n - 1) + 1)));
+	vector<int> pixels(count);
+	for (size_t i = 0; i < count; ++i)
+		pixels[i] = candidates[(2 * i + 1) * candidates.size() / (2 * count)];
+	return pixels;
+}
+
+HDRImage mergeBrackets(vector<unique_ptr<ScanlineReader>> & readers, const vector<string> & names,
+                       const ExposureMergeOptions & options, size_t maxBytes, AtomicProgress progress)
+{
+	auto console = spdlog::get("console");
+	int n = int(readers.size());
+	if (n < 2)
+		throw invalid_argument("Merging exposures requires at least 2 images.");
+	for (int j = 1; j < n; ++j)
+		if (readers[j]->width() != readers[0]->width() || readers[j]->height() != readers[0]->height())
+			throw invalid_argument(fmt::format("Cannot merge \"{}\" ({}x{}) with images of size {}x{}.",
+			                                   names[j], readers[j]->width(), readers[j]->height(),
+			                                   readers[0]->width(), readers[0]->height()));
+	if (!options.exposures.empty() && int(options.exposures.size()) != n)
+		throw invalid_argument(fmt::format("Got {} exposures for {} images.", options.exposures.size(), n));
+	if (options.reference >= n)
+		throw invalid_argument(fmt::format("The reference image must be one of the {} images.", n));
+
+	Timer timer;
+	int w = readers[0]->width(), h = readers[0]->height();
+
+	// the bands of all images, plus each reader's decoding buffer
+	size_t bytesPerRow = 2 * size_t(n) * w * sizeof(Color4);
+	int bandHeight = int(max(size_t(1), min(size_t(h), maxBytes / max(size_t(1), bytesPerRow))));
+	int numBands = (h + bandHeight - 1) / bandHeight;
+	progress.setNumSteps(numBands + 1);
+
+	// sample the same pixels of every bracket
+	vector<vector<Color4>> samples(n);
+	parallel_for(0, n, [&](int j)
+	{
+		HDRImage row;
+		for (int k = 0; k < SAMPLE_ROWS; ++k)
+		{
+			int y = min(h - 1, (2 * k + 1) * h / (2 * SAMPLE_ROWS));
+			readers[j]->read(y, y + 1, row);
+			for (int i = 0; i < min(w, SAMPLES_PER_ROW); ++i)
+				samples[j].push_back(row((2 * i + 1) * w / (2 * min(w, SAMPLES_PER_ROW)), 0));
+		}
+	});
+
+	vector<float> stops = options.exposures.empty() ? estimateExposures(samples, names) : options.exposures;
+	vector<int> order(n);
+	iota(order.begin(), order.end(), 0);
+	sort(order.begin(), order.end(), [&stops](int a, int b) {return stops[a] < stops[b];});
+	int darkest = order.front(), brightest = order.back();
+	int reference = options.reference >= 0 ? options.reference : order[(n - 1) / 2];
+
+	// the radiance is expressed in the units of the reference bracket
+	vector<float> exposures(n), gains(n);
+	for (int j = 0; j < n; ++j)
+	{
+		exposures[j] = exp2(stops[j] - stops[reference]);
+		gains[j] = 1.f / exposures[j];
+		console->info("\"{}\": {:+.2f} stops{}", names[j], stops[j] - stops[reference], j == reference ? " (reference)" : "");
+	}
+
+	ResponseCurve response;
+	if (options.recoverResponse)
+	{
+		if (options.exposures.empty())
+			console->warn("The exposures are estimated assuming an sRGB response; "
+			              "specify them to recover the camera response accurately.");
+		vector<int> pixels = responsePixels(samples, reference);
+		if (pixels.size() < 16)
+			throw runtime_error("Too few pixels to recover the camera response.");
+		for (int ch = 0; ch < 3; ++ch)
+			solveResponse(samples, stops, pixels, ch, response.table[ch]);
+		console->debug("Recovered the camera response from {} pixels.", pixels.size());
+	}
+	++progress;
+
+	console->info("Merging {} exposures of size {}x{} with {}, in {} band(s) of {} scanlines.",
+	              n, w, h, options.description(), numBands, bandHeight);
+
+	const float ghostScale = options.ghostThreshold > 0.f ? -0.5f / (options.ghostThreshold * options.ghostThreshold) : 0.f;
+	HDRImage result(w, h);
+	vector<HDRImage> bands(n);
+	for (int y0 = 0; y0 < h; y0 += bandHeight)
+	{
+		int y1 = min(h, y0 + bandHeight);
+
+		// every reader works on its own file, so the bands can be decoded concurrently
+		parallel_for(0, n, [&readers,&bands,y0,y1](int j)
+		{
+			readers[j]->read(y0, y1, bands[j]);
+		});
+
+		parallel_for(y0, y1, [&](int y)
+		{
+			vector<Color3> radiance(n);
+			vector<float> values(n), weights(n);
+			for (int x = 0; x < w; ++x)
+			{
+				for (int j = 0; j < n; ++j)
+				{
+					const Color4 & c = bands[j](x, y - y0);
+					Color3 v(c.r, c.g, c.b);
+					values[j] = maxChannel(c);
+					if (options.recoverResponse)
+					{
+						v = Color3(response(0, c.r), response(1, c.g), response(2, c.b));
+						values[j] = LinearToSRGB(values[j]);
+					}
+					radiance[j] = v * gains[j];
+					weights[j] = isfinite(v.r + v.g + v.b) ? hat(values[j]) * exposures[j] : 0.f;
+				}
+
+				if (options.ghostThreshold > 0.f)
+				{
+					// compare with the reference where it is well exposed, and with the plain merge elsewhere
+					Color3 ref = radiance[reference];
+					if (hat(values[reference]) < 0.5f)
+					{
+						Color3 sum(0.f);
+						float sumW = 0.f;
+						for (int j = 0; j < n; ++j)
+							if (weights[j] > 0.f)
+							{
+								sum += weights[j] * radiance[j];
+								sumW += weights[j];
+							}
+						ref = sumW > 0.f ? sum / sumW : Color3(0.f);
+					}
+
+					float refLum = max(ref.average(), 1e-8f);
+					for (int j = 0; j < n; ++j)
+						if (j != reference && weights[j] > 0.f)
+						{
+							float d = log2(max(radiance[j].average(), 1e-8f) / refLum);
+							weights[j] *= exp(ghostScale * d * d);
+						}
+				}
+
+				Color3 sum(0.f);
+				float sumW = 0.f;
+				for (int j = 0; j < n; ++j)
+					if (weights[j] > 0.f)
+					{
+						sum += weights[j] * radiance[j];
+						sumW += weights[j];
+					}
+
+				// pixels that are clipped or black in every bracket take the most useful one as is
+				Color3 merged = sumW > 0.f ? sum / sumW :
+				                values[darkest] >= 0.5f ? radiance[darkest] : radiance[brightest];
+				result(x, y) = Color4(merged, bands[reference](x, y - y0).a);
+			}
+		});
+		++progress;
+	}
+
+	console->debug("Merging exposures took: {} seconds.", (timer.elapsed() / 1000.f));
+	return result;
+}
+
+} // namespace
+
+
+HDRImage mergeExposures(const vector<string> & filenames, const ExposureMergeOptions & options,
+                        size_t maxBytes, AtomicProgress progress)
+{
+	// unlike stackImages(), the brackets stay open, as the exposures are estimated from single scanlines;
+	// bracket sets are small, but fail clearly instead of running out of file descriptors
+	if (filenames.size() > maxOpenReaders())
+		throw invalid_argument(fmt::format("Cannot merge {} brackets, more than the {} files that can be open at once.",
+		                                   filenames.size(), maxOpenReaders()));
+
+	// declared before the readers, so the files are removed only after they are closed
+	vector<unique_ptr<TemporaryFile>> spills;
+	size_t decodedBytes;
+	vector<unique_ptr<ScanlineReader>> readers = openBandReaders(filenames, maxBytes, true, spills, decodedBytes);
+
+	return mergeBrackets(readers, filenames, options, maxBytes - min(maxBytes, decodedBytes), progress);
+}
+
+HDRImage mergeExposures(const vector<shared_ptr<const HDRImage>> & images, const vector<string> & names,
+                        const ExposureMergeOptions & options, AtomicProgress progress)
+{
+	if (names.size() != images.size())
+		throw invalid_argument("Every image to merge needs a name.");
+
+	vector<unique_ptr<ScanlineReader>> readers;
+	for (auto & image : images)
+		readers.emplace_back(new MemoryScanlineReader(image));
+
+	// the brackets are already in memory, so only the copies of their bands need to be bounded
+	return mergeBrackets(readers, names, options, size_t(256) << 20, progress);
+}
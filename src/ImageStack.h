@@ -0,0 +1,155 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <memory>                // for unique_ptr, shared_ptr
+#include <string>                // for string
+#include <vector>                // for vector
+#include "HDRImage.h"            // for HDRImage
+#include "Progress.h"            // for AtomicProgress
+
+
+/*!
+ * @brief Reads horizontal bands of scanlines from an image file.
+ *
+ * OpenEXR and 3-channel PFM files are decoded band by band, so only the requested
+ * scanlines are ever in memory. Other formats are decoded in full when opened.
+ */
+class ScanlineReader
+{
+public:
+	//! Open \a filename, throwing std::runtime_error if it cannot be read.
+	static std::unique_ptr<ScanlineReader> open(const std::string & filename);
+
+	virtual ~ScanlineReader() = default;
+
+	int width() const           {return m_width;}
+	int height() const          {return m_height;}
+
+	//! Whether this reader decodes bands on demand instead of holding the whole image
+	virtual bool isStreaming() const = 0;
+
+	//! Read scanlines [y0,y1) into \a band, which is resized to width() x (y1-y0).
+	virtual void read(int y0, int y1, HDRImage & band) = 0;
+
+	//! Close the file read from, if any, until the next call to read() reopens it.
+	virtual void close() {}
+
+protected:
+	int m_width = 0, m_height = 0;
+};
+
+
+//! A robust per-pixel statistic used to merge a stack of images
+struct StackMethod
+{
+	enum Type
+	{
+		MEDIAN = 0,
+		TRIMMED_MEAN,
+		SIGMA_CLIP
+	};
+
+	Type type = MEDIAN;
+	float trim = 0.1f;          ///< Fraction of samples dropped at each end for TRIMMED_MEAN
+	float kappa = 3.f;          ///< Rejection threshold, in standard deviations, for SIGMA_CLIP
+	int iterations = 5;         ///< Maximum number of rejection passes for SIGMA_CLIP
+
+	/*!
+	 * @brief Parse "median", "trimmed[:FRACTION]" or "sigma-clip[:KAPPA[,ITERATIONS]]".
+	 *
+	 * Throws std::invalid_argument if the specification cannot be parsed.
+	 */
+	static StackMethod parse(const std::string & spec);
+
+	std::string description() const;
+
+	/*!
+	 * @brief Compute the statistic of the finite values in \a samples.
+	 *
+	 * The samples are reordered. Returns 0 if there are no samples.
+	 */
+	float operator()(std::vector<float> & samples) const;
+};
+
+
+/*!
+ * @brief Merge equally-sized images into one using a robust per-pixel statistic.
+ *
+ * The images are processed in bands of scanlines: the same band is read from every
+ * file, the statistic is computed for each pixel of the band in parallel, and the
+ * result is written to the output. The band height is chosen so that the bands of
+ * all files fit within \a maxBytes. Images that cannot be read in bands are handled
+ * as in mergeExposures(): kept in memory while they fit within \a maxBytes, and
+ * otherwise written to temporary PFM files. Stacks with more files than can be open at
+ * once reopen each file for every band.
+ *
+ * Throws std::invalid_argument if the images differ in size, and std::runtime_error
+ * if a file cannot be read.
+ */
+HDRImage stackImages(const std::vector<std::string> & filenames, const StackMethod & method,
+                     size_t maxBytes, AtomicProgress progress = AtomicProgress());
+
+
+//! The parameters of mergeExposures()
+struct ExposureMergeOptions
+{
+	/*!
+	 * The exposure of each bracket in stops, in the order the brackets are given. If empty,
+	 * the exposures are estimated from the ratios of well-exposed pixels between the brackets.
+	 */
+	std::vector<float> exposures;
+	/*!
+	 * If positive, pixels whose radiance differs from that of the reference bracket are
+	 * down-weighted by a Gaussian of this standard deviation, in stops, to suppress ghosts.
+	 */
+	float ghostThreshold = 0.f;
+	/*!
+	 * Recover the camera response from the brackets instead of assuming that their values are
+	 * linear. Since the exposures are estimated from the values as loaded, they should be
+	 * given explicitly for the response to be accurate.
+	 */
+	bool recoverResponse = false;
+	//! The bracket the radiance is expressed relative to, and deghosted against; -1 picks the middle exposure
+	int reference = -1;
+
+	/*!
+	 * @brief Parse a comma-separated list of exposures in stops, such as "-2,0,2".
+	 *
+	 * Throws std::invalid_argument if the list cannot be parsed.
+	 */
+	static std::vector<float> parseExposures(const std::string & list);
+
+	std::string description() const;
+};
+
+
+/*!
+ * @brief Merge bracketed exposures of a static scene into one high-dynamic range image.
+ *
+ * The brackets are expected to hold values in [0,1], as produced by the image loaders, with
+ * clipping at 1. Each pixel's radiance is the average of the brackets' values divided by
+ * their exposures, weighted by how far each value is from black and white and by the exposure
+ * itself [Debevec and Malik 1997]. Pixels that are clipped or black in every bracket take the
+ * darkest or brightest bracket's value. With \a options.recoverResponse, the values are first
+ * linearized with a response curve solved from a sample of pixels of all brackets.
+ *
+ * Like stackImages(), the brackets are read and merged in bands of scanlines that fit within
+ * \a maxBytes. Brackets that cannot be read in bands, such as raw or LDR files, are decoded one
+ * at a time with the regular image loaders; they are kept in memory while they fit within
+ * \a maxBytes, and otherwise written to temporary PFM files that are then read in bands.
+ *
+ * Throws std::invalid_argument if the brackets differ in size, do not match the given
+ * exposures or are more files than can be open at once, and std::runtime_error if a file cannot be read or the exposures cannot be estimated.
+ */
+HDRImage mergeExposures(const std::vector<std::string> & filenames, const ExposureMergeOptions & options,
+                        size_t maxBytes, AtomicProgress progress = AtomicProgress());
+
+//! Merge brackets that are already in memory; \a names are used in messages
+HDRImage mergeExposures(const std::vector<std::shared_ptr<const HDRImage>> & images,
+                        const std::vector<std::string> & names, const ExposureMergeOptions & options,
+                        AtomicProgress progress = AtomicProgress());
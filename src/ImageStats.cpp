@@ -0,0 +1,305 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "ImageStats.h"
+#include <algorithm>             // for min, max
+#include <cmath>                 // for isfinite
+#include <cstring>               // for memcmp
+#include <fstream>               // for ifstream, ofstream
+#include <limits>                // for numeric_limits
+#include <stdexcept>             // for invalid_argument, runtime_error
+#include "ParallelFor.h"         // for parallel_for
+#include <spdlog/fmt/fmt.h>
+
+using namespace std;
+
+namespace
+{
+
+const char MAGIC[8] = {'H', 'D', 'R', 'S', 'T', 'A', 'T', 'S'};
+const uint32_t VERSION = 1;
+
+// all accumulators of a single pixel, in the order they are stored in partial-result files
+struct PixelRecord
+{
+	uint32_t count;
+	uint32_t padding;   // explicit, so that value-initialization zeroes it instead of writing garbage
+	double mean[4], m2[4];
+	float min[4], max[4];
+};
+static_assert(sizeof(PixelRecord) == 2 * sizeof(uint32_t) + 8 * sizeof(double) + 8 * sizeof(float),
+              "PixelRecord must not contain implicit padding");
+
+// the size of the header, before the pixel records
+const size_t HEADER_BYTES = sizeof(MAGIC) + sizeof(uint32_t) + 2 * sizeof(int32_t) + sizeof(uint64_t);
+
+template <typename T>
+void writeValue(ofstream & out, const T & value)
+{
+	out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+void readValue(ifstream & in, T & value)
+{
+	in.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+} // namespace
+
+
+template <typename F>
+void ImageStats::forEachPixel(F f)
+{
+	int tilesX = numTilesX();
+	parallel_for(0, numTilesX() * numTilesY(), [this,tilesX,&f](int t)
+	{
+		Tile & tile = m_tiles[t];
+		int x0 = (t % tilesX) * TILE_SIZE, y0 = (t / tilesX) * TILE_SIZE;
+		int x1 = std::min(x0 + TILE_SIZE, m_width), y1 = std::min(y0 + TILE_SIZE, m_height);
+		for (int y = y0; y < y1; ++y)
+			for (int x = x0; x < x1; ++x)
+				f(tile, (y - y0) * TILE_SIZE + (x - x0), x, y);
+	});
+}
+
+template <typename F>
+void ImageStats::forEachPixel(F f) const
+{
+	const_cast<ImageStats *>(this)->forEachPixel([&f](Tile & tile, int i, int x, int y)
+	{
+		f(const_cast<const Tile &>(tile), i, x, y);
+	});
+}
+
+void ImageStats::resize(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	m_tiles.assign(size_t(numTilesX()) * numTilesY(), Tile());
+
+	const int n = TILE_SIZE * TILE_SIZE;
+	for (auto & tile : m_tiles)
+	{
+		tile.count.assign(n, 0);
+		tile.mean.assign(4 * n, 0.0);
+		tile.m2.assign(4 * n, 0.0);
+		tile.min.assign(4 * n, numeric_limits<float>::infinity());
+		tile.max.assign(4 * n, -numeric_limits<float>::infinity());
+	}
+}
+
+void ImageStats::add(const HDRImage & img)
+{
+	if (m_numImages == 0)
+		resize(img.width(), img.height());
+	else if (img.width() != m_width || img.height() != m_height)
+		throw invalid_argument(fmt::format("Images do not have the same size: expected {}x{}, but got {}x{}.",
+		                                   m_width, m_height, img.width(), img.height()));
+
+	forEachPixel([&img](Tile & tile, int i, int x, int y)
+	{
+		const Color4 & c = img(x,y);
+		if (!isfinite(c.sum()))
+			return;
+
+		double n = ++tile.count[i];
+		for (int ch = 0; ch < 4; ++ch)
+		{
+			double v = c[ch];
+			double & mean = tile.mean[4*i+ch];
+			double delta = v - mean;
+			mean += delta / n;
+			tile.m2[4*i+ch] += delta * (v - mean);
+			tile.min[4*i+ch] = std::min(tile.min[4*i+ch], c[ch]);
+			tile.max[4*i+ch] = std::max(tile.max[4*i+ch], c[ch]);
+		}
+	});
+
+	++m_numImages;
+}
+
+void ImageStats::merge(const ImageStats & other)
+{
+	if (other.empty())
+		return;
+	if (empty())
+	{
+		*this = other;
+		return;
+	}
+	if (other.m_width != m_width || other.m_height != m_height)
+		throw invalid_argument(fmt::format("Cannot merge statistics of {}x{} images with those of {}x{} images.",
+		                                   other.m_width, other.m_height, m_width, m_height));
+
+	// both use the same tiling, so tiles and pixels correspond one-to-one
+	parallel_for(0, int(m_tiles.size()), [this,&other](int t)
+	{
+		Tile & a = m_tiles[t];
+		const Tile & b = other.m_tiles[t];
+		for (size_t i = 0; i < a.count.size(); ++i)
+		{
+			if (b.count[i] == 0)
+				continue;
+
+			// Chan et al.'s pairwise update of the mean and sum of squared deviations
+
+			double na = a.count[i], nb = b.count[i], n = na + nb;
+			for (int ch = 0; ch < 4; ++ch)
+			{
+				size_t j = 4*i+ch;
+				double delta = b.mean[j] - a.mean[j];
+				a.mean[j] += delta * nb / n;
+				a.m2[j] += b.m2[j] + delta * delta * na * nb / n;
+				a.min[j] = std::min(a.min[j], b.min[j]);
+				a.max[j] = std::max(a.max[j], b.max[j]);
+			}
+			a.count[i] += b.count[i];
+		}
+	});
+
+	m_numImages += other.m_numImages;
+}
+
+HDRImage ImageStats::mean() const
+{
+	HDRImage result(m_width, m_height);
+	forEachPixel([&result](const Tile & tile, int i, int x, int y)
+	{
+		const double * m = &tile.mean[4*i];
+		result(x,y) = Color4(float(m[0]), float(m[1]), float(m[2]), float(m[3]));
+	});
+	return result;
+}
+
+HDRImage ImageStats::variance() const
+{
+	HDRImage result(m_width, m_height);
+	forEachPixel([&result](const Tile & tile, int i, int x, int y)
+	{
+		double n = tile.count[i];
+		const double * m2 = &tile.m2[4*i];
+		result(x,y) = n < 2 ? Color4(0.f, 0.f, 0.f, 1.f) :
+		              Color4(float(m2[0]/(n-1)), float(m2[1]/(n-1)), float(m2[2]/(n-1)), float(m2[3]/(n-1)));
+	});
+	return result;
+}
+
+HDRImage ImageStats::minimum() const
+{
+	HDRImage result(m_width, m_height);
+	forEachPixel([&result](const Tile & tile, int i, int x, int y)
+	{
+		result(x,y) = tile.count[i] ? Color4(&tile.min[4*i]) : Color4(0.f);
+	});
+	return result;
+}
+
+HDRImage ImageStats::maximum() const
+{
+	HDRImage result(m_width, m_height);
+	forEachPixel([&result](const Tile & tile, int i, int x, int y)
+	{
+		result(x,y) = tile.count[i] ? Color4(&tile.max[4*i]) : Color4(0.f);
+	});
+	return result;
+}
+
+HDRImage ImageStats::sampleCount() const
+{
+	HDRImage result(m_width, m_height);
+	forEachPixel([&result](const Tile & tile, int i, int x, int y)
+	{
+		result(x,y) = Color4(float(tile.count[i]));
+	});
+	return result;
+}
+
+void ImageStats::save(const string & filename) const
+{
+	ofstream out(filename, ios::binary);
+	if (!out)
+		throw runtime_error(fmt::format("Cannot open \"{}\" for writing.", filename));
+
+	out.write(MAGIC, sizeof(MAGIC));
+	writeValue(out, VERSION);
+	writeValue(out, int32_t(m_width));
+	writeValue(out, int32_t(m_height));
+	writeValue(out, uint64_t(m_numImages));
+
+	// pixels are stored in scanline order, independent of the tile size
+	for (int y = 0; y < m_height; ++y)
+		for (int x = 0; x < m_width; ++x)
+		{
+			const Tile & tile = m_tiles[(y / TILE_SIZE) * numTilesX() + x / TILE_SIZE];
+			int i = (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+
+			PixelRecord p{};
+			p.count = tile.count[i];
+			for (int ch = 0; ch < 4; ++ch)
+			{
+				p.mean[ch] = tile.mean[4*i+ch];
+				p.m2[ch] = tile.m2[4*i+ch];
+				p.min[ch] = tile.min[4*i+ch];
+				p.max[ch] = tile.max[4*i+ch];
+			}
+			writeValue(out, p);
+		}
+
+	if (!out)
+		throw runtime_error(fmt::format("Error while writing \"{}\".", filename));
+}
+
+ImageStats ImageStats::load(const string & filename)
+{
+	ifstream in(filename, ios::binary | ios::ate);
+	if (!in)
+		throw runtime_error(fmt::format("Cannot open \"{}\" for reading.", filename));
+	size_t fileSize = size_t(in.tellg());
+	in.seekg(0);
+
+	char magic[sizeof(MAGIC)];
+	uint32_t version = 0;
+	int32_t width = 0, height = 0;
+	uint64_t numImages = 0;
+	in.read(magic, sizeof(magic));
+	readValue(in, version);
+	readValue(in, width);
+	readValue(in, height);
+	readValue(in, numImages);
+	if (!in || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+		throw runtime_error(fmt::format("\"{}\" is not a partial statistics file.", filename));
+	if (version != VERSION)
+		throw runtime_error(fmt::format("Unsupported partial statistics version {} in \"{}\".", version, filename));
+	// check the size before allocating the accumulators, so that a corrupt header cannot exhaust the memory
+	if (width < 0 || height < 0 || fileSize != HEADER_BYTES + size_t(width) * size_t(height) * sizeof(PixelRecord))
+		throw runtime_error(fmt::format("Invalid image size {}x{} in \"{}\".", width, height, filename));
+
+	ImageStats stats;
+	stats.resize(width, height);
+	stats.m_numImages = numImages;
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			Tile & tile = stats.m_tiles[(y / TILE_SIZE) * stats.numTilesX() + x / TILE_SIZE];
+			int i = (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+
+			PixelRecord p{};
+			readValue(in, p);
+			tile.count[i] = p.count;
+			for (int ch = 0; ch < 4; ++ch)
+			{
+				tile.mean[4*i+ch] = p.mean[ch];
+				tile.m2[4*i+ch] = p.m2[ch];
+				tile.min[4*i+ch] = p.min[ch];
+				tile.max[4*i+ch] = p.max[ch];
+			}
+		}
+
+	if (!in)
+		throw runtime_error(fmt::format("Unexpected end of file while reading \"{}\".", filename));
+	return stats;
+}
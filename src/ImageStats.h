@@ -0,0 +1,98 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <cstdint>               // for uint32_t
+#include <string>                // for string
+#include <vector>                // for vector
+#include "HDRImage.h"            // for HDRImage
+
+
+/*!
+ * @brief Accumulates per-pixel statistics over a stream of equally-sized images.
+ *
+ * For every pixel, this keeps the number of finite samples, their running mean and
+ * sum of squared deviations (updated with Welford's algorithm in double precision),
+ * and the per-channel minimum and maximum. Samples containing NaNs or infinities are
+ * skipped, so the sample count can differ from pixel to pixel.
+ *
+ * The statistics are stored in square tiles, and each new image is folded in tile by
+ * tile in parallel, which keeps each tile's accumulators in cache while they are
+ * updated. Partial results computed separately (e.g. on different machines) can be
+ * saved, loaded and combined with merge().
+ */
+class ImageStats
+{
+public:
+	static const int TILE_SIZE = 64;
+
+	//! The number of images added so far, including those of merged partial results
+	size_t numImages() const    {return m_numImages;}
+	int width() const           {return m_width;}
+	int height() const          {return m_height;}
+	bool empty() const          {return m_numImages == 0;}
+
+	/*!
+	 * @brief Fold an image into the statistics.
+	 *
+	 * Throws std::invalid_argument if the image size differs from previously added images.
+	 */
+	void add(const HDRImage & img);
+
+	/*!
+	 * @brief Combine the statistics of another, independently accumulated, sequence.
+	 *
+	 * Throws std::invalid_argument if the image sizes differ.
+	 */
+	void merge(const ImageStats & other);
+
+	//-----------------------------------------------------------------------
+	//@{ \name Per-pixel results
+	//-----------------------------------------------------------------------
+	HDRImage mean() const;
+	//! The unbiased sample variance, using the (n-1) Bessel correction
+	HDRImage variance() const;
+	HDRImage minimum() const;
+	HDRImage maximum() const;
+	//! The number of finite samples of each pixel, stored in all four channels
+	HDRImage sampleCount() const;
+	//@}
+
+	//-----------------------------------------------------------------------
+	//@{ \name Partial results
+	//-----------------------------------------------------------------------
+	//! Write the full accumulator state to a binary file. Throws std::runtime_error on failure.
+	void save(const std::string & filename) const;
+
+	//! Read an accumulator state written by save(). Throws std::runtime_error on failure.
+	static ImageStats load(const std::string & filename);
+	//@}
+
+private:
+	// the accumulators of a TILE_SIZE x TILE_SIZE block of pixels, stored row by row
+	struct Tile
+	{
+		std::vector<uint32_t> count;
+		std::vector<double> mean, m2;       // 4 values per pixel
+		std::vector<float> min, max;        // 4 values per pixel
+	};
+
+	void resize(int width, int height);
+
+	int numTilesX() const       {return (m_width + TILE_SIZE - 1) / TILE_SIZE;}
+	int numTilesY() const       {return (m_height + TILE_SIZE - 1) / TILE_SIZE;}
+
+	// call f(tile, indexWithinTile, x, y) for every pixel, in parallel over tiles
+	template <typename F>
+	void forEachPixel(F f);
+	template <typename F>
+	void forEachPixel(F f) const;
+
+	int m_width = 0, m_height = 0;
+	size_t m_numImages = 0;
+	std::vector<Tile> m_tiles;
+};
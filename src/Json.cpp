@@ -0,0 +1,479 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "Json.h"
+#include <cmath>                 // for isfinite, floor
+#include <cstdio>                // for snprintf
+#include <cstdlib>               // for strtod
+#include <stdexcept>             // for invalid_argument
+
+using namespace std;
+
+namespace
+{
+
+const Json g_null;
+
+const char * typeName(Json::Type t)
+{
+	static const char * names[] = {"null", "boolean", "number", "string", "array", "object"};
+	return names[t];
+}
+
+void appendEscaped(string & out, const string & s)
+{
+	out += '"';
+	for (unsigned char c : s)
+	{
+		switch (c)
+		{
+			case '"':  out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\b': out += "\\b"; break;
+			case '\f': out += "\\f"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if (c < 0x20)
+				{
+					char buf[8];
+					snprintf(buf, sizeof(buf), "\\u%04x", c);
+					out += buf;
+				}
+				else
+					out += char(c);
+		}
+	}
+	out += '"';
+}
+
+string numberToString(double n)
+{
+	// JSON has no representation for NaNs and infinities
+	if (!std::isfinite(n))
+		return "null";
+
+	char buf[32];
+	if (n == floor(n) && fabs(n) < 1e15)
+	{
+		snprintf(buf, sizeof(buf), "%.0f", n);
+		return buf;
+	}
+
+	// use the shortest precision that reads back as the same double; 17 digits always do
+	for (int precision = 15; precision < 17; ++precision)
+	{
+		snprintf(buf, sizeof(buf), "%.*g", precision, n);
+		if (strtod(buf, nullptr) == n)
+			return buf;
+	}
+	snprintf(buf, sizeof(buf), "%.17g", n);
+	return buf;
+}
+
+
+// A straightforward recursive-descent parser. The nesting of arrays and objects is limited, so that
+// untrusted input, such as the jobs of socket clients, cannot overflow the stack
+class Parser
+{
+public:
+	static const int MAX_DEPTH = 512;
+
+	explicit Parser(const string & text) : m_text(text), m_pos(0) {}
+
+	Json parseDocument()
+	{
+		Json value = parseValue();
+		skipWhitespace();
+		if (m_pos != m_text.size())
+			error("unexpected trailing characters");
+		return value;
+	}
+
+private:
+	[[noreturn]] void error(const string & what) const
+	{
+		throw invalid_argument("JSON parse error at offset " + to_string(m_pos) + ": " + what + ".");
+	}
+
+	void skipWhitespace()
+	{
+		while (m_pos < m_text.size() && isspace((unsigned char)m_text[m_pos]))
+			++m_pos;
+	}
+
+	bool consume(char c)
+	{
+		skipWhitespace();
+		if (m_pos < m_text.size() && m_text[m_pos] == c)
+		{
+			++m_pos;
+			return true;
+		}
+		return false;
+	}
+
+	void expect(char c)
+	{
+		if (!consume(c))
+			error(string("expected '") + c + "'");
+	}
+
+	bool matchLiteral(const char * literal)
+	{
+		size_t n = char_traits<char>::length(literal);
+		if (m_text.compare(m_pos, n, literal) != 0)
+			return false;
+		m_pos += n;
+		return true;
+	}
+
+	Json parseValue()
+	{
+		skipWhitespace();
+		if (m_pos >= m_text.size())
+			error("unexpected end of input");
+
+		char c = m_text[m_pos];
+		if (c == '{' || c == '[')
+		{
+			if (m_depth >= MAX_DEPTH)
+				error("arrays and objects are nested more than " + to_string(MAX_DEPTH) + " levels deep");
+			++m_depth;
+			Json value = c == '{' ? parseObject() : parseArray();
+			--m_depth;
+			return value;
+		}
+		if (c == '"')
+			return Json(parseString());
+		if (matchLiteral("true"))
+			return Json(true);
+		if (matchLiteral("false"))
+			return Json(false);
+		if (matchLiteral("null"))
+			return Json();
+		return parseNumber();
+	}
+
+	Json parseObject()
+	{
+		Json obj = Json::object();
+		expect('{');
+		if (consume('}'))
+			return obj;
+		do
+		{
+			skipWhitespace();
+			if (m_pos >= m_text.size() || m_text[m_pos] != '"')
+				error("expected a member name");
+			string key = parseString();
+			expect(':');
+			obj[key] = parseValue();
+		} while (consume(','));
+		expect('}');
+		return obj;
+	}
+
+	Json parseArray()
+	{
+		Json arr = Json::array();
+		expect('[');
+		if (consume(']'))
+			return arr;
+		do
+		{
+			arr.push_back(parseValue());
+		} while (consume(','));
+		expect(']');
+		return arr;
+	}
+
+	bool isDigit(size_t pos) const
+	{
+		return pos < m_text.size() && m_text[pos] >= '0' && m_text[pos] <= '9';
+	}
+
+	void skipDigits(size_t & pos) const
+	{
+		while (isDigit(pos))
+			++pos;
+	}
+
+	// Only accepts the JSON number grammar, -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?, so that
+	// strtod extensions like "nan", "inf", "0x1p3" or "+1" are rejected
+	Json parseNumber()
+	{
+		size_t end = m_pos;
+		if (end < m_text.size() && m_text[end] == '-')
+			++end;
+
+		if (!isDigit(end))
+			error("unexpected character");
+		if (m_text[end] == '0')
+			++end;
+		else
+			skipDigits(end);
+
+		if (end < m_text.size() && m_text[end] == '.')
+		{
+			++end;
+			if (!isDigit(end))
+				error("expected a digit after the decimal point");
+			skipDigits(end);
+		}
+
+		if (end < m_text.size() && (m_text[end] == 'e' || m_text[end] == 'E'))
+		{
+			++end;
+			if (end < m_text.size() && (m_text[end] == '+' || m_text[end] == '-'))
+				++end;
+			if (!isDigit(end))
+				error("expected a digit in the exponent");
+			skipDigits(end);
+		}
+
+		double n = strtod(m_text.substr(m_pos, end - m_pos).c_str(), nullptr);
+		m_pos = end;
+		return Json(n);
+	}
+
+	void appendUTF8(string & out, unsigned code)
+	{
+		if (code < 0x80)
+			out += char(code);
+		else if (code < 0x800)
+		{
+			out += char(0xC0 | (code >> 6));
+			out += char(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000)
+		{
+			out += char(0xE0 | (code >> 12));
+			out += char(0x80 | ((code >> 6) & 0x3F));
+			out += char(0x80 | (code & 0x3F));
+		}
+		else
+		{
+			out += char(0xF0 | (code >> 18));
+			out += char(0x80 | ((code >> 12) & 0x3F));
+			out += char(0x80 | ((code >> 6) & 0x3F));
+			out += char(0x80 | (code & 0x3F));
+		}
+	}
+
+	unsigned parseHex4()
+	{
+		if (m_pos + 4 > m_text.size())
+			error("truncated unicode escape");
+		unsigned code = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			char c = m_text[m_pos++];
+			code <<= 4;
+			if (c >= '0' && c <= '9')      code |= c - '0';
+			else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+			else error("invalid unicode escape");
+		}
+		return code;
+	}
+
+	string parseString()
+	{
+		string out;
+		++m_pos; // opening quote
+		while (true)
+		{
+			if (m_pos >= m_text.size())
+				error("unterminated string");
+			char c = m_text[m_pos++];
+			if (c == '"')
+				return out;
+			if (c != '\\')
+			{
+				out += c;
+				continue;
+			}
+
+			if (m_pos >= m_text.size())
+				error("unterminated string");
+			c = m_text[m_pos++];
+			switch (c)
+			{
+				case '"':  out += '"'; break;
+				case '\\': out += '\\'; break;
+				case '/':  out += '/'; break;
+				case 'b':  out += '\b'; break;
+				case 'f':  out += '\f'; break;
+				case 'n':  out += '\n'; break;
+				case 'r':  out += '\r'; break;
+				case 't':  out += '\t'; break;
+				case 'u':
+				{
+					unsigned code = parseHex4();
+					// combine UTF-16 surrogate pairs, which cannot be encoded as UTF-8 on their own
+					if (code >= 0xDC00 && code < 0xE000)
+						error("unpaired low surrogate in unicode escape");
+					if (code >= 0xD800 && code < 0xDC00)
+					{
+						if (!matchLiteral("\\u"))
+							error("unpaired high surrogate in unicode escape");
+						unsigned low = parseHex4();
+						if (low < 0xDC00 || low >= 0xE000)
+							error("invalid low surrogate in unicode escape");
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					}
+					appendUTF8(out, code);
+					break;
+				}
+				default:
+					error("invalid escape sequence");
+			}
+		}
+	}
+
+	const string & m_text;
+	size_t m_pos;
+	int m_depth = 0;     // the number of arrays and objects being parsed
+};
+
+} // namespace
+
+
+bool Json::asBool() const
+{
+	if (m_type != BOOLEAN)
+		throw invalid_argument(string("Expected a boolean JSON value, but got ") + typeName(m_type) + ".");
+	return m_bool;
+}
+
+double Json::asNumber() const
+{
+	if (m_type != NUMBER)
+		throw invalid_argument(string("Expected a numeric JSON value, but got ") + typeName(m_type) + ".");
+	return m_number;
+}
+
+const string & Json::asString() const
+{
+	if (m_type != STRING)
+		throw invalid_argument(string("Expected a string JSON value, but got ") + typeName(m_type) + ".");
+	return m_string;
+}
+
+string Json::toString() const
+{
+	switch (m_type)
+	{
+		case STRING:    return m_string;
+		case NUMBER:    return numberToString(m_number);
+		case BOOLEAN:   return m_bool ? "true" : "false";
+		default:        return dump();
+	}
+}
+
+size_t Json::size() const
+{
+	return m_type == ARRAY ? m_items.size() : m_type == OBJECT ? m_members.size() : 0;
+}
+
+void Json::push_back(const Json & value)
+{
+	if (m_type == NULL_VALUE)
+		m_type = ARRAY;
+	if (m_type != ARRAY)
+		throw invalid_argument(string("Cannot append to a JSON ") + typeName(m_type) + ".");
+	m_items.push_back(value);
+}
+
+bool Json::contains(const string & key) const
+{
+	for (auto & m : m_members)
+		if (m.first == key)
+			return true;
+	return false;
+}
+
+Json & Json::operator[](const string & key)
+{
+	if (m_type == NULL_VALUE)
+		m_type = OBJECT;
+	if (m_type != OBJECT)
+		throw invalid_argument(string("Cannot access member \"") + key + "\" of a JSON " + typeName(m_type) + ".");
+
+	for (auto & m : m_members)
+		if (m.first == key)
+			return m.second;
+	m_members.emplace_back(key, Json());
+	return m_members.back().second;
+}
+
+const Json & Json::operator[](const string & key) const
+{
+	for (auto & m : m_members)
+		if (m.first == key)
+			return m.second;
+	return g_null;
+}
+
+string Json::dump(int indent) const
+{
+	string out;
+	dump(out, indent, 0);
+	return out;
+}
+
+void Json::dump(string & out, int indent, int level) const
+{
+	auto newline = [&out,indent](int l)
+	{
+		if (indent >= 0)
+		{
+			out += '\n';
+			out.append(size_t(indent * l), ' ');
+		}
+	};
+
+	switch (m_type)
+	{
+		case NULL_VALUE:    out += "null"; break;
+		case BOOLEAN:       out += m_bool ? "true" : "false"; break;
+		case NUMBER:        out += numberToString(m_number); break;
+		case STRING:        appendEscaped(out, m_string); break;
+		case ARRAY:
+			out += '[';
+			for (size_t i = 0; i < m_items.size(); ++i)
+			{
+				if (i) out += indent >= 0 ? "," : ", ";
+				newline(level + 1);
+				m_items[i].dump(out, indent, level + 1);
+			}
+			if (!m_items.empty())
+				newline(level);
+			out += ']';
+			break;
+		case OBJECT:
+			out += '{';
+			for (size_t i = 0; i < m_members.size(); ++i)
+			{
+				if (i) out += indent >= 0 ? "," : ", ";
+				newline(level + 1);
+				appendEscaped(out, m_members[i].first);
+				out += ": ";
+				m_members[i].second.dump(out, indent, level + 1);
+			}
+			if (!m_members.empty())
+				newline(level);
+			out += '}';
+			break;
+	}
+}
+
+Json Json::parse(const string & text)
+{
+	return Parser(text).parseDocument();
+}
@@ -0,0 +1,116 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <string>                // for string
+#include <utility>               // for pair
+#include <vector>                // for vector
+
+
+/*!
+ * @brief A minimal JSON value for reading job descriptions and writing reports.
+ *
+ * Objects keep their members in insertion order so that the output is stable.
+ * Numbers are stored as doubles.
+ */
+class Json
+{
+public:
+	enum Type
+	{
+		NULL_VALUE = 0,
+		BOOLEAN,
+		NUMBER,
+		STRING,
+		ARRAY,
+		OBJECT
+	};
+
+	using Member = std::pair<std::string, Json>;
+
+	//-----------------------------------------------------------------------
+	//@{ \name Constructors
+	//-----------------------------------------------------------------------
+	Json() : m_type(NULL_VALUE) {}
+	Json(bool b) : m_type(BOOLEAN), m_bool(b) {}
+	Json(int n) : m_type(NUMBER), m_number(n) {}
+	Json(unsigned n) : m_type(NUMBER), m_number(n) {}
+	Json(long n) : m_type(NUMBER), m_number(double(n)) {}
+	Json(unsigned long n) : m_type(NUMBER), m_number(double(n)) {}
+	Json(long long n) : m_type(NUMBER), m_number(double(n)) {}
+	Json(unsigned long long n) : m_type(NUMBER), m_number(double(n)) {}
+	Json(double n) : m_type(NUMBER), m_number(n) {}
+	Json(const char * s) : m_type(STRING), m_string(s) {}
+	Json(const std::string & s) : m_type(STRING), m_string(s) {}
+
+	static Json array()     {Json j; j.m_type = ARRAY; return j;}
+	static Json object()    {Json j; j.m_type = OBJECT; return j;}
+	//@}
+
+	//-----------------------------------------------------------------------
+	//@{ \name Type queries and value access
+	//-----------------------------------------------------------------------
+	Type type() const       {return m_type;}
+	bool isNull() const     {return m_type == NULL_VALUE;}
+	bool isBool() const     {return m_type == BOOLEAN;}
+	bool isNumber() const   {return m_type == NUMBER;}
+	bool isString() const   {return m_type == STRING;}
+	bool isArray() const    {return m_type == ARRAY;}
+	bool isObject() const   {return m_type == OBJECT;}
+
+	//! These throw std::invalid_argument if the value has a different type
+	bool asBool() const;
+	double asNumber() const;
+	const std::string & asString() const;
+
+	//! Converts a string, number or boolean to its textual representation
+	std::string toString() const;
+	//@}
+
+	//-----------------------------------------------------------------------
+	//@{ \name Arrays and objects
+	//-----------------------------------------------------------------------
+	size_t size() const;
+
+	//! Array elements; empty for non-arrays
+	const std::vector<Json> & items() const     {return m_items;}
+	void push_back(const Json & value);
+
+	//! Object members in insertion order; empty for non-objects
+	const std::vector<Member> & members() const {return m_members;}
+	bool contains(const std::string & key) const;
+
+	//! Access (and create, if needed) an object member. Turns a null value into an object.
+	Json & operator[](const std::string & key);
+
+	//! Access an object member, returning a null value if it does not exist
+	const Json & operator[](const std::string & key) const;
+	//@}
+
+	//-----------------------------------------------------------------------
+	//@{ \name Serialization
+	//-----------------------------------------------------------------------
+	/*!
+	 * @brief Convert to a JSON string.
+	 * @param indent 	Number of spaces to indent nested values by, or -1 to write everything on one line.
+	 */
+	std::string dump(int indent = -1) const;
+
+	//! Parse a JSON string, throwing std::invalid_argument on syntax errors.
+	static Json parse(const std::string & text);
+	//@}
+
+private:
+	void dump(std::string & out, int indent, int level) const;
+
+	Type m_type;
+	bool m_bool = false;
+	double m_number = 0.0;
+	std::string m_string;
+	std::vector<Json> m_items;
+	std::vector<Member> m_members;
+};
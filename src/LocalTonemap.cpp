@@ -0,0 +1,407 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "LocalTonemap.h"
+#include <algorithm>             // for min, max, nth_element
+#include <cmath>                 // for ceil, exp2, fabs
+#include "FastMath.h"            // for fastLog2, fastExp2, fastPow
+#include "ParallelFor.h"         // for parallel_for
+#include "Pyramid.h"             // for Plane, gaussianPyramid, pyramidUp, collapsedPyramid
+#include "Timer.h"               // for Timer
+#include "Trace.h"               // for TraceZone, traceImageId
+#include <spdlog/spdlog.h>
+
+using namespace std;
+using namespace Eigen;
+
+// local functions
+namespace
+{
+
+// the luminance range that is tone mapped, which keeps the logarithms finite
+const float MIN_LUMINANCE = 1e-8f;
+const float MAX_LUMINANCE = 1e20f;
+
+// the number of scales Reinhard's operator chooses from, each twice as large as the previous one
+const int REINHARD_SCALES = 8;
+
+// the largest number of intensities the local Laplacian filter is sampled at
+const int MAX_LAPLACIAN_SAMPLES = 32;
+
+// the percentiles that stand for the darkest and brightest values of an image, so that a few black or
+// hot pixels do not change the tone mapping of the rest
+const float BLACK_PERCENTILE = 0.001f;
+const float WHITE_PERCENTILE = 0.999f;
+
+// the 5-tap binomial filter used by the bilateral grid, whose variance is 1
+const float BINOMIAL[5] = {1/16.f, 4/16.f, 6/16.f, 4/16.f, 1/16.f};
+
+// bilinearly interpolate \a p at the position (u,v) in [0,1]^2, relative to its whole extent
+inline float bilinear(const Plane & p, float u, float v)
+{
+	int w = int(p.rows()), h = int(p.cols());
+	float x = min(max(u * w - 0.5f, 0.f), float(w - 1));
+	float y = min(max(v * h - 0.5f, 0.f), float(h - 1));
+	int x0 = int(x), y0 = int(y);
+	int x1 = min(x0 + 1, w - 1), y1 = min(y0 + 1, h - 1);
+	float fx = x - x0, fy = y - y0;
+	return (1.f - fy) * ((1.f - fx) * p(x0, y0) + fx * p(x1, y0)) +
+	       fy * ((1.f - fx) * p(x0, y1) + fx * p(x1, y1));
+}
+
+// the \a p-th percentile of about 100000 regularly spaced values of \a in
+float percentile(const Plane & in, float p)
+{
+	vector<float> samples;
+	size_t stride = max(size_t(1), size_t(in.size()) / 100000);
+	for (size_t i = 0; i < size_t(in.size()); i += stride)
+		samples.push_back(in(i));
+	auto nth = samples.begin() + size_t(p * (samples.size() - 1));
+	nth_element(samples.begin(), nth, samples.end());
+	return *nth;
+}
+
+Plane resized(const Plane & in, int w, int h)
+{
+	Plane out(w, h);
+	parallel_for(0, h, [&in,&out,w,h](int y)
+	{
+		float v = (y + 0.5f) / h;
+		for (int x = 0; x < w; ++x)
+			out(x, y) = bilinear(in, (x + 0.5f) / w, v);
+	});
+	return out;
+}
+
+// average blocks of factor x factor pixels
+Plane boxDownsampled(const Plane & in, int factor)
+{
+	int w = int(in.rows()), h = int(in.cols());
+	int w2 = (w + factor - 1) / factor, h2 = (h + factor - 1) / factor;
+	Plane out(w2, h2);
+	parallel_for(0, h2, [&in,&out,w,h,w2,factor](int y2)
+	{
+		int y0 = y2 * factor, y1 = min(h, y0 + factor);
+		for (int x2 = 0; x2 < w2; ++x2)
+		{
+			int x0 = x2 * factor, x1 = min(w, x0 + factor);
+			out(x2, y2) = in.block(x0, y0, x1 - x0, y1 - y0).mean();
+		}
+	});
+	return out;
+}
+
+
+//
+// Each operator computes the log2 of the gain that each pixel's luminance is multiplied by,
+// given the log2 luminance \a logL.
+//
+
+// Reinhard et al. [2002], with the Gaussians of increasing scale read from a Gaussian pyramid
+Plane reinhardGain(const Plane & logL, const LocalTonemapSpec & spec, float pixelSize, AtomicProgress progress)
+{
+	int w = int(logL.rows()), h = int(logL.cols());
+
+	// scale the image so that its log-average luminance maps to the key
+	float logScale = log2(spec.key) - float(logL.cast<double>().mean());
+	Plane L = logL.unaryExpr([logScale](float l) {return fastExp2(l + logScale);});
+	vector<Plane> pyramid = gaussianPyramid(L, REINHARD_SCALES + 1);
+
+	// the center-surround threshold 2^phi * key / s^2, for the scale s of each level in pixels
+	float thresholds[REINHARD_SCALES];
+	for (int i = 0; i < REINHARD_SCALES; ++i)
+		thresholds[i] = exp2(spec.sharpening) * spec.key / pow(exp2(float(i)) * pixelSize, 2.f);
+
+	Plane gain(w, h);
+	progress.setNumSteps(h);
+	parallel_for(0, h, [&](int y)
+	{
+		float v = (y + 0.5f) / h;
+		for (int x = 0; x < w; ++x)
+		{
+			float u = (x + 0.5f) / w;
+
+			// find the largest scale around the pixel that has no large contrasts
+			float center = L(x, y), local = center;
+			for (int i = 0; i < REINHARD_SCALES; ++i)
+			{
+				float surround = bilinear(pyramid[i + 1], u, v);
+				if (fabs(center - surround) >= spec.threshold * (thresholds[i] + center))
+					break;
+				local = center;
+				center = surround;
+			}
+			gain(x, y) = logScale - fastLog2(1.f + local);
+		}
+		++progress;
+	});
+	return gain;
+}
+
+
+// the bilateral filter of \a in, computed by splatting it into a bilateral grid [Paris and Durand 2006]
+// that is blurred and sliced with trilinear interpolation
+Plane bilateralGridFiltered(const Plane & in, float sigmaS, float sigmaR)
+{
+	// the grid is padded so that blurring it with the 5-tap filter never reaches outside of it
+	const int PAD = 2;
+	int w = int(in.rows()), h = int(in.cols());
+	float lo = in.minCoeff(), hi = in.maxCoeff();
+	int gw = int(ceil((w - 1) / sigmaS)) + 1 + 2 * PAD;
+	int gh = int(ceil((h - 1) / sigmaS)) + 1 + 2 * PAD;
+	int gd = int(ceil((hi - lo) / sigmaR)) + 1 + 2 * PAD;
+	auto index = [gw,gh](int x, int y, int z) {return (size_t(z) * gh + y) * gw + x;};
+
+	// each cell holds the sum of the values splatted into it, and their number
+	vector<float> values(size_t(gw) * gh * gd, 0.f), weights(values.size(), 0.f);
+
+	// splat each pixel into its nearest cell. The rows of cells are filled in parallel, each from the
+	// rows of pixels nearest to it
+	vector<int> firstRow(gh + 1, h);
+	for (int y = h - 1; y >= 0; --y)
+		firstRow[int(y / sigmaS + 0.5f) + PAD] = y;
+	for (int gy = gh - 1; gy > 0; --gy)
+		firstRow[gy - 1] = min(firstRow[gy - 1], firstRow[gy]);
+	parallel_for(0, gh, [&](int gy)
+	{
+		for (int y = firstRow[gy]; y < firstRow[gy + 1]; ++y)
+			for (int x = 0; x < w; ++x)
+			{
+				size_t i = index(int(x / sigmaS + 0.5f) + PAD, gy, int((in(x, y) - lo) / sigmaR + 0.5f) + PAD);
+				values[i] += in(x, y);
+				weights[i] += 1.f;
+			}
+	});
+
+	// blur the grid along each axis
+	auto blurAxis = [&](vector<float> & grid, int axis)
+	{
+		int n = axis == 0 ? gw : (axis == 1 ? gh : gd);
+		size_t stride = axis == 0 ? 1 : (axis == 1 ? size_t(gw) : size_t(gw) * gh);
+		int outer = axis == 2 ? gh : gd;
+		parallel_for(0, outer, [&,n,stride](int o)
+		{
+			vector<float> line(n);
+			int m1 = axis == 0 ? gh : gw;
+			for (int j = 0; j < m1; ++j)
+			{
+				size_t start = axis == 0 ? index(0, j, o) : (axis == 1 ? index(j, 0, o) : index(j, o, 0));
+				for (int k = 0; k < n; ++k)
+					line[k] = grid[start + k * stride];
+				for (int k = 0; k < n; ++k)
+				{
+					float s = 0.f;
+					for (int t = 0; t < 5; ++t)
+					{
+						int kk = k + t - 2;
+						s += kk >= 0 && kk < n ? BINOMIAL[t] * line[kk] : 0.f;
+					}
+					grid[start + k * stride] = s;
+				}
+			}
+		});
+	};
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		blurAxis(values, axis);
+		blurAxis(weights, axis);
+	}
+
+	// slice the grid at each pixel
+	Plane out(w, h);
+	parallel_for(0, h, [&](int y)
+	{
+		float gy = y / sigmaS + PAD;
+		int y0 = int(gy);
+		float fy = gy - y0;
+		for (int x = 0; x < w; ++x)
+		{
+			float gx = x / sigmaS + PAD, gz = (in(x, y) - lo) / sigmaR + PAD;
+			int x0 = int(gx), z0 = int(gz);
+			float fx = gx - x0, fz = gz - z0;
+			float v = 0.f, wt = 0.f;
+			for (int k = 0; k < 8; ++k)
+			{
+				int dx = k & 1, dy = (k >> 1) & 1, dz = k >> 2;
+				float c = (dx ? fx : 1.f - fx) * (dy ? fy : 1.f - fy) * (dz ? fz : 1.f - fz);
+				size_t i = index(x0 + dx, y0 + dy, z0 + dz);
+				v += c * values[i];
+				wt += c * weights[i];
+			}
+			out(x, y) = wt > 0.f ? v / wt : in(x, y);
+		}
+	});
+	return out;
+}
+
+// Durand and Dorsey [2002]: compress the contrast of the bilateral filtered base, and keep the details
+Plane durandGain(const Plane & logL, const LocalTonemapSpec & spec, AtomicProgress progress)
+{
+	progress.setNumSteps(1);
+	int w = int(logL.rows()), h = int(logL.cols());
+	float sigmaS = max(1.f, spec.sigmaSpatial * max(w, h));
+	float sigmaR = max(1e-3f, spec.sigmaRange);
+	Plane base = bilateralGridFiltered(logL, sigmaS, sigmaR);
+
+	// the output is (base - max) * compression + (logL - base), so that the brightest base maps to 1
+	float lo = percentile(base, BLACK_PERCENTILE), hi = percentile(base, WHITE_PERCENTILE);
+	float compression = hi > lo ? min(1.f, spec.contrast / (hi - lo)) : 1.f;
+	++progress;
+	return (compression - 1.f) * base - compression * hi;
+}
+
+
+// Paris et al. [2011], computed with the sampled remapping of Aubry et al. [2014]: the Laplacian
+// pyramid of the image remapped around each of a few intensities is computed, and the coefficients of
+// the output pyramid are interpolated from those of the two intensities nearest to the input's
+// Gaussian pyramid
+Plane localLaplacianGain(const Plane & logL, const LocalTonemapSpec & spec, AtomicProgress progress)
+{
+	int w = int(logL.rows()), h = int(logL.cols());
+	float sigmaR = max(1e-3f, spec.sigmaRange);
+	float alpha = spec.detail, beta = spec.compression;
+	float lo = percentile(logL, BLACK_PERCENTILE), hi = percentile(logL, WHITE_PERCENTILE);
+
+	int numLevels = fullPyramidLevels(w, h);
+	vector<Plane> gauss = gaussianPyramid(logL, numLevels);
+
+	// the output pyramid, whose residual is that of the input
+	vector<Plane> out(numLevels);
+	for (int l = 0; l + 1 < numLevels; ++l)
+		out[l] = Plane::Zero(gauss[l].rows(), gauss[l].cols());
+	out.back() = gauss.back();
+
+	// sample the intensities every half of sigmaR, and interpolate those outside of the samples from the
+	// nearest one
+	int numSamples = hi > lo ? min(MAX_LAPLACIAN_SAMPLES, int(ceil((hi - lo) / (0.5f * sigmaR))) + 1) : 1;
+	float step = numSamples > 1 ? (hi - lo) / (numSamples - 1) : 1.f;
+	progress.setNumSteps(numSamples);
+	for (int k = 0; k < numSamples; ++k)
+	{
+		float g = lo + k * step;
+
+		// compress differences from g above sigmaR by beta, and raise smaller ones to the power alpha
+		Plane remapped = logL.unaryExpr([g,sigmaR,alpha,beta](float i) -> float
+		{
+			float d = fabs(i - g);
+			float r = d > sigmaR ? beta * (d - sigmaR) + sigmaR :
+			          (alpha == 1.f ? d : sigmaR * fastPow(d / sigmaR, alpha));
+			return i < g ? g - r : g + r;
+		});
+
+		vector<Plane> pyramid = gaussianPyramid(remapped, numLevels);
+		for (int l = 0; l + 1 < numLevels; ++l)
+		{
+			Plane coarse = pyramidUp(pyramid[l + 1], int(pyramid[l].rows()), int(pyramid[l].cols()));
+			const Plane & fine = pyramid[l], & input = gauss[l];
+			Plane & dst = out[l];
+			parallel_for(0, int(fine.cols()), [&,g,step,lo,hi](int y)
+			{
+				for (int x = 0; x < int(fine.rows()); ++x)
+				{
+					float weight = max(0.f, 1.f - fabs(min(max(input(x, y), lo), hi) - g) / step);
+					dst(x, y) += weight * (fine(x, y) - coarse(x, y));
+				}
+			});
+		}
+		++progress;
+	}
+
+	Plane result = collapsedPyramid(out);
+
+	// map a high percentile, instead of the maximum, to white
+	return result - percentile(result, WHITE_PERCENTILE) - logL;
+}
+
+} // namespace
+
+
+const vector<string> & LocalTonemapSpec::operatorNames()
+{
+	static const vector<string> names =
+		{
+			"Reinhard",
+			"Durand",
+			"Local Laplacian"
+		};
+	return names;
+}
+
+string LocalTonemapSpec::description() const
+{
+	string preview = previewSize > 0 ? fmt::format(" (preview at {} pixels)", previewSize) : "";
+	switch (op)
+	{
+		case REINHARD:  return fmt::format("Reinhard tone mapping with key {:g}, sharpening {:g} and threshold {:g}{}",
+		                                   key, sharpening, threshold, preview);
+		case DURAND:    return fmt::format("Durand tone mapping to {:g} stops with spatial sigma {:g} and range sigma {:g}{}",
+		                                   contrast, sigmaSpatial, sigmaRange, preview);
+		default:        return fmt::format("local Laplacian tone mapping with detail {:g}, compression {:g} and "
+		                                   "range sigma {:g}{}", detail, compression, sigmaRange, preview);
+	}
+}
+
+
+HDRImage locallyTonemapped(const HDRImage & image, const LocalTonemapSpec & spec, AtomicProgress progress)
+{
+	Timer timer;
+	TraceZone zone("locallyTonemapped", traceImageId(&image), image.size() * sizeof(Color4));
+	int w = image.width(), h = image.height();
+	if (image.isNull())
+		return image;
+
+	// the clamped luminance, from which the operators work at full or preview resolution
+	Plane L(w, h);
+	parallel_for(0, h, [&image,&L,w](int y)
+	{
+		for (int x = 0; x < w; ++x)
+		{
+			float l = image(x, y).luminance();
+			L(x, y) = l > MIN_LUMINANCE ? min(l, MAX_LUMINANCE) : MIN_LUMINANCE;
+		}
+	});
+
+	int factor = spec.previewSize > 0 ? max(1, int(ceil(max(w, h) / float(spec.previewSize)))) : 1;
+	Plane logL = (factor > 1 ? boxDownsampled(L, factor) : L).unaryExpr([](float l) {return fastLog2(l);});
+
+	Plane gain;
+	AtomicProgress opProgress(progress, 0.9f);
+	switch (spec.op)
+	{
+		case LocalTonemapSpec::REINHARD:    gain = reinhardGain(logL, spec, float(factor), opProgress); break;
+		case LocalTonemapSpec::DURAND:      gain = durandGain(logL, spec, opProgress); break;
+		default:                            gain = localLaplacianGain(logL, spec, opProgress); break;
+	}
+	if (factor > 1)
+		gain = resized(gain, w, h);
+
+	// scale the colors by the gain, and change their saturation relative to the luminance
+	HDRImage result(w, h);
+	AtomicProgress applyProgress(progress, 0.1f);
+	applyProgress.setNumSteps(h);
+	parallel_for(0, h, [&](int y)
+	{
+		for (int x = 0; x < w; ++x)
+		{
+			const Color4 & c = image(x, y);
+			float g = fastExp2(gain(x, y));
+			if (spec.saturation == 1.f)
+				result(x, y) = Color4(c.r * g, c.g * g, c.b * g, c.a);
+			else
+			{
+				float l = L(x, y), ld = l * g;
+				result(x, y) = Color4(ld * fastPow(max(c.r / l, 0.f), spec.saturation),
+				                      ld * fastPow(max(c.g / l, 0.f), spec.saturation),
+				                      ld * fastPow(max(c.b / l, 0.f), spec.saturation), c.a);
+			}
+		}
+		++applyProgress;
+	});
+
+	spdlog::get("console")->debug("{} of a {}x{} image took: {} seconds.", spec.description(), w, h,
+	                              (timer.elapsed()/1000.f));
+	return result;
+}
@@ -0,0 +1,66 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <string>                // for string
+#include <vector>                // for vector
+#include "HDRImage.h"            // for HDRImage
+#include "Progress.h"            // for AtomicProgress
+
+
+//! The parameters of the local tone mapping operators of locallyTonemapped()
+struct LocalTonemapSpec
+{
+	enum Operator
+	{
+		REINHARD = 0,       ///< The photographic operator of Reinhard et al. [2002], with automatic dodging and burning
+		DURAND,             ///< The base/detail decomposition of Durand and Dorsey [2002]
+		LOCAL_LAPLACIAN     ///< The local Laplacian filter of Paris et al. [2011]
+	};
+
+	Operator op = REINHARD;
+
+	// REINHARD
+	float key = 0.18f;              ///< The value the log-average luminance is mapped to
+	float sharpening = 8.f;         ///< The sharpening parameter phi of the scale selection
+	float threshold = 0.05f;        ///< The threshold epsilon of the scale selection
+
+	// DURAND
+	float contrast = 5.f;           ///< The contrast of the base layer after compression, in stops
+	float sigmaSpatial = 0.02f;     ///< The spatial standard deviation, as a fraction of the image size
+
+	// DURAND and LOCAL_LAPLACIAN
+	float sigmaRange = 1.3f;        ///< The range standard deviation, or the size of details, in stops
+
+	// LOCAL_LAPLACIAN
+	float detail = 1.f;             ///< The exponent alpha applied to details: below 1 enhances them
+	float compression = 0.3f;       ///< The factor beta applied to edges: below 1 compresses the range
+
+	float saturation = 1.f;         ///< The exponent of the ratio between the colors and the luminance
+	/*!
+	 * If positive, the local adaptation is computed on a copy of the luminance downsampled to at
+	 * most this many pixels across, and the resulting gains are upsampled to the full image.
+	 */
+	int previewSize = 0;
+
+	static const std::vector<std::string> & operatorNames();
+	std::string description() const;
+};
+
+
+/*!
+ * @brief Compress the dynamic range of \a image with a local tone mapping operator.
+ *
+ * The operators act on the base-2 logarithm of the luminance and never on full-resolution
+ * neighborhoods: Reinhard's scale selection reads a Gaussian pyramid, Durand's bilateral filter
+ * is computed in a bilateral grid [Paris and Durand 2006], and the local Laplacian filter uses
+ * the sampled remapping of Aubry et al. [2014]. Each pixel's color is then scaled by the ratio of
+ * the new and old luminance, raised to \a spec.saturation relative to the luminance. Alpha is
+ * unchanged. The result is display-referred, with white at 1.
+ */
+HDRImage locallyTonemapped(const HDRImage & image, const LocalTonemapSpec & spec,
+                           AtomicProgress progress = AtomicProgress());
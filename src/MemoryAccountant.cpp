@@ -0,0 +1,179 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "MemoryAccountant.h"
+#include <algorithm>             // for max
+#include <spdlog/fmt/fmt.h>
+
+using namespace std;
+
+
+string formatBytes(uint64_t bytes)
+{
+	static const char * units[] = {"B", "KB", "MB", "GB", "TB"};
+	double value = double(bytes);
+	int unit = 0;
+	while (value >= 1024.0 && unit < 4)
+	{
+		value /= 1024.0;
+		++unit;
+	}
+	return unit == 0 ? fmt::format("{} B", bytes) : fmt::format("{:.1f} {}", value, units[unit]);
+}
+
+
+const vector<string> & MemoryAccountant::categoryNames()
+{
+	static const vector<string> names =
+		{
+			"image",
+			"history",
+			"histogram",
+			"texture",
+			"cache",
+			"working"
+		};
+	return names;
+}
+
+MemoryAccountant & MemoryAccountant::global()
+{
+	// never destroyed, so that owners with static storage, like the fusion cache of the edit panel,
+	// can still remove themselves at exit
+	static MemoryAccountant * accountant = new MemoryAccountant;
+	return *accountant;
+}
+
+void MemoryAccountant::set(const void * owner, Category category, uint64_t bytes)
+{
+	lock_guard<mutex> lock(m_mutex);
+	update(owner, category, bytes);
+}
+
+void MemoryAccountant::add(const void * owner, Category category, int64_t bytes)
+{
+	// hold the lock across the read and the update so concurrent additions are not lost
+	lock_guard<mutex> lock(m_mutex);
+	uint64_t current = usage(owner)[category];
+	update(owner, category, bytes < 0 && uint64_t(-bytes) > current ? 0 : current + bytes);
+}
+
+void MemoryAccountant::remove(const void * owner)
+{
+	lock_guard<mutex> lock(m_mutex);
+	auto it = m_owners.find(owner);
+	if (it == m_owners.end())
+		return;
+
+	for (int c = 0; c < NUM_CATEGORIES; ++c)
+	{
+		m_totals[c] -= it->second[c];
+		m_total -= it->second[c];
+	}
+	m_owners.erase(it);
+}
+
+uint64_t MemoryAccountant::bytes(const void * owner, Category category) const
+{
+	lock_guard<mutex> lock(m_mutex);
+	auto it = m_owners.find(owner);
+	return it == m_owners.end() ? 0 : it->second[category];
+}
+
+uint64_t MemoryAccountant::bytes(const void * owner) const
+{
+	lock_guard<mutex> lock(m_mutex);
+	auto it = m_owners.find(owner);
+	uint64_t sum = 0;
+	if (it != m_owners.end())
+		for (auto b : it->second)
+			sum += b;
+	return sum;
+}
+
+uint64_t MemoryAccountant::total(Category category) const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_totals[category];
+}
+
+uint64_t MemoryAccountant::total() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_total;
+}
+
+uint64_t MemoryAccountant::peak(Category category) const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_peaks[category];
+}
+
+uint64_t MemoryAccountant::peak() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_peak;
+}
+
+size_t MemoryAccountant::numOwners() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_owners.size();
+}
+
+void MemoryAccountant::setBudget(uint64_t bytes)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_budget = bytes;
+}
+
+uint64_t MemoryAccountant::budget() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_budget;
+}
+
+bool MemoryAccountant::overBudget() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_budget && m_total > m_budget;
+}
+
+MemoryAccountant::Usage & MemoryAccountant::usage(const void * owner)
+{
+	auto & usage = m_owners[owner];
+	if (usage.empty())
+		usage.assign(NUM_CATEGORIES, 0);
+	return usage;
+}
+
+void MemoryAccountant::update(const void * owner, Category category, uint64_t bytes)
+{
+	auto & current = usage(owner)[category];
+	m_totals[category] += bytes - current;
+	m_total += bytes - current;
+	current = bytes;
+
+	m_peaks[category] = max(m_peaks[category], m_totals[category]);
+	m_peak = max(m_peak, m_total);
+}
+
+string MemoryAccountant::summary(bool peaks) const
+{
+	lock_guard<mutex> lock(m_mutex);
+	string out = fmt::format("{} total", formatBytes(m_total));
+	if (peaks)
+		out += fmt::format(" ({} peak)", formatBytes(m_peak));
+	for (int c = 0; c < NUM_CATEGORIES; ++c)
+	{
+		if (!m_totals[c] && !(peaks && m_peaks[c]))
+			continue;
+		out += fmt::format(", {} {}", formatBytes(m_totals[c]), categoryNames()[c]);
+		if (peaks)
+			out += fmt::format(" ({} peak)", formatBytes(m_peaks[c]));
+	}
+	return out;
+}
@@ -0,0 +1,121 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <cstdint>               // for uint64_t, int64_t
+#include <map>                   // for map
+#include <mutex>                 // for mutex
+#include <string>                // for string
+#include <vector>                // for vector
+
+
+//! Format a number of bytes with a binary unit, e.g. "12.3 MB"
+std::string formatBytes(uint64_t bytes);
+
+
+/*!
+ * @brief Thread-safe record of the memory held by each image, broken down by category.
+ *
+ * Owners (usually the address of a GLImage, or of a cache in hdrbatch) report their current
+ * usage with set() or add(), and remove() themselves when destroyed. The accountant keeps
+ * per-category totals and their peaks, and compares the total against an optional budget.
+ */
+class MemoryAccountant
+{
+public:
+	enum Category : int
+	{
+		IMAGE = 0,              ///< Pixel data of the current image
+		HISTORY,                ///< Undo/redo snapshots
+		HISTOGRAM,              ///< Statistics and histograms
+		TEXTURE,                ///< GPU textures, including their mipmaps
+		CACHE,                  ///< Decoded images kept for reuse
+		WORKING,                ///< Temporaries of images being processed
+		NUM_CATEGORIES
+	};
+
+	static const std::vector<std::string> & categoryNames();
+
+	//! The accountant shared by the whole process, which is never destroyed
+	static MemoryAccountant & global();
+
+	//! Set the bytes held by \a owner in \a category
+	void set(const void * owner, Category category, uint64_t bytes);
+
+	//! Add \a bytes (which may be negative) to the bytes held by \a owner in \a category
+	void add(const void * owner, Category category, int64_t bytes);
+
+	//! Forget everything held by \a owner
+	void remove(const void * owner);
+
+	uint64_t bytes(const void * owner, Category category) const;
+	uint64_t bytes(const void * owner) const;
+
+	uint64_t total(Category category) const;
+	uint64_t total() const;
+
+	//! The largest value total(category) has had
+	uint64_t peak(Category category) const;
+
+	//! The largest value total() has had
+	uint64_t peak() const;
+
+	size_t numOwners() const;
+
+	//! Set a budget for total() in bytes, or 0 for none
+	void setBudget(uint64_t bytes);
+	uint64_t budget() const;
+	bool overBudget() const;
+
+	/*!
+	 * @brief A one-line description of the current and peak use of each non-empty category.
+	 * @param peaks		Whether to include the peaks
+	 */
+	std::string summary(bool peaks = false) const;
+
+private:
+	using Usage = std::vector<uint64_t>;
+
+	// these assume that m_mutex is held
+	Usage & usage(const void * owner);
+	void update(const void * owner, Category category, uint64_t bytes);
+
+	mutable std::mutex m_mutex;
+	std::map<const void *, Usage> m_owners;
+	Usage m_totals = Usage(NUM_CATEGORIES, 0);
+	Usage m_peaks = Usage(NUM_CATEGORIES, 0);
+	uint64_t m_total = 0;
+	uint64_t m_peak = 0;
+	uint64_t m_budget = 0;
+};
+
+
+//! Adds bytes to one category of an owner for the lifetime of the charge
+class MemoryCharge
+{
+public:
+	MemoryCharge(MemoryAccountant & accountant, const void * owner, MemoryAccountant::Category category,
+	             uint64_t bytes) :
+		m_accountant(accountant), m_owner(owner), m_category(category), m_bytes(bytes)
+	{
+		m_accountant.add(m_owner, m_category, int64_t(m_bytes));
+	}
+
+	~MemoryCharge()
+	{
+		m_accountant.add(m_owner, m_category, -int64_t(m_bytes));
+	}
+
+	MemoryCharge(const MemoryCharge &) = delete;
+	MemoryCharge & operator=(const MemoryCharge &) = delete;
+
+private:
+	MemoryAccountant & m_accountant;
+	const void * m_owner;
+	MemoryAccountant::Category m_category;
+	uint64_t m_bytes;
+};
@@ -0,0 +1,96 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "MemoryPanel.h"
+#include "GLImage.h"
+#include "ImageListPanel.h"
+#include "MemoryAccountant.h"
+#include <nanogui/label.h>
+#include <nanogui/layout.h>
+#include <nanogui/opengl.h>
+
+using namespace std;
+
+namespace
+{
+
+// how often to poll the accountant, in seconds
+const double UPDATE_INTERVAL = 0.5;
+
+Label * addRow(Widget * grid, AdvancedGridLayout * agl, const string & caption, const string & font = "sans")
+{
+	agl->appendRow(0);
+	agl->setAnchor(new Label(grid, caption, font), AdvancedGridLayout::Anchor(0, agl->rowCount()-1));
+	auto label = new Label(grid, "", font);
+	agl->setAnchor(label, AdvancedGridLayout::Anchor(2, agl->rowCount()-1, Alignment::Maximum));
+	return label;
+}
+
+} // namespace
+
+
+MemoryPanel::MemoryPanel(Widget *parent, ImageListPanel * imagesPanel)
+	: Widget(parent), m_imagesPanel(imagesPanel)
+{
+	setId("memory panel");
+	setLayout(new BoxLayout(Orientation::Vertical, Alignment::Fill, 5, 5));
+
+	auto grid = new Widget(this);
+	auto agl = new AdvancedGridLayout({0, 10, 0}, {});
+	grid->setLayout(agl);
+	agl->setColStretch(2, 1.0f);
+
+	m_totalLabel = addRow(grid, agl, "All images:", "sans-bold");
+	for (auto & name : MemoryAccountant::categoryNames())
+		m_totalLabels.push_back(addRow(grid, agl, "  " + name));
+	m_peakLabel = addRow(grid, agl, "  peak");
+	m_budgetLabel = addRow(grid, agl, "  budget");
+
+	agl->appendRow(10);
+	m_currentLabel = addRow(grid, agl, "Current image:", "sans-bold");
+	for (auto & name : MemoryAccountant::categoryNames())
+		m_currentLabels.push_back(addRow(grid, agl, "  " + name));
+
+	setTooltip("Memory used by the open images, including undo history, histograms, "
+	           "and GPU textures with their mipmaps.");
+}
+
+
+void MemoryPanel::updateLabels()
+{
+	auto & accountant = MemoryAccountant::global();
+	for (int i = 0; i < m_imagesPanel->numImages(); ++i)
+		m_imagesPanel->image(i)->updateMemoryUsage();
+
+	m_totalLabel->setCaption(formatBytes(accountant.total()));
+	for (int c = 0; c < MemoryAccountant::NUM_CATEGORIES; ++c)
+		m_totalLabels[c]->setCaption(formatBytes(accountant.total(MemoryAccountant::Category(c))));
+	m_peakLabel->setCaption(formatBytes(accountant.peak()));
+
+	bool overBudget = accountant.overBudget();
+	m_budgetLabel->setCaption(accountant.budget() ? formatBytes(accountant.budget()) : "none");
+	m_budgetLabel->setColor(overBudget ? Color(255, 80, 80, 255) : mTheme->mTextColor);
+
+	auto img = m_imagesPanel->currentImage();
+	const void * owner = img.get();
+	m_currentLabel->setCaption(owner ? formatBytes(accountant.bytes(owner)) : "-");
+	for (int c = 0; c < MemoryAccountant::NUM_CATEGORIES; ++c)
+		m_currentLabels[c]->setCaption(owner ? formatBytes(accountant.bytes(owner, MemoryAccountant::Category(c))) : "-");
+}
+
+
+void MemoryPanel::draw(NVGcontext *ctx)
+{
+	// only poll while the panel is shown
+	double now = glfwGetTime();
+	if (visible() && now - m_lastUpdate > UPDATE_INTERVAL)
+	{
+		updateLabels();
+		m_lastUpdate = now;
+	}
+
+	Widget::draw(ctx);
+}
@@ -0,0 +1,40 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <nanogui/widget.h>
+#include <vector>
+#include "Fwd.h"
+
+using namespace nanogui;
+
+/*!
+ * A side-panel section listing the memory held by all open images in each
+ * MemoryAccountant category, the peak, the budget, and the share of the current image.
+ */
+class MemoryPanel : public Widget
+{
+public:
+	MemoryPanel(Widget *parent, ImageListPanel * imagesPanel);
+
+	void draw(NVGcontext *ctx) override;
+
+private:
+	void updateLabels();
+
+	ImageListPanel * m_imagesPanel = nullptr;
+	std::vector<Label*> m_totalLabels;      ///< One per category
+	std::vector<Label*> m_currentLabels;    ///< One per category
+	Label * m_totalLabel = nullptr;
+	Label * m_currentLabel = nullptr;
+	Label * m_peakLabel = nullptr;
+	Label * m_budgetLabel = nullptr;
+	double m_lastUpdate = -1.0;
+
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
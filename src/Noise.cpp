@@ -0,0 +1,178 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "Noise.h"
+#include <cmath>                 // for sqrt, log, cos, sin, exp, round
+#include <stdexcept>             // for invalid_argument
+#include "ParallelFor.h"         // for parallel_for
+#include "Timer.h"               // for Timer
+#include <spdlog/spdlog.h>
+
+using namespace std;
+
+namespace
+{
+
+const uint32_t PHILOX_M0 = 0xD2511F53u, PHILOX_M1 = 0xCD9E8D57u;
+const uint32_t PHILOX_W0 = 0x9E3779B9u, PHILOX_W1 = 0xBB67AE85u;
+
+inline void mulhilo(uint32_t a, uint32_t b, uint32_t & hi, uint32_t & lo)
+{
+	uint64_t product = uint64_t(a) * b;
+	hi = uint32_t(product >> 32);
+	lo = uint32_t(product);
+}
+
+// sample a Poisson distribution with mean lambda, given a uniform u and a standard normal z
+float samplePoisson(float lambda, float u, float z)
+{
+	if (std::isnan(lambda))
+		return lambda;
+	if (lambda <= 0.f)
+		return 0.f;
+
+	// for large means the normal approximation is accurate, and inversion would take long
+	if (lambda >= 64.f)
+		return max(0.f, round(lambda + sqrt(lambda) * z));
+
+	// invert the cumulative distribution function
+	double p = exp(-double(lambda)), cdf = p;
+	int k = 0;
+	while (u > cdf && k < 1024)
+	{
+		++k;
+		p *= lambda / k;
+		cdf += p;
+	}
+	return float(k);
+}
+
+} // namespace
+
+
+void Philox::generate(const uint32_t counter[4], uint32_t out[4]) const
+{
+	uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	uint32_t k0 = m_key[0], k1 = m_key[1];
+	for (int round = 0; round < 10; ++round)
+	{
+		uint32_t hi0, lo0, hi1, lo1;
+		mulhilo(PHILOX_M0, c0, hi0, lo0);
+		mulhilo(PHILOX_M1, c2, hi1, lo1);
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+
+const vector<string> & NoiseSpec::distributionNames()
+{
+	static const vector<string> names =
+		{
+			"Uniform",
+			"Gaussian",
+			"Poisson"
+		};
+	return names;
+}
+
+string NoiseSpec::description() const
+{
+	string kind = monochrome ? "monochrome " : "";
+	switch (distribution)
+	{
+		case UNIFORM:   return fmt::format("{}uniform noise in [{:g},{:g}] (seed {})", kind, a, b, seed);
+		case GAUSSIAN:  return fmt::format("{}Gaussian noise with mean {:g} and standard deviation {:g} (seed {})",
+		                                   kind, a, b, seed);
+		default:        return fmt::format("{}Poisson noise with {:g} photons per unit intensity (seed {})", kind, a, seed);
+	}
+}
+
+
+HDRImage noisy(const HDRImage & image, const NoiseSpec & spec, uint32_t stream, AtomicProgress progress)
+{
+	if (spec.distribution == NoiseSpec::POISSON && !(spec.a > 0.f))
+		throw invalid_argument("Poisson noise needs a positive number of photons per unit intensity.");
+
+	Timer timer;
+	Philox rng(spec.seed);
+	int w = image.width();
+	HDRImage result(w, image.height());
+
+	// Poisson noise needs both uniform and normal variates, so it uses two blocks per pixel
+	int numBlocks = spec.distribution == NoiseSpec::POISSON ? 2 : 1;
+
+	progress.setNumSteps(image.height());
+	parallel_for(0, image.height(), [&](int y)
+	{
+		// first generate the random words of the whole row, then transform them into noise.
+		// The generation and Box-Muller loops have no data-dependent branches, so they vectorize well
+		vector<uint32_t> bits(4 * size_t(numBlocks) * w);
+		for (int x = 0; x < w; ++x)
+		{
+			uint64_t index = uint64_t(y) * w + x;
+			for (int b = 0; b < numBlocks; ++b)
+			{
+				uint32_t counter[4] = {uint32_t(index), uint32_t(index >> 32), stream, uint32_t(b)};
+				rng.generate(counter, &bits[4 * (size_t(x) * numBlocks + b)]);
+			}
+		}
+
+		// four uniform, and for Gaussian and Poisson noise, four standard normal values per pixel
+		vector<float> u(4 * size_t(w)), z(4 * size_t(w));
+		for (size_t i = 0; i < u.size(); ++i)
+			u[i] = Philox::toUnitFloat(bits[numBlocks * (i & ~size_t(3)) + (i & 3)]);
+
+		if (spec.distribution != NoiseSpec::UNIFORM)
+		{
+			// Box-Muller transform, using the second block's words for Poisson noise
+			size_t offset = numBlocks == 2 ? 4 : 0;
+			for (size_t i = 0; i < z.size(); i += 2)
+			{
+				size_t j = numBlocks * (i & ~size_t(3)) + offset + (i & 3);
+				float r = sqrt(-2.f * log(1.f - Philox::toUnitFloat(bits[j])));
+				float theta = float(2.0 * M_PI) * Philox::toUnitFloat(bits[j + 1]);
+				z[i] = r * cos(theta);
+				z[i + 1] = r * sin(theta);
+			}
+		}
+
+		for (int x = 0; x < w; ++x)
+		{
+			const Color4 & c = image(x, y);
+			Color4 n = c;
+			for (int ch = 0; ch < 3; ++ch)
+			{
+				size_t i = 4 * size_t(x) + (spec.monochrome ? 0 : ch);
+				switch (spec.distribution)
+				{
+					case NoiseSpec::UNIFORM:
+						n[ch] = c[ch] + spec.a + (spec.b - spec.a) * u[i];
+						break;
+					case NoiseSpec::GAUSSIAN:
+						n[ch] = c[ch] + spec.a + spec.b * z[i];
+						break;
+					default:
+						n[ch] = samplePoisson(c[ch] * spec.a, u[i], z[i]) / spec.a;
+						break;
+				}
+			}
+			result(x, y) = n;
+		}
+		++progress;
+	});
+
+	spdlog::get("console")->debug("Generating {} took: {} seconds.", spec.description(), (timer.elapsed() / 1000.f));
+	return result;
+}
@@ -0,0 +1,76 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <cstdint>               // for uint32_t, uint64_t
+#include <string>                // for string
+#include <vector>                // for vector
+#include "HDRImage.h"            // for HDRImage
+#include "Progress.h"            // for AtomicProgress
+
+
+/*!
+ * @brief The Philox4x32-10 counter-based random number generator of Salmon et al. [2011].
+ *
+ * Unlike a sequential generator, each output block is a pure function of a 128-bit counter
+ * and a 64-bit key, so random numbers can be generated for any element of a computation
+ * independently, in any order and on any thread, and always come out the same.
+ */
+class Philox
+{
+public:
+	explicit Philox(uint64_t seed) : m_key{uint32_t(seed), uint32_t(seed >> 32)} {}
+
+	//! Write the four random 32-bit words of the block at \a counter to \a out
+	void generate(const uint32_t counter[4], uint32_t out[4]) const;
+
+	//! Map a random 32-bit word to a float uniformly distributed in [0,1)
+	static float toUnitFloat(uint32_t bits)  {return float(bits >> 8) * (1.f / 16777216.f);}
+
+private:
+	uint32_t m_key[2];
+};
+
+
+//! The parameters of the noise generated by noisy()
+struct NoiseSpec
+{
+	enum Distribution
+	{
+		UNIFORM = 0,
+		GAUSSIAN,
+		POISSON
+	};
+
+	Distribution distribution = GAUSSIAN;
+	/*!
+	 * The meaning of the parameters depends on the distribution:
+	 *  - UNIFORM:  values uniformly distributed in [a,b] are added to the image
+	 *  - GAUSSIAN: Gaussian values with mean a and standard deviation b are added to the image
+	 *  - POISSON:  shot noise. Each value v is replaced with n/a, where n is Poisson distributed
+	 *              with mean v*a, so a is the number of photons per unit intensity. b is unused.
+	 */
+	float a = 0.f, b = 1.f;
+	bool monochrome = false;    ///< Use the same random value for the red, green and blue channels
+	uint64_t seed = 0;
+
+	static const std::vector<std::string> & distributionNames();
+	std::string description() const;
+};
+
+
+/*!
+ * @brief Add random noise to the color channels of \a image, leaving alpha unchanged.
+ *
+ * The noise of each pixel is generated from its own Philox counter, made of the pixel's
+ * index and \a stream, with \a spec.seed as the key. The rows are generated in parallel,
+ * but the result only depends on the seed, stream and image size, so it is bit-identical
+ * regardless of the number of threads. Use different streams to get independent noise for
+ * several images generated with the same seed.
+ */
+HDRImage noisy(const HDRImage & image, const NoiseSpec & spec, uint32_t stream = 0,
+               AtomicProgress progress = AtomicProgress());
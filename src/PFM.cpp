@@ -34,6 +34,16 @@ float reinterpretAsHostEndian(float f, bool bigEndian)
 	return ret;
 }
 
+// seek to a 64-bit offset, as files of several GiB are past what long reaches on Windows
+int seek64(FILE *f, int64_t offset)
+{
+#if defined(_WIN32)
+	return _fseeki64(f, offset, SEEK_SET);
+#else
+	return fseeko(f, off_t(offset), SEEK_SET);
+#endif
+}
+
 } // end namespace
 
 bool isPFMImage(const char *filename) noexcept
@@ -71,7 +81,8 @@ bool isPFMImage(const char *filename) noexcept
 	}
 	catch (const exception & e)
 	{
-		fclose(f);
+		if (f)
+			fclose(f);
 		return false;
 	}
 }
@@ -80,7 +91,6 @@ float * loadPFMImage(const char *filename, int *width, int *height, int *numChan
 {
 	float * data = nullptr;
 	FILE *f = nullptr;
-	int numInputsRead = 0;
 
 	try
 	{
@@ -89,55 +99,64 @@ float * loadPFMImage(const char *filename, int *width, int *height, int *numChan
 		if (!f)
 			throw runtime_error("loadPFMImage: Error opening");
 
-		char buffer[1024];
-		numInputsRead = fscanf(f, "%2s\n", buffer);
-		if (numInputsRead != 1)
-			throw runtime_error("loadPFMImage: Could not read number of channels in header");
-
-	    if (strcmp(buffer, "Pf") == 0)
-	        *numChannels = 1;
-	    else if (strcmp(buffer, "PF") == 0)
-	        *numChannels = 3;
-	    else
-			throw runtime_error("loadPFMImage: Cannot deduce number of channels from header");
-
-
-		numInputsRead = fscanf(f, "%d%d", width, height);
-		if (numInputsRead != 2 || *width <= 0 || *height <= 0)
-	    	throw runtime_error("loadPFMImage: Invalid image width or height");
-
 		float scale;
-		numInputsRead = fscanf(f, "%f", &scale);
-		if (numInputsRead != 1)
-	    	throw runtime_error("loadPFMImage: Invalid file endianness. Big-Endian files not supported");
+		readPFMHeader(f, width, height, numChannels, &scale);
 
-	    bool bigEndian = scale > 0.0f;
-
-		data = new float[(*width) * (*height) * 3];
-
-		if (fread(data, 1, 1, f) != 1)
-			throw runtime_error("loadPFMImage: Unknown error");
-
-		size_t numFloats = static_cast<size_t>((*width) * (*height) * (*numChannels));
-		if (fread(data, sizeof(float), numFloats, f) != numFloats)
-			throw runtime_error("loadPFMImage: Could not read all pixel data");
-
-		// multiply data by scale factor
-		scale = fabsf(scale);
-        for (size_t i = 0; i < numFloats; ++i)
-            data[i] = scale*reinterpretAsHostEndian(data[i], bigEndian);
+		data = new float[size_t(*width) * size_t(*height) * size_t(*numChannels)];
+		readPFMRows(f, ftell(f), *width, *numChannels, scale, 0, *height, data);
 
 		fclose(f);
 		return data;
 	}
 	catch (const runtime_error & e)
 	{
-		fclose(f);
+		if (f)
+			fclose(f);
 		delete [] data;
 		throw runtime_error(string(e.what()) + " in file '" + filename + "'");
 	}
 }
 
+void readPFMHeader(FILE *f, int *width, int *height, int *numChannels, float *scale)
+{
+	char buffer[1024];
+	if (fscanf(f, "%2s\n", buffer) != 1)
+		throw runtime_error("readPFMHeader: Could not read number of channels in header");
+
+	if (strcmp(buffer, "Pf") == 0)
+		*numChannels = 1;
+	else if (strcmp(buffer, "PF") == 0)
+		*numChannels = 3;
+	else
+		throw runtime_error("readPFMHeader: Cannot deduce number of channels from header");
+
+	if (fscanf(f, "%d%d", width, height) != 2 || *width <= 0 || *height <= 0)
+		throw runtime_error("readPFMHeader: Invalid image width or height");
+
+	if (fscanf(f, "%f", scale) != 1)
+		throw runtime_error("readPFMHeader: Invalid file endianness. Big-Endian files not supported");
+
+	// skip the single whitespace character separating the header from the pixel data
+	if (fgetc(f) == EOF)
+		throw runtime_error("readPFMHeader: Unknown error");
+}
+
+void readPFMRows(FILE *f, int64_t dataOffset, int width, int numChannels, float scale, int y0, int y1, float *data)
+{
+	size_t rowFloats = size_t(width) * numChannels;
+	if (seek64(f, dataOffset + int64_t(y0) * int64_t(rowFloats * sizeof(float))) != 0)
+		throw runtime_error("readPFMRows: Could not seek to scanline");
+
+	size_t numFloats = rowFloats * (y1 - y0);
+	if (fread(data, sizeof(float), numFloats, f) != numFloats)
+		throw runtime_error("readPFMRows: Could not read all pixel data");
+
+	bool bigEndian = scale > 0.0f;
+	scale = fabsf(scale);
+	for (size_t i = 0; i < numFloats; ++i)
+		data[i] = scale*reinterpretAsHostEndian(data[i], bigEndian);
+}
+
 bool writePFMImage(const char *filename, int width, int height, int numChannels, const float *data)
 {
 	FILE *f = fopen(filename, "wb");
@@ -162,14 +181,15 @@ bool writePFMImage(const char *filename, int width, int height, int numChannels,
 
 	fprintf(f, littleEndian ? "-1.0000000\n" : "1.0000000\n");
 
+	bool written = true;
 	if (numChannels == 3 || numChannels == 1)
 	{
-		fwrite(&data[0], width * height * sizeof(float) * numChannels, 1, f);
+		written = fwrite(&data[0], size_t(width) * height * sizeof(float) * numChannels, 1, f) == 1;
 	}
 	else if (numChannels == 4)
 	{
-		for (int i = 0; i < width * height * 4; i += 4)
-			fwrite(&data[i], sizeof(float) * 3, 1, f);
+		for (size_t i = 0; written && i < size_t(width) * height * 4; i += 4)
+			written = fwrite(&data[i], sizeof(float) * 3, 1, f) == 1;
 	}
 	else
 	{
@@ -179,6 +199,12 @@ bool writePFMImage(const char *filename, int width, int height, int numChannels,
 		return false;
 	}
 
-	fclose(f);
+	// the header is only checked here, and fclose flushes the buffered data, so a full disk may only show then
+	written = !ferror(f) && written;
+	if (fclose(f) != 0 || !written)
+	{
+		cerr << "writePFMImage: Error writing file '" << filename << "'" << endl;
+		return false;
+	}
 	return true;
 }
@@ -6,6 +6,14 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstdio>
+
 bool isPFMImage(const char *filename) noexcept;
 bool writePFMImage(const char *filename, int width, int height, int numChannels, const float *data);
 float * loadPFMImage(const char *filename, int *width, int *height, int *numChannels);
+
+//! Read the header of the PFM file \a f, leaving \a f positioned at the start of the pixel data.
+void readPFMHeader(FILE *f, int *width, int *height, int *numChannels, float *scale);
+//! Read scanlines [y0,y1) from the PFM file \a f, whose pixel data starts at \a dataOffset.
+void readPFMRows(FILE *f, int64_t dataOffset, int width, int numChannels, float scale, int y0, int y1, float *data);
@@ -5,27 +5,61 @@
 //
 
 #include "ParallelFor.h"
+#include <cstdint>
 #include <future>
 #include <vector>
+#include "Trace.h"
 
 using namespace std;
 
+namespace
+{
+// per-thread limit on the number of threads used by parallel_for (0 means no limit)
+thread_local size_t t_maxThreads = 0;
+}
+
+void set_parallel_for_threads(size_t numThreads)
+{
+	t_maxThreads = numThreads;
+}
+
+size_t parallel_for_threads()
+{
+	size_t numCPUs = max(1u, thread::hardware_concurrency());
+	return t_maxThreads ? min(t_maxThreads, numCPUs) : numCPUs;
+}
+
 // adapted from http://www.andythomason.com/2016/08/21/c-multithreading-an-effective-parallel-for-loop/
 // license unknown, presumed public domain
 void parallel_for(int begin, int end, int step, function<void(int, size_t)> body, bool serial)
 {
+	TraceZone zone("parallel_for");
+
 	atomic<int> nextIndex;
 	nextIndex = begin;
 
-	auto policy = serial ? std::launch::deferred : std::launch::async;
-	size_t numCPUs = thread::hardware_concurrency();
+	// no more threads than iterations, so that the idle ones do not take a share of the limit below
+	size_t numIterations = end > begin ? size_t((int64_t(end) - begin + step - 1) / step) : 1;
+	size_t numCPUs = serial ? 1 : max(size_t(1), min(parallel_for_threads(), numIterations));
+	auto policy = numCPUs == 1 ? std::launch::deferred : std::launch::async;
+
+	// the workers split the caller's limit among their own nested loops, so a limited loop never
+	// uses more threads in total than its limit allows
+	size_t nestedThreads = t_maxThreads ? max(size_t(1), parallel_for_threads() / numCPUs) : 0;
+
 	vector< future<void> > futures(numCPUs);
 	for (size_t cpu = 0; cpu != numCPUs; ++cpu)
 	{
 		futures[cpu] = async(
 			policy,
-			[cpu, &nextIndex, end, step, &body]()
+			[cpu, &nextIndex, end, step, &body, policy, nestedThreads]()
 			{
+				TraceZone workerZone("parallel_for worker");
+
+				// deferred workers run on the calling thread, which keeps its own limit
+				if (policy == std::launch::async)
+					set_parallel_for_threads(nestedThreads);
+
 				// just iterate, grabbing the next available atomic index in the range [begin, end)
 				while (true)
 				{
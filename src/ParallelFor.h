@@ -6,8 +6,24 @@
 
 #pragma once
 
+#include <cstddef>
 #include <functional>
 
+/*!
+ * @brief 			Limits the number of threads that parallel_for uses when called from the current thread
+ *
+ * The limit also covers parallel_for loops nested in the body of a limited loop: its worker threads
+ * split the limit among themselves.
+ *
+ * @param numThreads	The maximum number of threads, or 0 to use all available hardware threads
+ */
+void set_parallel_for_threads(size_t numThreads);
+
+/*!
+ * @brief	The number of threads that parallel_for uses when called from the current thread
+ */
+size_t parallel_for_threads();
+
 /*!
  * @brief 			Executes the body of a for loop in parallel
  * @param begin		The starting index of the for loop
@@ -29,7 +45,7 @@ void parallel_for(int begin, int end, int step, std::function<void(int)> body, b
 // license unknown, presumed public domain
 inline void parallel_for(int begin, int end, std::function<void(int, size_t)> body, bool serial = false)
 {
-	parallel_for(begin, end, 1, body);
+	parallel_for(begin, end, 1, body, serial);
 }
 
 inline void parallel_for(int begin, int end, std::function<void(int)> body, bool serial = false)
@@ -0,0 +1,380 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+#pragma once
+
+#include <algorithm>                // for max
+#include <condition_variable>       // for condition_variable
+#include <deque>                    // for deque
+#include <exception>                // for exception_ptr
+#include <functional>               // for function
+#include <map>                      // for map
+#include <mutex>                    // for mutex, unique_lock
+#include <stdexcept>                // for runtime_error
+#include <thread>                   // for thread
+#include <vector>                   // for vector
+
+
+/*!
+ * A thread-safe FIFO queue with a fixed capacity.
+ *
+ * push blocks while the queue is full, and pop blocks while it is empty.
+ * Once the queue is closed, push fails and pop drains the remaining items.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : m_capacity(std::max(size_t(1), capacity)) {}
+
+	//! Add an item to the back of the queue. Returns false if the queue has been closed.
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notFull.wait(lock, [this]{return m_closed || m_items.size() < m_capacity;});
+		if (m_closed)
+			return false;
+		m_items.push_back(std::move(item));
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	//! Remove the item at the front of the queue. Returns false once the queue is closed and empty.
+	bool pop(T & item)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notEmpty.wait(lock, [this]{return m_closed || !m_items.empty();});
+		if (m_items.empty())
+			return false;
+		item = std::move(m_items.front());
+		m_items.pop_front();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	//! Stop accepting new items and wake up all waiting threads.
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+		m_notEmpty.notify_all();
+		m_notFull.notify_all();
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_notEmpty, m_notFull;
+	std::deque<T> m_items;
+	size_t m_capacity;
+	bool m_closed = false;
+};
+
+
+/*!
+ * Produces the items [0,count) on several worker threads, but hands them out in index order.
+ *
+ * At most \a window items are produced ahead of the consumer. Each item is charged
+ * a number of bytes (computed by \a bytes) against a soft memory cap: once the cap is
+ * exceeded, workers stop starting new items until the consumer calls release().
+ * The item the consumer is waiting on is always allowed to proceed, so this cannot deadlock.
+ */
+template <typename T>
+class OrderedPrefetcher
+{
+public:
+	using ProduceFunc = std::function<T(size_t index)>;
+	using SizeFunc = std::function<size_t(const T & item)>;
+
+	OrderedPrefetcher(size_t count, size_t numThreads, size_t window, size_t maxBytes,
+	                  ProduceFunc produce, SizeFunc bytes) :
+		m_count(count), m_window(std::max(size_t(1), window)), m_maxBytes(maxBytes),
+		m_produce(produce), m_bytesOf(bytes)
+	{
+		numThreads = std::max(size_t(1), std::min(numThreads, count));
+		for (size_t t = 0; t < numThreads; ++t)
+			m_threads.emplace_back([this]{run();});
+	}
+
+	~OrderedPrefetcher()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cv.notify_all();
+		for (auto & t : m_threads)
+			t.join();
+	}
+
+	/*!
+	 * Wait for the next item in index order.
+	 *
+	 * @return false once all items have been handed out. Rethrows any exception thrown while producing.
+	 */
+	bool pop(T & item)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_nextOut >= m_count)
+			return false;
+		m_cv.wait(lock, [this]{return m_error || m_ready.count(m_nextOut);});
+		if (m_error)
+			std::rethrow_exception(m_error);
+
+		auto it = m_ready.find(m_nextOut);
+		item = std::move(it->second);
+		m_ready.erase(it);
+		++m_nextOut;
+		m_cv.notify_all();
+		return true;
+	}
+
+	//! Return \a bytes previously charged to an item, once that item's memory has been freed.
+	void release(size_t bytes)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bytes -= std::min(bytes, m_bytes);
+		}
+		m_cv.notify_all();
+	}
+
+	//! The largest number of bytes that were charged at any one time.
+	size_t peakBytes() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_peakBytes;
+	}
+
+private:
+	void run()
+	{
+		while (true)
+		{
+			size_t i;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv.wait(lock, [this]
+				{
+					return m_stop || m_error || m_nextClaim >= m_count ||
+					       (m_nextClaim < m_nextOut + m_window &&
+					        (m_nextClaim == m_nextOut || m_bytes < m_maxBytes));
+				});
+				if (m_stop || m_error || m_nextClaim >= m_count)
+					return;
+				i = m_nextClaim++;
+			}
+
+			try
+			{
+				T item = m_produce(i);
+				size_t bytes = m_bytesOf(item);
+
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_bytes += bytes;
+				m_peakBytes = std::max(m_peakBytes, m_bytes);
+				m_ready.emplace(i, std::move(item));
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_error = std::current_exception();
+			}
+			m_cv.notify_all();
+		}
+	}
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::vector<std::thread> m_threads;
+	std::map<size_t, T> m_ready;
+	std::exception_ptr m_error;
+
+	size_t m_count, m_window, m_maxBytes;
+	size_t m_nextClaim = 0, m_nextOut = 0;
+	size_t m_bytes = 0, m_peakBytes = 0;
+	bool m_stop = false;
+
+	ProduceFunc m_produce;
+	SizeFunc m_bytesOf;
+};
+
+
+/*!
+ * Lets several threads run a critical section one at a time, in ticket order.
+ *
+ * Each ticket in [0,n) must be passed to run() exactly once. Calling abort() releases
+ * all waiting threads, which then throw instead of running their section.
+ */
+class OrderedSection
+{
+public:
+	//! Wait until it is \a ticket's turn, run \a section, and then let the next ticket through.
+	void run(size_t ticket, const std::function<void()> & section)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [this,ticket]{return m_aborted || m_next == ticket;});
+		if (m_aborted)
+			throw std::runtime_error("Ordered section aborted.");
+
+		try
+		{
+			section();
+		}
+		catch (...)
+		{
+			m_aborted = true;
+			m_cv.notify_all();
+			throw;
+		}
+
+		++m_next;
+		m_cv.notify_all();
+	}
+
+	//! Release all waiting threads.
+	void abort()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_aborted = true;
+		m_cv.notify_all();
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	size_t m_next = 0;
+	bool m_aborted = false;
+};
+
+
+/*!
+ * Admits concurrent jobs while their estimated working sets fit within a memory budget.
+ *
+ * A job is always admitted when no other job is running, so a single job larger
+ * than the budget still makes progress.
+ */
+class MemoryBudget
+{
+public:
+	explicit MemoryBudget(size_t maxBytes) : m_maxBytes(maxBytes) {}
+
+	size_t maxBytes() const {return m_maxBytes;}
+
+	//! Block until \a bytes fit within the budget, and then charge them.
+	void acquire(size_t bytes)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [this,bytes]{return m_jobs == 0 || m_bytes + bytes <= m_maxBytes;});
+		m_bytes += bytes;
+		++m_jobs;
+	}
+
+	//! Return \a bytes charged by a finished job.
+	void release(size_t bytes)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bytes -= std::min(bytes, m_bytes);
+			--m_jobs;
+		}
+		m_cv.notify_all();
+	}
+
+	//! Charges a job's bytes to a MemoryBudget for the lifetime of this object.
+	class Reservation
+	{
+	public:
+		Reservation(MemoryBudget & budget, size_t bytes) : m_budget(budget), m_bytes(bytes)
+		{
+			m_budget.acquire(m_bytes);
+		}
+		~Reservation()
+		{
+			m_budget.release(m_bytes);
+		}
+		Reservation(const Reservation &) = delete;
+		Reservation & operator=(const Reservation &) = delete;
+
+	private:
+		MemoryBudget & m_budget;
+		size_t m_bytes;
+	};
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	size_t m_maxBytes, m_bytes = 0, m_jobs = 0;
+};
+
+
+/*!
+ * A pool of worker threads consuming items from a BoundedQueue.
+ *
+ * The destructor waits for all queued items to be consumed.
+ */
+template <typename T>
+class ConsumerPool
+{
+public:
+	using ConsumeFunc = std::function<void(T & item)>;
+
+	ConsumerPool(size_t numThreads, size_t capacity, ConsumeFunc consume) :
+		m_queue(capacity), m_consume(consume)
+	{
+		for (size_t t = 0; t < std::max(size_t(1), numThreads); ++t)
+			m_threads.emplace_back([this]
+			{
+				T item;
+				while (m_queue.pop(item))
+				{
+					try
+					{
+						m_consume(item);
+					}
+					catch (...)
+					{
+						std::lock_guard<std::mutex> lock(m_mutex);
+						if (!m_error)
+							m_error = std::current_exception();
+					}
+				}
+			});
+	}
+
+	~ConsumerPool()
+	{
+		join();
+	}
+
+	//! Queue an item for consumption, blocking while the queue is full.
+	void push(T item)
+	{
+		m_queue.push(std::move(item));
+	}
+
+	//! Wait for all queued items to be consumed, and rethrow the first exception thrown by a consumer.
+	void finish()
+	{
+		join();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_error)
+			std::rethrow_exception(m_error);
+	}
+
+private:
+	void join()
+	{
+		m_queue.close();
+		for (auto & t : m_threads)
+			if (t.joinable())
+				t.join();
+	}
+
+	BoundedQueue<T> m_queue;
+	ConsumeFunc m_consume;
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::exception_ptr m_error;
+};
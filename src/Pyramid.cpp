@@ -0,0 +1,109 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "Pyramid.h"
+#include <algorithm>             // for min, max
+#include "ParallelFor.h"         // for parallel_for
+
+using namespace std;
+
+// local functions
+namespace
+{
+
+// the 5-tap binomial filter, whose variance is 1
+const float BINOMIAL[5] = {1/16.f, 4/16.f, 6/16.f, 4/16.f, 1/16.f};
+
+inline int clampIndex(int i, int n)
+{
+	return min(max(i, 0), n - 1);
+}
+
+} // namespace
+
+
+Plane pyramidDown(const Plane & in)
+{
+	int w = int(in.rows()), h = int(in.cols());
+	int w2 = (w + 1) / 2, h2 = (h + 1) / 2;
+	Plane tmp(w2, h), out(w2, h2);
+	parallel_for(0, h, [&in,&tmp,w,w2](int y)
+	{
+		for (int x = 0; x < w2; ++x)
+		{
+			float s = 0.f;
+			for (int i = 0; i < 5; ++i)
+				s += BINOMIAL[i] * in(clampIndex(2 * x + i - 2, w), y);
+			tmp(x, y) = s;
+		}
+	});
+	parallel_for(0, h2, [&tmp,&out,h](int y)
+	{
+		out.col(y) = BINOMIAL[0] * tmp.col(clampIndex(2 * y - 2, h)) + BINOMIAL[1] * tmp.col(clampIndex(2 * y - 1, h)) +
+		             BINOMIAL[2] * tmp.col(2 * y) +
+		             BINOMIAL[3] * tmp.col(clampIndex(2 * y + 1, h)) + BINOMIAL[4] * tmp.col(clampIndex(2 * y + 2, h));
+	});
+	return out;
+}
+
+Plane pyramidUp(const Plane & in, int w, int h)
+{
+	int w2 = int(in.rows()), h2 = int(in.cols());
+	Plane tmp(w, h2), out(w, h);
+	parallel_for(0, h2, [&in,&tmp,w,w2](int y)
+	{
+		for (int x = 0; x < w; ++x)
+		{
+			int j = x / 2;
+			tmp(x, y) = x % 2 ? 0.5f * (in(j, y) + in(clampIndex(j + 1, w2), y))
+			                  : 0.125f * (in(clampIndex(j - 1, w2), y) + 6.f * in(j, y) + in(clampIndex(j + 1, w2), y));
+		}
+	});
+	parallel_for(0, h, [&tmp,&out,h2](int y)
+	{
+		int j = y / 2;
+		if (y % 2)
+			out.col(y) = 0.5f * (tmp.col(j) + tmp.col(clampIndex(j + 1, h2)));
+		else
+			out.col(y) = 0.125f * (tmp.col(clampIndex(j - 1, h2)) + 6.f * tmp.col(j) + tmp.col(clampIndex(j + 1, h2)));
+	});
+	return out;
+}
+
+int fullPyramidLevels(int w, int h)
+{
+	int n = 1;
+	for (; w > 1 || h > 1; ++n)
+	{
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	return n;
+}
+
+vector<Plane> gaussianPyramid(const Plane & in, int numLevels)
+{
+	vector<Plane> pyramid(1, in);
+	while (int(pyramid.size()) < numLevels)
+		pyramid.push_back(pyramidDown(pyramid.back()));
+	return pyramid;
+}
+
+vector<Plane> laplacianPyramid(const Plane & in, int numLevels)
+{
+	vector<Plane> pyramid = gaussianPyramid(in, numLevels);
+	for (int l = 0; l + 1 < numLevels; ++l)
+		pyramid[l] -= pyramidUp(pyramid[l + 1], int(pyramid[l].rows()), int(pyramid[l].cols()));
+	return pyramid;
+}
+
+Plane collapsedPyramid(const vector<Plane> & pyramid)
+{
+	Plane result = pyramid.back();
+	for (int l = int(pyramid.size()) - 2; l >= 0; --l)
+		result = pyramid[l] + pyramidUp(result, int(pyramid[l].rows()), int(pyramid[l].cols()));
+	return result;
+}
@@ -0,0 +1,38 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <vector>                // for vector
+#include <Eigen/Core>            // for ArrayXXf
+
+
+//! A single channel image, indexed (x,y) like HDRImage
+using Plane = Eigen::ArrayXXf;
+
+
+//! Blur \a in with the 5-tap binomial filter and keep every other sample in both directions
+Plane pyramidDown(const Plane & in);
+
+//! The inverse of pyramidDown(): insert zeros in between the samples, and blur with twice the binomial filter
+Plane pyramidUp(const Plane & in, int w, int h);
+
+//! The number of levels of a pyramid of a \a w x \a h image whose last level is a single pixel
+int fullPyramidLevels(int w, int h);
+
+//! The levels of the Gaussian pyramid of \a in, with the image itself as the first one
+std::vector<Plane> gaussianPyramid(const Plane & in, int numLevels);
+
+/*!
+ * @brief The Laplacian pyramid of \a in [Burt and Adelson 1983].
+ *
+ * Each level but the last holds the difference between a level of the Gaussian pyramid and the
+ * upsampled next one. The last level is the last level of the Gaussian pyramid.
+ */
+std::vector<Plane> laplacianPyramid(const Plane & in, int numLevels);
+
+//! Reconstruct the image whose Laplacian pyramid is \a pyramid
+Plane collapsedPyramid(const std::vector<Plane> & pyramid);
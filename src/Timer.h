@@ -9,9 +9,10 @@
 #include "Common.h"
 #include <chrono>
 
-//! Simple timer with millisecond precision
+//! Simple timer reporting fractional milliseconds
 /*!
-    This class is convenient for collecting performance data
+    This class is convenient for collecting performance data. It uses a monotonic clock,
+    so measurements are not affected by changes to the system time.
 */
 class Timer
 {
@@ -25,26 +26,25 @@ public:
     //! Reset the timer to the current time
     void reset()
     {
-        start = std::chrono::system_clock::now();
+        start = std::chrono::steady_clock::now();
     }
 
     //! Return the number of milliseconds elapsed since the timer was last reset
     double elapsed() const
     {
-        auto now = std::chrono::system_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - start);
-        return (double) duration.count();
+        auto now = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(now - start).count();
     }
 
     //! Return the number of milliseconds elapsed since the timer was last reset and then reset it
     double lap()
     {
-        auto now = std::chrono::system_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - start);
+        auto now = std::chrono::steady_clock::now();
+        double duration = std::chrono::duration<double, std::milli>(now - start).count();
         start = now;
-        return (double) duration.count();
+        return duration;
     }
 
 private:
-    std::chrono::system_clock::time_point start;
+    std::chrono::steady_clock::time_point start;
 };
@@ -0,0 +1,152 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#include "Trace.h"
+#include <algorithm>             // for max
+#include <atomic>                // for atomic
+#include <chrono>                // for steady_clock, duration_cast
+#include <fstream>               // for ofstream
+#include <mutex>                 // for mutex, lock_guard
+#include <stdexcept>             // for runtime_error
+#include "Json.h"                // for Json
+#include <spdlog/fmt/fmt.h>
+
+using namespace std;
+
+namespace
+{
+
+atomic<bool> g_enabled(false);
+atomic<uint32_t> g_nextThread(1);
+
+mutex g_mutex;
+vector<TraceEvent> g_ring;       // guarded by g_mutex
+size_t g_head = 0;               // index of the next event to write
+size_t g_count = 0;              // number of valid events in the ring
+
+// timestamps are relative to program start-up, so zones that straddle startTracing() stay consistent
+const chrono::steady_clock::time_point g_start = chrono::steady_clock::now();
+
+uint64_t now()
+{
+	return uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - g_start).count());
+}
+
+uint32_t threadId()
+{
+	thread_local uint32_t id = g_nextThread++;
+	return id;
+}
+
+void record(TraceEvent && event)
+{
+	lock_guard<mutex> lock(g_mutex);
+	if (g_ring.empty())
+		return;
+	g_ring[g_head] = move(event);
+	g_head = (g_head + 1) % g_ring.size();
+	g_count = min(g_count + 1, g_ring.size());
+}
+
+} // namespace
+
+
+void startTracing(size_t capacity)
+{
+	lock_guard<mutex> lock(g_mutex);
+	g_ring.assign(max(capacity, size_t(1)), TraceEvent());
+	g_head = g_count = 0;
+	g_enabled = true;
+}
+
+void stopTracing()
+{
+	g_enabled = false;
+}
+
+bool tracingEnabled()
+{
+	return g_enabled.load(memory_order_relaxed);
+}
+
+vector<TraceEvent> traceEvents()
+{
+	lock_guard<mutex> lock(g_mutex);
+	vector<TraceEvent> events;
+	events.reserve(g_count);
+	size_t first = (g_head + g_ring.size() - g_count) % max(g_ring.size(), size_t(1));
+	for (size_t i = 0; i < g_count; ++i)
+		events.push_back(g_ring[(first + i) % g_ring.size()]);
+	return events;
+}
+
+void writeChromeTrace(const string & filename)
+{
+	auto events = traceEvents();
+
+	ofstream out(filename);
+	if (!out)
+		throw runtime_error(fmt::format("Cannot write trace file \"{}\".", filename));
+
+	// complete ("X") events with microsecond timestamps, see the Trace Event Format specification.
+	// The names are quoted and escaped by the JSON writer.
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const TraceEvent & e = events[i];
+		out << fmt::format("{{\"name\": {}, \"cat\": \"hdrview\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, "
+		                   "\"ts\": {:.3f}, \"dur\": {:.3f}, \"args\": {{\"image\": {}, \"bytes\": {}}}}}{}\n",
+		                   Json(e.name).dump(), e.thread, e.begin / 1000.0, (e.end - e.begin) / 1000.0,
+		                   e.image, e.bytes, i + 1 < events.size() ? "," : "");
+	}
+	out << "]}\n";
+
+	if (!out)
+		throw runtime_error(fmt::format("Failed writing trace file \"{}\".", filename));
+}
+
+
+TraceZone::TraceZone(const char * name, uint64_t image, uint64_t bytes) :
+	m_active(tracingEnabled()), m_literal(name), m_image(image), m_bytes(bytes)
+{
+	if (m_active)
+		m_begin = now();
+}
+
+TraceZone::TraceZone(const string & name, uint64_t image, uint64_t bytes) :
+	m_active(tracingEnabled()), m_literal(nullptr), m_image(image), m_bytes(bytes)
+{
+	if (m_active)
+	{
+		m_name = name;
+		m_begin = now();
+	}
+}
+
+TraceZone::TraceZone(const char * prefix, const string & suffix, uint64_t image, uint64_t bytes) :
+	m_active(tracingEnabled()), m_literal(nullptr), m_image(image), m_bytes(bytes)
+{
+	if (m_active)
+	{
+		m_name = prefix + suffix;
+		m_begin = now();
+	}
+}
+
+TraceZone::~TraceZone()
+{
+	if (!m_active)
+		return;
+
+	TraceEvent event;
+	event.end = now();
+	event.name = m_literal ? string(m_literal) : move(m_name);
+	event.begin = m_begin;
+	event.thread = threadId();
+	event.image = m_image;
+	event.bytes = m_bytes;
+	record(move(event));
+}
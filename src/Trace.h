@@ -0,0 +1,88 @@
+//
+// Copyright (C) Wojciech Jarosz <wjarosz@gmail.com>. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can
+// be found in the LICENSE.txt file.
+//
+
+#pragma once
+
+#include <cstddef>               // for size_t
+#include <cstdint>               // for uint64_t, uint32_t, uintptr_t
+#include <string>                // for string
+#include <vector>                // for vector
+
+
+//! One completed trace zone
+struct TraceEvent
+{
+	std::string name;
+	uint64_t begin = 0;          ///< Nanoseconds since the program started
+	uint64_t end = 0;            ///< Nanoseconds since the program started
+	uint32_t thread = 0;         ///< Small sequential id of the recording thread
+	uint64_t image = 0;          ///< Id of the image the zone worked on, or 0
+	uint64_t bytes = 0;          ///< Number of bytes the zone read, wrote or transferred, or 0
+};
+
+
+/*!
+ * @brief Start recording trace zones into a ring buffer, discarding any previous events.
+ *
+ * Once the buffer is full, the oldest events are overwritten.
+ *
+ * @param capacity	The maximum number of events kept
+ */
+void startTracing(size_t capacity = 1 << 16);
+
+//! Stop recording trace zones. The recorded events are kept.
+void stopTracing();
+
+//! Whether trace zones are currently recorded
+bool tracingEnabled();
+
+//! The recorded events, oldest first
+std::vector<TraceEvent> traceEvents();
+
+/*!
+ * @brief Write the recorded events as a Chrome trace (viewable in chrome://tracing or Perfetto).
+ *
+ * Throws std::runtime_error if the file cannot be written.
+ */
+void writeChromeTrace(const std::string & filename);
+
+//! An id for the image at address \a image, for use with TraceZone
+inline uint64_t traceImageId(const void * image)
+{
+	return uint64_t(reinterpret_cast<uintptr_t>(image));
+}
+
+
+/*!
+ * @brief Records the time from its construction to its destruction as one trace event.
+ *
+ * When tracing is disabled, constructing a zone only costs an atomic load.
+ * The name passed as a C string must outlive the zone, which is the case for string literals.
+ */
+class TraceZone
+{
+public:
+	explicit TraceZone(const char * name, uint64_t image = 0, uint64_t bytes = 0);
+	explicit TraceZone(const std::string & name, uint64_t image = 0, uint64_t bytes = 0);
+	//! A zone named \a prefix followed by \a suffix, which are only concatenated when tracing is enabled
+	TraceZone(const char * prefix, const std::string & suffix, uint64_t image = 0, uint64_t bytes = 0);
+	~TraceZone();
+
+	TraceZone(const TraceZone &) = delete;
+	TraceZone & operator=(const TraceZone &) = delete;
+
+	void setImage(uint64_t image)   {m_image = image;}
+	void setBytes(uint64_t bytes)   {m_bytes = bytes;}
+	void addBytes(uint64_t bytes)   {m_bytes += bytes;}
+
+private:
+	bool m_active;
+	const char * m_literal;
+	std::string m_name;
+	uint64_t m_begin = 0;
+	uint64_t m_image;
+	uint64_t m_bytes;
+};